@@ -291,6 +291,7 @@ main(int argc, char **argv)
 	    strcmp("eat", argv[4])					&&
 	    strcmp("wrap", argv[4])					&&
 	    strcmp("cat", argv[4])					&&
+	    strcmp("range", argv[4])					&&
 	    strcmp("roll", argv[4]))
 		die2("not verb", argv[4]);
 
@@ -9,11 +9,17 @@
  *
  *	Need to document why move() and rename() are not combined into
  *	single call.
+ *
+ *	With --direct-commit true the request process publishes the blob
+ *	itself, without a round trip to the arborist.  See direct_commit().
  */
+#define _GNU_SOURCE		//  renameat2() in glibc
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include <stdio.h>
 #include <unistd.h>
 
 #include "bio4d.h"
@@ -21,6 +27,7 @@
 extern pid_t	logged_pid;
 
 pid_t		arborist_pid = 0;
+int		direct_commit = -1;
 
 static int	arbor_fd = -1;
 
@@ -47,7 +54,7 @@ static void
 rename_blob(char *reply_path, char *src_path, char *tgt_path)
 {
 	char *slash, *p;
-	int reply_fd;
+	int reply_fd, is_new;
 	unsigned char reply_payload = 0;
 	static char nm[] = "rename_blob";
 
@@ -71,6 +78,11 @@ rename_blob(char *reply_path, char *src_path, char *tgt_path)
 		p = slash + 1;
 	}
 
+	/*
+	 *  Index the blob before the rename makes the blob visible.
+	 */
+	is_new = exist_put(tgt_path);
+
 	/*
 	 *  Move the blob to the target directory.
 	 */
@@ -84,6 +96,8 @@ rename_blob(char *reply_path, char *src_path, char *tgt_path)
 		reply_payload = 1;
 		goto bye;
 	}
+	if (is_new)
+		exist_count(1);
 	
 	/*
 	 *  Set the blob read only for user/group.
@@ -237,11 +251,131 @@ bye:
 	return ret;
 }
 
+/*
+ *  Make the full directory path to the target blob, for a request process
+ *  committing a blob directly.
+ */
+static void
+make_blob_dirs(char *tgt_path)
+{
+	char *slash, *p;
+	int status;
+
+	p = tgt_path;
+	while ((slash = index(p, '/'))) {
+		*slash = 0;
+		status = make_path(tgt_path);
+		*slash = '/';
+		if (status)
+			panic3("make_blob_dirs", "make_path() failed", tgt_path);
+		p = slash + 1;
+	}
+}
+
+/*
+ *  Link the source file to the target path, never replacing an existing
+ *  blob, then remove the source.  Returns 1 when linked, 0 when the target
+ *  already exists and -1 on error.
+ */
+static int
+publish(char *src_path, char *tgt_path)
+{
+again:
+#ifdef RENAME_NOREPLACE
+	if (renameat2(AT_FDCWD, src_path, AT_FDCWD, tgt_path,
+						RENAME_NOREPLACE) == 0)
+		return 1;
+	if (errno == EINTR)
+		goto again;
+	if (errno == EEXIST)
+		return 0;
+
+	//  file system or kernel without RENAME_NOREPLACE, so try link
+
+	if (errno != EINVAL && errno != ENOSYS)
+		return -1;
+#endif
+	if (linkat(AT_FDCWD, src_path, AT_FDCWD, tgt_path, 0)) {
+		if (errno == EINTR)
+			goto again;
+		if (errno == EEXIST)
+			return 0;
+		return -1;
+	}
+	if (io_unlink(src_path))
+		return -1;
+	return 1;
+}
+
+/*
+ *  Rename a blob file into place from outside the arborist, without
+ *  replacing an existing blob, in which case the source is simply removed.
+ *  The directories to the blob are only made when the rename fails with
+ *  ENOENT, which also covers an arborist trim racing to remove the empty
+ *  directories.
+ *
+ *  Returns 1 when renamed, 0 when the blob already existed, or -1 with
+ *  errno EXDEV when the source is on another device.
+ */
+int
+arbor_publish(char *src_path, char *tgt_path)
+{
+	int status, try;
+	static char nm[] = "arbor_publish";
+
+	for (try = 0;  try < 8;  try++) {
+		status = publish(src_path, tgt_path);
+		if (status == 1)
+			return 1;
+		if (status == 0) {
+			if (io_unlink(src_path) && errno != ENOENT)
+				panic4(nm, "unlink(src) failed", src_path,
+							strerror(errno));
+			return 0;
+		}
+		if (errno == EXDEV)
+			return -1;
+		if (errno != ENOENT)
+			break;
+		make_blob_dirs(tgt_path);
+	}
+	panic4(nm, "rename(src, tgt) failed", tgt_path, strerror(errno));
+
+	/*NOTREACHED*/
+	return -1;
+}
+
+/*
+ *  Publish a blob from within the request process instead of the arborist.
+ *  The blob is made read only and added to the existence index before the
+ *  rename makes the blob visible.
+ *
+ *  Returns 0 on success, -1 when the source is on another device, so the
+ *  caller must ask the arborist for a copy.
+ */
+static int
+direct_commit_blob(char *src_path, char *tgt_path)
+{
+	int status;
+	static char nm[] = "direct_commit";
+
+	if (io_chmod(src_path, S_IRUSR | S_IRGRP))
+		panic4(nm, "chmod(src) failed", src_path, strerror(errno));
+	exist_put(tgt_path);
+
+	status = arbor_publish(src_path, tgt_path);
+	if (status < 0)
+		return -1;
+	if (status == 1)
+		exist_count(1);
+	return 0;
+}
+
 static void
 move_blob(char *reply_path, char *src_path, char *tgt_path)
 {
 	char *slash, *p;
-	int reply_fd;
+	int reply_fd, is_new;
 	unsigned char reply_payload = 0;
 	static char nm[] = "move_blob";
 
@@ -265,12 +399,16 @@ move_blob(char *reply_path, char *src_path, char *tgt_path)
 		p = slash + 1;
 	}
 
+	is_new = exist_put(tgt_path);
+
 	//  move the blob file, perhaps doing a copy across file systems.
 
 	if (_move(src_path, tgt_path)) {
 		reply_payload = 1;
 		goto bye;
 	}
+	if (is_new)
+		exist_count(1);
 
 	/*
 	 *  Set the blob read only for user/group.
@@ -314,9 +452,12 @@ trim_blob_dir(char *dir_path)
 	struct stat st;
 
 	/*
-	 *   Start at the deepest directory.
+	 *   Start at the deepest directory, stopping at the root of the blob
+	 *   tree, data/fs_<algo>, held open by the digest module.
 	 */
 zap:
+	if (index(dir_path, '/') == rindex(dir_path, '/'))
+		return count;
 	if (io_rmdir(dir_path)) {
 		if (errno == ENOTEMPTY)
 			return count;
@@ -526,6 +667,9 @@ arbor_rename(char *tmp_path, char *tgt_path)
 	struct io_message reply;
 	static char nm[] = "arbor_rename";
 
+	if (direct_commit == 1 && direct_commit_blob(tmp_path, tgt_path) == 0)
+		return;
+
 	snprintf(reply_path, sizeof reply_path,"run/arborist-%u.fifo",getpid());
 	rlen = strlen(reply_path) + 1;
 
@@ -604,6 +748,11 @@ arbor_move(char *tmp_path, char *tgt_path)
 	struct io_message reply;
 	static char nm[] = "arbor_move";
 
+	//  across devices the arborist copies the blob
+
+	if (direct_commit == 1 && direct_commit_blob(tmp_path, tgt_path) == 0)
+		return;
+
 	snprintf(reply_path, sizeof reply_path,"run/arborist-%u.fifo",getpid());
 	rlen = strlen(reply_path) + 1;
 
@@ -676,3 +825,45 @@ arbor_trim(char *dir_path)
 		panic2("arbor_trim: msg_write(arborist) failed",
 							strerror(errno));
 }
+
+/*
+ *  Link an anonymous blob file staged by tmp_open_anon() into the blob
+ *  tree, from within the request process.  The directories are made
+ *  lazily, as in direct_commit_blob().  An existing blob is left alone and
+ *  the anonymous file vanishes on close.
+ *
+ *  Returns 0 when linked or the blob exists, -1 when the file can not be
+ *  linked, such as a temp directory on another file system, in which case
+ *  the caller stages the blob in a named file with tmp_name_anon().
+ */
+int
+arbor_link(int fd, char *tgt_path)
+{
+	char fd_path[32];
+	int try;
+	static char nm[] = "arbor_link";
+
+	snprintf(fd_path, sizeof fd_path, "/proc/self/fd/%d", fd);
+	exist_put(tgt_path);
+
+	for (try = 0;  try < 8;  try++) {
+		if (linkat(AT_FDCWD, fd_path, AT_FDCWD, tgt_path,
+						AT_SYMLINK_FOLLOW) == 0) {
+			exist_count(1);
+			return 0;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno == EEXIST)
+			return 0;
+		if (errno == EXDEV || errno == EPERM || errno == ENOSYS)
+			return -1;
+		if (errno != ENOENT)
+			break;
+		make_blob_dirs(tgt_path);
+	}
+	panic4(nm, "linkat(tmp, blob) failed", tgt_path, strerror(errno));
+
+	/*NOTREACHED*/
+	return -1;
+}
@@ -16,15 +16,9 @@
  *	Having GYR stats in bio4d is problematic.  The observer
  *	should defined green/yellow/red, not the performer!
  *
- *	Need to add udig distinct/total stats, which implies a hash table,
- *	probably managed by either a hash table or a bloom filter process.
- *	when (total udig - distinct) grows to big, then caching needed.
- *
  *	Should {wrap,roll}->no be considered green and not yellow!
  *	or, should GYR concepts be totally removed from bio4d?
  *
- *	Need to count distinct blobs as part of stats!
- *
  *	Verify that a process core dump is always a RED condition.  It may
  *	be classified as just a termination by signal for the dumping process.
  *
@@ -60,6 +54,7 @@
  *	option.
  */
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -84,7 +79,7 @@
 
 #define BIO4D_PORT		1797
 
-#define MAX_VERB_SIZE		5
+#define MAX_VERB_SIZE		7
 
 /*
  *  States of lexical parser for incoming client requests.
@@ -94,7 +89,11 @@
 #define STATE_SCAN_ALGORITHM	2
 #define STATE_SCAN_NEW_LINE	3
 #define STATE_SCAN_DIGEST	4
-#define STATE_MAX		5
+#define STATE_SCAN_SIZE		5
+#define STATE_SCAN_LENGTH	6
+#define STATE_MAX		7
+
+#define MAX_SIZE_DIGITS		18
 
 #define STATE_go							\
 {									\
@@ -114,6 +113,9 @@
 #define NET_TIMEOUT		20	/* 20 seconds for net read/write */
 #define LEAVE_PAUSE		2	/* pause seconds before exiting */
 
+#define PREFORK_WORKERS		8	/* default prefork worker count */
+#define PREFORK_REQUESTS	10000	/* requests before worker retires */
+
 extern pid_t	brr_logger_pid;
 extern pid_t	logged_pid;
 extern pid_t	arborist_pid;
@@ -135,6 +137,8 @@ unsigned char	request_exit_status = 0;
 time_t		start_time;	
 ui16		rrd_duration = 0;
 int		trust_fs = -1;
+ui32		chunk_size = 0;
+i64		stage_max_size = -1;
 
 char pid_path[] ="run/bio4d.pid";
 
@@ -155,12 +159,28 @@ static struct request	req =
 	.scan_size	=	0,
 	.open_data	=	0,
 	.blob_size	=	0,
+	.declared_size	=	-1,
+	.reply_size	=	-1,
+	.stage_token	=	-1,
+	.range_offset	=	-1,
+	.range_length	=	-1,
+	.stage_fd	=	-1,
 	.read_timeout	=	NET_TIMEOUT,
 	.write_timeout	=	NET_TIMEOUT
 };
 
 static int		listen_fd = -1;
 
+/*
+ *  Request engine: either fork a process per accept() (prefork == 0) or
+ *  accept() in a pool of long lived, prefork workers (prefork == 1).
+ *  Each prefork worker retires after PREFORK_REQUESTS and is replaced by
+ *  the master.
+ */
+static int		prefork = -1;
+static int		prefork_workers = 0;
+static pid_t		*worker_pids = 0;
+
 /*
  *  Inbound Connections:
  *	accept_count ==
@@ -171,58 +191,72 @@ static int		listen_fd = -1;
  *		fault_count
  *
  *  we track accept/wait explicity, to ferret bugs.
+ *
+ *  The counters live in an anonymous, shared memory map so a prefork
+ *  worker can tally a finished request in process, without exiting.
+ *  The fork-per-accept engine still tallies from the exit status of the
+ *  reaped request process.
  */
-static ui64	accept_count = 0;	//  socket connections answered
-static ui64	exit_count = 0;		//  number of req process waited upon
+struct request_stats
+{
+	ui64	accept_count;	//  socket connections answered
+	ui64	exit_count;	//  number of requests completed
 
-/*
- *  Request summaries
- */
-static ui64	success_count =	0;	//  exit ok
-static ui64	error_count =	0;	//  error talking with client
-static ui64	timeout_count =	0;	//  timeout read()/write() with client
-static ui64	signal_count =	0;	//  terminated with signal
-static ui64	fault_count =	0;	//  faulted (panic in request)
+	/*
+	 *  Request summaries
+	 */
+	ui64	success_count;	//  exit ok
+	ui64	error_count;	//  error talking with client
+	ui64	timeout_count;	//  timeout read()/write() with client
+	ui64	signal_count;	//  terminated with signal
+	ui64	fault_count;	//  faulted (panic in request)
 
-static ui64	ok_count = 	0;
-static ui64	no_count = 	0;
-static ui64	no2_count = 	0;
-static ui64	no3_count = 	0;
+	ui64	ok_count;
+	ui64	no_count;
+	ui64	no2_count;
+	ui64	no3_count;
 
-/*
- *  Request Verbs
- */
-static ui64	cat_count =	0;	//  all "cat" requests
-static ui64	get_count =	0;	//  all "get" requests
-static ui64	put_count =	0;	//  all "put" requests
-static ui64	give_count =	0;	//  all "give" requests
-static ui64	take_count =	0;	//  all "take" requests
-static ui64	eat_count =	0;	//  all "eat" requests
-static ui64	wrap_count =	0;	//  all "wrap" requests
-static ui64	roll_count =	0;	//  all "roll" requests
+	/*
+	 *  Request Verbs
+	 */
+	ui64	cat_count;	//  all "cat" requests
+	ui64	get_count;	//  all "get" requests
+	ui64	put_count;	//  all "put" requests
+	ui64	give_count;	//  all "give" requests
+	ui64	take_count;	//  all "take" requests
+	ui64	eat_count;	//  all "eat" requests
+	ui64	wrap_count;	//  all "wrap" requests
+	ui64	roll_count;	//  all "roll" requests
 
-/*
- *  Statistics for failed requests that generate blob request record.
- */
-static ui64	cat_no_count =	0;	//  first "no" on "cat"
+	/*
+	 *  Statistics for failed requests that generate blob request record.
+	 */
+	ui64	cat_no_count;	//  first "no" on "cat"
+
+	ui64	eat_no_count;	//  first "no" on "eat"
 
-static ui64	eat_no_count =	0;	//  first "no" on "eat"
+	ui64	get_no_count;	//  "no" on "get"
 
-static ui64	get_no_count =	0;	//  "no" on "get"
+	ui64	put_no_count;	//  first "no" on "put"
+	ui64	put_no2_count;	//  second "no" on "eat"
 
-static ui64	put_no_count =	0;	//  first "no" on "put"
-static ui64	put_no2_count =	0;	//  second "no" on "eat"
+	ui64	wrap_no_count;	//  first "no" on "wrap"
+	ui64	roll_no_count;	//  first "no" on "roll"
 
-static ui64	wrap_no_count =	0;	//  first "no" on "wrap"
-static ui64	roll_no_count =	0;	//  first "no" on "roll"
+	ui64	take_no_count;	//  first "no" on "take"
+	ui64	take_no2_count;	//  second "no" on take
+	ui64	take_no3_count;	//  third "no" on "take"
 
-static ui64	take_no_count =	0;	//  first "no" on "take"
-static ui64	take_no2_count =0;	//  second "no" on take
-static ui64	take_no3_count =0;	//  third "no" on "take"
+	ui64	give_no_count;	//  first "no" on "give"
+	ui64	give_no2_count;	//  second "no" on "give"
+	ui64	give_no3_count;	//  second "no" on "give"
+};
+static struct request_stats	*stats = 0;
 
-static ui64	give_no_count =	0;	//  first "no" on "give"
-static ui64	give_no2_count =0;	//  second "no" on "give"
-static ui64	give_no3_count =0;	//  second "no" on "give"
+/*
+ *  Counters are bumped concurrently by prefork workers.
+ */
+#define STAT_BUMP(c)	__sync_fetch_and_add(&stats->c, 1)
 
 static char	rrd_path[] = "run/bio4d.rrd";
 static char	gyr_path[] = "run/bio4d.gyr";
@@ -288,6 +322,8 @@ leave(int exit_status)
 	info("shutting down digest modules");
 	module_leave();
 
+	verify_close();
+
 	info("sending TERM signal to request children");
 	killpg(getpgrp(), SIGTERM);
 	
@@ -407,13 +443,171 @@ die3_NO(char *msg1, char *msg2, char *msg3)
 	die_NO(log_strcpy3(buf, sizeof buf, msg1, msg2, msg3));
 }
 
+/*
+ *  Does the blob of a well formed udig exist?  Ask the existence index
+ *  before a stat of the blob.  The empty blob always exists.
+ */
+static int
+udig_exists(char *algorithm, char *digest)
+{
+	struct digest_module *mp;
+	int empty;
+
+	if (!(mp = module_get(algorithm)) || !(empty = mp->is_digest(digest)))
+		return 0;
+	return empty == 2 || (exist_maybe(digest) && mp->exists(digest));
+}
+
+struct cat_context
+{
+	struct request	*request;
+	ui64		count;		//  udigs in set
+	ui64		missing;	//  udigs with no blob
+	int		status;		//  -1 after a failed send
+};
+
+/*
+ *  Digest a blob in the cat set on an untrusted store, like the scrubber.
+ *  The blob file is stamped verified, so the blob is not digested again
+ *  when sent.  Returns the status of frisk(): 0 when the blob matches the
+ *  digest, 1 when the blob disappeared and 2 when corrupt.
+ */
+static int
+cat_verify(char *algorithm, char *digest)
+{
+	struct digest_module *mp = module_get(algorithm);
+	struct request r;
+	int status;
+
+	if ((*mp->is_digest)(digest) == 2)
+		return 0;
+	memset(&r, 0, sizeof r);
+	r.client_fd = -1;
+	r.verb = "cat";
+	r.step = "request";
+	r.algorithm = algorithm;
+	r.digest = digest;
+	r.declared_size = -1;
+	r.range_offset = r.range_length = -1;
+	if ((*mp->open)(&r))
+		die3("cat", "digest->open() failed", digest);
+	status = (*mp->frisk)(&r);
+	(*mp->close)(&r, status);
+	free(r.open_data);
+	return status;
+}
+
+/*
+ *  Count a udig in the cat set, noting when the blob does not exist or,
+ *  on an untrusted store, fails the digest.
+ */
+static void
+cat_exists(char *udig, void *context)
+{
+	struct cat_context *cp = (struct cat_context *)context;
+	char *colon = strchr(udig, ':');
+	int exists, status = 0;
+
+	cp->count++;
+	if (cp->missing > 0)
+		return;
+	*colon = 0;
+	exists = udig_exists(udig, colon + 1);
+	if (exists && trust_fs != 1)
+		status = cat_verify(udig, colon + 1);
+	*colon = ':';
+	if (!exists || status == 1) {
+		warn3("cat", "no blob for udig in set", udig);
+		cp->missing++;
+	} else if (status == 2) {
+		error3("cat", "blob in set fails digest", udig);
+		cp->missing++;
+	}
+}
+
+/*
+ *  Send a blob in the cat set, framed as "<udig> <size>\n[bytes]", by the
+ *  get callbacks of the digest module of the blob, so a trusted blob goes
+ *  straight from file to socket.  The request stands for the blob until
+ *  sent, then for the set again.
+ */
+static void
+cat_blob(char *udig, void *context)
+{
+	struct cat_context *cp = (struct cat_context *)context;
+	struct request *rp = cp->request;
+	struct digest_module *mp;
+	char *algorithm = rp->algorithm, *digest = rp->digest;
+	void *open_data = rp->open_data;
+	char blob[MAX_UDIG_SIZE + 1];
+	char frame[MAX_UDIG_SIZE + 1 + 20 + 1 + 1];
+	i64 range_offset = rp->range_offset, range_length = rp->range_length;
+	int status;
+
+	if (cp->status)
+		return;
+	strcpy(blob, udig);
+	rp->algorithm = blob;
+	rp->digest = strchr(blob, ':');
+	*rp->digest++ = 0;
+	mp = module_get(rp->algorithm);
+	rp->open_data = 0;
+
+	if ((*mp->is_digest)(rp->digest) == 2) {
+		snprintf(frame, sizeof frame, "%s 0\n", udig);
+		if (req_write(rp, frame, strlen(frame)))
+			cp->status = -1;
+		goto restore;
+	}
+	if ((*mp->open)(rp))
+		die3("cat", "digest->open() failed", udig);
+
+	/*
+	 *  On an untrusted store, ask for the blob as a range of the whole
+	 *  blob, so the stamp of cat_verify() lets the bytes go trusted.
+	 */
+	if (trust_fs != 1) {
+		rp->range_offset = 0;
+		rp->range_length = -1;
+	}
+	if ((*mp->get_request)(rp))
+		die3("cat", "blob disappeared after ok", udig);
+
+	snprintf(frame, sizeof frame, "%s %lld\n", udig, rp->reply_size);
+	status = req_write(rp, frame, strlen(frame));
+	if (status == 0)
+		status = (*mp->get_bytes)(rp);
+	if ((*mp->close)(rp, status) < 0)
+		error3("cat", "digest->close() failed", udig);
+	free(rp->open_data);
+	if (status)
+		cp->status = -1;
+restore:
+	rp->algorithm = algorithm;
+	rp->digest = digest;
+	rp->open_data = open_data;
+	rp->range_offset = range_offset;
+	rp->range_length = range_length;
+}
+
 /*
  *  Synopsis:
- *	Fire digest module callbacks for unimplemented "cat" verb.
+ *	Stream the blobs of a udig set back to back in a single reply.
  *  Protocol Flow:
- *	cat algorithm:digest\n		#  blob
- *		<ok algorithm:digest\n	#  the udig of the concat (no blob)
- *		<no\n			#  concat not completed
+ *	cat udig\n			# udig of a udig set
+ *	    <ok.<count>\n		#   all <count> blobs in set exist
+ *	      <udig <size>\n[bytes]	#     each blob, in order of set
+ *	    <no\n[close]		#   no set, not udig set or no blob
+ *
+ *	In a session, the connection stays open after the last blob.
+ *  Description:
+ *	The set blob is copied to a temporary file, like a roll set, and
+ *	parsed twice: first to verify every blob exists before the "ok",
+ *	then to send each blob.  On an untrusted store, the first pass also
+ *	digests each blob, so a corrupt blob is answered "no", not found
+ *	after the "ok".  A blob that disappears or changes between the
+ *	passes ends the connection short of <count> blobs.  The brr records the
+ *	udig of the set and the sum of the sizes of the blobs.
  *  Return Status:
  *	0	no error
  *	-1	error
@@ -421,12 +615,64 @@ die3_NO(char *msg1, char *msg2, char *msg3)
 static int
 cat(struct request *rp, struct digest_module *mp)
 {
-	(void)mp;
+	char set_path[MAX_FILE_PATH_LEN + 1];
+	int set_fd, status;
+	struct cat_context cc;
+	static char n[] = "cat";
 
 	request_exit_status = (request_exit_status & 0x1C) |
 					(REQUEST_EXIT_STATUS_CAT << 2);
-	rp->step = "cat";
-	return write_no(rp);		//  concatenation not implemented
+	rp->step = "request";
+
+	//  the empty set has no blobs to send
+
+	if ((*mp->is_digest)(rp->digest) == 2)
+		return write_ok_size(rp, 0);
+	if (!exist_maybe(rp->digest))
+		return write_no(rp);
+
+	snprintf(set_path, sizeof set_path, "%s/cat-%d-%u.set",
+					tmp_get(rp->algorithm, rp->digest),
+					(int)time((time_t *)0),
+					getpid()
+	);
+	set_fd = io_open(set_path, O_CREAT | O_EXCL | O_RDWR, S_IRUSR|S_IWUSR);
+	if (set_fd < 0)
+		panic4(n, set_path, "open(cat set) failed", strerror(errno));
+
+	//  blocks of the unlinked file are freed upon close
+
+	if (io_unlink(set_path))
+		panic4(n, set_path, "unlink(cat set) failed", strerror(errno));
+
+	if ((status = (*mp->copy)(rp, set_fd))) {
+		if (status < 0)
+			error4(n, "copy(set) failed", rp->algorithm,
+							rp->digest);
+		status = write_no(rp);
+		goto cleanup;
+	}
+
+	cc.request = rp;
+	cc.count = cc.missing = 0;
+	cc.status = 0;
+	if (udig_set_each(set_fd, set_path, cat_exists, (void *)&cc) ||
+	    cc.missing > 0) {
+		status = write_no(rp);
+		goto cleanup;
+	}
+	if ((status = write_ok_size(rp, cc.count)))
+		goto cleanup;
+
+	rp->step = "bytes";
+	rp->blob_size = 0;
+	if (udig_set_each(set_fd, set_path, cat_blob, (void *)&cc))
+		panic3(n, "udig set changed", set_path);
+	status = cc.status;
+cleanup:
+	if (io_close(set_fd))
+		panic4(n, set_path, "close(cat set) failed", strerror(errno));
+	return status;
 }
 
 /*
@@ -436,6 +682,8 @@ cat(struct request *rp, struct digest_module *mp)
  *	get algorithm:digest\n		# request for blob
  *	    <ok\n[bytes][close]		# server sends blob, bye
  *          <no\n[close]		# server rejects blob, bye
+ *
+ *	In a session, the ok is "ok.<size>\n" and the connection stays open.
  *  Return Status:
  *	0	no error
  *	-1	error
@@ -455,10 +703,13 @@ get(struct request *rp, struct digest_module *mp)
 	 *	bio4d: ok\n[close] -> client:
 	 */
 	if ((*mp->is_digest)(rp->digest) == 2) {
-		if (write_ok(rp))
+		rp->reply_size = 0;
+		if (write_ok_blob(rp))
 			return -1;
 		return 0;
 	}
+	if (!exist_maybe(rp->digest))
+		return write_no(rp);
 
 	/*
 	 *  Digest is "full", so consult the driver
@@ -467,13 +718,270 @@ get(struct request *rp, struct digest_module *mp)
 	if ((*mp->get_request)(rp))
 		return write_no(rp);
 
-	if (write_ok(rp))
+	if (write_ok_blob(rp))
 		return -1;
 
 	rp->step = "bytes";
 	return (*mp->get_bytes)(rp);
 }
 
+/*
+ *  Synopsis:
+ *	Fire the get callbacks of the digest module for a range of a blob.
+ *  Protocol Flow:
+ *	range.<offset>[.<length>] udig\n	# bytes of blob from offset
+ *	    <ok.<size>.<blob size>\n[bytes]	#   server sends <size> bytes
+ *	    <no\n[close]			#   no blob or offset past end
+ *
+ *	<size> is <length>, less at the end of the blob, or the rest of the
+ *	blob without <length>.  <blob size> is the size of the whole blob, so
+ *	a client knows where the blob ends from the first range.
+ *  Description:
+ *	The bytes are sent from the blob file by sendfile() at the offset.
+ *	Since a range can not be digested as sent, an untrusted blob is
+ *	verified whole before the "ok", unless stamped fresh.  Without
+ *	--verify-ttl, the stamp of a range is fresh for a few minutes, so the
+ *	ranges of one get over many streams verify the blob once.
+ *  Return Status:
+ *	0	no error
+ *	-1	error
+ */
+static int
+range(struct request *rp, struct digest_module *mp)
+{
+	i64 size;
+
+	request_exit_status = (request_exit_status & 0x1C) |
+					(REQUEST_EXIT_STATUS_GET << 2);
+	rp->step = "request";
+
+	if ((*mp->is_digest)(rp->digest) == 2) {
+		if (rp->range_offset > 0)
+			return write_no(rp);
+		return write_ok_range(rp, 0, 0);
+	}
+	if (!exist_maybe(rp->digest) || (*mp->get_request)(rp))
+		return write_no(rp);
+	if (rp->range_offset > rp->reply_size)
+		return write_no(rp);
+
+	size = rp->reply_size - rp->range_offset;
+	if (rp->range_length >= 0 && rp->range_length < size)
+		size = rp->range_length;
+	rp->range_length = size;
+	if (write_ok_range(rp, size, rp->reply_size))
+		return -1;
+
+	rp->step = "bytes";
+	return (*mp->get_bytes)(rp);
+}
+
+/*
+ *  The file tmp/stage-<token>-<algorithm>-<digest> shared by every
+ *  connection of the client staging the blob.  The token of the session
+ *  keeps apart clients staging the same blob at once, so a commit never
+ *  reads, or unlinks, the segments of another client.
+ */
+static void
+stage_path(struct request *rp, char *path, int size)
+{
+	snprintf(path, size, "%s/stage-%lld-%s-%s",
+					tmp_get(rp->algorithm, rp->digest),
+					rp->stage_token,
+					rp->algorithm,
+					rp->digest
+	);
+}
+
+/*
+ *  Write the bytes of a segment into the staged file at the offset of the
+ *  segment.  The file is opened without O_EXCL, since the other segments
+ *  arrive on other connections, in any order.
+ *
+ *  A segment ending past --stage-max-size is refused.  When the file
+ *  system refuses a write, say when full, the rest of the segment is
+ *  still read, so the session stays in step, then answered with no.
+ */
+static int
+stage_segment(struct request *rp)
+{
+	char path[MAX_FILE_PATH_LEN + 1];
+	static unsigned char *buf = 0;
+	unsigned char *p;
+	int fd, status = -1, write_errno = 0;
+	ssize_t nr, nw;
+	i64 offset, size;
+	static char n[] = "stage_segment";
+
+	if (rp->scan_size > rp->range_length)
+		return write_no(rp);
+	if (rp->range_offset > stage_max_size ||
+	    rp->range_length > stage_max_size - rp->range_offset) {
+		error2(n, "segment ends past --stage-max-size");
+		return write_no(rp);
+	}
+	if (buf == (unsigned char *)0) {
+		buf = (unsigned char *)malloc(chunk_size);
+		if (buf == (unsigned char *)0)
+			panic3(n, "malloc(chunk) failed", strerror(errno));
+	}
+
+	stage_path(rp, path, sizeof path);
+	fd = io_open(path, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		if (errno != ENOSPC && errno != EDQUOT)
+			panic4(n, path, "open(stage) failed", strerror(errno));
+		error4(n, path, "open(stage) failed", strerror(errno));
+		return write_no(rp);
+	}
+	if (write_ok(rp))
+		goto cleanup;
+
+	rp->step = "bytes";
+	offset = rp->range_offset;
+	p = rp->scan_buf;
+	nr = rp->scan_size;
+	while (1) {
+		while (nr > 0 && write_errno == 0) {
+			nw = pwrite(fd, p, nr, (off_t)offset);
+			if (nw < 0 && errno == EINTR)
+				continue;
+			if (nw <= 0) {
+				write_errno = nw < 0 ? errno : ENOSPC;
+				error4(n, path, "pwrite(stage) failed",
+							strerror(write_errno));
+				break;
+			}
+			p += nw;
+			nr -= nw;
+			offset += nw;
+		}
+		if (rp->blob_size >= rp->range_length)
+			break;
+		size = rp->range_length - rp->blob_size;
+		if (size > (i64)chunk_size)
+			size = chunk_size;
+		nr = blob_read(rp, buf, size);
+		if (nr < 0)
+			goto cleanup;
+		if (nr == 0) {
+			error2(n, "unexpected end of segment");
+			goto cleanup;
+		}
+		p = buf;
+	}
+	if (write_errno)
+		status = write_no(rp);
+	else
+		status = write_ok(rp);
+cleanup:
+	if (io_close(fd))
+		panic4(n, path, "close(stage) failed", strerror(errno));
+	return status;
+}
+
+/*
+ *  Replay the staged file through the put callbacks of the digest module,
+ *  which verify the digest over the whole blob before the blob is stored.
+ */
+static int
+stage_commit(struct request *rp, struct digest_module *mp)
+{
+	char path[MAX_FILE_PATH_LEN + 1];
+	struct stat st;
+	int fd, status;
+	static char n[] = "stage_commit";
+
+	stage_path(rp, path, sizeof path);
+	fd = io_open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return write_no(rp);
+		panic4(n, path, "open(stage) failed", strerror(errno));
+	}
+
+	//  a later stage of the same blob starts over in a new file
+
+	if (io_unlink(path) && errno != ENOENT)
+		panic4(n, path, "unlink(stage) failed", strerror(errno));
+	if (io_fstat(fd, &st))
+		panic4(n, path, "fstat(stage) failed", strerror(errno));
+	if (st.st_size != rp->declared_size ||
+	    rp->declared_size > stage_max_size || (*mp->put_request)(rp)) {
+		status = write_no(rp);
+		goto cleanup;
+	}
+	if ((status = write_ok(rp)))
+		goto cleanup;
+
+	rp->step = "bytes";
+	rp->stage_fd = fd;
+	rp->blob_size = 0;
+	rp->scan_size = 0;
+	status = (*mp->put_bytes)(rp);
+	rp->stage_fd = -1;
+	if (status)
+		status = write_no(rp);
+	else
+		status = write_ok(rp);
+cleanup:
+	if (io_close(fd))
+		panic4(n, path, "close(stage) failed", strerror(errno));
+	return status;
+}
+
+/*
+ *  Synopsis:
+ *	Stage a segment of a blob put over many connections, or commit the
+ *	staged blob.
+ *  Protocol Flow:
+ *	>stage.<offset>.<length> udig\n	# segment of blob at offset
+ *	  <ok\n
+ *	    >[length bytes]
+ *	    <ok\n			#   segment staged
+ *	    <no\n			#   write failed, say disk full
+ *	<no\n				# past --stage-max-size, or no token
+ *
+ *	>stage.<size> udig\n		# commit staged blob of size bytes
+ *	  <ok\n				#   staged blob is size bytes
+ *	    <ok\n			#     digest matched, blob stored
+ *	    <no\n			#     digest does not match
+ *	<no\n				#   nothing staged, or wrong size
+ *  Description:
+ *	Segments are written into a single staged file in tmp, so a client
+ *	may send the segments of one blob on several connections at once.
+ *	Every connection of the client starts with "session.<token>", the
+ *	same token on each, which keys the staged file.  A stage outside a
+ *	session with a token is answered no.
+ *	A staged file not written for an hour is removed by tmp_heartbeat().
+ *	The commit reads the staged file through put_bytes(), so the digest
+ *	is verified once over the whole blob.  "stage" is not a brr verb:
+ *	a segment writes no brr, and the commit is recorded as a put.  Both
+ *	are tallied as a put.
+ *  Return Status:
+ *	0	no error
+ *	-1	error
+ */
+static int
+stage(struct request *rp, struct digest_module *mp)
+{
+	request_exit_status = (request_exit_status & 0x1C) |
+						(REQUEST_EXIT_STATUS_PUT << 2);
+	rp->step = "request";
+
+	//  the empty blob is put, never staged
+
+	if ((*mp->is_digest)(rp->digest) == 2)
+		return write_no(rp);
+	if (rp->stage_token < 0) {
+		error2("stage", "not in a session.<token>");
+		return write_no(rp);
+	}
+	if (rp->range_length >= 0)
+		return stage_segment(rp);
+	return stage_commit(rp, mp);
+}
+
 /*
  *  Synopsis:
  *	Fire digest module callbacks for "eat" verb.
@@ -490,7 +998,7 @@ eat(struct request *rp, struct digest_module *mp)
 {
 	request_exit_status = (request_exit_status & 0x1C) |
 						(REQUEST_EXIT_STATUS_EAT << 2);
-	if ((*mp->eat)(rp))
+	if (!exist_maybe(rp->digest) || (*mp->eat)(rp))
 		return write_no(rp);
 	return write_ok(rp);
 }
@@ -500,6 +1008,7 @@ eat(struct request *rp, struct digest_module *mp)
  *	Fire the put request of the digest module.
  *  Protocol Flow:
  *	>put udig\n	# request from client to put blob matching digest
+ *	>put.size udig\n	# same, but blob is exactly size bytes
  *	  <ok\n		#   server ready for bytes matching bytes
  *	    >[bytes]	#     blob bytes sent from client
  *	    <ok\n	#       accepted bytes for blob
@@ -600,9 +1109,9 @@ take(struct request *rp, struct digest_module *mp)
 	}
 
 	rp->step = "request";
-	if ((*mp->take_request)(rp))
+	if (!exist_maybe(rp->digest) || (*mp->take_request)(rp))
 		return write_no(rp);
-	if (write_ok(rp))
+	if (write_ok_blob(rp))
 		return -1;
 
 	rp->step = "bytes";
@@ -685,12 +1194,152 @@ give(struct request *rp, struct digest_module *mp)
 	return (*mp->give_reply)(rp, reply);
 }
 
+struct have_context
+{
+	unsigned char	*bitmap;
+	ui64		bitmap_size;	//  bytes allocated
+	ui64		count;		//  udigs in set
+};
+
+/*
+ *  Set the bit of a udig in the set when the blob exists.  The udig is a
+ *  well formed algorithm:digest, per udig_set_scan().
+ */
+static void
+have_udig(char *udig, void *context)
+{
+	struct have_context *hp = (struct have_context *)context;
+	char *digest;
+
+	if (hp->count / 8 == hp->bitmap_size) {
+		hp->bitmap = realloc(hp->bitmap, 2 * hp->bitmap_size);
+		if (hp->bitmap == NULL)
+			panic3("have", "realloc(bitmap) failed",
+							strerror(errno));
+		memset(hp->bitmap + hp->bitmap_size, 0, hp->bitmap_size);
+		hp->bitmap_size *= 2;
+	}
+
+	digest = strchr(udig, ':');
+	*digest++ = 0;
+	if (udig_exists(udig, digest))
+		hp->bitmap[hp->count / 8] |= 1 << (hp->count % 8);
+	hp->count++;
+}
+
+/*
+ *  Synopsis:
+ *	Which blobs in a udig set exist?
+ *  Protocol Flow:
+ *	>have.<size>\n			# udig set is <size> bytes
+ *	  <ok\n				#   server ready for udig set
+ *	    >[bytes]			#     udigs, one per line
+ *	      <ok.<count>\n[bitmap]	#       count of udigs in set
+ *	      <no\n[close]		#       bytes are not a udig set
+ *	  <no\n[close]			#   server rejects request
+ *  Description:
+ *	The bitmap is (count + 7) / 8 bytes, the bit of udig i in the set
+ *	is bit i % 8 of byte i / 8, set when the blob exists.  Memory is one
+ *	bit per udig, since the set is parsed as read, like a roll set.
+ *
+ *	A blob is found by the existence index and a stat, never read, so
+ *	"have" is far cheaper and weaker than "eat", which verifies the
+ *	blob.  "have" is not a brr verb, so no brr is written, and the
+ *	request is tallied as an "eat".
+ *  Return Status:
+ *	0	no error
+ *	-1	error
+ */
+static int
+have(struct request *rp)
+{
+	static unsigned char buf[64 * 1024];
+	struct udig_set_scan scan;
+	struct have_context hc;
+	ssize_t nr;
+	i64 size;
+	int status = -1;
+	static char n[] = "have";
+
+	request_exit_status = (request_exit_status & 0x1C) |
+						(REQUEST_EXIT_STATUS_EAT << 2);
+	rp->step = "request";
+	if (rp->scan_size > rp->declared_size)
+		return write_no(rp);
+	if (write_ok(rp))
+		return -1;
+
+	hc.bitmap_size = 4096;
+	hc.bitmap = calloc(hc.bitmap_size, 1);
+	if (hc.bitmap == NULL)
+		panic3(n, "calloc(bitmap) failed", strerror(errno));
+	hc.count = 0;
+
+	rp->step = "bytes";
+	udig_set_scan_init(&scan);
+	if (udig_set_scan(&scan, rp->scan_buf, rp->scan_size, have_udig, &hc))
+		goto croak;
+	while (rp->blob_size < rp->declared_size) {
+		size = rp->declared_size - rp->blob_size;
+		if (size > (i64)sizeof buf)
+			size = sizeof buf;
+		nr = blob_read(rp, buf, size);
+		if (nr < 0)
+			goto cleanup;
+		if (nr == 0) {
+			error2(n, "unexpected end of udig set");
+			goto cleanup;
+		}
+		if (udig_set_scan(&scan, buf, nr, have_udig, &hc))
+			goto croak;
+	}
+	if (udig_set_scan_end(&scan))
+		goto croak;
+
+	rp->step = "reply";
+	if (write_ok_size(rp, hc.count) || (hc.count > 0 &&
+	    req_write(rp, hc.bitmap, (hc.count + 7) / 8)))
+		goto cleanup;
+	status = 0;
+	goto cleanup;
+croak: {
+	char ebuf[MSG_SIZE];
+
+	snprintf(ebuf, sizeof ebuf, "not a udig set: %s: line #%d",
+						scan.err, scan.line_count);
+	warn2(n, ebuf);
+
+	//  in a session, skip the rest of the set to reach the next request
+
+	while (rp->session && rp->blob_size < rp->declared_size) {
+		size = rp->declared_size - rp->blob_size;
+		if (size > (i64)sizeof buf)
+			size = sizeof buf;
+		if ((nr = blob_read(rp, buf, size)) <= 0)
+			goto cleanup;
+	}
+	status = write_no(rp);
+}
+cleanup:
+	free(hc.bitmap);
+	return status;
+}
+
 /*
- *  Process a request from client.  All verbs except "wrap" match
+ *  Process a request from client.  All verbs except "wrap", "session"
+ *  and "have" match
  *
  *	<verb> <udig>[\r]?\n
  *  OR
  *	wrap[\r]?\n
+ *  OR
+ *	session[.<token>][\r]?\n
+ *  OR
+ *	have.<size>[\r]?\n
+ *  OR
+ *	range.<offset>[.<length>] <udig>[\r]?\n
+ *  OR
+ *	stage.<offset|size>[.<length>] <udig>[\r]?\n
  */
 static void
 bio4d(
@@ -703,10 +1352,55 @@ bio4d(
 	int status;
 	struct digest_module *mp;
 	int (*verb_callback)(struct request *, struct digest_module *) = 0;
-	char ps_title[6 + 4 + 1];
+	char ps_title[6 + MAX_VERB_SIZE + 1];
 
 	req.verb = verb;
 	req.step = 0;
+	req.algorithm = algorithm;
+	req.digest = digest;
+
+	/*
+	 *  In a session, bytes read past the request line belong to this
+	 *  request or the next, so push them back for req_read().
+	 */
+	if (req.session && scan_size > 0) {
+		req_unread(&req, scan_buf, scan_size);
+		scan_size = 0;
+	}
+	if (req.range_length >= 0 && strcmp("range", verb) != 0 &&
+	    strcmp("stage", verb) != 0)
+		die2_NO(verb, "length only allowed for range or stage");
+	if (strcmp("session", verb) == 0) {
+		if (algorithm[0])
+			die2_NO(verb, "unexpected udig");
+		if (req.range_length >= 0)
+			die2_NO(verb, "unexpected length");
+		if (req.session)
+			die2_NO(verb, "session already started");
+		if (write_ok(&req))
+			die2(verb, "write_ok() failed");
+		req.session = 1;
+
+		//  the token is scanned as the byte count
+
+		req.stage_token = req.declared_size;
+		req.declared_size = -1;
+		if (scan_size > 0)
+			req_unread(&req, scan_buf, scan_size);
+		return;
+	}
+	if (strcmp("have", verb) == 0) {
+		if (algorithm[0])
+			die2_NO(verb, "unexpected udig");
+		if (req.declared_size < 0)
+			die2_NO(verb, "missing byte count of udig set");
+		ps_title_set("bio4d-have", (char *)0, (char *)0);
+		req.blob_size = scan_size;
+		req.scan_buf = scan_buf;
+		req.scan_size = scan_size;
+		have(&req);
+		return;
+	}
 	if (strcmp("wrap", verb) == 0) {
 		if (algorithm[0])
 			die3_NO(verb, algorithm, "unexpected algorithm");
@@ -714,9 +1408,29 @@ bio4d(
 	} else if (!algorithm[0] || !digest[0])
 		die2_NO(verb, "missing algo or digest");
 
-	req.algorithm = algorithm;
+	//  the offset of a range is scanned as the byte count
+
+	if (strcmp("range", verb) == 0) {
+		if (req.declared_size < 0)
+			die2_NO(verb, "missing offset of range");
+		req.range_offset = req.declared_size;
+		req.declared_size = -1;
+	}
+
+	//  the offset of a segment is scanned as the byte count, too
+
+	if (strcmp("stage", verb) == 0) {
+		if (req.declared_size < 0)
+			die2_NO(verb, "missing offset or size of stage");
+		if (req.range_length >= 0) {
+			req.range_offset = req.declared_size;
+			req.declared_size = -1;
+		}
+	} else if (req.declared_size >= 0 && strcmp("put", verb) != 0 &&
+	    strcmp("give", verb) != 0)
+		die2_NO(verb, "byte count only allowed for put or give");
+
 	req.blob_size = scan_size;
-	req.digest = digest;
 
 	/*
 	 *  Find the digest algorithm in the installed list.
@@ -747,7 +1461,7 @@ bio4d(
 	 *
 	 *  Note:
 	 *  	Collapse into faster inline tests.
-	 *	verb is in {get,put,give,take,eat,wrap,roll}
+	 *	verb is in {get,put,give,take,eat,wrap,roll,cat,range,stage}
 	 */
 	if (strcmp("get", verb) == 0)
 		verb_callback = get;
@@ -765,9 +1479,19 @@ bio4d(
 		verb_callback = roll;
 	else if (strcmp("cat", verb) == 0)
 		verb_callback = cat;
+	else if (strcmp("range", verb) == 0)
+		verb_callback = range;
+	else if (strcmp("stage", verb) == 0)
+		verb_callback = stage;
 	else
 		die3_NO(algorithm, "unknown verb", verb);
 
+	//  count the udig of a blob, but not of a wrap set
+
+	if (verb_callback != wrap && verb_callback != roll &&
+	    verb_callback != cat)
+		sketch_udig(algorithm, digest);
+
 	//  set the process title seen by the os
 
 	ps_title[0] = 0;
@@ -803,12 +1527,38 @@ bio4d(
 	 */
 	if ((*mp->close)(&req, status) < 0)
 		error3(mp->name, "close() failed", mp->name); 
+
+	//  "stage" is not a brr verb, so record the commit as a put
+
+	if (verb_callback == stage && req.range_length < 0)
+		req.verb = "put";
 }
 
 /*
- *  Execute a client blobio request in the child process.
+ *  Synopsis:
+ *	Execute a client blobio request in a request process or prefork
+ *	worker.
+ *  Description:
+ *	After the "session" verb, the client sends any number of requests on
+ *	the connection, each answered and recorded in a brr as usual.  The
+ *	client may pipeline requests, sending the next before reading the
+ *	reply, except after a put or give without a byte count, which ends
+ *	where the digest matches.  The session ends when the client closes
+ *	or is idle for the read timeout.  The optional number in
+ *	"session.<token>" keys the staged file of the "stage" verb.
+ *
+ *		>session\n
+ *		  <ok\n
+ *		>eat udig\n
+ *		>get udig\n
+ *		  <ok\n
+ *		  <ok.<size>\n[bytes]
+ *		  ...
+ *  Returns:
+ *	1	a request was read and answered
+ *	0	the client ended the session between requests
  */
-static void
+static int
 request()
 {
 	ssize_t nr;
@@ -816,6 +1566,7 @@ request()
 	char verb[MAX_VERB_SIZE + 1], *v_next, *v_end;
 	char algorithm[MAX_ALGORITHM_SIZE + 1], *a_next, *a_end;
 	char digest[MAX_DIGEST_SIZE + 1], *d_next, *d_end;
+	int size_digits = 0;
 	char unsigned buf[MSG_SIZE];
 
 	static char big_verb[] = "too many characters in verb";
@@ -828,7 +1579,10 @@ request()
 				"first character in algorithm can't be digit";
 	static char no_print_digest[] = "unprintable character in digest";
 	static char no_new_line[] = "new line expected after carriage return";
+	static char no_digit_size[] = "non digit character in blob size";
+	static char big_size[] = "too many digits in blob size";
 
+next:
 	ps_title_set("bio4d-request", (char *)0, (char *)0);
 	v_next = verb;
 	v_end = verb + MAX_VERB_SIZE;
@@ -850,9 +1604,39 @@ request()
 	 *  
 	 *  OR
 	 *	 wrap[\r]?\n
+	 *
+	 *  OR, with the size of the blob declared by the client,
+	 *	[put|give].[0-9]{1,18} $UDIG_RE[\r]?\n
+	 *
+	 *  OR, with the optional token of the staged files of the session,
+	 *	session(.[0-9]{1,18})?[\r]?\n
+	 *
+	 *  OR, with the size of a udig set,
+	 *	have.[0-9]{1,18}[\r]?\n
+	 *
+	 *  OR, with the offset and optional length of a range of a blob,
+	 *	range.[0-9]{1,18}(.[0-9]{1,18})? $UDIG_RE[\r]?\n
+	 *
+	 *  OR, with the offset and length of a segment, or the size of the
+	 *  staged blob to commit,
+	 *	stage.[0-9]{1,18}(.[0-9]{1,18})? $UDIG_RE[\r]?\n
 	 */
 	state = STATE_SCAN_VERB;
-	while (state != STATE_HALT && (nr=req_read(&req, buf, sizeof buf)) > 0){
+	if (req.session) {
+		nr = req_read_next(&req, buf, sizeof buf);
+		if (nr == 0)
+			return 0;
+
+		//  each request after the first counts as an accept
+
+		if (nr > 0 && req.session++ > 1)
+			STAT_BUMP(accept_count);
+		if (clock_gettime(CLOCK_REALTIME, &req.start_time) < 0)
+			panic2("clock_gettime(start REALTIME) failed",
+							strerror(errno));
+	} else
+		nr = req_read(&req, buf, sizeof buf);
+	while (state != STATE_HALT && nr > 0) {
 
 		unsigned char *b = buf;
 		unsigned char *b_end = buf + nr;
@@ -869,6 +1653,10 @@ request()
 				if (c == ' ') {
 					*v_next = 0;
 					state = STATE_SCAN_ALGORITHM;
+				} else if (c == '.') {
+					*v_next = 0;
+					req.declared_size = 0;
+					state = STATE_SCAN_SIZE;
 				} else if (c == '\n') {
 					*v_next = 0;
 					STATE_go;
@@ -951,6 +1739,54 @@ request()
 					die2_NO(no_print_digest, ebuf);
 				}
 				break;
+			case STATE_SCAN_SIZE:
+				if (isdigit(c)) {
+					if (size_digits++ == MAX_SIZE_DIGITS)
+						die_NO(big_size);
+					req.declared_size = req.declared_size *
+								10 + (c - '0');
+					break;
+				}
+				if (size_digits == 0) {
+					char ebuf[16];
+
+					snprintf(ebuf, sizeof ebuf, "0x%02x",c);
+					die2_NO(no_digit_size, ebuf);
+				}
+				if (c == ' ') {
+					state = STATE_SCAN_ALGORITHM;
+				} else if (c == '\n') {
+					STATE_go;
+				} else if (c == '\r') {
+					state = STATE_SCAN_NEW_LINE;
+				} else if (c == '.') {
+					size_digits = 0;
+					req.range_length = 0;
+					state = STATE_SCAN_LENGTH;
+				} else {
+					char ebuf[16];
+
+					snprintf(ebuf, sizeof ebuf, "0x%02x",c);
+					die2_NO(no_digit_size, ebuf);
+				}
+				break;
+			case STATE_SCAN_LENGTH:
+				if (isdigit(c)) {
+					if (size_digits++ == MAX_SIZE_DIGITS)
+						die_NO(big_size);
+					req.range_length = req.range_length *
+								10 + (c - '0');
+					break;
+				}
+				if (size_digits > 0 && c == ' ') {
+					state = STATE_SCAN_ALGORITHM;
+				} else {
+					char ebuf[16];
+
+					snprintf(ebuf, sizeof ebuf, "0x%02x",c);
+					die2_NO(no_digit_size, ebuf);
+				}
+				break;
 			default: {
 				char ebuf[16];
 				
@@ -958,12 +1794,22 @@ request()
 				panic2("request: impossible state", ebuf);
 			}}
 		}
+		if (state != STATE_HALT)
+			nr = req_read(&req, buf, sizeof buf);
 	}
 	if (state != STATE_HALT && nr < 0)
 		die_NO("read_buf(request) failed");
 	if (state == STATE_SCAN_VERB && v_next == verb)
 		die_NO("empty read_buf(verb)");
 
+	//  the session started, so scan the first request of the session
+
+	if (state == STATE_HALT && strcmp(verb, "session") == 0) {
+		memset(req.chat_history, 0, sizeof req.chat_history);
+		size_digits = 0;
+		goto next;
+	}
+
 	/*
 	 *  Write out the blob request record if the verb halted "normally".
 	 */
@@ -1012,13 +1858,11 @@ request()
 		if (clock_gettime(CLOCK_REALTIME, &req.end_time) < 0)
 			panic2("clock_gettime(end REALTIME) failed",
 							strerror(errno));
+		scrub_request(&req);
 		brr_send(&req);
 	} else
 		error("incomplete read from client");
-	/*
-	 *  Exit the child process that handled the single request.
-	 */
-	leave(request_exit_status);
+	return 1;
 }
 
 /*
@@ -1032,27 +1876,174 @@ bump_no(unsigned char exit_status, ui64 *v_no, ui64 *v_no2, ui64 *v_no3) {
 
 	switch ((exit_status & 0x60) >> 5) {
 	case REQUEST_EXIT_STATUS_CHAT_OK:
-		ok_count++;
+		STAT_BUMP(ok_count);
 		break;
 	case REQUEST_EXIT_STATUS_CHAT_NO:
-		no_count++;
+		STAT_BUMP(no_count);
 		if (v_no == NULL)
 			panic("bump_no: v_no==NULL");
-		*v_no += 1;
+		__sync_fetch_and_add(v_no, 1);
 		break;
 	case REQUEST_EXIT_STATUS_CHAT_NO2:
-		no2_count++;
+		STAT_BUMP(no2_count);
 		if (v_no2 == NULL)
 			panic("bump_no: v_no2==NULL");
-		*v_no2 += 1;
+		__sync_fetch_and_add(v_no2, 1);
 		break;
 	case REQUEST_EXIT_STATUS_CHAT_NO3:
-		no3_count++;
+		STAT_BUMP(no3_count);
 		if (v_no3 == NULL)
 			panic("bump_no: v_no3==NULL");
-		*v_no3 += 1;
+		__sync_fetch_and_add(v_no3, 1);
+		break;
+	}
+}
+
+/*
+ *  Synopsis:
+ *	Accumulate stats derived from the bits in a request exit status.
+ *  Note:
+ *	Called by the master for a reaped request process and, in process,
+ *	by a prefork worker after each request.  See reap_request() for
+ *	the bit encoding.
+ */
+static void
+tally_request(unsigned char s8)
+{
+	/*
+	 *  Process exit status in first 2 lower bits.
+	 */
+	switch (s8 & 0x3) {
+	case REQUEST_EXIT_STATUS_SUCCESS:
+		STAT_BUMP(success_count);
+		break;
+	case REQUEST_EXIT_STATUS_ERROR:
+		STAT_BUMP(error_count);
+		break;
+	case REQUEST_EXIT_STATUS_TIMEOUT:
+		STAT_BUMP(timeout_count);
+		break;
+	case REQUEST_EXIT_STATUS_FAULT:
+		STAT_BUMP(fault_count);
+		break;
+	}
+
+	/*
+	 *  Verb stored in bits 3,4 and 5
+	 */
+	switch ((s8 & 0x1C) >> 2) {
+	case REQUEST_EXIT_STATUS_CAT:
+		STAT_BUMP(cat_count);
+		bump_no(
+			s8,
+			&stats->cat_no_count,
+			(ui64*)0,
+			(ui64*)0
+		);
+		break;
+	case REQUEST_EXIT_STATUS_GET:
+		STAT_BUMP(get_count);
+		bump_no(
+			s8,
+			&stats->get_no_count,
+			(ui64*)0,
+			(ui64*)0
+		);
+		break;
+	case REQUEST_EXIT_STATUS_PUT:
+		STAT_BUMP(put_count);
+		bump_no(
+			s8,
+			&stats->put_no_count,
+			&stats->put_no2_count,
+			(ui64*)0
+		);
+		break;
+	case REQUEST_EXIT_STATUS_GIVE:
+		STAT_BUMP(give_count);
+		bump_no(
+			s8,
+			&stats->give_no_count,
+			&stats->give_no2_count,
+			&stats->give_no3_count
+		);
+		break;
+	case REQUEST_EXIT_STATUS_TAKE:
+		STAT_BUMP(take_count);
+		bump_no(
+			s8,
+			&stats->take_no_count,
+			&stats->take_no2_count,
+			&stats->take_no3_count
+		);
+		break;
+	case REQUEST_EXIT_STATUS_EAT:
+		STAT_BUMP(eat_count);
+
+		//  "have" is tallied as "eat", chatting "ok,no" for a bad set
+
+		bump_no(
+			s8,
+			&stats->eat_no_count,
+			&stats->eat_no_count,
+			(ui64 *)0
+		);
+		break;
+	case REQUEST_EXIT_STATUS_WRAP:
+		STAT_BUMP(wrap_count);
+		bump_no(
+			s8,
+			&stats->wrap_no_count,
+			(ui64 *)0,
+			(ui64 *)0
+		);
+		break;
+	case REQUEST_EXIT_STATUS_ROLL:
+		STAT_BUMP(roll_count);
+		bump_no(
+			s8,
+			&stats->roll_no_count,
+			(ui64 *)0,
+			(ui64 *)0
+		);
 		break;
-	}
+	default: {
+		/*
+		 *  Cheap sanity test of exit status code.
+		 *  An exit status with no errors must have
+		 *  a verb.
+		 */
+		if (s8 & 0x3)
+			break;
+		panic("no verb in exit status");
+	}}
+}
+
+/*
+ *  Synopsis:
+ *	Free the slot of an exited prefork worker.  Master forks another.
+ *  Returns:
+ *	1	worker retired cleanly, so no request to tally
+ *	0	not a worker or worker exited during a request
+ */
+static int
+reap_worker(pid_t corpse, int status)
+{
+	int i;
+
+	for (i = 0;  i < prefork_workers;  i++)
+		if (worker_pids[i] == corpse)
+			break;
+	if (i == prefork_workers)
+		return 0;
+	worker_pids[i] = 0;
+
+	if (WIFEXITED(status) &&
+	    WEXITSTATUS(status) == REQUEST_EXIT_STATUS_RETIRE)
+		return 1;
+	if (!leaving)
+		warn("prefork worker exited during request");
+	return 0;
 }
 
 /*
@@ -1061,7 +2052,8 @@ bump_no(unsigned char exit_status, ui64 *v_no, ui64 *v_no2, ui64 *v_no3) {
  *
  *  Child Exit Status Codes:
  *  	First seven bits of the exit status encode the final state of the
- *  	request process.  Statistics are accumulated.
+ *  	request process.  Statistics are accumulated.  Bit 8 alone marks
+ *  	an exit with no request in progress.
  *
  *	Process Exit Class - Bits 1 and 2:
  *
@@ -1072,14 +2064,14 @@ bump_no(unsigned char exit_status, ui64 *v_no, ui64 *v_no2, ui64 *v_no3) {
  *
  *  	Verb - Bits 3, 4, and 5
  *
- *	  ---000--	unused		- may become "cat" verb
- *	  ---001--	get request 	
- *	  ---010--	put request 	
- *	  ---011--	give request 	
- *	  ---100--	take request 	
- *	  ---101--	eat request 	
- *	  ---110--	wrap request 	
- *	  ---111--	roll request 	
+ *	  ---000--	cat request
+ *	  ---001--	get request	- and range
+ *	  ---010--	put request	- and stage
+ *	  ---011--	give request
+ *	  ---100--	take request
+ *	  ---101--	eat request	- and have
+ *	  ---110--	wrap request
+ *	  ---111--	roll request
  *
  *	Client Chat - Bits 6 and 7
  *
@@ -1087,6 +2079,12 @@ bump_no(unsigned char exit_status, ui64 *v_no, ui64 *v_no2, ui64 *v_no3) {
  *	  -01-----	client chat no
  *	  -10-----	client chat ok,no
  *	  -11-----	client chat ok,ok,no
+ *
+ *	Retire - Bit 8, REQUEST_EXIT_STATUS_RETIRE
+ *
+ *	  10000000	retired		- prefork worker retired, or session
+ *					  ended, with each request tallied
+ *					  already, so nothing is tallied
  *  Note:
  *	Panicing too soon upon unexpected termination of arborist or loggers.
  */
@@ -1120,7 +2118,31 @@ again:
 				continue;
 			panic("unexpected exit of arborist process");
 		}
-		exit_count++;
+		if (corpse == migrate_pid) {
+			migrate_pid = 0;
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				warn("layout migrator process exited abnormally");
+			continue;
+		}
+		if (corpse == scrub_pid) {
+			if (!leaving)
+				scrub_reap(status);
+			scrub_pid = 0;
+			continue;
+		}
+
+		//  release brr slots left by a killed request process
+
+		brr_reap(corpse);
+		if (prefork == 1 && reap_worker(corpse, status))
+			continue;
+
+		//  a session tallied each request in the request process
+
+		if (WIFEXITED(status) &&
+		    WEXITSTATUS(status) == REQUEST_EXIT_STATUS_RETIRE)
+			continue;
+		STAT_BUMP(exit_count);
 
 		/*
 		 *  Process exited abnormally with signal, so log status.
@@ -1134,7 +2156,7 @@ again:
 
 			jmscott_ulltoa((unsigned long long)corpse, corpsea);
 
-			signal_count++;
+			STAT_BUMP(signal_count);
 			sig = WTERMSIG(status);
 			sign = sig_name(sig);
 			jmscott_ulltoa((unsigned long long)sig, siga);
@@ -1172,114 +2194,8 @@ again:
 		 *  Process exited normally.  Accumlate stats derived
 		 *  from bits in the exit status.
 		 */
-		if (WIFEXITED(status)) {
-			unsigned char s8 = WEXITSTATUS(status);
-
-			/*
-			 *  Process exit status in first 2 lower bits.
-			 */
-			switch (s8 & 0x3) {
-			case REQUEST_EXIT_STATUS_SUCCESS:
-				success_count++;
-				break;
-			case REQUEST_EXIT_STATUS_ERROR:
-				error_count++;
-				break;
-			case REQUEST_EXIT_STATUS_TIMEOUT:
-				timeout_count++;
-				break;
-			case REQUEST_EXIT_STATUS_FAULT:
-				fault_count++;
-				break;
-			}
-
-			/*
-			 *  Verb stored in bits 3,4 and 5
-			 */
-			switch ((s8 & 0x1C) >> 2) {
-			case REQUEST_EXIT_STATUS_CAT:
-				cat_count++;
-				bump_no(
-					s8,
-					&cat_no_count,
-					(ui64*)0,
-					(ui64*)0
-				);
-				break;
-			case REQUEST_EXIT_STATUS_GET:
-				get_count++;
-				bump_no(
-					s8,
-					&get_no_count,
-					(ui64*)0,
-					(ui64*)0
-				);
-				break;
-			case REQUEST_EXIT_STATUS_PUT:
-				put_count++;
-				bump_no(
-					s8,
-					&put_no_count,
-					&put_no2_count,
-					(ui64*)0
-				);
-				break;
-			case REQUEST_EXIT_STATUS_GIVE:
-				give_count++;
-				bump_no(
-					s8,
-					&give_no_count,
-					&give_no2_count,
-					&give_no3_count
-				);
-				break;
-			case REQUEST_EXIT_STATUS_TAKE:
-				take_count++;
-				bump_no(
-					s8,
-					&take_no_count,
-					&take_no2_count,
-					&take_no3_count
-				);
-				break;
-			case REQUEST_EXIT_STATUS_EAT:
-				eat_count++;
-				bump_no(
-					s8,
-					&eat_no_count,
-					(ui64 *)0,
-					(ui64 *)0
-				);
-				break;
-			case REQUEST_EXIT_STATUS_WRAP:
-				wrap_count++;
-				bump_no(
-					s8,
-					&wrap_no_count,
-					(ui64 *)0,
-					(ui64 *)0
-				);
-				break;
-			case REQUEST_EXIT_STATUS_ROLL:
-				roll_count++;
-				bump_no(
-					s8,
-					&roll_no_count,
-					(ui64 *)0,
-					(ui64 *)0
-				);
-				break;
-			default: {
-				/*
-				 *  Cheap sanity test of exit status code.
-				 *  An exit status with no errors must have
-				 *  a verb.
-				 */
-				if (s8 & 0x3)
-					break;
-				panic("no verb in exit status");
-			}}
-		}
+		if (WIFEXITED(status))
+			tally_request(WEXITSTATUS(status));
 	}
 	if (corpse) {
 		if (errno == EINTR)
@@ -1315,73 +2231,83 @@ heartbeat()
 
 	snprintf(buf, sizeof buf, "heartbeat: %u sec", LOG_HEARTBEAT);
 	info(buf);
+	tmp_heartbeat();
 
 	/*
 	 *  Only burp out message when request count changes.
 	 *  A simple tickle of the listen socket will change the request count.
 	 */
-	if (prev_accept_count == accept_count &&
-	    prev_wait_count == exit_count)
+	if (prev_accept_count == stats->accept_count &&
+	    prev_wait_count == stats->exit_count)
 		return;
 
 	snprintf(buf, sizeof buf,
 		"accept=%llu,exit=%llu",
-			accept_count,
-			exit_count
+			stats->accept_count,
+			stats->exit_count
 	);
 	info(buf);
 
 	snprintf(buf, sizeof buf,
 		"suc=%llu, err=%llu, tmo=%llu, sig=%llu, flt=%llu",
-			success_count,
-			error_count,
-			timeout_count,
-			signal_count,
-			fault_count
+			stats->success_count,
+			stats->error_count,
+			stats->timeout_count,
+			stats->signal_count,
+			stats->fault_count
 	);
 	info(buf);
 
 	snprintf(buf, sizeof buf,
 		"get=%llu, put=%llu, give=%llu, take=%llu, eat=%llu, cat=%llu",
-			get_count,
-			put_count,
-			give_count,
-			take_count,
-			eat_count,
-			cat_count
+			stats->get_count,
+			stats->put_count,
+			stats->give_count,
+			stats->take_count,
+			stats->eat_count,
+			stats->cat_count
 
 	);
 	info(buf);
 
-	snprintf(buf, sizeof buf, "wrap=%llu, roll=%llu",wrap_count,roll_count);
+	snprintf(buf, sizeof buf, "wrap=%llu, roll=%llu",
+			stats->wrap_count,
+			stats->roll_count
+	);
 	info(buf);
 
-	ui64 no_count = eat_no_count +
-			   get_no_count +
-			   put_no_count + put_no2_count +
-			   give_no_count + give_no2_count + give_no3_count +
-			   take_no_count + take_no2_count + take_no3_count +
-			   wrap_no_count +
-			   roll_no_count
+	ui64 no_count = stats->eat_no_count +
+			stats->get_no_count +
+			stats->put_no_count + stats->put_no2_count +
+			stats->give_no_count + stats->give_no2_count +
+				stats->give_no3_count +
+			stats->take_no_count + stats->take_no2_count +
+				stats->take_no3_count +
+			stats->wrap_no_count +
+			stats->roll_no_count
 	;
-	ui64 chat_ok_count = success_count - no_count;
+	ui64 chat_ok_count = stats->success_count - no_count;
 	snprintf(buf, sizeof buf,
 	      "chat: ok=%llu, no=%llu, eat|take no=%llu|%llu",
 			chat_ok_count,
 			no_count,
-			eat_no_count,
-			take_no_count
+			stats->eat_no_count,
+			stats->take_no_count
 	);
 	info(buf);
+	exist_heartbeat();
+	pack_heartbeat();
+	verify_heartbeat();
+	sketch_heartbeat();
 
-	accept_diff = accept_count - prev_accept_count;
+	accept_diff = stats->accept_count - prev_accept_count;
 	accept_rate = (float)accept_diff / (float)LOG_HEARTBEAT;
 	snprintf(buf, sizeof buf, "sample: %.0f accept/sec, accept=%llu",
 				accept_rate, accept_diff);
 	info(buf);
 
-	prev_accept_count = accept_count;
-	prev_wait_count = exit_count;
+	prev_accept_count = stats->accept_count;
+	prev_wait_count = stats->exit_count;
 }
 
 /*
@@ -1436,6 +2362,11 @@ heartbeat()
  *		wrap_no_count:
  *		roll_count:
  *		roll_no_count:
+ *
+ *		//  udigs in get/put/give/take/eat, distinct is estimated
+ *
+ *		udig_count:
+ *		udig_distinct:
  *  Note:
  *	Add accept/wait() counts to run/bio4d.gyr.
  */
@@ -1445,6 +2376,7 @@ gyr_rrd()
 	int fd;
 	char buf[512];		/* <= PIPE_MAX */
 	time_t now;
+	ui64 udig_count, udig_distinct;
 
 	if (rrd_duration == 0)
 		return;
@@ -1516,10 +2448,13 @@ gyr_rrd()
 		"%llu:%llu:%llu:%llu:"		/* give: ok,no,no[23]*/
 		"%llu:%llu:%llu:%llu:"		/* take: ok,no,no[23]*/
 		"%llu:%llu:"			/* wrap: ok,no */
-		"%llu:%llu"			/* roll: ok,no */
+		"%llu:%llu:"			/* roll: ok,no */
+		"%llu:%llu"			/* udig: total,distinct */
 		"\n"
 	;
 
+	sketch_rrd(&udig_count, &udig_distinct);
+
 	fd = io_open_append(rrd_path);
 	if (fd < 0)
 		panic2("open(rrd) failed", strerror(errno));
@@ -1527,40 +2462,43 @@ gyr_rrd()
 	snprintf(buf, sizeof buf, rrd_format,
 		now,
 
-		accept_count - accept_count_prev,
-		exit_count - exit_count_prev,
+		stats->accept_count - accept_count_prev,
+		stats->exit_count - exit_count_prev,
 
- 		success_count - success_count_prev,
-		error_count - error_count_prev,
-		timeout_count - timeout_count_prev,
-		signal_count - signal_count_prev,
-		fault_count - fault_count_prev,
+ 		stats->success_count - success_count_prev,
+		stats->error_count - error_count_prev,
+		stats->timeout_count - timeout_count_prev,
+		stats->signal_count - signal_count_prev,
+		stats->fault_count - fault_count_prev,
 
-		eat_count - eat_count_prev,
-		eat_no_count - eat_no_count_prev,
+		stats->eat_count - eat_count_prev,
+		stats->eat_no_count - eat_no_count_prev,
 
-		get_count - get_count_prev,
-		get_no_count - get_no_count_prev,
+		stats->get_count - get_count_prev,
+		stats->get_no_count - get_no_count_prev,
 
-		put_count - put_count_prev,
-		put_no_count - put_no_count_prev,
-		put_no2_count - put_no2_count_prev,
+		stats->put_count - put_count_prev,
+		stats->put_no_count - put_no_count_prev,
+		stats->put_no2_count - put_no2_count_prev,
 
-		give_count - give_count_prev,
-		give_no_count - give_no_count_prev,
-		give_no2_count - give_no2_count_prev,
-		give_no3_count - give_no3_count_prev,
+		stats->give_count - give_count_prev,
+		stats->give_no_count - give_no_count_prev,
+		stats->give_no2_count - give_no2_count_prev,
+		stats->give_no3_count - give_no3_count_prev,
 
-		take_count - take_count_prev,
-		take_no_count - take_no_count_prev,
-		take_no2_count - take_no2_count_prev,
-		take_no3_count - take_no3_count_prev,
+		stats->take_count - take_count_prev,
+		stats->take_no_count - take_no_count_prev,
+		stats->take_no2_count - take_no2_count_prev,
+		stats->take_no3_count - take_no3_count_prev,
 
-		wrap_count - wrap_count_prev,
-		wrap_no_count - wrap_no_count_prev,
+		stats->wrap_count - wrap_count_prev,
+		stats->wrap_no_count - wrap_no_count_prev,
 
-		roll_count - roll_count_prev,
-		roll_no_count - roll_no_count_prev
+		stats->roll_count - roll_count_prev,
+		stats->roll_no_count - roll_no_count_prev,
+
+		udig_count,
+		udig_distinct
 	);
 	if (io_write(fd, buf, strlen(buf)) < 0)
 		panic2("write(rrd) failed", strerror(errno));
@@ -1569,15 +2507,17 @@ gyr_rrd()
 
 	//  Note: what about accept/wait counts?
 
-	ui64 green_count = success_count - (no2_count+no3_count)+ eat_no_count;
+	ui64 green_count = stats->success_count -
+				(stats->no2_count + stats->no3_count) +
+				stats->eat_no_count;
 	ui64 recent_green_count = green_count - green_count_prev;
 
-	ui64 yellow_count = (no2_count+no3_count) +
-			   error_count + timeout_count +
-			   wrap_no_count + roll_no_count;
+	ui64 yellow_count = (stats->no2_count+stats->no3_count) +
+			   stats->error_count + stats->timeout_count +
+			   stats->wrap_no_count + stats->roll_no_count;
 	ui64 recent_yellow_count = yellow_count - yellow_count_prev;
 
-	ui64 red_count = signal_count + fault_count;
+	ui64 red_count = stats->signal_count + stats->fault_count;
 	ui64 recent_red_count = red_count - red_count_prev;
 
 	//  only update run/bio4d.gyr when stats change.
@@ -1610,39 +2550,39 @@ gyr_rrd()
 	//  reset the samples
 	rrd_now_prev = now;
 
-	accept_count_prev = accept_count;
-	exit_count_prev = exit_count;
-	success_count_prev = success_count;
-	error_count_prev = error_count;
-	timeout_count_prev = timeout_count;
-	signal_count_prev = signal_count;
-	fault_count_prev = fault_count;
+	accept_count_prev = stats->accept_count;
+	exit_count_prev = stats->exit_count;
+	success_count_prev = stats->success_count;
+	error_count_prev = stats->error_count;
+	timeout_count_prev = stats->timeout_count;
+	signal_count_prev = stats->signal_count;
+	fault_count_prev = stats->fault_count;
 
-	eat_count_prev = eat_count;
-	eat_no_count_prev = eat_no_count;
+	eat_count_prev = stats->eat_count;
+	eat_no_count_prev = stats->eat_no_count;
 
-	get_count_prev = get_count;
-	get_no_count_prev = get_no_count;
+	get_count_prev = stats->get_count;
+	get_no_count_prev = stats->get_no_count;
 
-	put_count_prev = put_count;
-	put_no_count_prev = put_no_count;
-	put_no2_count_prev = put_no2_count;
+	put_count_prev = stats->put_count;
+	put_no_count_prev = stats->put_no_count;
+	put_no2_count_prev = stats->put_no2_count;
 
-	give_count_prev = give_count;
-	give_no_count_prev = give_no_count;
-	give_no2_count_prev = give_no2_count;
-	give_no3_count_prev = give_no3_count;
+	give_count_prev = stats->give_count;
+	give_no_count_prev = stats->give_no_count;
+	give_no2_count_prev = stats->give_no2_count;
+	give_no3_count_prev = stats->give_no3_count;
 
-	take_count_prev = take_count;
-	take_no_count_prev = take_no_count;
-	take_no2_count_prev = take_no2_count;
-	take_no3_count_prev = take_no3_count;
+	take_count_prev = stats->take_count;
+	take_no_count_prev = stats->take_no_count;
+	take_no2_count_prev = stats->take_no2_count;
+	take_no3_count_prev = stats->take_no3_count;
 
-	wrap_count_prev = wrap_count;
-	wrap_no_count_prev = wrap_no_count;
+	wrap_count_prev = stats->wrap_count;
+	wrap_no_count_prev = stats->wrap_no_count;
 
-	roll_count_prev = roll_count;
-	roll_no_count_prev = roll_no_count;
+	roll_count_prev = stats->roll_count;
+	roll_no_count_prev = stats->roll_no_count;
 
 	green_count_prev = green_count;
 	yellow_count_prev = yellow_count;
@@ -1666,7 +2606,8 @@ gyr_rrd_empty()
 		"0:0:0:0:"		/* give: ok,no,no[23]*/
 		"0:0:0:0:"		/* take: ok,no,no[23]*/
 		"0:0:"			/* wrap: ok,no */
-		"0:0"			/* roll: ok,no */
+		"0:0:"			/* roll: ok,no */
+		"0:0"			/* udig: total,distinct */
 		"\n"
 	;
 
@@ -1898,6 +2839,81 @@ fork_request()
 	return 0;
 }
 
+/*
+ *  Synopsis:
+ *	Tally a finished request and reset for the next on the socket.
+ *  Note:
+ *	The socket itself is closed by the caller.
+ */
+static void
+end_request()
+{
+	STAT_BUMP(exit_count);
+	tally_request(request_exit_status);
+
+	if (req.open_data) {
+		free(req.open_data);
+		req.open_data = 0;
+	}
+	req.verb = req.step = req.algorithm = req.digest = 0;
+	req.scan_buf = 0;
+	req.scan_size = 0;
+	req.blob_size = 0;
+	req.declared_size = -1;
+	req.reply_size = -1;
+	req.range_offset = req.range_length = -1;
+	memset(req.chat_history, 0, sizeof req.chat_history);
+	request_exit_status = 0;
+}
+
+/*
+ *  Synopsis:
+ *	Run the requests on an accepted socket, in either a forked request
+ *	process or a prefork worker.
+ *  Description:
+ *	Each request in a session is tallied in process, as it ends.
+ *  Returns:
+ *	1	the last request is yet to be tallied
+ *	0	all requests tallied, nothing left to do
+ */
+static int
+run_request(struct request *rp)
+{
+	static char n[] = "run_request";
+
+	/*
+	 *  Record start time.
+	 */
+	if (clock_gettime(CLOCK_REALTIME, &rp->start_time) < 0)
+		panic3(n, "clock_gettime(start REALTIME) failed",
+						strerror(errno));
+	/*
+	 *  Build a description of a network connection for blob request
+	 *  record and error messages.
+	 */
+	strcpy(rp->transport_tiny,
+		net_32addr2text(ntohl(rp->remote_address.sin_addr.s_addr)));
+	snprintf(rp->transport, sizeof rp->transport - 1,
+		"tcp4~%s:%u;%s:%u",
+		net_32addr2text(ntohl(rp->bind_address.sin_addr.s_addr)),
+		(unsigned int)ntohs(rp->bind_address.sin_port),
+		net_32addr2text(ntohl(rp->remote_address.sin_addr.s_addr)),
+		(unsigned int)ntohs(rp->remote_address.sin_port)
+	);
+
+	while (request()) {
+		if (!rp->session)
+			return 1;
+		end_request();
+	}
+	if (rp->session > 1)
+		return 0;
+
+	error2(rp->transport, "session ended before first request");
+	request_exit_status = REQUEST_EXIT_STATUS_ERROR;
+	return 1;
+}
+
 /*
  *  Fork a request process to handle an accepted socket.
  */
@@ -1921,12 +2937,6 @@ fork_accept(struct request *rp)
 
 	/* in the child request */
 
-	/*
-	 *  Record start time.
-	 */
-	if (clock_gettime(CLOCK_REALTIME, &rp->start_time) < 0)
-		panic3(n, "clock_gettime(start REALTIME) failed",
-						strerror(errno));
 	/*
 	 *  Shutdown listen fd.
 	 *  Need to disable signals here?
@@ -1936,23 +2946,129 @@ fork_accept(struct request *rp)
 	if (status < 0)
 		die3(n, "close(listen) failed", strerror(errno));
 
-	/*
-	 *  Build a description of a network connection for blob request
-	 *  record and error messages.
-	 */
-	strcpy(rp->transport_tiny,
-		net_32addr2text(ntohl(rp->remote_address.sin_addr.s_addr)));
-	snprintf(rp->transport, sizeof rp->transport - 1,
-		"tcp4~%s:%u;%s:%u",
-		net_32addr2text(ntohl(rp->bind_address.sin_addr.s_addr)),
-		(unsigned int)ntohs(rp->bind_address.sin_port),
-		net_32addr2text(ntohl(rp->remote_address.sin_addr.s_addr)),
-		(unsigned int)ntohs(rp->remote_address.sin_port)
-	);
+	leave(run_request(rp) ? request_exit_status :
+				REQUEST_EXIT_STATUS_RETIRE);
+}
+
+/*
+ *  Synopsis:
+ *	Accept and run requests in a long lived, prefork worker process.
+ *  Description:
+ *	Each worker blocks in accept() on the listen socket shared with the
+ *	master and all other workers, runs the request in process and then
+ *	tallies the request exit status into the shared stats.  A request
+ *	that dies still exits the worker, which the master reaps, tallies
+ *	and replaces.  After PREFORK_REQUESTS the worker retires, limiting
+ *	any memory leaked by the digest modules.
+ */
+static void
+prefork_worker()
+{
+	static char n[] = "prefork_worker";
+	pid_t parent_pid = getppid();
+	int served = 0;
+
+	ps_title_set("bio4d-worker", (char *)0, (char *)0);
+	layout_cache_dirs();
+	while (served < PREFORK_REQUESTS) {
+		req.remote_len = sizeof req.remote_address;
+		switch (net_accept(
+				listen_fd,
+				(struct sockaddr *)&req.remote_address,
+				&req.remote_len,
+				&req.client_fd,
+				ACCEPT_TIMEOUT)) {
+		case -1:
+			die3(n, "accept(listen) failed", strerror(errno));
+			/*NOTREACHED*/
+			break;
+		case 0:
+			break;
+		case 1:
+			if (getppid() != parent_pid) {
+				warn2(n, "master process exited");
+				leave(REQUEST_EXIT_STATUS_RETIRE);
+			}
+			continue;
+		default:
+			panic2(n, "net_accept() returned impossible value");
+			/*NOTREACHED*/
+		}
+		STAT_BUMP(accept_count);
+		served++;
+
+		if (run_request(&req))
+			end_request();
+
+		/*
+		 *  Reset the socket for the next accept().
+		 */
+		if (io_close(req.client_fd))
+			panic3(n, "close(client fd) failed", strerror(errno));
+		req.client_fd = -1;
+		req.session = 0;
+		req.stage_token = -1;
+
+		ps_title_set("bio4d-worker", (char *)0, (char *)0);
+	}
+	leave(REQUEST_EXIT_STATUS_RETIRE);
+}
+
+/*
+ *  Fork a prefork worker into an empty slot of the pool.
+ *  SIGCHLD is blocked until the slot records the pid of the worker.
+ */
+static void
+fork_worker(int slot)
+{
+	static char n[] = "fork_worker";
+	sigset_t chld, prev;
+	pid_t pid;
+
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &chld, &prev))
+		panic3(n, "sigprocmask(BLOCK CHLD) failed", strerror(errno));
+
+	pid = fork();
+	if (pid < 0)
+		panic3(n, "fork() failed", strerror(errno));
+	if (pid > 0)
+		worker_pids[slot] = pid;
+	else {
+		master_pid = 0;
+		request_pid = logged_pid = getpid();
+	}
+	if (sigprocmask(SIG_SETMASK, &prev, (sigset_t *)0))
+		panic3(n, "sigprocmask(SETMASK) failed", strerror(errno));
+	if (pid == 0)
+		prefork_worker();
+}
 
-	request();
+/*
+ *  Synopsis:
+ *	Master loop of prefork engine: replace exited workers and log stats.
+ *  Note:
+ *	The master never accept()s, so the master only watches the workers.
+ */
+static void
+prefork_master()
+{
+	static char n[] = "prefork_master";
+	int i;
 
-	panic2(n, "unexpected return from request()");
+	worker_pids = (pid_t *)calloc(prefork_workers, sizeof (pid_t));
+	if (worker_pids == NULL)
+		panic3(n, "calloc(worker pids) failed", strerror(errno));
+	while (1) {
+		for (i = 0;  i < prefork_workers;  i++)
+			if (worker_pids[i] == 0)
+				fork_worker(i);
+		sleep(ACCEPT_TIMEOUT);
+		heartbeat();
+		gyr_rrd();
+		reap_request();
+	}
 }
 
 static int
@@ -1969,6 +3085,18 @@ Options:\n\
 	--in-foreground\n\
 	--net-timeout\n\
 	--trust-fs\n\
+	--exist-index <true|false>\n\
+	--direct-commit <true|false>\n\
+	--pack-small <true|false>\n\
+	--mmap-blobs <true|false>\n\
+	--verify-ttl <seconds>\n\
+	--scrub-rate <MB/sec>\n\
+	--scrub-iops <blobs/sec>\n\
+	--scrub-workers <count>\n\
+	--engine <fork|prefork>\n\
+	--prefork-workers <count>\n\
+	--chunk-size <bytes>\n\
+	--stage-max-size <MB>\n\
 	--ps-title-XXXXXXXXXXX\n\
 ";
 
@@ -2123,6 +3251,210 @@ main(int argc, char **argv, char **env)
 				trust_fs = 0;
 			else
 				odie(opt, "unknown boolean");
+		} else if (strcmp("exist-index", opt) == 0) {
+			if (exist_index >= 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing true or false");
+
+			char *a = argv[i];
+			if (strcmp(a, "true") == 0)
+				exist_index = 1;
+			else if (strcmp(a, "false") == 0)
+				exist_index = 0;
+			else
+				odie(opt, "unknown boolean");
+		} else if (strcmp("direct-commit", opt) == 0) {
+			if (direct_commit >= 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing true or false");
+
+			char *a = argv[i];
+			if (strcmp(a, "true") == 0)
+				direct_commit = 1;
+			else if (strcmp(a, "false") == 0)
+				direct_commit = 0;
+			else
+				odie(opt, "unknown boolean");
+		} else if (strcmp("pack-small", opt) == 0) {
+			if (pack_small >= 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing true or false");
+
+			char *a = argv[i];
+			if (strcmp(a, "true") == 0)
+				pack_small = 1;
+			else if (strcmp(a, "false") == 0)
+				pack_small = 0;
+			else
+				odie(opt, "unknown boolean");
+		} else if (strcmp("mmap-blobs", opt) == 0) {
+			if (mmap_blobs >= 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing true or false");
+
+			char *a = argv[i];
+			if (strcmp(a, "true") == 0)
+				mmap_blobs = 1;
+			else if (strcmp(a, "false") == 0)
+				mmap_blobs = 0;
+			else
+				odie(opt, "unknown boolean");
+		} else if (strcmp("verify-ttl", opt) == 0) {
+			unsigned j, secs;
+
+			if (verify_ttl >= 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing seconds");
+
+			char *a = argv[i];
+			if (strlen(a) > 9)
+				odie(opt, "seconds must be < 10 digits");
+			for (j = 0;  a[j];  j++)
+				if (!isdigit(a[j]))
+					odie(opt, "non digit in seconds");
+			if (sscanf(a, "%u", &secs) != 1)
+				odie(opt, "sscanf(seconds) failed");
+			verify_ttl = secs;
+		} else if (strcmp("scrub-rate", opt) == 0) {
+			unsigned j, rate;
+
+			if (scrub_rate >= 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing MB/sec");
+
+			char *a = argv[i];
+			if (strlen(a) > 6)
+				odie(opt, "MB/sec must be < 7 digits");
+			for (j = 0;  a[j];  j++)
+				if (!isdigit(a[j]))
+					odie(opt, "non digit in MB/sec");
+			if (sscanf(a, "%u", &rate) != 1)
+				odie(opt, "sscanf(MB/sec) failed");
+			scrub_rate = rate;
+		} else if (strcmp("scrub-iops", opt) == 0) {
+			unsigned j, iops;
+
+			if (scrub_iops >= 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing blobs/sec");
+
+			char *a = argv[i];
+			if (strlen(a) > 6)
+				odie(opt, "blobs/sec must be < 7 digits");
+			for (j = 0;  a[j];  j++)
+				if (!isdigit(a[j]))
+					odie(opt, "non digit in blobs/sec");
+			if (sscanf(a, "%u", &iops) != 1)
+				odie(opt, "sscanf(blobs/sec) failed");
+			scrub_iops = iops;
+		} else if (strcmp("scrub-workers", opt) == 0) {
+			unsigned j, count;
+
+			if (scrub_workers > 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing worker count");
+
+			char *a = argv[i];
+			if (!isdigit(a[0]))
+				odie(opt, "first char of count not digit");
+			if (strlen(a) > 2)
+				odie(opt, "count must be < 3 digits");
+			for (j = 1;  a[j];  j++)
+				if (!isdigit(a[j]))
+					odie(opt, "non digit in count");
+			if (sscanf(a, "%u", &count) != 1)
+				odie(opt, "sscanf(count) failed");
+			if (count == 0)
+				odie(opt, "count is 0");
+			if (count > SCRUB_MAX_WORKERS)
+				odie(opt, "count > 64");
+			scrub_workers = count;
+		} else if (strcmp("engine", opt) == 0) {
+			if (prefork >= 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing fork or prefork");
+
+			char *a = argv[i];
+			if (strcmp(a, "fork") == 0)
+				prefork = 0;
+			else if (strcmp(a, "prefork") == 0)
+				prefork = 1;
+			else
+				odie(opt, "unknown engine");
+		} else if (strcmp("prefork-workers", opt) == 0) {
+			unsigned j, count;
+
+			if (prefork_workers > 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing worker count");
+
+			char *a = argv[i];
+			if (!isdigit(a[0]))
+				odie(opt, "first char of count not digit");
+			if (strlen(a) > 3)
+				odie(opt, "count must be < 4 digits");
+			for (j = 1;  a[j];  j++)
+				if (!isdigit(a[j]))
+					odie(opt, "non digit in count");
+			if (sscanf(a, "%u", &count) != 1)
+				odie(opt, "sscanf(count) failed");
+			if (count == 0)
+				odie(opt, "count is 0");
+			prefork_workers = count;
+		} else if (strcmp("chunk-size", opt) == 0) {
+			unsigned j, size;
+
+			if (chunk_size > 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing chunk size in bytes");
+
+			char *a = argv[i];
+			if (!isdigit(a[0]))
+				odie(opt, "first char of size not digit");
+			if (strlen(a) > 7)
+				odie(opt, "size must be < 8 digits");
+			for (j = 1;  a[j];  j++)
+				if (!isdigit(a[j]))
+					odie(opt, "non digit in size");
+			if (sscanf(a, "%u", &size) != 1)
+				odie(opt, "sscanf(size) failed");
+			if (size < CHUNK_SIZE_MIN)
+				odie(opt, "size < 4096 bytes");
+			if (size > CHUNK_SIZE_MAX)
+				odie(opt, "size > 1048576 bytes");
+			if (size & (size - 1))
+				odie(opt, "size not a power of two");
+			chunk_size = size;
+		} else if (strcmp("stage-max-size", opt) == 0) {
+			unsigned j, mb;
+
+			if (stage_max_size >= 0)
+				odie(opt, "given more than once");
+			if (++i >= argc)
+				odie(opt, "missing size in MB");
+
+			char *a = argv[i];
+			if (strlen(a) > 9)
+				odie(opt, "MB must be < 10 digits");
+			for (j = 0;  a[j];  j++)
+				if (!isdigit(a[j]))
+					odie(opt, "non digit in MB");
+			if (sscanf(a, "%u", &mb) != 1)
+				odie(opt, "sscanf(MB) failed");
+			if (mb == 0)
+				odie(opt, "MB is 0");
+			stage_max_size = (i64)mb * 1024 * 1024;
 		} else if (strcmp("brr-mask", opt) == 0) {
 			if (seen_brr_mask)
 				odie(opt, "given more than once on cli");
@@ -2193,6 +3525,15 @@ main(int argc, char **argv, char **env)
 	if (net_timeout == -1)
 		net_timeout = NET_TIMEOUT;
 
+	if (prefork == -1)
+		prefork = 0;
+	if (prefork_workers == 0)
+		prefork_workers = PREFORK_WORKERS;
+	if (chunk_size == 0)
+		chunk_size = CHUNK_SIZE_DEFAULT;
+	if (stage_max_size == -1)
+		stage_max_size = (i64)STAGE_MAX_SIZE_DEFAULT * 1024 * 1024;
+
 	if (port == 0)
 		port = BIO4D_PORT;
 
@@ -2254,9 +3595,23 @@ main(int argc, char **argv, char **env)
 		info("trust fs is enabled");
 	else
 		info("trust fs is disabled");
+
+	snprintf(buf, sizeof buf, "blob chunk size: %u bytes", chunk_size);
+	info(buf);
+	snprintf(buf, sizeof buf, "stage max size: %lld MB",
+					stage_max_size / (1024 * 1024));
+	info(buf);
+	if (mmap_blobs == 1)
+		info("mmap of large blob files is enabled");
+	else
+		info("mmap of large blob files is disabled");
 	if (module_boot())
 		die("modules_boot() failed");
 
+	pack_open();
+	exist_open();
+	verify_open();
+
 	tmp_open();
 
 	brr_open();
@@ -2266,6 +3621,23 @@ main(int argc, char **argv, char **env)
 	arbor_open();
 	snprintf(buf, sizeof buf, "arborist process id: %u", arborist_pid);
 	info(buf);
+	if (direct_commit == 1)
+		info("direct commit of blobs is enabled");
+	else
+		info("direct commit of blobs is disabled");
+
+	layout_migrate();
+	if (migrate_pid > 0) {
+		snprintf(buf, sizeof buf, "layout migrator process id: %u",
+							migrate_pid);
+		info(buf);
+	}
+
+	scrub_open();
+	if (scrub_pid > 0) {
+		snprintf(buf, sizeof buf, "scrubber process id: %u", scrub_pid);
+		info(buf);
+	}
 
 	snprintf(buf, sizeof buf, "brr mask: 0x%x", brr_mask);
 	info(buf);
@@ -2314,6 +3686,21 @@ main(int argc, char **argv, char **env)
 
 	ps_title_set("bio4d-listen", (char *)0, (char *)0);
 
+	/*
+	 *  Map the request stats shared by the master and prefork workers.
+	 */
+	stats = (struct request_stats *)mmap(
+			(void *)0,
+			sizeof *stats,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANON,
+			-1,
+			(off_t)0
+	);
+	if (stats == MAP_FAILED)
+		panic2("mmap(request stats) failed", strerror(errno));
+	sketch_open();
+
 	/*
 	 *  Open the socket to listen for requests.
 	 */
@@ -2347,6 +3734,18 @@ main(int argc, char **argv, char **env)
 	req.remote_len = sizeof req.remote_address;
 	req.read_timeout = req.write_timeout = net_timeout;
 
+	if (prefork == 1) {
+		snprintf(buf, sizeof buf, "engine: prefork, %d workers",
+						prefork_workers);
+		info(buf);
+		snprintf(buf, sizeof buf, "worker retires after %d requests",
+						PREFORK_REQUESTS);
+		info(buf);
+		info("accepting incoming requests in workers ...");
+		prefork_master();
+	}
+	info("engine: fork per accept");
+
 	info("accepting incoming requests ...");
 accept_request:
 	switch (net_accept(
@@ -2364,7 +3763,7 @@ accept_request:
 		/*NOTREACHED*/
 		break;
 	case 0:
-		accept_count++;
+		STAT_BUMP(accept_count);
 		fork_accept(&req);
 		break;
 	/*
@@ -14,7 +14,9 @@
  *	https://stackoverflow.com/questions/2888425/
  *		is-o-largefile-needed-just-to-write-a-large-file
  */
+#ifndef _LARGEFILE_SOURCE
 #define _LARGEFILE_SOURCE
+#endif
 #define _FILE_OFFSET_BITS 64
 
 #include <sys/types.h>
@@ -22,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -54,6 +57,20 @@ typedef unsigned char		ui8;
  */
 #define MSG_SIZE		255
 
+/*
+ *  Bytes per read()/write() of a blob by the digest modules, set at boot
+ *  by option --chunk-size.  Must be a power of two.
+ */
+#define CHUNK_SIZE_DEFAULT	(4 * 1024)
+#define CHUNK_SIZE_MIN		(4 * 1024)
+#define CHUNK_SIZE_MAX		(1024 * 1024)
+
+/*
+ *  Largest blob in MB staged over many connections, set at boot by option
+ *  --stage-max-size.
+ */
+#define STAGE_MAX_SIZE_DEFAULT	(64 * 1024)
+
 struct request
 {
 	int	client_fd;		/* pipe to the client */
@@ -109,6 +126,42 @@ struct request
 
 	i64	blob_size;
 
+	/*
+	 *  Blob size declared by the client in "put.<size> udig",
+	 *  or -1 when the end of the blob is detected by the digest.
+	 */
+	i64	declared_size;
+
+	/*
+	 *  Set after the "session" verb, when the client sends many requests
+	 *  on the connection, to 1 + the count of requests begun.  In a
+	 *  session, the "ok" of a get or take carries reply_size, the size
+	 *  of the blob set by get_request(), which also frames each blob
+	 *  streamed by "cat".
+	 */
+	int	session;
+	i64	reply_size;
+
+	/*
+	 *  The token of "session.<token>", chosen by the client to key the
+	 *  staged file of a blob put over several connections, or -1.
+	 */
+	i64	stage_token;
+
+	/*
+	 *  The first byte of a "range" request or "stage" segment, or -1 for
+	 *  any other verb, and the count of bytes to send or stage, or -1
+	 *  for the rest of the blob.
+	 */
+	i64	range_offset;
+	i64	range_length;
+
+	/*
+	 *  The staged file read by blob_read() in place of the client, when
+	 *  "stage" commits a blob put over several connections, or -1.
+	 */
+	int	stage_fd;
+
 	//  Note: why ui32 for {read,write}_timeout?  Seems like ui2 enough.
 
 	ui32	read_timeout;	/* # seconds before a request read timeout */
@@ -145,6 +198,13 @@ struct request
 #define REQUEST_EXIT_STATUS_CHAT_NO2	2
 #define REQUEST_EXIT_STATUS_CHAT_NO3	3
 
+/*
+ *  Bit 8: a prefork worker retired after serving many requests, or a
+ *  session ended after tallying each of its requests.  No request was
+ *  in progress, so no stats are tallied.
+ */
+#define REQUEST_EXIT_STATUS_RETIRE	0x80
+
 struct digest_module
 {
 	char	*name;
@@ -192,6 +252,21 @@ struct digest_module
 	 */
 	int	(*eat)(struct request *);
 
+	/*
+	 *  Verify an existing blob for the scrubber, without panic.
+	 *  Return:
+	 *	0	if the blob matches the digest
+	 *	1	if the blob does not exist
+	 *	2	if the blob is corrupt
+	 */
+	int	(*frisk)(struct request *);
+
+	/*
+	 *  Does a blob exist, packed or as a file?  The blob is not read.
+	 *  Return 1 if the blob exists, 0 if not.
+	 */
+	int	(*exists)(char *digest);
+
 	/*
 	 *  Digest a local stream up to EOF and copy text digest as c string to
 	 *  memory referenced by char *digest.
@@ -287,6 +362,9 @@ void	log_format(char *msg, char *buf, int buf_size);
 int	burp_text_file(char *buf, char *path);
 int	slurp_text_file(char *path, char *buf, size_t buf_size);
 int	write_ok(struct request *rp);
+int	write_ok_blob(struct request *rp);
+int	write_ok_size(struct request *rp, i64 size);
+int	write_ok_range(struct request *rp, i64 size, i64 blob_size);
 int	write_no(struct request *rp);
 int	read_buf(
 		int fd,
@@ -301,6 +379,8 @@ char	*net_32addr2text(u_long addr);
 char	*sig_name(int sig);
 
 extern int	trust_fs;
+extern ui32	chunk_size;
+extern i64	stage_max_size;
 extern ui8	brr_mask;
 
 /*
@@ -308,11 +388,14 @@ extern ui8	brr_mask;
  */
 int		io_path_exists(char *path);
 int		io_close(int fd);
+int		io_dup(int fd);
 ssize_t		io_read(int fd, void *buf, size_t count);
 ssize_t		io_write(int fd, void *buf, size_t count);
+ssize_t		io_writev(int fd, const struct iovec *iov, int iovcnt);
 int		io_write_buf(int fd, void *buf, size_t count);
 int		io_pipe(int fds[2]);
 int		io_open(char *path, int flags, int mode);
+int		io_openat(int dir_fd, char *path, int flags, int mode);
 int		io_open_append(char *path);
 int		io_open_trunc(char *path);
 int		io_select(
@@ -327,6 +410,7 @@ int		io_rename(char *old_path, char *new_path);
 DIR		*io_opendir(char *path);
 struct dirent	*io_readdir(DIR *dirp);
 int		io_unlink(const char *path);
+int		io_unlinkat(int dir_fd, const char *path);
 int		io_rmdir(const char *path);
 int		io_mkfifo(char *path, mode_t mode);
 int		io_chmod(char *path, mode_t mode);
@@ -335,6 +419,7 @@ int		io_fstat(int fd, struct stat *buf);
 int		io_closedir(DIR *dirp);
 int		io_mkdir(const char *pathname, mode_t mode);
 int		io_stat(const char *pathname, struct stat *st);
+int		io_fstatat(int dir_fd, const char *path, struct stat *st);
 int		io_lstat(const char *pathname, struct stat *st);
 int		io_utimes(const char *pathname, const struct timeval times[2]);
 
@@ -344,6 +429,7 @@ int		net_accept(
 			int *client_fd,
 			unsigned timeout
 		);
+int		net_wait_read(int fd, unsigned timeout);
 ssize_t		net_read(
 			int fd,
 			void *buf,
@@ -356,12 +442,29 @@ int		net_write(
 			size_t count,
 			unsigned timeout
 		);
+int		net_send_file(
+			int in_fd,
+			int out_fd,
+			i64 length,
+			i64 *nsent,
+			unsigned timeout
+		);
 
 ssize_t		req_read(
 			struct request *r,
 			void *buf,
 			size_t buf_size
 		);
+ssize_t		req_read_next(
+			struct request *r,
+			void *buf,
+			size_t buf_size
+		);
+void		req_unread(
+			struct request *r,
+			void *buf,
+			size_t size
+		);
 int		req_write(
 			struct request *r,
 			void *buf,
@@ -379,28 +482,65 @@ int		blob_write(
 			void *buf,
 			size_t buf_size
 		);
+int		blob_send_file(
+			struct request *r,
+			int blob_fd,
+			i64 length
+		);
 
 void		decode_hex(char *hex, unsigned char *bytes);
 
 /*
- *  Trivial stream orient message by single reader.
+ *  Trivial stream orient message by single reader.  A read() fills buf[]
+ *  with as many framed messages as the stream holds, up to IO_MSG_BUF_SIZE.
  */
+#define IO_MSG_BUF_SIZE		(32 * (MSG_SIZE + 1))
+
 struct io_message
 {
 	int		fd;
-	unsigned char	payload[MSG_SIZE];
+
+	//  points into buf[], valid until the next io_msg_read()
+
+	unsigned char	*payload;
 	ssize_t		len;
+
+	unsigned char	buf[IO_MSG_BUF_SIZE];
+	size_t		buf_off;
+	size_t		buf_end;
 };
 
 ssize_t		io_msg_write(int fd, void *payload,unsigned char count);
 void		io_msg_new(struct io_message *ip, int fd);
 int		io_msg_read(struct io_message *ip);
+int		io_msg_buffered(struct io_message *ip);
+
+/*
+ *  Sequential scan of a large blob file through a read only mapping,
+ *  IO_MAP_WINDOW bytes at a time, with read ahead of the next window.
+ */
+#define IO_MAP_MIN_SIZE		(1024 * 1024)
+#define IO_MAP_WINDOW		(1024 * 1024)
+
+struct io_map
+{
+	int		state;		//  0 untried, 1 mapped, -1 use read()
+	unsigned char	*base;
+	size_t		size;
+	size_t		offset;
+};
+
+extern int	mmap_blobs;
+
+int		io_map_read(struct io_map *mp, int fd, unsigned char **p_buf);
+void		io_map_close(struct io_map *mp);
 
 /*
  *  Blob request record, defined in brr.c
  */
 void	brr_close();
 void	brr_open();
+void	brr_reap(pid_t pid);
 void	brr_send(struct request *);
 int	brr_roll();
 int	brr_roll_final();
@@ -409,6 +549,35 @@ int	brr_stat(struct stat *buf);
 int	wrap(struct request *, struct digest_module *);
 int	roll(struct request *, struct digest_module *);
 
+/*
+ *  State of the parse of a udig set, one udig per line, fed in chunks.
+ *  Defined in brr.c, shared by "roll", "have" and "cat".
+ */
+struct udig_set_scan
+{
+	char	udig[MAX_UDIG_SIZE + 1];
+	int	len;
+	int	colon;
+	int	line_count;
+	char	*err;
+};
+
+void	udig_set_scan_init(struct udig_set_scan *sp);
+int	udig_set_scan(
+		struct udig_set_scan *sp,
+		unsigned char *buf,
+		int size,
+		void (*each)(char *udig, void *context),
+		void *context
+	);
+int	udig_set_scan_end(struct udig_set_scan *sp);
+int	udig_set_each(
+		int fd,
+		char *path,
+		void (*each)(char *udig, void *context),
+		void *context
+	);
+
 /*
  *  OS dependent interface routines for process title, typical used
  *  by the unix 'ps' verb, defined ps_title.c
@@ -436,6 +605,95 @@ int			module_boot();
 void			module_leave();
 struct digest_module *	module_get(char *name);
 
+/*
+ *  In memory index of blobs existing in data/fs_*, defined in exist.c
+ */
+extern int	exist_index;
+
+void		exist_open();
+int		exist_maybe(char *digest);
+int		exist_put(char *blob_path);
+void		exist_count(int delta);
+void		exist_packed(char *digest);
+void		exist_heartbeat();
+
+/*
+ *  Small blobs packed into append only segments, defined in pack.c
+ */
+#define PACK_MAX_BLOB	4096
+
+extern int	pack_small;
+
+void		pack_open();
+int		pack_put(char *algorithm, char *digest, int fd);
+int		pack_exists(char *algorithm, char *digest);
+int		pack_open_blob(char *algorithm, char *digest, i64 *offset,
+							i64 *length);
+int		pack_take(char *algorithm, char *digest);
+ui64		pack_each(void (*each)(char *algorithm, char *digest));
+void		pack_compact();
+void		pack_heartbeat();
+
+/*
+ *  Cache of verification stamps of blob files, defined in verify.c
+ */
+extern int	verify_ttl;
+
+void		verify_open();
+int		verify_fresh(int fd, int range);
+void		verify_stamp(int fd);
+void		verify_heartbeat();
+void		verify_close();
+
+/*
+ *  Scrubber process that verifies every stored blob, defined in scrub.c
+ */
+#define SCRUB_MAX_WORKERS	64
+
+extern int	scrub_rate;
+extern int	scrub_iops;
+extern int	scrub_workers;
+extern pid_t	scrub_pid;
+
+void		scrub_open();
+void		scrub_request(struct request *r);
+void		scrub_reap(int status);
+
+/*
+ *  Streaming sketches of udig total, distinct and hot counts, in sketch.c
+ */
+void		sketch_open();
+void		sketch_udig(char *algo, char *digest);
+void		sketch_heartbeat();
+void		sketch_rrd(ui64 *total, ui64 *distinct);
+
+/*
+ *  Incremental hash backend for the digest modules, defined in hash.c
+ */
+#define HASH_SHA1		0
+#define HASH_SHA256		1
+#define HASH_RIPEMD160		2
+#define HASH_TYPE_COUNT		3
+
+struct hash
+{
+	struct evp_md_ctx_st	*ctx;		//  EVP_MD_CTX
+};
+
+int		hash_boot();
+int		hash_init(struct hash *h, int type);
+int		hash_update(struct hash *h, void *buf, size_t size);
+int		hash_final(struct hash *h, unsigned char *digest);
+int		hash_copy(struct hash *to, struct hash *from);
+void		hash_swap(struct hash *a, struct hash *b);
+void		hash_free(struct hash *h);
+int		hash_digest(
+			int type,
+			void *buf,
+			size_t size,
+			unsigned char *digest
+		);
+
 /*
  *  Trivial set stored on heap of blobs with get/put/for-each operations.
  */
@@ -453,16 +711,45 @@ int		blob_set_for_each(
  *  The arborist/file process that moves files and garbage collects
  *  empty directories.
  */
+extern int	direct_commit;
+
 void		arbor_open();
 void		arbor_close();
 void		arbor_rename(char *tmp_path, char *new_path);
 void		arbor_move(char *tmp_path, char *new_path);
+int		arbor_link(int fd, char *new_path);
+int		arbor_publish(char *src_path, char *new_path);
 void		arbor_trim(char *blob_path);
 
+/*
+ *  Versioned directory layout of data/fs_*, with background migration
+ */
+struct blob_layout;
+
+extern pid_t	migrate_pid;
+
+struct blob_layout *	layout_open(char *root_dir_path);
+void			layout_path(struct blob_layout *lp, char *digest,
+					char *dir_path, char *blob_path);
+int			layout_probe(struct blob_layout *lp, int probe,
+					char *digest, char *dir_path,
+					char *blob_path);
+void			layout_cache_dirs();
+int			layout_open_blob(struct blob_layout *lp,
+					char *blob_path);
+int			layout_unlink_blob(struct blob_layout *lp,
+					char *blob_path, int *exists);
+int			layout_blob_exists(struct blob_layout *lp,
+					char *blob_path);
+void			layout_migrate();
+
 /*
  *  Map digest prefix onto temp directory on same file system as blob storage.
  */
 void		tmp_open();
+void		tmp_heartbeat();
 char *		tmp_get(char *algorithm, char *digest_prefix);
+int		tmp_open_anon(char *algorithm, char *digest_prefix);
+int		tmp_name_anon(int fd, char *tmp_path, int errno_link);
 
 #endif
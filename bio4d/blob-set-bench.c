@@ -0,0 +1,164 @@
+/*
+ *  Synopsis:
+ *	Measure insert and lookup of udigs in the blob_set of roll and wrap.
+ *  Usage:
+ *	blob-set-bench [count]
+ *	blob-set-bench 10000000
+ *  Description:
+ *	Put <count> distinct sha udigs into a blob_set, then look up each
+ *	udig again and <count> udigs not in the set.  The default count is
+ *	10000000, the size of a very large roll set.  The udigs are made on
+ *	the fly from a counter, so the time to make a udig, measured first,
+ *	is included in each step.  The output is
+ *
+ *		<step>	<count>	<seconds>	<million/sec>
+ *
+ *	followed by the peak resident memory of the process.
+ *  Exit Status:
+ *	0	ok
+ *	1	error, or a lookup answered wrong
+ */
+#include <sys/resource.h>
+#include <time.h>
+
+#include "bio4d.h"
+
+#define UDIG_LEN	44		//  sha: + 40 hex digits
+
+static volatile unsigned char	sink;	//  keeps the udig loop
+
+static void
+die(char *msg1, char *msg2)
+{
+	fprintf(stderr, "blob-set-bench: ERROR: %s: %s\n", msg1, msg2);
+	exit(1);
+}
+
+//  called by blob_set.c and io.c
+
+void
+panic2(char *msg1, char *msg2)
+{
+	die(msg1, msg2);
+}
+
+void
+panic3(char *msg1, char *msg2, char *msg3)
+{
+	fprintf(stderr, "blob-set-bench: PANIC: %s: %s\n", msg1, msg2);
+	die("panic", msg3);
+}
+
+void
+error2(char *msg1, char *msg2)
+{
+	fprintf(stderr, "blob-set-bench: ERROR: %s: %s\n", msg1, msg2);
+}
+
+void
+error3(char *msg1, char *msg2, char *msg3)
+{
+	fprintf(stderr, "blob-set-bench: ERROR: %s: %s: %s\n", msg1, msg2,
+								msg3);
+}
+
+void
+error4(char *msg1, char *msg2, char *msg3, char *msg4)
+{
+	fprintf(stderr, "blob-set-bench: ERROR: %s: %s: %s: %s\n", msg1, msg2,
+								msg3, msg4);
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		die("clock_gettime() failed", strerror(errno));
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ *  Make the sha udig of a counter, scrambled so that neighbouring udigs
+ *  share no prefix, like the digests in a real roll set.
+ */
+static void
+udig(ui64 i, unsigned char *u)
+{
+	static char hex[] = "0123456789abcdef";
+	ui64 x = i;
+	int d, w;
+
+	memcpy(u, "sha:", 4);
+	for (w = 0;  w < 3;  w++) {
+		x += 0x9e3779b97f4a7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		x ^= x >> 31;
+		for (d = 0;  d < 16 && 4 + w * 16 + d < UDIG_LEN;  d++)
+			u[4 + w * 16 + d] = hex[(x >> (d * 4)) & 0xf];
+	}
+}
+
+static void
+report(char *step, ui64 count, double elapsed)
+{
+	printf("%s\t%llu\t%.3f\t%.2f\n", step, (unsigned long long)count,
+					elapsed, count / elapsed / 1e6);
+}
+
+int
+main(int argc, char **argv)
+{
+	ui64 count = 10000000, i;
+	unsigned char u[UDIG_LEN];
+	void *set;
+	double start;
+	struct rusage ru;
+
+	if (argc > 2)
+		die("wrong number of arguments", "blob-set-bench [count]");
+	if (argc == 2 && (count = strtoull(argv[1], (char **)0, 10)) == 0)
+		die("count not > 0", argv[1]);
+
+	start = now();
+	for (i = 0;  i < count;  i++) {
+		udig(i, u);
+		sink = u[4];
+	}
+	report("udig", count, now() - start);
+
+	blob_set_alloc(&set);
+
+	start = now();
+	for (i = 0;  i < count;  i++) {
+		udig(i, u);
+		if (blob_set_put(set, u, UDIG_LEN))
+			die("blob_set_put() not 0", "duplicate udig");
+	}
+	report("insert", count, now() - start);
+
+	start = now();
+	for (i = 0;  i < count;  i++) {
+		udig(i, u);
+		if (!blob_set_exists(set, u, UDIG_LEN))
+			die("blob_set_exists() not true", "lost udig");
+	}
+	report("hit", count, now() - start);
+
+	start = now();
+	for (i = count;  i < 2 * count;  i++) {
+		udig(i, u);
+		if (blob_set_exists(set, u, UDIG_LEN))
+			die("blob_set_exists() true", "phantom udig");
+	}
+	report("miss", count, now() - start);
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		die("getrusage() failed", strerror(errno));
+	printf("maxrss\t%ld KB\n", ru.ru_maxrss);
+
+	blob_set_free(set);
+	exit(0);
+}
@@ -1,45 +1,184 @@
 /*
  *  Synopsis:
  *	Simple functions to get/put small blobs in memory
+ *  Description:
+ *	An open addressing hash table with linear probing.  Each slot holds
+ *	the 64 bit siphash of the element and the offset of the element in a
+ *	single arena, so a set of millions of udigs costs two allocations
+ *	that grow by doubling, not two mallocs per element.  A probe compares
+ *	the full hash before touching the arena.
+ *
+ *	The table doubles when 3/4 full, rehashing from the stored hashes.
+ *
+ *	The siphash key is drawn from /dev/urandom once per process, so a
+ *	client can not craft a roll set of colliding udigs.
  *  Note:
- *	Contemplate replacing djb hash with 64bit siphash.
+ *	A set is private to one process, so no locking.
  */
+#include <time.h>
+#include <unistd.h>
+
 #include "bio4d.h"
 
+#define MIN_TABLE_SIZE		1024		//  power of two
+#define MIN_ARENA_SIZE		(64 * 1024)
+
+struct hash_set_slot
+{
+	ui64			hash;		//  0 when slot is empty
+	size_t			offset;		//  of value in arena
+	int			size;
+};
+
+struct hash_set
+{
+	ui64			mask;		//  table size - 1
+	ui64			count;
+	struct hash_set_slot	*table;
+
+	unsigned char		*arena;
+	size_t			arena_size;
+	size_t			arena_used;
+
+	int			for_each_level;
+};
+
+static ui64		sip_k0, sip_k1;
+static int		sip_keyed = 0;
+
+#define ROTL(x, b)	(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND						\
+	do {							\
+		v0 += v1;  v1 = ROTL(v1, 13);  v1 ^= v0;	\
+		v0 = ROTL(v0, 32);				\
+		v2 += v3;  v3 = ROTL(v3, 16);  v3 ^= v2;	\
+		v0 += v3;  v3 = ROTL(v3, 21);  v3 ^= v0;	\
+		v2 += v1;  v1 = ROTL(v1, 17);  v1 ^= v2;	\
+		v2 = ROTL(v2, 32);				\
+	} while (0)
+
 /*
- *  Size of hash table.  Really ought to grow dynamically.
+ *  SipHash-2-4 of Aumasson and Bernstein, 64 bit output.
  */
-#define HASH_TABLE_SIZE		99991
+static ui64
+siphash(unsigned char *buf, int nbytes)
+{
+	ui64 v0 = 0x736f6d6570736575ULL ^ sip_k0;
+	ui64 v1 = 0x646f72616e646f6dULL ^ sip_k1;
+	ui64 v2 = 0x6c7967656e657261ULL ^ sip_k0;
+	ui64 v3 = 0x7465646279746573ULL ^ sip_k1;
+	ui64 m, b = (ui64)nbytes << 56;
+	unsigned char *end = buf + (nbytes & ~7);
+	int i;
+
+	for (;  buf < end;  buf += 8) {
+		m = 0;
+		for (i = 7;  i >= 0;  i--)
+			m = (m << 8) | buf[i];
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+	for (i = (nbytes & 7) - 1;  i >= 0;  i--)
+		b |= (ui64)buf[i] << (8 * i);
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return v0 ^ v1 ^ v2 ^ v3;
+}
 
 /*
- *  Attributed to Dan Berstein from a usenet comp.lang.c newsgroup.
+ *  Draw the siphash key.  Without /dev/urandom, fall back to the clock
+ *  and process id, which still defeats a precomputed roll set.
  */
-static unsigned int
-djb(unsigned char *buf, int nbytes)
+static void
+sip_key()
 {
-	unsigned int hash = 5381;
-	unsigned char *p;
+	ui64 key[2];
+	struct timespec now;
+	int fd, nread = -1;
 
-	p = buf;
-	while (--nbytes >= 0)
-		 hash = ((hash << 5) + hash) + *p++;
-	return hash;
+	fd = io_open("/dev/urandom", O_RDONLY, 0);
+	if (fd >= 0) {
+		nread = io_read(fd, (unsigned char *)key, sizeof key);
+		io_close(fd);
+	}
+	if (nread != sizeof key) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		key[0] = ((ui64)now.tv_sec << 32) ^ now.tv_nsec;
+		key[1] = ((ui64)getpid() << 32) ^ (ui64)(size_t)&now;
+	}
+	sip_k0 = key[0];
+	sip_k1 = key[1];
+	sip_keyed = 1;
 }
 
-struct hash_set_element
+static ui64
+hash(unsigned char *element, int size)
 {
-	unsigned char		*value;
-	int			size;		
+	ui64 h = siphash(element, size);
 
-	struct hash_set_element	*next;
-};
+	return h ? h : 1;
+}
 
-struct hash_set
+/*
+ *  Find the slot of an element, or the empty slot where it belongs.
+ */
+static struct hash_set_slot *
+find(struct hash_set *s, ui64 h, unsigned char *element, int size)
 {
-	int			size;
-	struct hash_set_element	**table;
-	int			for_each_level;
-};
+	struct hash_set_slot *sp;
+	ui64 i;
+
+	for (i = h & s->mask;  ;  i = (i + 1) & s->mask) {
+		sp = &s->table[i];
+		if (sp->hash == 0)
+			return sp;
+		if (sp->hash == h && sp->size == size &&
+		    memcmp(s->arena + sp->offset, element, size) == 0)
+			return sp;
+	}
+	/*NOTREACHED*/
+}
+
+/*
+ *  Double the table, reinserting from the stored hashes.
+ */
+static void
+grow(struct hash_set *s)
+{
+	struct hash_set_slot *old, *sp;
+	ui64 old_size, i, j;
+	static char nm[] = "blob_set_grow";
+
+	old = s->table;
+	old_size = s->mask + 1;
+
+	s->mask = 2 * old_size - 1;
+	s->table = calloc(s->mask + 1, sizeof *s->table);
+	if (s->table == NULL)
+		panic3(nm, "calloc(table) failed", strerror(errno));
+	for (i = 0;  i < old_size;  i++) {
+		if (old[i].hash == 0)
+			continue;
+		for (j = old[i].hash & s->mask;  ;  j = (j + 1) & s->mask) {
+			sp = &s->table[j];
+			if (sp->hash == 0)
+				break;
+		}
+		*sp = old[i];
+	}
+	free(old);
+}
 
 /*
  *  Invoke a callback on each element in a set.
@@ -52,8 +191,9 @@ blob_set_for_each(void *set,
 		)
 {
 	struct hash_set *s;
-	struct hash_set_element *e;
-	int status, i;
+	struct hash_set_slot *sp;
+	int status;
+	ui64 i;
 
 	s = (struct hash_set *)set;
 	s->for_each_level++;
@@ -62,18 +202,15 @@ blob_set_for_each(void *set,
 	 *  For each element, invoke the callback.
 	 */
 	status = 0;
-	for (i = 0;  i < s->size;  i++)
-		if ((e = s->table[i]))
-			while (e) {
-				if ((status = (*each_callback)(
-						e->value,
-						e->size,
+	for (i = 0;  i <= s->mask;  i++) {
+		sp = &s->table[i];
+		if (sp->hash && (status = (*each_callback)(
+						s->arena + sp->offset,
+						sp->size,
 						context_data
-				)))
-					goto bye;
-				e = e->next;
-			}
-bye:
+		)))
+			break;
+	}
 	--s->for_each_level;
 	return status;
 }
@@ -84,13 +221,22 @@ blob_set_alloc(void **set)
 	struct hash_set *s;
 	static char nm[] = "blob_set_alloc";
 
+	if (!sip_keyed)
+		sip_key();
+
 	s = malloc(sizeof *s);
 	if (s == NULL)
 		panic3(nm, "malloc(hash_set) failed", strerror(errno));
-	s->size = HASH_TABLE_SIZE;
-	s->table = calloc(s->size * sizeof *s->table, sizeof *s->table);
+	s->mask = MIN_TABLE_SIZE - 1;
+	s->count = 0;
+	s->table = calloc(MIN_TABLE_SIZE, sizeof *s->table);
 	if (s->table == NULL)
 		panic3(nm, "calloc(table) failed", strerror(errno));
+	s->arena_size = MIN_ARENA_SIZE;
+	s->arena_used = 0;
+	s->arena = malloc(s->arena_size);
+	if (s->arena == NULL)
+		panic3(nm, "malloc(arena) failed", strerror(errno));
 	s->for_each_level = 0;
 	*set = (void *)s;
 }
@@ -102,17 +248,8 @@ int
 blob_set_exists(void *set, ui8 *element, int size)
 {
 	struct hash_set *s = (struct hash_set *)set;
-	struct hash_set_element *e;
-	unsigned int hash;
-
-	hash = djb(element, size) % s->size;
-	e = s->table[hash];
-	if (e) do {
-		if (size == e->size && memcmp(e->value, element, size) == 0)
-			return 1;
-	} while ((e = e->next));
 
-	return 0;
+	return find(s, hash(element, size), element, size)->hash != 0;
 }
 
 /*
@@ -129,43 +266,40 @@ blob_set_exists(void *set, ui8 *element, int size)
 int
 blob_set_put(void *set, ui8 *element, int size)
 {
-	unsigned int hash;
 	struct hash_set *s;
-	struct hash_set_element *e, *e_new;
+	struct hash_set_slot *sp;
+	ui64 h;
 	static char nm[] = "blob_set_put";
 
 	s = (struct hash_set *)set;
 	if (s->for_each_level > 0)
 		panic2(nm, "blob_set_put() called in for each");
-	if (blob_set_exists(set, element, size))
+
+	h = hash(element, size);
+	sp = find(s, h, element, size);
+	if (sp->hash)
 		return 1;
 
 	/*
-	 *  Allocate new hash entry.
+	 *  Copy the element to the end of the arena.
 	 */
-	e_new = malloc(sizeof *e);
-	if (e_new == NULL)
-		panic3(nm, "malloc() failed", strerror(errno));
-	e_new->value = malloc(size);
-	if (e_new->value == NULL)
-		panic3(nm, "malloc(element) failed", strerror(errno));
-	memcpy(e_new->value, element, size);
-	e_new->size = size;
-	e_new->next = 0;
-	hash = djb(element, size) % s->size;
-	e_new->next = s->table[hash];
-	s->table[hash] = e_new;
-	return 0;
-}
-
-static void
-free_element(struct hash_set_element *e)
-{
-	if (e) {
-		free_element(e->next);
-		free(e->value);
-		free(e);
+	if (s->arena_used + size > s->arena_size) {
+		while (s->arena_used + size > s->arena_size)
+			s->arena_size *= 2;
+		s->arena = realloc(s->arena, s->arena_size);
+		if (s->arena == NULL)
+			panic3(nm, "realloc(arena) failed", strerror(errno));
 	}
+	memcpy(s->arena + s->arena_used, element, size);
+
+	sp->hash = h;
+	sp->offset = s->arena_used;
+	sp->size = size;
+	s->arena_used += size;
+
+	if (++s->count > (s->mask + 1) / 4 * 3)
+		grow(s);
+	return 0;
 }
 
 /*
@@ -179,10 +313,8 @@ int
 blob_set_free(void *set)
 {
 	struct hash_set *s = (struct hash_set *)set;
-	int i;
 
-	for (i = 0;  i < s->size;  i++)
-		free_element(s->table[i]);
+	free(s->arena);
 	free(s->table);
 	free(s);
 	return 0;
@@ -0,0 +1,208 @@
+/*
+ *  Synopsis:
+ *	Flood the brr logger of a running bio4d from many request processes.
+ *  Usage:
+ *	brr-flood <host> <port> <clients> <requests> [session]
+ *	BLOBIO_ROOT=/usr/local/blobio brr-flood localhost 1797 8 10000
+ *  Description:
+ *	Fork <clients> processes, each sending <requests> "eat" requests of
+ *	udigs with no blob.  The cheap "no" reply makes the blob request
+ *	record the bulk of the work, so the rate measures the brr logger
+ *	and the logger process.  Without "session", each request is a new
+ *	connection served by a new request process, as most clients do.
+ *	With "session", each client sends all requests over one connection.
+ *
+ *	When BLOBIO_ROOT is set, the records appended to spool/bio4d.brr are
+ *	counted, waiting up to 10 seconds for the logger to drain.  The
+ *	output is
+ *
+ *		requests <count> <seconds> <requests/sec>
+ *		brr <appended> of <count>
+ *  Exit Status:
+ *	0	all requests answered, all records appended
+ *	1	error
+ *	2	records missing from spool/bio4d.brr
+ *  Note:
+ *	A wrap or roll during the flood moves spool/bio4d.brr, so the count
+ *	of records is only correct on an otherwise idle server.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct addrinfo	*server;
+
+static void
+die(char *msg1, char *msg2)
+{
+	fprintf(stderr, "brr-flood: ERROR: %s: %s\n", msg1, msg2);
+	exit(1);
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		die("clock_gettime() failed", strerror(errno));
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+dial()
+{
+	int fd, on = 1;
+
+	fd = socket(server->ai_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		die("socket() failed", strerror(errno));
+	if (connect(fd, server->ai_addr, server->ai_addrlen))
+		die("connect() failed", strerror(errno));
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on))
+		die("setsockopt(TCP_NODELAY) failed", strerror(errno));
+	return fd;
+}
+
+static void
+chat(int fd, char *request, char *reply)
+{
+	char buf[16];
+	size_t len = strlen(request), rlen = strlen(reply), nread = 0;
+	ssize_t nr;
+
+	if (write(fd, request, len) != (ssize_t)len)
+		die("write(request) failed", strerror(errno));
+	while (nread < rlen) {
+		nr = read(fd, buf + nread, rlen - nread);
+		if (nr < 0 && errno == EINTR)
+			continue;
+		if (nr <= 0)
+			die("read(reply) failed", nr ? strerror(errno) : "eof");
+		nread += nr;
+	}
+	if (memcmp(buf, reply, rlen))
+		die("unexpected reply", request);
+}
+
+static void
+client(int id, long requests, int session)
+{
+	char request[128];
+	long i;
+	int fd = -1;
+
+	if (session) {
+		fd = dial();
+		chat(fd, "session\n", "ok\n");
+	}
+	for (i = 0;  i < requests;  i++) {
+		snprintf(request, sizeof request, "eat sha:%08x%032lx\n",
+								id, i);
+		if (!session)
+			fd = dial();
+		chat(fd, request, "no\n");
+		if (!session)
+			close(fd);
+	}
+	if (session)
+		close(fd);
+	exit(0);
+}
+
+static long
+brr_count(char *path)
+{
+	char buf[64 * 1024];
+	ssize_t nr, i;
+	long count = 0;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (errno == ENOENT)
+			return 0;
+		die("open(brr) failed", strerror(errno));
+	}
+	while ((nr = read(fd, buf, sizeof buf)) > 0)
+		for (i = 0;  i < nr;  i++)
+			if (buf[i] == '\n')
+				count++;
+	if (nr < 0)
+		die("read(brr) failed", strerror(errno));
+	close(fd);
+	return count;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct addrinfo hints;
+	char *root, brr_path[4096];
+	int clients, c, session = 0, status, err, wait_sec;
+	long requests, total, before = 0, appended = 0;
+	double start, elapsed;
+	pid_t pid;
+
+	if (argc < 5 || argc > 6)
+		die("usage",
+		    "brr-flood <host> <port> <clients> <requests> [session]");
+	if ((clients = atoi(argv[3])) <= 0)
+		die("clients not > 0", argv[3]);
+	if ((requests = atol(argv[4])) <= 0)
+		die("requests not > 0", argv[4]);
+	if (argc == 6) {
+		if (strcmp(argv[5], "session"))
+			die("unknown option", argv[5]);
+		session = 1;
+	}
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((err = getaddrinfo(argv[1], argv[2], &hints, &server)))
+		die("getaddrinfo() failed", (char *)gai_strerror(err));
+
+	root = getenv("BLOBIO_ROOT");
+	if (root) {
+		snprintf(brr_path, sizeof brr_path, "%s/spool/bio4d.brr", root);
+		before = brr_count(brr_path);
+	}
+	total = clients * requests;
+
+	start = now();
+	for (c = 0;  c < clients;  c++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork() failed", strerror(errno));
+		if (pid == 0)
+			client(c, requests, session);
+	}
+	for (c = 0;  c < clients;  c++) {
+		if (wait(&status) < 0)
+			die("wait() failed", strerror(errno));
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			die("client failed", "see above");
+	}
+	elapsed = now() - start;
+	printf("requests %ld %.3f %.0f\n", total, elapsed, total / elapsed);
+
+	if (!root)
+		exit(0);
+	for (wait_sec = 0;  wait_sec <= 10;  wait_sec++) {
+		appended = brr_count(brr_path) - before;
+		if (appended >= total)
+			break;
+		sleep(1);
+	}
+	printf("brr %ld of %ld\n", appended, total);
+	exit(appended == total ? 0 : 2);
+}
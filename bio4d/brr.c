@@ -11,12 +11,12 @@
  *	the wrap ought to stat the file after wrapping.
  *
  *	Ought to automatically create the spool/wrap directory.
- *
- *	Investigate possible memory leak in blob_set_free() during wrap verb.
  */
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <poll.h>
 #include <signal.h>
 #include <ctype.h>
 #include <fcntl.h>
@@ -51,7 +51,7 @@ static char	*brr_format =
  *	1	+	<tab>
  *	8+1+160 +	proto8~[[:graph:]{1,160}
  *	1	+	<tab>
- *	8	+	verb: get|put|give|take|eat|wrap|roll|cat ...
+ *	8	+	verb: get|put|give|take|eat|wrap|roll|cat|range
  *	1	+	<tab>
  *	8+1+128 +	udig: algorithm:digest
  *	8	+	chat history: ok(,ok){,2}|no|ok,no|ok,ok,no
@@ -62,6 +62,304 @@ static char	*brr_format =
  */
 #define BRR_SIZE		419		//  terminating null NOT counted
 
+/*
+ *  Bytes per coalesced write() to spool/bio4d.brr by the brr logger.
+ */
+#define BRR_WRITE_SIZE		(64 * 1024)
+
+/*
+ *  Shared memory ring of blob request records, mapped from the file
+ *  run/bio4d-brr.ring by the listener before the brr logger and request
+ *  processes fork.  Request processes append records without locking and
+ *  the brr logger drains the ring in bulk.
+ *
+ *  The ring is a bounded, multiple producer, single consumer queue.  Each
+ *  slot carries a sequence number and an owner pid.  A producer claims slot
+ *  "pos" when seq == pos by swapping its pid into the owner, then reserves
+ *  the slot by advancing the tail, publishes the record with seq = pos + 1
+ *  and the logger frees the slot for the next lap with seq = pos +
+ *  BRR_RING_SLOTS.
+ *
+ *  The logger sleeps in read() on the brr pipe.  A producer that finds the
+ *  logger asleep rings the doorbell, a one byte message on the pipe.  The
+ *  pipe still carries wrap requests and, when the ring is full, the record.
+ *
+ *  Note:
+ *	A request process killed between reserving and publishing a slot
+ *	stalls the ring, so the logger abandons such a slot after
+ *	BRR_RING_STALL seconds, but only when the owner no longer exists.
+ *	A stalled but live owner still writes the slot, so abandoning it
+ *	would let the late record overwrite the next lap.
+ *
+ *	The owner is known to be gone only when the listener reaps the pid,
+ *	since the pid may be reused as soon as it is reaped.  brr_reap()
+ *	then marks the unpublished slots of the pid as BRR_OWNER_REAPED.
+ */
+#define BRR_RING_SLOTS		4096		//  power of two
+#define BRR_RING_MAGIC		0x62727232	//  "brr2"
+#define BRR_RING_STALL		10		//  seconds
+#define BRR_RING_DOORBELL	1		//  length of doorbell message
+#define BRR_RING_SPINS		1024		//  waits on a claimed slot
+#define BRR_OWNER_REAPED	((pid_t)-1)	//  owner exited and was reaped
+
+struct brr_slot
+{
+	volatile ui64	seq;
+	volatile pid_t	owner;			//  claiming process, 0 or reaped
+	ui16		len;
+	char		record[BRR_SIZE + 1];	//  record + new-line
+};
+
+struct brr_ring
+{
+	ui32		magic;
+	ui32		slot_count;
+	volatile ui64	tail;			//  next slot to reserve
+	char		pad1[48];
+
+	volatile ui64	head;			//  next slot to drain
+	volatile ui32	sleeping;		//  logger waits on the pipe
+	char		pad2[52];
+
+	struct brr_slot	slots[BRR_RING_SLOTS];
+};
+
+static struct brr_ring	*ring = (struct brr_ring *)0;
+static char		ring_path[] = "run/bio4d-brr.ring";
+
+static void	write_records(unsigned char *records, ssize_t nrecord);
+
+/*
+ *  Has the process that claimed a slot exited?  A pid alone can not tell,
+ *  since the pid of an exited owner may belong to a new process.
+ */
+static int
+owner_gone(pid_t pid)
+{
+	return pid == 0 || pid == BRR_OWNER_REAPED;
+}
+
+/*
+ *  Append a record to the ring.  Returns 1 if appended, 0 if the ring is
+ *  full or not mapped, so the caller must send the record on the pipe.
+ */
+static int
+ring_put(char *brr, size_t len)
+{
+	struct brr_slot *slot;
+	ui64 pos, seq;
+	pid_t me, owner;
+	int spins = 0;
+	static char n[] = "ring_put";
+
+	if (ring == (struct brr_ring *)0 || len > sizeof slot->record)
+		return 0;
+	me = getpid();
+	pos = ring->tail;
+	for (;;) {
+		slot = &ring->slots[pos & (BRR_RING_SLOTS - 1)];
+		seq = slot->seq;
+		if (seq == pos) {
+			owner = slot->owner;
+			if (owner == 0) {
+				if (__sync_bool_compare_and_swap(
+						&slot->owner, 0, me)) {
+					if (__sync_bool_compare_and_swap(
+						&ring->tail, pos, pos + 1))
+						break;
+					slot->owner = 0;	//  stale pos
+				}
+			} else if (owner_gone(owner))
+				//  claimed by a process killed before reserving
+				__sync_bool_compare_and_swap(&slot->owner,
+								owner, 0);
+			else if (++spins > BRR_RING_SPINS)
+				return 0;
+		} else if ((i64)(seq - pos) < 0)
+			return 0;			//  full
+		pos = ring->tail;
+	}
+	memcpy(slot->record, brr, len);
+	slot->len = len;
+	__sync_synchronize();
+	slot->seq = pos + 1;
+	__sync_synchronize();
+
+	if (__sync_bool_compare_and_swap(&ring->sleeping, 1, 0) &&
+	    io_msg_write(log_fd, "\n", BRR_RING_DOORBELL) < 0)
+		panic3(n, "write(doorbell) failed", strerror(errno));
+	return 1;
+}
+
+/*
+ *  Is the record at the head of the ring published?
+ */
+static int
+ring_ready()
+{
+	ui64 head = ring->head;
+
+	return ring->slots[head & (BRR_RING_SLOTS - 1)].seq == head + 1;
+}
+
+/*
+ *  Move published records from the ring to records[], writing to
+ *  spool/bio4d.brr whenever records[] fills.  Returns the count of bytes
+ *  pending in records[].
+ */
+static ssize_t
+ring_drain(unsigned char *records, ssize_t nrecord)
+{
+	struct brr_slot *slot;
+	ui64 pos;
+
+	if (ring == (struct brr_ring *)0)
+		return nrecord;
+	pos = ring->head;
+	for (;;) {
+		slot = &ring->slots[pos & (BRR_RING_SLOTS - 1)];
+		if (slot->seq != pos + 1)
+			break;
+		__sync_synchronize();
+		if (nrecord + slot->len > BRR_WRITE_SIZE) {
+			write_records(records, nrecord);
+			nrecord = 0;
+		}
+		memcpy(records + nrecord, slot->record, slot->len);
+		nrecord += slot->len;
+		slot->owner = 0;
+		__sync_synchronize();
+		slot->seq = pos + BRR_RING_SLOTS;
+		pos++;
+	}
+	ring->head = pos;
+	return nrecord;
+}
+
+/*
+ *  Tell producers the logger is about to sleep on the pipe.
+ *  Returns 1 if the logger must drain the ring again instead of sleeping.
+ */
+static int
+ring_sleep(int pipe_fd)
+{
+	struct pollfd pfd;
+	int status;
+	static time_t stall_start;
+	static ui64 stall_head = (ui64)-1;
+	static int stall_warned;
+	static char n[] = "ring_sleep";
+
+	if (ring == (struct brr_ring *)0)
+		return 0;
+	ring->sleeping = 1;
+	__sync_synchronize();
+	if (ring_ready()) {
+		ring->sleeping = 0;
+		return 1;
+	}
+	if (ring->tail == ring->head)
+		return 0;
+
+	/*
+	 *  The oldest slot is reserved but not yet published, which normally
+	 *  lasts a few instructions.  Check once a second and abandon the slot
+	 *  when the producer has stalled for BRR_RING_STALL seconds and no
+	 *  longer exists.  A live producer is waited on, since it will still
+	 *  publish into the slot.
+	 */
+	pfd.fd = pipe_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	status = poll(&pfd, 1, 1000);
+	if (status < 0 && errno != EINTR)
+		panic3(n, "poll(brr pipe) failed", strerror(errno));
+	if (status > 0)
+		return 0;
+	if (stall_head != ring->head) {
+		stall_head = ring->head;
+		stall_start = time((time_t *)0);
+		stall_warned = 0;
+	} else if (time((time_t *)0) - stall_start >= BRR_RING_STALL) {
+		struct brr_slot *slot;
+		pid_t owner;
+
+		slot = &ring->slots[stall_head & (BRR_RING_SLOTS - 1)];
+		owner = slot->owner;
+		if (slot->seq != stall_head)
+			return 1;			//  published meanwhile
+		if (!owner_gone(owner)) {
+			if (!stall_warned) {
+				char buf[MSG_SIZE];
+
+				snprintf(buf, sizeof buf,
+					"brr ring stalled by unreaped process #%d",
+					(int)owner);
+				warn2(n, buf);
+				stall_warned = 1;
+			}
+			return 1;
+		}
+		error2(n, "abandoning stalled slot in brr ring");
+		slot->owner = 0;
+		__sync_synchronize();
+		slot->seq = stall_head + BRR_RING_SLOTS;
+		ring->head = stall_head + 1;
+	}
+	return 1;
+}
+
+/*
+ *  Map the ring file run/bio4d-brr.ring shared by all bio4d processes.
+ *  Records published but not drained before a crash are first appended
+ *  to spool/bio4d.brr.
+ */
+static void
+ring_open()
+{
+	int fd;
+	struct stat st;
+	ssize_t nrecord;
+	ui64 i;
+	static unsigned char records[BRR_WRITE_SIZE];
+	static char n[] = "ring_open";
+
+	fd = io_open(ring_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		panic4(n, ring_path, "open() failed", strerror(errno));
+	if (io_fstat(fd, &st))
+		panic4(n, ring_path, "fstat() failed", strerror(errno));
+	if (st.st_size != sizeof *ring && ftruncate(fd, sizeof *ring))
+		panic4(n, ring_path, "ftruncate() failed", strerror(errno));
+	ring = (struct brr_ring *)mmap(
+			(void *)0,
+			sizeof *ring,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED,
+			fd,
+			(off_t)0
+	);
+	if (ring == MAP_FAILED)
+		panic4(n, ring_path, "mmap() failed", strerror(errno));
+	if (io_close(fd))
+		panic4(n, ring_path, "close() failed", strerror(errno));
+
+	if (st.st_size == sizeof *ring && ring->magic == BRR_RING_MAGIC &&
+	    ring->slot_count == BRR_RING_SLOTS) {
+		nrecord = ring_drain(records, 0);
+		if (nrecord > 0) {
+			write_records(records, nrecord);
+			info2(n, "recovered brr records from previous ring");
+		}
+	}
+
+	memset(ring, 0, sizeof *ring);
+	for (i = 0;  i < BRR_RING_SLOTS;  i++)
+		ring->slots[i].seq = i;
+	ring->slot_count = BRR_RING_SLOTS;
+	ring->magic = BRR_RING_MAGIC;
+}
+
 /*
  *  Answer a wrap request from a child process.
  *  Move spool/bio4d.brr to spool/bio4d-<now>-seq.brr and inform the child
@@ -131,6 +429,39 @@ answer_wrap(char *reply_fifo_path)
 		panic3(n, "close(reply fifo) failed", strerror(errno));
 }
 
+/*
+ *  Write a run of coalesced blob request records to spool/bio4d.brr.
+ */
+static void
+write_records(unsigned char *records, ssize_t nrecord)
+{
+	ssize_t nwritten;
+	static char n[] = "write_records";
+
+	nwritten = io_write(log_fd, records, nrecord);
+
+	/*
+	 *  Failed writes to physical brr log file are very problematic.
+	 *  Just close down the physical file, redirect to stderr and abort.
+	 */
+	if (nwritten < 0)
+		panic4(n, "write(brr) failed", log_path, strerror(errno));
+	if (nwritten == 0)
+		panic2(n, "write(brr) empty");
+	if (nwritten != nrecord) {
+		char buf[MSG_SIZE];
+
+		snprintf(buf, sizeof buf,
+				"write(brr) too %s: %ld %c %ld",
+				nwritten > nrecord ? "big" : "short",
+				nwritten,
+				nwritten > nrecord ? '>' : '<',
+				nrecord
+		);
+		panic2(n, buf);
+	}
+}
+
 /*
  *  Respond to requests from blob request child process and log results
  *  into spool/bio4d.brr.
@@ -138,29 +469,52 @@ answer_wrap(char *reply_fifo_path)
 static void
 brr_logger(int request_fd)
 {
-	ssize_t status, nwritten, nread;
+	ssize_t status, nread;
 	static char n[] = "brr_logger";
 	struct io_message request;
+	static unsigned char records[BRR_WRITE_SIZE];
+	ssize_t nrecord = 0;
 
 	/*
-	 *  Loop reading from child processes wishing to log blob request
-	 *  records. We depend upon atomic write/reads on pipes.
+	 *  Loop draining the ring and reading from child processes wishing
+	 *  to log blob request records. We depend upon atomic write/reads on
+	 *  pipes.
 	 */
 	io_msg_new(&request, request_fd);
 request:
+	nrecord = ring_drain(records, nrecord);
+
+	/*
+	 *  Flush coalesced records before blocking on the pipe.
+	 */
+	if (!io_msg_buffered(&request)) {
+		if (nrecord > 0) {
+			write_records(records, nrecord);
+			nrecord = 0;
+		}
+		if (ring_sleep(request_fd))
+			goto request;
+	}
 	status = io_msg_read(&request);
 	if (status < 0)
 		panic3(n, "io_msg_read(request) failed", strerror(errno));
 	if (status == 0) {
 		char ebuf[MSG_SIZE];
 
+		nrecord = ring_drain(records, 0);
+		if (nrecord > 0)
+			write_records(records, nrecord);
 		info("read from client request pipe of zero bytes");
 		snprintf(ebuf, sizeof ebuf,"parent process id: #%d",getppid());
 		info(ebuf);
 		info("shutting down brr logger");
 		leave(0);
 	}
+	if (ring)
+		ring->sleeping = 0;
 	nread = request.len;
+	if (nread == BRR_RING_DOORBELL)
+		goto request;
 	/*
 	 *  Typically the blob request child sends only a full brr record,
 	 *  which is promptly written to spool/bio4d.brr. 
@@ -232,36 +586,30 @@ request:
 	 *		#
 	 */
 	if (nread == 25) {
+		/*
+		 *  Records published to the ring before the wrap request
+		 *  belong in the frozen brr log.
+		 */
+		nrecord = ring_drain(records, nrecord);
+		if (nrecord > 0) {
+			write_records(records, nrecord);
+			nrecord = 0;
+		}
 		answer_wrap((char *)request.payload);
 		goto request;
 	}
 
 	/*
-	 *  Client request wrote a simple, atomic blob request record, so just
-	 *  log that record to file spool/bio4d.brr.
-	 */
-	nwritten = io_write(log_fd, request.payload, nread);
-
-	/*
-	 *  Failed writes to physical brr log file are very problematic.
-	 *  Just close down the physical file, redirect to stderr and abort.
+	 *  Client request wrote a simple, atomic blob request record on the
+	 *  pipe, since the ring was full.  Coalesce with other records, so a
+	 *  burst of requests costs a single write to spool/bio4d.brr.
 	 */
-	if (nwritten < 0)
-		panic4(n, "write(brr) failed", log_path, strerror(errno));
-	if (nwritten == 0)
-		panic2(n, "write(brr) empty");
-	if (nwritten != nread) {
-		char buf[MSG_SIZE];
-
-		snprintf(buf, sizeof buf,
-				"write(reply fifo) too %s: %ld %c %ld",
-				nwritten > nread ? "big" : "short",
-				nwritten,
-				nwritten > nread ? '>' : '<',
-				nread
-		);
-		panic2(n, buf);
+	if (nrecord + nread > BRR_WRITE_SIZE) {
+		write_records(records, nrecord);
+		nrecord = 0;
 	}
+	memcpy(records + nrecord, request.payload, nread);
+	nrecord += nread;
 	goto request;
 }
 
@@ -328,9 +676,34 @@ brr_open()
 	 */
 	if ((log_fd = io_open_append(log_path)) < 0)
 		panic4(n, "open() failed", log_path, strerror(errno));
+	ring_open();
 	fork_brr_logger();
 }
 
+/*
+ *  Mark the slots claimed but never published by a request process just
+ *  reaped by the listener, so the slots are released instead of waiting
+ *  on a pid that may be reused.  Only slots from the head to the tail of
+ *  the ring can be unpublished.
+ */
+void
+brr_reap(pid_t pid)
+{
+	ui64 pos, tail;
+	int i;
+
+	if (ring == (struct brr_ring *)0)
+		return;
+	pos = ring->head;
+	tail = ring->tail;
+	for (i = 0;  i < BRR_RING_SLOTS && pos <= tail;  i++, pos++)
+		__sync_bool_compare_and_swap(
+			&ring->slots[pos & (BRR_RING_SLOTS - 1)].owner,
+			pid,
+			BRR_OWNER_REAPED
+		);
+}
+
 void
 brr_close()
 {
@@ -365,6 +738,8 @@ brr_close()
  *	7	"roll"
  *	8	"cat"
  *
+ *  A "range" of a blob is recorded with the bit of "get".
+ *
  *  For example, verbs that only write:
  *
  *	take,put,give,wrap,roll = 01101110 = 0x6e
@@ -382,10 +757,16 @@ brr_mask_is_set(char *verb, ui8 mask)
 		if (verb[1] == 'e')
 			return (mask & 0x01) ? 1 : 0;	//  verb "get"
 		return (mask & 0x08) ? 1 : 0;		//  verb "give"
+	case 'h':
+		return 0;				//  "have", not in brr
 	case 'p':
 		return (mask & 0x04) ? 1 : 0;		//  verb "put"
 	case 'r':
+		if (verb[1] == 'a')
+			return (mask & 0x01) ? 1 : 0;	//  verb "range"
 		return (mask & 0x40) ? 1 : 0;		//  verb "roll"
+	case 's':
+		return 0;				//  "stage", not in brr
 	case 't':
 		return (mask & 0x02) ? 1 : 0;		//  verb "take"
 	case 'w':
@@ -483,181 +864,126 @@ brr_send(struct request *r)
 	);
 
 	len = strlen(brr);
+	if (ring_put(brr, len))
+		return;
+
 	/*
-	 *  Write the entire blob request record in a single write().
+	 *  Ring is full, so write the entire blob request record in a single
+	 *  write() to the pipe.
 	 */
 	if (io_msg_write(log_fd, brr, len) < 0)
 		panic3(n, "write(log) failed", strerror(errno));
 }
 
 /*
- *  States while parsing a udig set during a roll.
+ *  Size of the buffer for reading a roll set.
  */
-#define NEW_UDIG	0
-#define IN_ALGORITHM	1
-#define IN_DIGEST	2
-#define PUT_UDIG	3
+#define ROLL_READ_SIZE		(64 * 1024)
+
+void
+udig_set_scan_init(struct udig_set_scan *sp)
+{
+	sp->len = sp->colon = 0;
+	sp->line_count = 1;
+	sp->err = (char *)0;
+}
 
 /*
- *  Parse the blob into a hash set of udigs.
- *  Duplicates are NOT allowed.
+ *  Parse the next chunk of a udig set, one udig per line, so memory is
+ *  bounded for any size of set.  Call "each" on each udig, when not null.
+ *  Return 0 when every line so far is a udig, -1 with sp->err set
+ *  otherwise.
+ *
+ *	(algorithm{1,8}:digest{1,128}\n)*
  */
-static int
-blob2udig_set(char *blob, off_t size, void **udig_set, void **algo_set)
+int
+udig_set_scan(struct udig_set_scan *sp, unsigned char *buf, int size,
+	      void (*each)(char *udig, void *context), void *context)
 {
-	char *b, *b_end;
-	char *udig_start, *digest_start;
-	void *uset = 0, *aset = 0;
-	int state;			/* parse state */
-	char *sn;			/* parse state name */
-	char ebuf[MSG_SIZE];
-	int line_count = 1;
-	int status;
-	static char n[] = "blob2udig_set";
-	static char no_graph_algo[] =
-		"non graphic character in algorithm: 0x%x: line #%d";
-	static char no_graph_dig[] =
-		"non graphic character in digest: 0x%x: line #%d";
-
-	if (size == 0)
-		panic2(n, "impossible empty blob");
-	if (blob[size - 1] != '\n') {
-		error2(n, "last character of blob is not newline");
-		return -1;
-	}
-	/*
-	 *  Allocate the udig set.
-	 */
-	blob_set_alloc(&uset);
-	/*
-	 *  Allocate the algorithm set that is derived from the
-	 */
-	blob_set_alloc(&aset);
-	b = blob;
-
-	/*
-	 *  Parse the blob for udigs that match.
-	 *
-	 *	(algorithm{1,8}:digest{28,128}\n)*
-	 */
-	state = NEW_UDIG;
-	sn = "NEW_UDIG";
-	b_end = blob + size;
-	while (b < b_end) {
-		char c = *b++;
-
-		switch (state) {
-		case NEW_UDIG:
-			if (c == '\n') {
-				snprintf(ebuf, sizeof ebuf,
-					"empty udig: line #%d", line_count);
-				error3(n, sn, ebuf);
-				goto croak;
-			}
-			if (c == ':') {
-				snprintf(ebuf, sizeof ebuf,
-				      "unexpected colon: line #%d", line_count);
-				error3(n, sn,  ebuf);
-				goto croak;
-			}
-			if ('a' <= c&&c < 'z') {
-				udig_start = b - 1;
-				state = IN_ALGORITHM;
-				sn = "IN_ALGORITHM";
-			} else if (isgraph(c)) {
-				snprintf(ebuf, sizeof ebuf,
-				       "first char is not a-z: %c: line #%d",
-					c, line_count);
-				error3(n, sn, ebuf);
-				goto croak;
-			} else {
-				snprintf(ebuf, sizeof ebuf,
-				       "non graphic character: 0x%x: line #%d",
-				       	c, line_count);
-				error3(n, sn, ebuf);
-				goto croak;
-			}
-			break;
-		case IN_ALGORITHM:
-			if (b - udig_start > MAX_ALGORITHM_SIZE) {
-				snprintf(ebuf, sizeof ebuf,
-						"algorithm too long: line #%d",
-						line_count);
-				error3(n, sn, ebuf);
-				goto croak;
-			}
-			if (c == ':') {
-				state = IN_DIGEST;
-				digest_start = b + 1;
-				sn = "IN_DIGEST";
-			} else if (!isgraph(c)) {
-				snprintf(ebuf, sizeof ebuf, no_graph_algo,
-								c, line_count);
-				error3(n, sn, ebuf);
+	unsigned char *b, *b_end, c;
+	char *err = 0;
+
+	for (b = buf, b_end = buf + size;  b < b_end;  b++) {
+		c = *b;
+		if (c == '\n') {
+			if (sp->len == 0)
+				err = "empty udig";
+			else if (sp->colon == 0)
+				err = "no colon in udig";
+			else if (sp->colon == sp->len - 1)
+				err = "empty digest";
+			if (err)
 				goto croak;
-			}
-			break;
-		case IN_DIGEST:
-			if (digest_start - udig_start > MAX_DIGEST_SIZE) {
-				snprintf(ebuf, sizeof ebuf,
-						"digest too long: line #%d",
-						line_count);
-				error3(n, sn, ebuf);
-				goto croak;
-			}
-			if (c == '\n') {	/* new line terminating udig */
-				line_count++;
-				*--b = 0;
-				state = PUT_UDIG;
-				sn = "PUT_UDIG";
-			} else if (!isgraph(c)) {
-				snprintf(ebuf, sizeof ebuf, no_graph_dig,
-								c, line_count);
-				error3(n, sn, ebuf);
-				goto croak;
-			}
-			break;
-		case PUT_UDIG:
-			/*
-			 *  Verify the udig is unique in the set.
-			 */
-			status = blob_set_put(uset, (unsigned char *)udig_start,
-							b - udig_start - 1);
-			if (status == 1) {
-				*b = 0;
-				error3(n, "duplicate udig in set", udig_start);
-				goto croak;
-			}
-
-			/*
-			 *  Record the algorithm.
-			 */
-			(void)blob_set_put(aset, (unsigned char *)udig_start,
-						(digest_start - udig_start -2));
-			state = NEW_UDIG;
-			sn = "NEW_UDIG";
-			break;
-		default:
-			panic3(n, sn, "impossible state");
+			sp->udig[sp->len] = 0;
+			if (each)
+				(*each)(sp->udig, context);
+			sp->line_count++;
+			sp->len = sp->colon = 0;
+			continue;
 		}
+		if (sp->len == 0 && (c < 'a' || c > 'z'))
+			err = "first char is not a-z";
+		else if (!isgraph(c))
+			err = "non graphic character";
+		else if (sp->colon == 0 && c == ':')
+			sp->colon = sp->len;
+		else if (sp->colon == 0 && sp->len == MAX_ALGORITHM_SIZE)
+			err = "algorithm too long";
+		else if (sp->len == MAX_UDIG_SIZE)
+			err = "digest too long";
+		if (err)
+			goto croak;
+		sp->udig[sp->len++] = c;
 	}
-	if (state != NEW_UDIG)
-		panic3(n, "unexpected state at end of parse",
-			state == IN_ALGORITHM ? "IN_ALGORITHM" :
-			(state == IN_DIGEST ? "IN_DIGEST" :
-			 (state == PUT_UDIG ? "PUT_UDIG" : "UNKNOWN")
-			)
-		);
+	return 0;
+croak:
+	sp->err = err;
+	return -1;
+}
+
+/*
+ *  The set ended, so verify the last udig ended with a new-line.
+ */
+int
+udig_set_scan_end(struct udig_set_scan *sp)
+{
+	if (sp->len == 0)
+		return 0;
+	sp->err = "last character of blob is not newline";
+	return -1;
+}
 
-	*udig_set = uset;
-	*algo_set = aset;
+/*
+ *  Parse a udig set, reading the temporary copy of the blob in chunks,
+ *  for "roll" and "cat".  Call "each" on each udig, when not null.  Return
+ *  0 when every line is a udig, -1 otherwise.
+ */
+int
+udig_set_each(int fd, char *path, void (*each)(char *udig, void *context),
+	      void *context)
+{
+	static unsigned char buf[ROLL_READ_SIZE];
+	struct udig_set_scan scan;
+	char ebuf[MSG_SIZE];
+	int nread;
+	static char n[] = "udig_set_each";
+
+	if (io_lseek(fd, (off_t)0, SEEK_SET))
+		panic4(n, path, "lseek(udig set) failed", strerror(errno));
+
+	udig_set_scan_init(&scan);
+	while ((nread = io_read(fd, buf, sizeof buf)) > 0)
+		if (udig_set_scan(&scan, buf, nread, each, context))
+			goto croak;
+	if (nread < 0)
+		panic4(n, path, "read(udig set) failed", strerror(errno));
+	if (udig_set_scan_end(&scan))
+		goto croak;
 	return 0;
 croak:
-	status = -1;
-	if (uset)
-		blob_set_free(uset);
-	if (aset)
-		blob_set_free(aset);
+	snprintf(ebuf, sizeof ebuf, "%s: line #%d", scan.err,
+							scan.line_count);
+	error2(n, ebuf);
 	return -1;
 }
 
@@ -694,6 +1020,46 @@ extract_wrap_udig(char *name, char *udig)
 	return mp->is_digest(udig + (colon - name) + 1) > 0  ? 0 : -1;
 }
 
+struct roll_context
+{
+	void	*wrap_set;		//  udigs of brr logs in spool/wrap
+	void	*rolled_set;		//  udigs of brr logs removed
+	int	roll_file_count;
+};
+
+/*
+ *  Remove the brr log of a udig in the roll set, if in spool/wrap.
+ */
+static void
+roll_udig(char *udig, void *context)
+{
+	struct roll_context *rc = (struct roll_context *)context;
+	char path[MAX_FILE_PATH_LEN];
+	int len = strlen(udig);
+	static char n[] = "roll_udig";
+
+	if (!blob_set_exists(rc->wrap_set, (ui8 *)udig, len))
+		return;
+	if (blob_set_put(rc->rolled_set, (ui8 *)udig, len))
+		return;				//  duplicate udig in roll set
+
+	path[0] = 0;
+	jmscott_strcat3(path, sizeof path, "spool/wrap/", udig, ".brr");
+
+	/*
+	 *  What about verifying the existence of the blob?
+	 */
+	if (io_unlink(path)) {
+		//  simultaneous rolls are ok
+		if (errno == ENOENT)
+			warn3(n, "brr file disappeared (ok)", path);
+		else
+			panic4(n, path, "unlink(roll brr) failed",
+						strerror(errno));
+	}
+	rc->roll_file_count++;
+}
+
 /*
  *  Synopsis:
  *	Roll up brr logs in udig set referenced by "roll udig".
@@ -711,9 +1077,8 @@ roll(struct request *r, struct digest_module *mp)
 	char roll_path[MAX_FILE_PATH_LEN + 1];
 	int roll_fd;
 	struct stat st;
-	char *blob, *b, *b_start, *b_end;
-	void *udig_set = 0, *algo_set = 0;
-	int roll_file_count;
+	struct roll_context rc;
+	int wrap_file_count;
 	DIR *dirp;
 	struct dirent *dp;
 	int err;
@@ -763,21 +1128,13 @@ roll(struct request *r, struct digest_module *mp)
 		return -1;
 	}
 
-	/*
-	 *  Seek to begining of roll list.
-	 */
-	if (io_lseek(roll_fd, (off_t)0, SEEK_SET))
-		panic3(n, "lseek(roll set failed", strerror(errno));
-	/*
-	 *  How much ram do we need to store the blob in memory?
-	 *
-	 *  Note: since we've already stored the blob on the file system, then
-	 *        why not just reference that blob directly via mmap()?
-	 */
 	if (io_fstat(roll_fd, &st))
 		panic4(n, roll_path, "fstat() failed", strerror(errno));
 	if (st.st_size == 0) {
 		warn4(n, "empty blob", r->algorithm, r->digest);
+		if (io_close(roll_fd))
+			panic4(n, roll_path, "close(roll set) failed",
+							strerror(errno));
 		if (write_ok(r)) {
 			error3(n, r->algorithm, "write_ok(client) failed");
 			return -1;
@@ -786,47 +1143,18 @@ roll(struct request *r, struct digest_module *mp)
 	}
 
 	/*
-	 *  Allocate enough memory for udig list.
-	 *  Need make sure the blob is not too big.
-	 */
-	blob = (char *)malloc(st.st_size);
-	if (blob == NULL) {
-		char buf[MSG_SIZE];
-
-		int e = errno;
-
-		snprintf(buf, sizeof buf, "roll set malloc(%lu) failed",
-						(unsigned long)st.st_size); 
-		panic3(n, buf, strerror(e));
-	}
-
-	/*
-	 *  Slurp up the blob into memory.
-	 */
-	b = b_start = blob;
-	b_end = blob + st.st_size;
-	while (b < b_end) {
-		int nread = io_read(roll_fd, (unsigned char*)b, b_end - b);
-		if (nread < 0)
-			panic3(n, "read(roll set) failed", strerror(errno));
-		if (nread == 0)
-			panic2(n, "read(roll set) unexpected end of file");
-		b += nread;
-	}
-	if (io_close(roll_fd))
-		panic4(n, roll_path, "close(roll set) failed",strerror(errno));
-
-	/*
-	 *  Parse the blob into a udig hash set.
+	 *  Verify the whole blob is a udig set before removing any brr log.
 	 */
-	err = blob2udig_set(blob, st.st_size, &udig_set, &algo_set);
-	free(blob);
-	if (err < 0) {
+	if (udig_set_each(roll_fd, roll_path,
+			(void (*)(char *, void *))0, (void *)0)) {
 		char buf[MSG_SIZE];
 
 		snprintf(buf, sizeof buf, "%s: blob not udig set: %s:%s",
 						n, r->algorithm, r->digest);
 		warn(buf);
+		if (io_close(roll_fd))
+			panic4(n, roll_path, "close(roll set) failed",
+							strerror(errno));
 		if (write_no(r)) {
 			error2(n, "reply: write_no() failed");
 			return -1;
@@ -835,17 +1163,15 @@ roll(struct request *r, struct digest_module *mp)
 	}
 
 	/*
-	 *  Scan the spool/wrap directory for brr logs to remove.
+	 *  Index the brr logs in spool/wrap, a set far smaller than the
+	 *  roll set.
 	 */
 	dirp = io_opendir("spool/wrap");
 	if (dirp == NULL)
 		panic3(n, "opendir(spool/wrap) failed", strerror(errno));
+	blob_set_alloc(&rc.wrap_set);
+	wrap_file_count = 0;
 	errno = 0;
-	roll_file_count = 0;
-
-	/*
-	 *  Loop through spool/wrap/ adding udigs to the temporary wrap set.
-	 */
 	while ((dp = io_readdir(dirp))) {
 	 	char *n = dp->d_name;
 		char udig[MAX_UDIG_SIZE + 1];
@@ -860,39 +1186,36 @@ roll(struct request *r, struct digest_module *mp)
 			warn3(n, "file in spool wrap is not log file", n);
 			continue;
 		}
-		if (blob_set_exists(udig_set, (ui8 *)udig, strlen(udig))) {
-
-			char path[MAX_FILE_PATH_LEN];
-
-			path[0] = 0;
-			jmscott_strcat2(path, sizeof path, "spool/wrap/", n);
-
-			/*
-			 *  What about verifying the existence of the blob?
-			 */
-			if (io_unlink(path)) {
-				//  simultaneous rolls are ok
-				if (errno == ENOENT)
-					warn3(n, "brr file disappeared (ok)",n);
-				else
-					panic4(n, n, "unlink(roll brr) failed",
-							strerror(errno));
-			}
-			roll_file_count++;
-		}
+		blob_set_put(rc.wrap_set, (ui8 *)udig, strlen(udig));
+		wrap_file_count++;
 	}
 	if (errno && errno != ENOENT)
 		panic3(n, "readdir(spool/wrap) failed", strerror(errno));
 	if (io_closedir(dirp))
 		panic3(n, "close(spool/wrap) failed", strerror(errno));
 
-	if (roll_file_count > 0) {
+	/*
+	 *  Stream the roll set again, removing the brr logs in the set.
+	 */
+	blob_set_alloc(&rc.rolled_set);
+	rc.roll_file_count = 0;
+	if (wrap_file_count > 0 &&
+	    udig_set_each(roll_fd, roll_path, roll_udig, (void *)&rc))
+		panic2(n, "roll set changed between parses");
+	if (io_close(roll_fd))
+		panic4(n, roll_path, "close(roll set) failed", strerror(errno));
+
+	//  a prefork worker lives on, so free the sets
+	blob_set_free(rc.wrap_set);
+	blob_set_free(rc.rolled_set);
+
+	if (rc.roll_file_count > 0) {
 		char buf[MSG_SIZE];
 
 		snprintf(buf, sizeof buf,
 			"removed %u brr log file%s in roll set",
-			roll_file_count,
-			roll_file_count == 1 ? "" : "s"
+			rc.roll_file_count,
+			rc.roll_file_count == 1 ? "" : "s"
 		);
 		info2(n, buf);
 	} else
@@ -901,6 +1224,12 @@ roll(struct request *r, struct digest_module *mp)
 		error2(n, "reply: write_ok() failed");
 		return -1;
 	}
+
+	/*
+	 *  The client has its answer, so reclaim the dead bytes left in
+	 *  pack segments by takes.
+	 */
+	pack_compact();
 	return 0;
 }
 
@@ -0,0 +1,371 @@
+/*
+ *  Synopsis:
+ *	In memory index of blobs existing in data/fs_*, to answer "no" quickly.
+ *  Description:
+ *	A bloom filter of the digests of every blob file in data/fs_* is built
+ *	by the listener at boot and shared with all request processes through
+ *	an anonymous, shared mapping.  A get, eat or take of a digest not in
+ *	the filter is answered "no" without touching the file system, saving
+ *	the path build and the failed open() or stat() of a miss.  A digest
+ *	in the filter may still be a false positive, so the file system
+ *	always has the final word on a hit.
+ *
+ *	The arborist process adds the digest of each new blob before renaming
+ *	the blob into place, so a reader never sees a blob file missing from
+ *	the filter.  Since the arborist serializes all renames, it also keeps
+ *	an exact count of the distinct blobs, reported in the heartbeat.
+ *	Blobs packed in data/pack are added by pack_put().
+ *
+ *	The index is enabled with --exist-index true.
+ *  Note:
+ *	A bloom filter can not forget, so taken blobs stay in the filter till
+ *	the next boot, costing only a wasted lookup.
+ *
+ *	Blob files created in data/fs_* by other than bio4d are invisible till
+ *	the next boot.  Do not enable the index when blobs are restored or
+ *	copied into data/ behind the back of bio4d.
+ */
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "bio4d.h"
+
+/*
+ *  Bits per expected blob, which, with 7 probes, yields a false positive
+ *  rate near 1%.  The filter is sized for twice the blobs counted at boot.
+ */
+#define BITS_PER_BLOB		10
+#define PROBE_COUNT		7
+#define MIN_BLOB_COUNT		(256 * 1024)
+
+struct exist_index
+{
+	ui64	bit_mask;		//  bit count - 1, a power of two
+
+	ui64	blob_count;		//  distinct blobs in data/fs_*
+	ui64	lookup_count;		//  get/eat/take probes of index
+	ui64	miss_count;		//  "no" answered without file system
+
+	ui64	bits[];
+};
+
+int				exist_index = -1;
+
+static struct exist_index	*filter = (struct exist_index *)0;
+
+/*
+ *  The digest is the hex of a cryptographic hash, so the first 16 hex
+ *  characters are already uniformly distributed and serve as two 32 bit
+ *  hashes for the double hashing of the probes.
+ *
+ *  Returns 0 when the digest has too few hex characters to hash.
+ */
+static int
+digest_hash(char *digest, ui32 *h1, ui32 *h2)
+{
+	ui64 h = 0;
+	int i;
+	char c;
+
+	for (i = 0;  i < 16;  i++) {
+		c = digest[i];
+		if (c >= '0' && c <= '9')
+			h = (h << 4) | (c - '0');
+		else if (c >= 'a' && c <= 'f')
+			h = (h << 4) | (c - 'a' + 10);
+		else
+			return 0;
+	}
+	*h1 = (ui32)h;
+	*h2 = (ui32)(h >> 32) | 1;
+	return 1;
+}
+
+static void
+add(char *digest)
+{
+	ui32 h1, h2;
+	ui64 bit;
+	int i;
+
+	if (!digest_hash(digest, &h1, &h2))
+		return;
+	for (i = 0;  i < PROBE_COUNT;  i++) {
+		bit = (h1 + (ui64)i * h2) & filter->bit_mask;
+		__sync_fetch_and_or(&filter->bits[bit >> 6],
+						1ULL << (bit & 63));
+	}
+}
+
+static void
+add_packed(char *algorithm, char *digest)
+{
+	(void)algorithm;
+	add(digest);
+}
+
+static int
+maybe(char *digest)
+{
+	ui32 h1, h2;
+	ui64 bit;
+	int i;
+
+	if (!digest_hash(digest, &h1, &h2))
+		return 1;
+	for (i = 0;  i < PROBE_COUNT;  i++) {
+		bit = (h1 + (ui64)i * h2) & filter->bit_mask;
+		if ((filter->bits[bit >> 6] & (1ULL << (bit & 63))) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ *  Walk the blob files in data/fs_<algo>/<hex dir> .../<digest>, either
+ *  counting or adding to the filter.  The walk follows any directory
+ *  layout, including both layouts during a migration.
+ */
+static ui64
+scan(char *path, int depth)
+{
+	DIR *dirp;
+	struct dirent *dp;
+	struct stat st;
+	char *n, sub_path[MAX_FILE_PATH_LEN];
+	ui64 count = 0;
+	int is_dir;
+	static char nm[] = "exist_scan";
+
+	dirp = io_opendir(path);
+	if (dirp == (DIR *)0)
+		panic4(nm, "opendir() failed", path, strerror(errno));
+	//  reset errno before each readdir() to detect an error at the end
+
+	for (errno = 0;  (dp = io_readdir(dirp));  errno = 0) {
+		n = dp->d_name;
+		if (n[0] == '.')
+			continue;
+		if (depth == 0 && strncmp(n, "fs_", 3))
+			continue;
+		if (snprintf(sub_path, sizeof sub_path, "%s/%s", path, n) >=
+		    (int)sizeof sub_path)
+			panic4(nm, "path too long", path, n);
+		if (dp->d_type == DT_UNKNOWN) {
+			if (io_lstat(sub_path, &st))
+				panic4(nm, "lstat() failed", sub_path,
+							strerror(errno));
+			is_dir = S_ISDIR(st.st_mode);
+		} else
+			is_dir = dp->d_type == DT_DIR;
+		if (is_dir) {
+			count += scan(sub_path, depth + 1);
+			continue;
+		}
+
+		//  skip data/fs_<algo>/layout
+
+		if (depth < 2)
+			continue;
+		if (filter)
+			add(n);
+		count++;
+	}
+	if (errno)
+		panic4(nm, "readdir() failed", path, strerror(errno));
+	if (io_closedir(dirp))
+		panic4(nm, "closedir() failed", path, strerror(errno));
+	return count;
+}
+
+/*
+ *  Bound the count of blob files by the inodes in use on the file systems
+ *  holding data/fs_*, so the filter is sized without walking the tree.
+ *  Returns 0 when a file system does not count inodes, as btrfs does not.
+ */
+static ui64
+inode_count()
+{
+	DIR *dirp;
+	struct dirent *dp;
+	struct stat st;
+	struct statvfs vfs;
+	dev_t dev[16];
+	char path[5 + NAME_MAX + 1];
+	int dev_count = 0, i;
+	ui64 count = 0;
+	static char nm[] = "exist_inode_count";
+
+	dirp = io_opendir("data");
+	if (dirp == (DIR *)0)
+		panic4(nm, "opendir() failed", "data", strerror(errno));
+	for (errno = 0;  (dp = io_readdir(dirp));  errno = 0) {
+		if (strncmp(dp->d_name, "fs_", 3))
+			continue;
+		if (snprintf(path, sizeof path, "data/%s", dp->d_name) >=
+		    (int)sizeof path)
+			panic4(nm, "path too long", "data", dp->d_name);
+		if (io_stat(path, &st))
+			panic4(nm, "stat() failed", path, strerror(errno));
+		for (i = 0;  i < dev_count && dev[i] != st.st_dev;  i++)
+			;
+		if (i < dev_count)
+			continue;
+		if (statvfs(path, &vfs))
+			panic4(nm, "statvfs() failed", path, strerror(errno));
+		if (vfs.f_files == 0 || dev_count == 16) {
+			count = 0;
+			break;
+		}
+		dev[dev_count++] = st.st_dev;
+		count += vfs.f_files - vfs.f_ffree;
+	}
+	if (errno)
+		panic4(nm, "readdir() failed", "data", strerror(errno));
+	if (io_closedir(dirp))
+		panic4(nm, "closedir() failed", "data", strerror(errno));
+	return count;
+}
+
+/*
+ *  Build the index of blobs in data/fs_*.  Called by the listener before
+ *  forking any process.
+ *
+ *  The filter is sized from the inodes in use, so a single walk of the
+ *  tree fills the filter.  Only when the file system does not count
+ *  inodes is the tree walked twice, first to count the blobs.
+ */
+void
+exist_open()
+{
+	ui64 blob_count, bit_count;
+	size_t size;
+	time_t start;
+	char buf[MSG_SIZE];
+	static char n[] = "exist_open";
+
+	if (exist_index != 1) {
+		info2(n, "existence index disabled");
+		return;
+	}
+
+	start = time((time_t *)0);
+	blob_count = inode_count();
+	if (blob_count == 0)
+		blob_count = scan("data", 0);
+	blob_count += pack_each((void (*)(char *, char *))0);
+
+	bit_count = 64;
+	while (bit_count < 2 * BITS_PER_BLOB *
+	       (blob_count > MIN_BLOB_COUNT ? blob_count : MIN_BLOB_COUNT))
+		bit_count <<= 1;
+	size = sizeof *filter + bit_count / 8;
+
+	filter = (struct exist_index *)mmap(
+			(void *)0,
+			size,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANON,
+			-1,
+			(off_t)0
+	);
+	if (filter == MAP_FAILED)
+		panic3(n, "mmap(filter) failed", strerror(errno));
+	filter->bit_mask = bit_count - 1;
+
+	filter->blob_count = scan("data", 0) + pack_each(add_packed);
+
+	snprintf(buf, sizeof buf,
+		"indexed %llu blobs in %ld sec, %llu KB filter",
+			filter->blob_count,
+			(long)(time((time_t *)0) - start),
+			(ui64)(size / 1024)
+	);
+	info2(n, buf);
+	if (filter->blob_count > blob_count)
+		warn2(n, "more blobs than inodes counted, so more false hits");
+}
+
+/*
+ *  Might a blob with the digest exist?  Returns 0 only when the blob
+ *  is certainly not in data/fs_*.
+ */
+int
+exist_maybe(char *digest)
+{
+	if (filter == (struct exist_index *)0)
+		return 1;
+	__sync_fetch_and_add(&filter->lookup_count, 1);
+	if (maybe(digest))
+		return 1;
+	__sync_fetch_and_add(&filter->miss_count, 1);
+	return 0;
+}
+
+/*
+ *  Add the blob about to be renamed to blob_path by the arborist.
+ *  Returns 1 if no blob file exists yet at blob_path, so the caller can
+ *  count the blob after the rename succeeds.
+ */
+int
+exist_put(char *blob_path)
+{
+	char *digest;
+	int status;
+
+	if (filter == (struct exist_index *)0)
+		return 0;
+	digest = rindex(blob_path, '/');
+	digest = digest ? digest + 1 : blob_path;
+	if (!maybe(digest)) {
+		add(digest);
+		return 1;
+	}
+	status = io_path_exists(blob_path);
+	if (status < 0)
+		panic4("exist_put", "stat(blob) failed", blob_path,
+							strerror(errno));
+	return status == 0;
+}
+
+/*
+ *  Adjust the count of distinct blobs after a new blob or a take.
+ */
+void
+exist_count(int delta)
+{
+	if (filter)
+		__sync_fetch_and_add(&filter->blob_count, delta);
+}
+
+/*
+ *  Add a blob about to be packed by pack_put(), which counts the blob
+ *  once packed.
+ */
+void
+exist_packed(char *digest)
+{
+	if (filter)
+		add(digest);
+}
+
+/*
+ *  Log the distinct blob count and lookups in the heartbeat.
+ */
+void
+exist_heartbeat()
+{
+	char buf[MSG_SIZE];
+
+	if (filter == (struct exist_index *)0)
+		return;
+	snprintf(buf, sizeof buf,
+		"exist: blobs=%llu, lookup=%llu, no=%llu",
+			filter->blob_count,
+			filter->lookup_count,
+			filter->miss_count
+	);
+	info(buf);
+}
@@ -24,23 +24,16 @@
 #include <ctype.h>
 
 #include "openssl/opensslv.h"
-#include "openssl/sha.h"
-#include "openssl/ripemd.h"
 #include "bio4d.h"
 
-/*
- *  How many bytes to read and write the blobs from either client or fs.
- */
-#define CHUNK_SIZE		(4 * 1024)
-
 static char	fs_btc20_root[]	= "data/fs_btc20";
 static char	empty_ascii[]	= "fd7b15dc5dc2039556693555c2b81b36c8deec15";
 
 typedef struct
 {
-	SHA256_CTX	sha256;
-	SHA256_CTX	sha256_sha256;
-	RIPEMD160_CTX	ripemd160;
+	struct hash	sha256;
+	struct hash	sha256_sha256;
+	struct hash	ripemd160;
 } BTC20_CTX;
 
 struct fs_btc20_request
@@ -53,13 +46,45 @@ struct fs_btc20_request
 	char		blob_path[MAX_FILE_PATH_LEN];
 	unsigned char	digest[20];
 	int		blob_fd;
+	int		packed;		//  blob_fd is the segment of a packed blob
+	i64		packed_offset;	//  first byte of packed blob in segment
+	i64		packed_size;
+	i64		packed_left;	//  bytes of packed blob after blob_fd
+	struct io_map	map;		//  mapping of a large blob_fd
+	int		verified;	//  digest verified before "ok"
+	BTC20_CTX	ctx;		//  running digest of the blob
+	BTC20_CTX	copy;		//  copy finalized by eat_chunk()
+	unsigned char	*chunk;		//  chunk_size bytes, follows struct
 };
 
 static struct fs_btc20_boot
 {
 	char		root_dir_path[MAX_FILE_PATH_LEN];
+	struct blob_layout *layout;
 } boot_data;
 
+/*
+ *  Hash contexts of the last request closed, handed to the next request
+ *  opened, so a worker allocates them once.
+ */
+static BTC20_CTX	spare_ctx, spare_copy;
+
+static void
+ctx_swap(BTC20_CTX *a, BTC20_CTX *b)
+{
+	hash_swap(&a->sha256, &b->sha256);
+	hash_swap(&a->sha256_sha256, &b->sha256_sha256);
+	hash_swap(&a->ripemd160, &b->ripemd160);
+}
+
+static void
+ctx_free(BTC20_CTX *c)
+{
+	hash_free(&c->sha256);
+	hash_free(&c->sha256_sha256);
+	hash_free(&c->ripemd160);
+}
+
 static char nib2hex[] =
 {
 	'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
@@ -209,11 +234,14 @@ fs_btc20_open(struct request *r)
 	struct fs_btc20_request *s;
 
 	//  why malloc()?
-	s = (struct fs_btc20_request *)malloc(sizeof *s);
+	s = (struct fs_btc20_request *)malloc(sizeof *s + chunk_size);
 	if (s == NULL)
 		_panic2(r, "malloc(fs_btc20_request) failed", strerror(errno));
 	memset(s, 0, sizeof *s);
 	s->blob_fd = -1;
+	s->chunk = (unsigned char *)(s + 1);
+	ctx_swap(&s->ctx, &spare_ctx);
+	ctx_swap(&s->copy, &spare_copy);
 	if (strcmp("wrap", r->verb))
 		nib2digest(r->digest, s->digest);
 	r->open_data = (void *)s;
@@ -224,37 +252,11 @@ fs_btc20_open(struct request *r)
 static int
 _unlink(struct request *r, char *path, int *exists)
 {
-	if (io_unlink(path)) {
+	if (layout_unlink_blob(boot_data.layout, path, exists)) {
 		char buf[MSG_SIZE];
-		int err = errno;
 
-		if (err == ENOENT) { 
-			if (exists)
-				*exists = 0;
-			return 0;
-		}
 		snprintf(buf, sizeof buf, "unlink(%s) failed", path);
-		_panic2(r, buf, strerror(err));
-	}
-	if (exists)
-		*exists = 1;
-	return 0;
-}
-
-/*
- *  Do a hard delete of a corrupted blob.
- *  Calling zap blob indicates a panicy situation with the server.
- *  Eventually will want to remove an empty, enclosing directory.
- */
-static int
-zap_blob(struct request *r)
-{
-	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
-	int exists = 0;
-
-	if (_unlink(r, s->blob_path, &exists)) {
-		_panic(r, "zap_blob: _unlink() failed");
-		return -1;
+		_panic2(r, buf, strerror(errno));
 	}
 	return 0;
 }
@@ -284,6 +286,45 @@ _read(struct request *r, int fd, unsigned char *buf, int buf_size)
 	return buf_size;
 }
 
+/*
+ *  Get the next chunk of the open blob, either a window of the mapped blob
+ *  file or a chunk read into the request buffer.
+ */
+static int
+_next(struct request *r, unsigned char **p_chunk)
+{
+	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
+	int nread, size = chunk_size;
+
+	if (s->packed) {
+		if (s->packed_left < size)
+			size = s->packed_left;
+	} else if ((nread = io_map_read(&s->map, s->blob_fd, p_chunk)) >= 0)
+		return nread;
+	*p_chunk = s->chunk;
+	nread = _read(r, s->blob_fd, s->chunk, size);
+	if (s->packed && nread > 0)
+		s->packed_left -= nread;
+	return nread;
+}
+
+/*
+ *  Position the open blob at offset, past the start of a packed blob in
+ *  its segment.
+ */
+static void
+_seek(struct request *r, i64 offset)
+{
+	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
+
+	if (s->packed) {
+		s->packed_left = s->packed_size - offset;
+		offset += s->packed_offset;
+	}
+	if (io_lseek(s->blob_fd, (off_t)offset, SEEK_SET) < 0)
+		_panic2(r, "lseek(blob) failed", strerror(errno));
+}
+
 static int
 _close(struct request *r, int *p_fd)
 {
@@ -305,7 +346,7 @@ _open(struct request *r, char *path, int *p_fd)
 {
 	int fd;
 
-	if ((fd = io_open(path, O_RDONLY, 0)) < 0) {
+	if ((fd = layout_open_blob(boot_data.layout, path)) < 0) {
 		char buf[MSG_SIZE];
 
 		if (errno == ENOENT)
@@ -372,64 +413,192 @@ static void
 make_path(struct request *r, char *digest)
 {
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
-	char *p, *q;
 
 	/*
-	 *  Derive a path to the blob from the digest.
-	 *  Each directory component in the path doubles the
-	 *  length of it's parent component.  For example, given
-	 *  the digest
+	 *  Derive a path to the blob from the digest, per the directory
+	 *  layout in data/fs_btc20/layout.  For example, given the digest
 	 *
 	 *	57cd5957fbc764c5ee9862f76287d09d2170b9ef
 	 *
-	 *  we derive the path to the blob file as
+	 *  the classic layout derives the path to the blob file as
 	 *
 	 *	57c/d59/57cd5957fbc764c5ee9862f76287d09d2170b9ef
 	 */
-	strcpy(s->blob_dir_path, boot_data.root_dir_path);
-	p = s->blob_dir_path + strlen(s->blob_dir_path);
-	q = digest;
+	layout_path(boot_data.layout, digest, s->blob_dir_path, s->blob_path);
+}
 
-	/*
-	 *   Build the directory path to the blob.
-	 */
+/*
+ *  Unlink the file of the open blob.  When the file is gone, the layout
+ *  migrator may have moved the blob into the current layout since the
+ *  open, so unlink the blob there.
+ */
+static int
+_unlink_blob(struct request *r, int *exists)
+{
+	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
+	char path[MAX_FILE_PATH_LEN];
 
-	 /*
-	  *  Directory 1:
-	  *	Three characters /[0-9a-f][0-9a-f][0-9a-f]
-	  */
-	*p++ = '/';
-	*p++ = *q++;
-	*p++ = *q++;
-	*p++ = *q++;
+	if (_unlink(r, s->blob_path, exists))
+		return -1;
+	if (*exists)
+		return 0;
+	strcpy(path, s->blob_path);
+	make_path(r, r->digest);
+	if (strcmp(path, s->blob_path) == 0)
+		return 0;
+	return _unlink(r, s->blob_path, exists);
+}
+
+/*
+ *  Do a hard delete of a corrupted blob.
+ *  Calling zap blob indicates a panicy situation with the server.
+ *  Eventually will want to remove an empty, enclosing directory.
+ */
+static int
+zap_blob(struct request *r)
+{
+	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
+	int exists = 0;
+
+	if (s->packed) {
+		pack_take(r->algorithm, r->digest);
+		return 0;
+	}
+	if (_unlink_blob(r, &exists)) {
+		_panic(r, "zap_blob: _unlink_blob() failed");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  Open the blob, either packed or the blob file, probing the previous
+ *  directory layout while the migration of the layout is in progress.
+ */
+static int
+_open_blob(struct request *r)
+{
+	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
+	int status, probe = 0;
+
+	s->blob_fd = pack_open_blob(r->algorithm, r->digest,
+							&s->packed_offset,
+							&s->packed_size);
+	if (s->blob_fd >= 0) {
+		s->packed = 1;
+		s->packed_left = s->packed_size;
+		return 0;
+	}
+	make_path(r, r->digest);
+	while ((status = _open(r, s->blob_path, &s->blob_fd)) == ENOENT &&
+	       layout_probe(boot_data.layout, probe++, r->digest,
+					s->blob_dir_path, s->blob_path))
+		;
+	return status;
+}
 
+/*
+ *  Digest the open blob, returning 0 when the digest matches the udig.
+ */
+static int
+_verify(struct request *r)
+{
+	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
+	unsigned char digest[20];
+	unsigned char sha_digest[32];
+	unsigned char sha_sha_digest[32];
+	unsigned char *chunk = s->chunk;
+	int nread;
+
+	if (!hash_init(&s->ctx.sha256, HASH_SHA256))
+		_panic(r, "hash_init(, HASH_SHA256) failed");
+
+	/*
+	 *  Read a chunk from the file and chew.
+	 */
+	while ((nread = _next(r, &chunk)) > 0)
+		/*
+		 *  Update the incremental digest.
+		 */
+		if (!hash_update(&s->ctx.sha256, chunk, nread))
+			_panic(r, "SHA256_Update(read) failed");
+	if (nread < 0)
+		_panic(r, "_read(blob) failed");
 	/*
-	 *  Directory 2:
-	 *	3 Characters: /[0-9a-f][0-9a-f]
+	 *  Finalize the digest.
 	 */
-	*p++ = '/';
-	*p++ = *q++;
-	*p++ = *q++;
-	*p++ = *q++;
-	*p++ = '/';
+	if (!hash_final(&s->ctx.sha256, sha_digest))
+		_panic(r, "SHA256_Final() failed");
+
+	if (!hash_init(&s->ctx.sha256_sha256, HASH_SHA256))
+		_panic(r, "hash_init(sha256, HASH_SHA256) failed");
+	if (!hash_update(&s->ctx.sha256_sha256, sha_digest, 32))
+		_panic(r, "SHA256_Update(sha256) failed");
+	if (!hash_final(&s->ctx.sha256_sha256, sha_sha_digest))
+		_panic(r, "SHA256_Final(sha256) failed");
 
 	/*
-	 *  Build the path to the final resting place of the blob file.
+	 *  Calulate RIPEMD160(SHA256)
 	 */
-	s->blob_path[0] = 0;
-	jmscott_strcat2(s->blob_path, sizeof s->blob_path,
-			s->blob_dir_path,
-			digest
-	);
+	if (!hash_init(&s->ctx.ripemd160, HASH_RIPEMD160))
+		_panic(r, "hash_init(, HASH_RIPEMD160) failed");
+	if (!hash_update(&s->ctx.ripemd160, sha_sha_digest, 32))
+		_panic(r, "RIPEMD160_Update(SHA256) failed");
+	if (!hash_final(&s->ctx.ripemd160, digest))
+		_panic(r, "RIPEMD160_Final(SHA256) failed");
+
+	return memcmp(s->digest, digest, 20) ? -1 : 0;
 }
 
+/*
+ *  Verify the digest of the open blob before the "ok" of a get or take,
+ *  unless stamped fresh, so a corrupt blob is answered "no".  The bytes
+ *  are then sent trusted.
+ */
 static int
-fs_btc20_get_request(struct request *r)
+_verify_before_ok(struct request *r)
 {
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
 
-	make_path(r, r->digest);
-	return _open(r, s->blob_path, &s->blob_fd);
+	if (!s->packed && verify_fresh(s->blob_fd, r->range_offset >= 0))
+		goto verified;
+	if (_verify(r)) {
+		_error2(r, "PANIC: fs blob fails udig digest", r->digest);
+		if (zap_blob(r))
+			_panic(r, "zap_blob(get_request) failed");
+		_close(r, &s->blob_fd);
+		return 1;
+	}
+	if (!s->packed)
+		verify_stamp(s->blob_fd);
+	_seek(r, 0);
+verified:
+	s->verified = 1;
+	return 0;
+}
+
+static int
+fs_btc20_get_request(struct request *r)
+{
+	int status = _open_blob(r);
+
+	if (status == 0) {
+		struct fs_btc20_request *s =
+				(struct fs_btc20_request *)r->open_data;
+		struct stat st;
+
+		if (io_fstat(s->blob_fd, &st))
+			_panic2(r, "fstat(blob) failed", strerror(errno));
+		r->reply_size = s->packed ? s->packed_size : st.st_size;
+	}
+	if (status || trust_fs == 1)
+		return status;
+
+	//  a range is not digested as sent, so verify the whole blob first
+
+	if (verify_ttl <= 0 && r->range_offset < 0)
+		return status;
+	return _verify_before_ok(r);
 }
 
 static int
@@ -437,26 +606,19 @@ fs_btc20_get_trusted_bytes(struct request *r)
 {
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
 	int status = 0;
-	unsigned char chunk[CHUNK_SIZE];
-	int nread;
 
 	/*
-	 *  Read a chunk from the file, write chunk to client,
-	 *  update incremental digest.
+	 *  No digest to update, so send the file straight to the client.
 	 *
 	 *  In principle, we ought to first scan the blob file
 	 *  before sending "ok" to the requestor.
 	 */
-	while ((nread = _read(r, s->blob_fd, chunk, sizeof chunk)) > 0) {
-		if (blob_write(r, chunk, nread))
-			goto croak;
-	}
-	if (nread < 0)
-		_panic(r, "_read(blob) failed");
-	goto cleanup;
-croak:
-	status = -1;
-cleanup:
+	if (r->range_offset > 0)
+		_seek(r, r->range_offset);
+	if (blob_send_file(r, s->blob_fd,
+				s->packed && r->range_length < 0 ?
+				s->packed_left : r->range_length))
+		status = -1;
 	_close(r, &s->blob_fd);
 	return status;
 }
@@ -464,19 +626,19 @@ cleanup:
 static int
 fs_btc20_get_bytes(struct request *r)
 {
-	if (trust_fs == 1)
+	if (trust_fs == 1 ||
+	    ((struct fs_btc20_request *)r->open_data)->verified)
 		return fs_btc20_get_trusted_bytes(r);
 
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
 	int status = 0;
-	BTC20_CTX ctx;
 	unsigned char sha_digest[32];
 	unsigned char digest[20];
-	unsigned char chunk[CHUNK_SIZE];
+	unsigned char *chunk = s->chunk;
 	int nread;
 
-	if (!SHA256_Init(&ctx.sha256))
-		_panic(r, "SHA256_Init() failed");
+	if (!hash_init(&s->ctx.sha256, HASH_SHA256))
+		_panic(r, "hash_init(, HASH_SHA256) failed");
 
 	/*
 	 *  Read a chunk from the file, write chunk to client,
@@ -485,13 +647,13 @@ fs_btc20_get_bytes(struct request *r)
 	 *  In principle, we ought to first scan the blob file
 	 *  before sending "ok" to the requestor.
 	 */
-	while ((nread = _read(r, s->blob_fd, chunk, sizeof chunk)) > 0) {
+	while ((nread = _next(r, &chunk)) > 0) {
 		if (blob_write(r, chunk, nread))
 			goto croak;
 		/*
 		 *  Update the incremental digest.
 		 */
-		if (!SHA256_Update(&ctx.sha256, chunk, nread))
+		if (!hash_update(&s->ctx.sha256, chunk, nread))
 			_panic(r, "SHA256_Update(write) failed");
 	}
 	if (nread < 0)
@@ -499,25 +661,25 @@ fs_btc20_get_bytes(struct request *r)
 	/*
 	 *  Finalize the SHA256 digest of the entire blob.
 	 */
-	if (!SHA256_Final(sha_digest, &ctx.sha256))
+	if (!hash_final(&s->ctx.sha256, sha_digest))
 		_panic(r, "SHA256_Final() failed");
 
 	/*
 	 *  Take the sha256 of the 32 byte sha256 of the entire blob
 	 */
 	unsigned char sha_sha_digest[32];
-	if (!SHA256_Init(&ctx.sha256_sha256))
-		_panic(r, "SHA256_Init(sha256) failed");
-	if (!SHA256_Update(&ctx.sha256_sha256, sha_digest, 32))
+	if (!hash_init(&s->ctx.sha256_sha256, HASH_SHA256))
+		_panic(r, "hash_init(sha256, HASH_SHA256) failed");
+	if (!hash_update(&s->ctx.sha256_sha256, sha_digest, 32))
 		_panic(r, "SHA256_Update(sha256) failed");
-	if (!SHA256_Final(sha_sha_digest, &ctx.sha256_sha256))
+	if (!hash_final(&s->ctx.sha256_sha256, sha_sha_digest))
 		_panic(r, "SHA256_Final(sha256) failed");
 
-	if (!RIPEMD160_Init(&ctx.ripemd160))
-		_panic(r, "RIPEMD160_Init() failed");
-	if (!RIPEMD160_Update(&ctx.ripemd160, sha_sha_digest, 32))
+	if (!hash_init(&s->ctx.ripemd160, HASH_RIPEMD160))
+		_panic(r, "hash_init(, HASH_RIPEMD160) failed");
+	if (!hash_update(&s->ctx.ripemd160, sha_sha_digest, 32))
 		_panic(r, "RIPEMD160_Update(SHA256) failed");
-	if (!RIPEMD160_Final(digest, &ctx.ripemd160))
+	if (!hash_final(&s->ctx.ripemd160, digest))
 		_panic(r, "RIPEMD160_Final(SHA256) failed");
 
 	/*
@@ -554,23 +716,21 @@ fs_btc20_trusted_copy(struct request *r, int out_fd)
 {
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
 	int status = 0;
-	unsigned char chunk[CHUNK_SIZE];
+	unsigned char *chunk = s->chunk;
 	int nread;
 	static char n[] = "fs_btc20_trusted_copy";
 
-	make_path(r, r->digest);
-
 	/*
 	 *  Open the file to the blob.
 	 */
-	if (_open(r, s->blob_path, &s->blob_fd) == ENOENT)
+	if (_open_blob(r) == ENOENT)
 		return 1;
 
 	/*
 	 *  Read a chunk from the file, write chunk to local stream,
 	 *  update incremental digest.
 	 */
-	while ((nread = _read(r, s->blob_fd, chunk, sizeof chunk)) > 0)
+	while ((nread = _next(r, &chunk)) > 0)
 		if (io_write_buf(out_fd, chunk, nread)) {
 			_error2(r, n, "write_buf() failed");
 			goto croak;
@@ -600,30 +760,27 @@ fs_btc20_copy(struct request *r, int out_fd)
 
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
 	int status = 0;
-	BTC20_CTX ctx;
 	unsigned char sha_digest[32];
 	unsigned char sha_sha_digest[32];
 	unsigned char digest[20];
-	unsigned char chunk[CHUNK_SIZE];
+	unsigned char *chunk = s->chunk;
 	int nread;
 	static char n[] = "fs_btc20_copy";
 
-	make_path(r, r->digest);
-
 	/*
 	 *  Open the file to the blob.
 	 */
-	if (_open(r, s->blob_path, &s->blob_fd) == ENOENT)
+	if (_open_blob(r) == ENOENT)
 		return 1;
 
-	if (!SHA256_Init(&ctx.sha256))
-		_panic2(r, n, "SHA256_Init() failed");
+	if (!hash_init(&s->ctx.sha256, HASH_SHA256))
+		_panic2(r, n, "hash_init(, HASH_SHA256) failed");
 
 	/*
 	 *  Read a chunk from the file, write chunk to local stream,
 	 *  update incremental digest.
 	 */
-	while ((nread = _read(r, s->blob_fd, chunk, sizeof chunk)) > 0) {
+	while ((nread = _next(r, &chunk)) > 0) {
 		if (io_write_buf(out_fd, chunk, nread)) {
 			_error2(r, n, "write_buf() failed");
 			goto croak;
@@ -632,7 +789,7 @@ fs_btc20_copy(struct request *r, int out_fd)
 		/*
 		 *  Update the incremental digest.
 		 */
-		if (!SHA256_Update(&ctx.sha256, chunk, nread))
+		if (!hash_update(&s->ctx.sha256, chunk, nread))
 			_panic2(r, n, "SHA256_Update(write) failed");
 	}
 	if (nread < 0)
@@ -640,24 +797,24 @@ fs_btc20_copy(struct request *r, int out_fd)
 	/*
 	 *  Finalize the digest.
 	 */
-	if (!SHA256_Final(sha_digest, &ctx.sha256))
+	if (!hash_final(&s->ctx.sha256, sha_digest))
 		_panic2(r, n, "SHA256_Final() failed");
 
-	if (!SHA256_Init(&ctx.sha256_sha256))
-		_panic2(r, n, "SHA256_Init(sha256) failed");
-	if (!SHA256_Update(&ctx.sha256_sha256, sha_digest, 32))
+	if (!hash_init(&s->ctx.sha256_sha256, HASH_SHA256))
+		_panic2(r, n, "hash_init(sha256, HASH_SHA256) failed");
+	if (!hash_update(&s->ctx.sha256_sha256, sha_digest, 32))
 		_panic2(r, n, "SHA256_Update(sha256) failed");
-	if (!SHA256_Final(sha_sha_digest, &ctx.sha256_sha256))
+	if (!hash_final(&s->ctx.sha256_sha256, sha_sha_digest))
 		_panic2(r, n, "SHA256_Final(sha256) failed");
 
 	/*
 	 *  Calulate RIPEMD160(SHA256)
 	 */
-	if (!RIPEMD160_Init(&ctx.ripemd160))
-		_panic2(r, n, "RIPEMD160_Init() failed");
-	if (!RIPEMD160_Update(&ctx.ripemd160, sha_sha_digest, 32))
+	if (!hash_init(&s->ctx.ripemd160, HASH_RIPEMD160))
+		_panic2(r, n, "hash_init(, HASH_RIPEMD160) failed");
+	if (!hash_update(&s->ctx.ripemd160, sha_sha_digest, 32))
 		_panic2(r, n, "RIPEMD160_Update(sha256) failed");
-	if (!RIPEMD160_Final(digest, &ctx.ripemd160))
+	if (!hash_final(&s->ctx.ripemd160, digest))
 		_panic2(r, n, "RIPEMD160_Final(sha256) failed");
 
 	/*
@@ -682,10 +839,15 @@ fs_trust_btc20_eat(struct request *r)
 {
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
 	struct stat st;
+	int probe = 0;
 
+	if (pack_exists(r->algorithm, r->digest) >= 0)
+		return 0;
 	make_path(r, r->digest);
-	if (_stat(r, s->blob_path, &st) == ENOENT)
-		return 1;
+	while (_stat(r, s->blob_path, &st) == ENOENT)
+		if (!layout_probe(boot_data.layout, probe++, r->digest,
+					s->blob_dir_path, s->blob_path))
+			return 1;
 	return 0;
 }
 
@@ -696,84 +858,89 @@ fs_btc20_eat(struct request *r)
 		return fs_trust_btc20_eat(r);
 
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
-	int status = 0;
-	BTC20_CTX ctx;
-	unsigned char digest[20];
-	unsigned char sha_digest[20];
-	unsigned char sha_sha_digest[20];
-	unsigned char chunk[CHUNK_SIZE];
-	int nread;
 
-	make_path(r, r->digest);
-
-	if (_open(r, s->blob_path, &s->blob_fd) == ENOENT)
+	if (_open_blob(r) == ENOENT)
 		return 1;
 
-	if (!SHA256_Init(&ctx.sha256))
-		_panic(r, "SHA256_Init() failed");
-
-	/*
-	 *  Read a chunk from the file and chew.
-	 */
-	while ((nread = _read(r, s->blob_fd, chunk, sizeof chunk)) > 0)
-		/*
-		 *  Update the incremental digest.
-		 */
-		if (!SHA256_Update(&ctx.sha256, chunk, nread))
-			_panic(r, "SHA256_Update(read) failed");
-	if (nread < 0)
-		_panic(r, "_read(blob) failed");
-	/*
-	 *  Finalize the digest.
-	 */
-	if (!SHA256_Final(sha_digest, &ctx.sha256))
-		_panic(r, "SHA256_Final() failed");
-
-	if (!SHA256_Init(&ctx.sha256_sha256))
-		_panic(r, "SHA256_Init(sha256) failed");
-	if (!SHA256_Update(&ctx.sha256_sha256, sha_digest, 32))
-		_panic(r, "SHA256_Update(sha256) failed");
-	if (!SHA256_Final(sha_sha_digest, &ctx.sha256_sha256))
-		_panic(r, "SHA256_Final(sha256) failed");
+	//  a blob file verified within --verify-ttl is not rehashed
 
-	/*
-	 *  Calulate RIPEMD160(SHA256)
-	 */
-	if (!RIPEMD160_Init(&ctx.ripemd160))
-		_panic(r, "RIPEMD160_Init() failed");
-	if (!RIPEMD160_Update(&ctx.ripemd160, sha_sha_digest, 32))
-		_panic(r, "RIPEMD160_Update(SHA256) failed");
-	if (!RIPEMD160_Final(digest, &ctx.ripemd160))
-		_panic(r, "RIPEMD160_Final(SHA256) failed");
+	if (!s->packed && verify_fresh(s->blob_fd, 0)) {
+		_close(r, &s->blob_fd);
+		return 0;
+	}
 
 	/*
 	 *  If the calculated digest does NOT match the stored digest,
-	 *  then zap the blob from storage and get panicy.
-	 *  A corrupt blob is a bad, bad thang.
-	 *
-	 *  Note: unfortunately we've already deceived the client
-	 *        by sending "ok".  Probably need to improve for
-	 *	  the special case when the entire blob is read
-	 *        in first chunk.  is this still true?
+	 *  then get panicy.  A corrupt blob is a bad, bad thang.
 	 */
-	if (memcmp(s->digest, digest, 20))
+	if (_verify(r))
 		_panic2(r, "stored blob doesn't match digest", r->digest);
+	if (!s->packed)
+		verify_stamp(s->blob_fd);
+	_close(r, &s->blob_fd);
+	return 0;
+}
+
+/*
+ *  Verify the digest of a stored blob for the scrubber, without the panic
+ *  of eat.  Return 0 when the blob matches the digest, 1 when the blob does
+ *  not exist and 2 when the blob is corrupt, like the script fs-frisk.
+ */
+static int
+fs_btc20_frisk(struct request *r)
+{
+	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
+	struct stat st;
+	int status = 0;
+
+	if (_open_blob(r) == ENOENT)
+		return 1;
+	if (io_fstat(s->blob_fd, &st))
+		_panic2(r, "fstat(blob) failed", strerror(errno));
+	r->blob_size = s->packed ? s->packed_size : st.st_size;
+	if (_verify(r))
+		status = 2;
+	else if (!s->packed)
+		verify_stamp(s->blob_fd);
 	_close(r, &s->blob_fd);
 	return status;
 }
 
+/*
+ *  Does the blob exist, packed or as a file?  Only a stat, for "have",
+ *  so the blob is neither read nor verified.
+ */
+static int
+fs_btc20_exists(char *digest)
+{
+	char dir_path[MAX_FILE_PATH_LEN], blob_path[MAX_FILE_PATH_LEN];
+	int status, probe = 0;
+
+	if (pack_exists("btc20", digest) >= 0)
+		return 1;
+	layout_path(boot_data.layout, digest, dir_path, blob_path);
+	while ((status = layout_blob_exists(boot_data.layout, blob_path)) == 0)
+		if (!layout_probe(boot_data.layout, probe++, digest, dir_path,
+								blob_path))
+			return 0;
+	if (status < 0)
+		panic4("btc20: exists", blob_path, "stat(blob) failed",
+							strerror(errno));
+	return 1;
+}
+
 /*
  *  Write a portion of a blob to local storage and derive a partial digest.
  *  Return 1 if the accumulated digest matches the expected digest,
- *  0 if the partial digest does not match do not match.
+ *  0 if the partial digest does not match do not match, -1 if the
+ *  blob can never match the size declared by the client.
  */
 static int
-eat_chunk(struct request *r, SHA256_CTX *sha_ctx, int fd, unsigned char *buf,
+eat_chunk(struct request *r, struct hash *sha_ctx, int fd, unsigned char *buf,
 	  int buf_size)
 {
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
 
-	BTC20_CTX ctx;
 	unsigned char sha_digest[32];
 	unsigned char sha_sha_digest[32];
 	unsigned char digest[20];
@@ -782,7 +949,7 @@ eat_chunk(struct request *r, SHA256_CTX *sha_ctx, int fd, unsigned char *buf,
 	/*
 	 *  Update the incremental digest.
 	 */
-	if (!SHA256_Update(sha_ctx, buf, buf_size))
+	if (!hash_update(sha_ctx, buf, buf_size))
 		_panic2(r, n, "SHA256_Update() failed");
 
 	/*
@@ -790,36 +957,49 @@ eat_chunk(struct request *r, SHA256_CTX *sha_ctx, int fd, unsigned char *buf,
 	 */
 	if (io_write_buf(fd, buf, buf_size))
 		_panic3(r, n, "write(tmp) failed", strerror(errno));
+	/*
+	 *  Size declared by client, so finalize only after the last byte.
+	 */
+	if (r->declared_size >= 0) {
+		if (r->blob_size < r->declared_size)
+			return 0;
+		if (r->blob_size > r->declared_size)
+			return -1;
+	}
+
 	/*
 	 *  Determine if we have seen the whole blob
 	 *  by copying the incremental digest, finalizing it,
 	 *  then comparing to the expected blob.
 	 */
-	ctx.sha256 = *sha_ctx;
-	if (!SHA256_Final(sha_digest, &ctx.sha256))
+	if (!hash_copy(&s->copy.sha256, sha_ctx))
+		_panic2(r, n, "hash_copy() failed");
+	if (!hash_final(&s->copy.sha256, sha_digest))
 		_panic2(r, n, "SHA256_Final() failed");
 
 	/*
 	 *  Take the sha256(sha25).
 	 */
-	if (!SHA256_Init(&ctx.sha256_sha256))
-		_panic2(r, n, "SHA256_Init(sha256) failed");
-	if (!SHA256_Update(&ctx.sha256_sha256, sha_digest, 32))
+	if (!hash_init(&s->copy.sha256_sha256, HASH_SHA256))
+		_panic2(r, n, "hash_init(sha256, HASH_SHA256) failed");
+	if (!hash_update(&s->copy.sha256_sha256, sha_digest, 32))
 		_panic2(r, n, "SHA256_Update(sha256) failed");
-	if (!SHA256_Final(sha_sha_digest, &ctx.sha256_sha256))
+	if (!hash_final(&s->copy.sha256_sha256, sha_sha_digest))
 		_panic2(r, n, "SHA256_Final(sha256) failed");
 
 	/*
 	 *  Calulate RIPEMD160(SHA256) of incremental digest.
 	 */
-	if (!RIPEMD160_Init(&ctx.ripemd160))
-		_panic2(r, n, "RIPEMD160_Init() failed");
-	if (!RIPEMD160_Update(&ctx.ripemd160, sha_sha_digest, 32))
+	if (!hash_init(&s->copy.ripemd160, HASH_RIPEMD160))
+		_panic2(r, n, "hash_init(, HASH_RIPEMD160) failed");
+	if (!hash_update(&s->copy.ripemd160, sha_sha_digest, 32))
 		_panic2(r, n, "RIPEMD160_Update(sha256) failed");
-	if (!RIPEMD160_Final(digest, &ctx.ripemd160))
+	if (!hash_final(&s->copy.ripemd160, digest))
 		_panic2(r, n, "RIPEMD160_Final(sha256) failed");
 
-	return memcmp(s->digest, digest, 20) == 0 ? 1 : 0;
+	if (memcmp(s->digest, digest, 20) == 0)
+		return 1;
+	return r->declared_size >= 0 ? -1 : 0;
 }
 
 static int
@@ -833,10 +1013,9 @@ static int
 fs_btc20_put_bytes(struct request *r)
 {
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
-	BTC20_CTX ctx;
 	char tmp_path[MAX_FILE_PATH_LEN];
-	unsigned char chunk[CHUNK_SIZE], *cp, *cp_end;
-	int status = 0;
+	unsigned char *chunk, *cp, *cp_end;
+	int status = 0, anon = 0;
 	char buf[MSG_SIZE*2];
 
 	/*
@@ -856,21 +1035,31 @@ fs_btc20_put_bytes(struct request *r)
 					(int)time((time_t *)0),
 					getpid(),
 					r->digest);
+	/*
+	 *  With direct commit, stage the blob in an anonymous file, linked
+	 *  into place only after the digest verifies.
+	 */
+	if (direct_commit == 1 &&
+	    (s->blob_fd = tmp_open_anon(r->algorithm, r->digest)) >= 0) {
+		anon = 1;
+		goto staged;
+	}
 	s->blob_fd = io_open(
 			tmp_path,
-			O_CREAT|O_EXCL|O_WRONLY|O_APPEND, S_IRUSR
+			O_CREAT|O_EXCL|O_RDWR|O_APPEND, S_IRUSR
 	);
 	if (s->blob_fd < 0) {
 		snprintf(buf, sizeof buf, "open(%s) failed: %s", tmp_path,
 							strerror(errno));
 		_panic(r, buf);
 	}
+staged:
 
 	/*
 	 *  Initialize digest of blob being scanned from the client.
 	 */
-	if (!SHA256_Init(&ctx.sha256))
-		_panic(r, "SHA256_Init() failed");
+	if (!hash_init(&s->ctx.sha256, HASH_SHA256))
+		_panic(r, "hash_init(, HASH_SHA256) failed");
 
 	/*
 	 *  An empty blob is always put.
@@ -892,26 +1081,32 @@ fs_btc20_put_bytes(struct request *r)
 		if ((i64)r->scan_size != r->blob_size)
 			_panic(r, "r->scan_size != r->blob_size");
 
-		if (r->scan_size > (int)(sizeof chunk - 1)) {
+		if (r->scan_size > (int)(chunk_size - 1)) {
 			snprintf(buf, sizeof buf, "max=%lu", 
-					(long unsigned)(sizeof chunk - 1));
+					(long unsigned)(chunk_size - 1));
 			_panic2(r, "scanned chunk too big", buf);
 		}
 
 		/*
 		 *  See if the entire blob fits in the first read.
 		 */
-		if (eat_chunk(
+		switch (eat_chunk(
 				r,
-				&ctx.sha256,
+				&s->ctx.sha256,
 				s->blob_fd,
 				r->scan_buf,
 				r->scan_size
-		))
+		)) {
+		case -1:
+			_error(r, "blob does not match declared size");
+			goto croak;
+		case 1:
 			goto digested;
+		}
 	}
+	chunk = s->chunk;
 	cp = chunk;
-	cp_end = &chunk[sizeof chunk];
+	cp_end = chunk + chunk_size;
 
 	/*
 	 *  Read more chunks until we see the blob.
@@ -932,8 +1127,13 @@ again:
 			_error(r, "blob_read() returns 0 before digest seen");
 			goto croak;
 		}
-		if (eat_chunk(r, &ctx.sha256, s->blob_fd, cp, nread))
+		switch (eat_chunk(r, &s->ctx.sha256, s->blob_fd, cp, nread)) {
+		case -1:
+			_error(r, "blob does not match declared size");
+			goto croak;
+		case 1:
 			goto digested;
+		}
 		cp += nread;
 	}
 	cp = chunk;
@@ -941,18 +1141,35 @@ again:
 
 digested:
 	/*
-	 *  Rename the temp blob file to the final blob path.
+	 *  Rename the temp blob file to the final blob path, unless small
+	 *  enough to pack.
 	 */
 	make_path(r, r->digest);
 
-	arbor_rename(tmp_path,
-			((struct fs_btc20_request *)r->open_data)->blob_path);
+	if (pack_small == 1 &&
+	    layout_blob_exists(boot_data.layout, s->blob_path) == 0 &&
+	    pack_put(r->algorithm, r->digest, s->blob_fd))
+		goto cleanup;
+	if (!anon) {
+		arbor_rename(tmp_path, s->blob_path);
+		goto cleanup;
+	}
+	if (arbor_link(s->blob_fd, s->blob_path) == 0)
+		goto cleanup;
+
+	//  not linkable, so copy to the named file, perhaps across devices
+	if (tmp_name_anon(s->blob_fd, tmp_path, errno)) {
+		_error2(r, "tmp_name_anon() failed", strerror(errno));
+		goto croak;
+	}
+	anon = 0;
+	arbor_move(tmp_path, s->blob_path);
 	goto cleanup;
 croak:
 	status = -1;
 cleanup:
 	_close(r, &s->blob_fd);
-	if (tmp_path[0] && _unlink(r, tmp_path, (int *)0))
+	if (!anon && _unlink(r, tmp_path, (int *)0))
 		_panic(r, "_unlink() failed");
 	return status; 
 }
@@ -985,11 +1202,19 @@ fs_btc20_take_reply(struct request *r, char *reply)
 		int exists = 1;
 		char *slash;
 
-		if (_unlink(r, s->blob_path, &exists))
-			_panic(r, "_unlink() failed");
+		if (s->packed) {
+			if (!pack_take(r->algorithm, r->digest))
+				_warn2(r, "expected packed blob does not exist",
+								r->digest);
+			return 0;
+		}
+		if (_unlink_blob(r, &exists))
+			_panic(r, "_unlink_blob() failed");
 		if (!exists)
 			_warn2(r, "expected blob file does not exist",
 							s->blob_path);
+		else
+			exist_count(-1);
 		/*
 		 *  Request trimming the empty directories.
 		 */
@@ -1042,9 +1267,9 @@ fs_btc20_give_reply(struct request *r, char *reply)
 static int
 fs_btc20_digest(struct request *r, int fd, char *hex_digest)
 {
+	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
 	char unsigned buf[4096], digest[20], *d, *d_end;
 	char *h;
-	BTC20_CTX ctx;
 	int nread;
 	int tmp_fd = -1;
 	char tmp_path[MAX_FILE_PATH_LEN];
@@ -1083,10 +1308,10 @@ fs_btc20_digest(struct request *r, int fd, char *hex_digest)
 		_error3(r, n, "open(tmp) failed", tmp_path);
 		_panic3(r, n, "open(tmp) failed", strerror(errno));
 	}
-	if (!SHA256_Init(&ctx.sha256))
-		_panic2(r, n, "SHA256_Init() failed");
+	if (!hash_init(&s->ctx.sha256, HASH_SHA256))
+		_panic2(r, n, "hash_init(, HASH_SHA256) failed");
 	while ((nread = io_read(fd, buf, sizeof buf)) > 0) {
-		if (!SHA256_Update(&ctx.sha256, buf, nread))
+		if (!hash_update(&s->ctx.sha256, buf, nread))
 			_panic2(r, n, "SHA256_Update(read) failed");
 		if (io_write_buf(tmp_fd, buf, nread) != 0)
 			_panic3(r, n, "write_buf(tmp) failed", strerror(errno));
@@ -1095,7 +1320,7 @@ fs_btc20_digest(struct request *r, int fd, char *hex_digest)
 		_error2(r, n, "read() failed");
 		goto croak;
 	}
-	if (!SHA256_Final(sha_digest, &ctx.sha256))
+	if (!hash_final(&s->ctx.sha256, sha_digest))
 		_panic2(r, n, "SHA256_Final() failed");
 
 	status = io_close(tmp_fd);
@@ -1106,21 +1331,21 @@ fs_btc20_digest(struct request *r, int fd, char *hex_digest)
 	/*
 	 *  Take the sha256(sha256)
 	 */
-	if (!SHA256_Init(&ctx.sha256_sha256))
-		_panic2(r, n, "SHA256_Init(sha256) failed");
-	if (!SHA256_Update(&ctx.sha256_sha256, sha_digest, 32))
+	if (!hash_init(&s->ctx.sha256_sha256, HASH_SHA256))
+		_panic2(r, n, "hash_init(sha256, HASH_SHA256) failed");
+	if (!hash_update(&s->ctx.sha256_sha256, sha_digest, 32))
 		_panic2(r, n, "SHA256_Update(sha256) failed");
-	if (!SHA256_Final(sha_sha_digest, &ctx.sha256_sha256))
+	if (!hash_final(&s->ctx.sha256_sha256, sha_sha_digest))
 		_panic2(r, n, "SHA256_Final(sha256) failed");
 
 	/*
 	 *  Calulate RIPEMD160(sha_digest)
 	 */
-	if (!RIPEMD160_Init(&ctx.ripemd160))
-		_panic2(r, n, "RIPEMD160_Init() failed");
-	if (!RIPEMD160_Update(&ctx.ripemd160, sha_sha_digest, 32))
+	if (!hash_init(&s->ctx.ripemd160, HASH_RIPEMD160))
+		_panic2(r, n, "hash_init(, HASH_RIPEMD160) failed");
+	if (!hash_update(&s->ctx.ripemd160, sha_sha_digest, 32))
 		_panic2(r, n, "RIPEMD160_Update(sha256) failed");
-	if (!RIPEMD160_Final(digest, &ctx.ripemd160))
+	if (!hash_final(&s->ctx.ripemd160, digest))
 		_panic2(r, n, "RIPEMD160_Final() failed");
 
 	/*
@@ -1165,6 +1390,14 @@ fs_btc20_close(struct request *r, int status)
 
 	struct fs_btc20_request *s = (struct fs_btc20_request *)r->open_data;
 	_close(r, &s->blob_fd);
+	io_map_close(&s->map);
+
+	//  keep the hash contexts for the next request, unless nested
+
+	ctx_swap(&s->ctx, &spare_ctx);
+	ctx_swap(&s->copy, &spare_copy);
+	ctx_free(&s->ctx);
+	ctx_free(&s->copy);
 
 	return 0;
 }
@@ -1197,6 +1430,7 @@ fs_btc20_boot()
 	 */
 	if (_mkdir((struct request *)0, boot_data.root_dir_path, 1))
 		panic("btc20: boot: _mkdir(root_dir) failed");
+	boot_data.layout = layout_open(boot_data.root_dir_path);
 	if (trust_fs == 1)
 		binfo("trust filesystem is enabled");
 
@@ -1264,6 +1498,8 @@ struct digest_module fs_btc20_module =
 	.give_reply	=	fs_btc20_give_reply,
 
 	.eat		=	fs_btc20_eat,
+	.frisk		=	fs_btc20_frisk,
+	.exists		=	fs_btc20_exists,
 
 	.digest		=	fs_btc20_digest,
 	.is_digest	=	fs_btc20_is_digest,
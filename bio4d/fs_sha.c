@@ -3,7 +3,8 @@
  *  Synopsis:
  *	Module that manages sha digested blobs in POSIX file system.
  *  Note:
- *	trust_fs is ignored for sha, due to time constraints.
+ *	trust_fs is ignored for sha, due to time constraints, except
+ *	for the bytes sent by get/take.
  *
  *	The tmp file path does not include the digest.  Not a serious problem
  *	since the odds of two different blobs having the same digest
@@ -16,15 +17,8 @@
 #include <unistd.h>
 
 #include "openssl/opensslv.h"
-#include "openssl/sha.h"
 #include "bio4d.h"
 
-/*
- *  How many bytes to read and write the blobs from either client or fs.
- *  Note: might want to make the get chunk size be much bigger than the put.
- */
-#define CHUNK_SIZE		(4 * 1024)
-
 static char	fs_sha_root[]	= "data/fs_sha";
 static char	empty_ascii[]	= "da39a3ee5e6b4b0d3255bfef95601890afd80709";
 
@@ -38,13 +32,35 @@ struct fs_sha_request
 	char		blob_path[MAX_FILE_PATH_LEN];
 	unsigned char	digest[20];
 	int		blob_fd;
+	int		packed;		//  blob_fd is the segment of a packed blob
+	i64		packed_offset;	//  first byte of packed blob in segment
+	i64		packed_size;
+	i64		packed_left;	//  bytes of packed blob after blob_fd
+	struct io_map	map;		//  mapping of a large blob_fd
+	int		verified;	//  digest verified before "ok"
+	struct hash	ctx;		//  running digest of the blob
+	struct hash	copy;		//  copy finalized by eat_chunk()
+
+	/*
+	 *  Buffer of chunk_size bytes to read and write the blob from
+	 *  either client or fs.  Allocated in the same malloc() as the
+	 *  request, directly after the struct.
+	 */
+	unsigned char	*chunk;
 };
 
 static struct fs_sha_boot
 {
 	char		root_dir_path[MAX_FILE_PATH_LEN];
+	struct blob_layout *layout;
 } boot_data;
 
+/*
+ *  Hash contexts of the last request closed, handed to the next request
+ *  opened, so a worker allocates them once.
+ */
+static struct hash	spare_ctx, spare_copy;
+
 static char nib2hex[] =
 {
 	'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
@@ -176,11 +192,14 @@ fs_sha_open(struct request *r)
 {
 	struct fs_sha_request *s;
 
-	s = (struct fs_sha_request *)malloc(sizeof *s);
+	s = (struct fs_sha_request *)malloc(sizeof *s + chunk_size);
 	if (s == NULL)
 		_panic2(r, "malloc(fs_sha_request) failed", strerror(errno));
 	memset(s, 0, sizeof *s);
 	s->blob_fd = -1;
+	s->chunk = (unsigned char *)(s + 1);
+	hash_swap(&s->ctx, &spare_ctx);
+	hash_swap(&s->copy, &spare_copy);
 	if (strcmp("wrap", r->verb))
 		decode_hex(r->digest, s->digest);
 	r->open_data = (void *)s;
@@ -191,37 +210,11 @@ fs_sha_open(struct request *r)
 static int
 _unlink(struct request *r, char *path, int *exists)
 {
-	if (io_unlink(path)) {
+	if (layout_unlink_blob(boot_data.layout, path, exists)) {
 		char buf[MSG_SIZE];
-		int err = errno;
 
-		if (err == ENOENT) { 
-			if (exists)
-				*exists = 0;
-			return 0;
-		}
 		snprintf(buf, sizeof buf, "unlink(%s) failed", path);
-		_panic2(r, buf, strerror(err));
-	}
-	if (exists)
-		*exists = 1;
-	return 0;
-}
-
-/*
- *  Do a hard delete of a corrupted blob.
- *  Calling zap blob indicates a panicy situation with the server.
- *  Eventually will want to remove an empty, enclosing directory.
- */
-static int
-zap_blob(struct request *r)
-{
-	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
-	int exists = 0;
-
-	if (_unlink(r, s->blob_path, &exists)) {
-		_panic(r, "zap_blob: _unlink() failed");
-		return -1;
+		_panic2(r, buf, strerror(errno));
 	}
 	return 0;
 }
@@ -251,6 +244,45 @@ _read(struct request *r, int fd, unsigned char *buf, int buf_size)
 	return buf_size;
 }
 
+/*
+ *  Get the next chunk of the open blob, either a window of the mapped blob
+ *  file or a chunk read into the request buffer.
+ */
+static int
+_next(struct request *r, unsigned char **p_chunk)
+{
+	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
+	int nread, size = chunk_size;
+
+	if (s->packed) {
+		if (s->packed_left < size)
+			size = s->packed_left;
+	} else if ((nread = io_map_read(&s->map, s->blob_fd, p_chunk)) >= 0)
+		return nread;
+	*p_chunk = s->chunk;
+	nread = _read(r, s->blob_fd, s->chunk, size);
+	if (s->packed && nread > 0)
+		s->packed_left -= nread;
+	return nread;
+}
+
+/*
+ *  Position the open blob at offset, past the start of a packed blob in
+ *  its segment.
+ */
+static void
+_seek(struct request *r, i64 offset)
+{
+	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
+
+	if (s->packed) {
+		s->packed_left = s->packed_size - offset;
+		offset += s->packed_offset;
+	}
+	if (io_lseek(s->blob_fd, (off_t)offset, SEEK_SET) < 0)
+		_panic2(r, "lseek(blob) failed", strerror(errno));
+}
+
 static void
 _close(struct request *r, char *what, int *p_fd)
 {
@@ -276,7 +308,7 @@ _open(struct request *r, char *path, int *p_fd)
 {
 	int fd;
 
-	if ((fd = io_open(path, O_RDONLY, 0)) < 0) {
+	if ((fd = layout_open_blob(boot_data.layout, path)) < 0) {
 		char buf[MSG_SIZE];
 
 		if (errno == ENOENT)
@@ -343,77 +375,208 @@ static void
 make_path(struct request *r, char *digest)
 {
 	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
-	char *p, *q;
 
 	/*
-	 *  Derive a path to the blob from the digest.
-	 *  Each directory component in the path doubles the
-	 *  length of it's parent component.  For example, given
-	 *  the digest
+	 *  Derive a path to the blob from the digest, per the directory
+	 *  layout in data/fs_sha/layout.  For example, given the digest
 	 *
 	 *	57cd5957fbc764c5ee9862f76287d09d2170b9ef
 	 *
-	 *  we derive the path to the blob file as
+	 *  the classic layout derives the path to the blob file as
 	 *
 	 *	57c/d59/57cd5957fbc764c5ee9862f76287d09d2170b9ef
 	 */
-	strcpy(s->blob_dir_path, boot_data.root_dir_path);
-	p = s->blob_dir_path + strlen(s->blob_dir_path);
-	q = digest;
+	layout_path(boot_data.layout, digest, s->blob_dir_path, s->blob_path);
+}
 
-	/*
-	 *   Build the directory path to the blob.
-	 */
+/*
+ *  Unlink the file of the open blob.  When the file is gone, the layout
+ *  migrator may have moved the blob into the current layout since the
+ *  open, so unlink the blob there.
+ */
+static int
+_unlink_blob(struct request *r, int *exists)
+{
+	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
+	char path[MAX_FILE_PATH_LEN];
 
-	 /*
-	  *  Directory 1:
-	  *	Three characters /[0-9a-f][0-9a-f][0-9a-f]
-	  */
-	*p++ = '/';
-	*p++ = *q++;
-	*p++ = *q++;
-	*p++ = *q++;
+	if (_unlink(r, s->blob_path, exists))
+		return -1;
+	if (*exists)
+		return 0;
+	strcpy(path, s->blob_path);
+	make_path(r, r->digest);
+	if (strcmp(path, s->blob_path) == 0)
+		return 0;
+	return _unlink(r, s->blob_path, exists);
+}
+
+/*
+ *  Do a hard delete of a corrupted blob.
+ *  Calling zap blob indicates a panicy situation with the server.
+ *  Eventually will want to remove an empty, enclosing directory.
+ */
+static int
+zap_blob(struct request *r)
+{
+	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
+	int exists = 0;
+
+	if (s->packed) {
+		pack_take(r->algorithm, r->digest);
+		return 0;
+	}
+	if (_unlink_blob(r, &exists)) {
+		_panic(r, "zap_blob: _unlink_blob() failed");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  Open the blob, either packed or the blob file, probing the previous
+ *  directory layout while the migration of the layout is in progress.
+ */
+static int
+_open_blob(struct request *r)
+{
+	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
+	int status, probe = 0;
+
+	s->blob_fd = pack_open_blob(r->algorithm, r->digest,
+							&s->packed_offset,
+							&s->packed_size);
+	if (s->blob_fd >= 0) {
+		s->packed = 1;
+		s->packed_left = s->packed_size;
+		return 0;
+	}
+	make_path(r, r->digest);
+	while ((status = _open(r, s->blob_path, &s->blob_fd)) == ENOENT &&
+	       layout_probe(boot_data.layout, probe++, r->digest,
+					s->blob_dir_path, s->blob_path))
+		;
+	return status;
+}
+
+/*
+ *  Digest the open blob, returning 0 when the digest matches the udig.
+ */
+static int
+_verify(struct request *r)
+{
+	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
+	unsigned char digest[20];
+	unsigned char *chunk = s->chunk;
+	int nread;
+
+	if (!hash_init(&s->ctx, HASH_SHA1))
+		_panic(r, "SHA1_Init() failed");
 
 	/*
-	 *  Directory 2:
-	 *	3 Characters: /[0-9a-f][0-9a-f]
+	 *  Read a chunk from the file and chew.
 	 */
-	*p++ = '/';
-	*p++ = *q++;
-	*p++ = *q++;
-	*p++ = *q++;
-	*p++ = '/';
-
+	while ((nread = _next(r, &chunk)) > 0)
+		/*
+		 *  Update the incremental digest.
+		 */
+		if (!hash_update(&s->ctx, chunk, nread))
+			_panic(r, "SHA1_Update(chunk) failed");
+	if (nread < 0)
+		_panic(r, "_read(blob) failed");
 	/*
-	 *  Build the path to the final resting place of the blob file.
+	 *  Finalize the digest.
 	 */
-	s->blob_path[0] = 0;
-	jmscott_strcat2(s->blob_path, sizeof s->blob_path,
-			s->blob_dir_path,
-			digest
-	);
+	if (!hash_final(&s->ctx, digest))
+		_panic(r, "SHA1_Final() failed");
+
+	return memcmp(s->digest, digest, 20) ? -1 : 0;
+}
+
+/*
+ *  Verify the digest of the open blob before the "ok" of a get or take,
+ *  unless stamped fresh, so a corrupt blob is answered "no".  The bytes
+ *  are then sent trusted.
+ */
+static int
+_verify_before_ok(struct request *r)
+{
+	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
+
+	if (!s->packed && verify_fresh(s->blob_fd, r->range_offset >= 0))
+		goto verified;
+	if (_verify(r)) {
+		_error2(r, "PANIC: fs blob fails udig digest", r->digest);
+		if (zap_blob(r))
+			_panic(r, "zap_blob(get_request) failed");
+		_close(r, "server blob", &s->blob_fd);
+		return 1;
+	}
+	if (!s->packed)
+		verify_stamp(s->blob_fd);
+	_seek(r, 0);
+verified:
+	s->verified = 1;
+	return 0;
 }
 
 static int
 fs_sha_get_request(struct request *r)
+{
+	int status = _open_blob(r);
+
+	if (status == 0) {
+		struct fs_sha_request *s =
+				(struct fs_sha_request *)r->open_data;
+		struct stat st;
+
+		if (io_fstat(s->blob_fd, &st))
+			_panic2(r, "fstat(blob) failed", strerror(errno));
+		r->reply_size = s->packed ? s->packed_size : st.st_size;
+	}
+	if (status || trust_fs == 1)
+		return status;
+
+	//  a range is not digested as sent, so verify the whole blob first
+
+	if (verify_ttl <= 0 && r->range_offset < 0)
+		return status;
+	return _verify_before_ok(r);
+}
+
+static int
+fs_sha_get_trusted_bytes(struct request *r)
 {
 	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
+	int status = 0;
 
-	make_path(r, r->digest);
-	return _open(r, s->blob_path, &s->blob_fd);
+	/*
+	 *  No digest to update, so send the file straight to the client.
+	 */
+	if (r->range_offset > 0)
+		_seek(r, r->range_offset);
+	if (blob_send_file(r, s->blob_fd,
+				s->packed && r->range_length < 0 ?
+				s->packed_left : r->range_length))
+		status = -1;
+	_close(r, "server blob", &s->blob_fd);
+	return status;
 }
 
 static int
 fs_sha_get_bytes(struct request *r)
 {
+	if (trust_fs == 1 ||
+	    ((struct fs_sha_request *)r->open_data)->verified)
+		return fs_sha_get_trusted_bytes(r);
+
 	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
 	int status = 0;
-	SHA_CTX ctx;
 	unsigned char digest[20];
-	unsigned char chunk[CHUNK_SIZE];
+	unsigned char *chunk = s->chunk;
 	int nread;
 
-	if (!SHA1_Init(&ctx))
+	if (!hash_init(&s->ctx, HASH_SHA1))
 		_panic(r, "SHA1_Init() failed");
 
 	/*
@@ -423,20 +586,20 @@ fs_sha_get_bytes(struct request *r)
 	 *  In principle, we ought to first scan the blob file
 	 *  before sending "ok" to the requestor.
 	 */
-	while ((nread = _read(r, s->blob_fd, chunk, sizeof chunk)) > 0) {
+	while ((nread = _next(r, &chunk)) > 0) {
 		if (blob_write(r, chunk, nread))
 			goto croak;
 		/*
 		 *  Update the incremental digest.
 		 */
-		SHA1_Update(&ctx, chunk, nread);
+		hash_update(&s->ctx, chunk, nread);
 	}
 	if (nread < 0)
 		_panic(r, "_read(blob) failed");
 	/*
 	 *  Finalize the digest.
 	 */
-	SHA1_Final(digest, &ctx);
+	hash_final(&s->ctx, digest);
 	/*
 	 *  If the calculated digest does NOT match the stored digest,
 	 *  then zap the blob from storage and get panicy.
@@ -471,30 +634,27 @@ fs_sha_copy(struct request *r, int out_fd)
 {
 	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
 	int status = 0;
-	SHA_CTX ctx;
 	unsigned char digest[20];
-	unsigned char chunk[CHUNK_SIZE];
+	unsigned char *chunk = s->chunk;
 	int nread;
 	static char n[] = "fs_sha_write";
 
-	make_path(r, r->digest);
-
 	/*
 	 *  Open the file to the blob.
 	 */
-	if (_open(r, s->blob_path, &s->blob_fd) == ENOENT) {
+	if (_open_blob(r) == ENOENT) {
 		_warn3(r, n, "open(blob): not found", r->digest);
 		return 1; 
 	}
 
-	if (!SHA1_Init(&ctx))
+	if (!hash_init(&s->ctx, HASH_SHA1))
 		_panic2(r, n, "SHA1_Init() failed");
 
 	/*
 	 *  Read a chunk from the file, write chunk to local stream,
 	 *  update incremental digest.
 	 */
-	while ((nread = _read(r, s->blob_fd, chunk, sizeof chunk)) > 0) {
+	while ((nread = _next(r, &chunk)) > 0) {
 		if (io_write_buf(out_fd, chunk, nread)) {
 			_error2(r, n, "write_buf() failed");
 			goto croak;
@@ -503,7 +663,7 @@ fs_sha_copy(struct request *r, int out_fd)
 		/*
 		 *  Update the incremental digest.
 		 */
-		if (!SHA1_Update(&ctx, chunk, nread))
+		if (!hash_update(&s->ctx, chunk, nread))
 			_panic2(r, n, "SHA1_Update(chunk) failed");
 	}
 	if (nread < 0)
@@ -511,7 +671,7 @@ fs_sha_copy(struct request *r, int out_fd)
 	/*
 	 *  Finalize the digest.
 	 */
-	if (!SHA1_Final(digest, &ctx))
+	if (!hash_final(&s->ctx, digest))
 		_panic2(r, n, "SHA1_Final() failed");
 
 	/*
@@ -533,74 +693,95 @@ static int
 fs_sha_eat(struct request *r)
 {
 	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
-	int status = 0;
-	SHA_CTX ctx;
-	unsigned char digest[20];
-	unsigned char chunk[CHUNK_SIZE];
-	int nread;
-
-	make_path(r, r->digest);
 
-	/*
-	 *  Open the file to the blob.
-	 */
-	if (_open(r, s->blob_path, &s->blob_fd) == ENOENT)
+	if (_open_blob(r) == ENOENT)
 		return 1;
 
-	if (!SHA1_Init(&ctx))
-		_panic(r, "SHA1_Init() failed");
+	//  a blob file verified within --verify-ttl is not rehashed
 
-	/*
-	 *  Read a chunk from the file and chew.
-	 */
-	while ((nread = _read(r, s->blob_fd, chunk, sizeof chunk)) > 0)
-		/*
-		 *  Update the incremental digest.
-		 */
-		if (!SHA1_Update(&ctx, chunk, nread))
-			_panic(r, "SHA1_Update(chunk) failed");
-	if (nread < 0)
-		_panic(r, "_read(blob) failed");
-	/*
-	 *  Finalize the digest.
-	 */
-	if (!SHA1_Final(digest, &ctx))
-		_panic(r, "SHA1_Final() failed");
+	if (!s->packed && verify_fresh(s->blob_fd, 0)) {
+		_close(r, "server blob", &s->blob_fd);
+		return 0;
+	}
 
 	/*
 	 *  If the calculated digest does NOT match the stored digest,
-	 *  then zap the blob from storage and get panicy.
-	 *  A corrupt blob is a bad, bad thang.
-	 *
-	 *  Note: unfortunately we've already deceived the client
-	 *        by sending "ok".  Probably need to improve for
-	 *	  the special case when the entire blob is read
-	 *        in first chunk.
+	 *  then get panicy.  A corrupt blob is a bad, bad thang.
 	 */
-	if (memcmp(s->digest, digest, 20))
+	if (_verify(r))
 		_panic2(r, "stored blob doesn't match digest", r->digest);
+	if (!s->packed)
+		verify_stamp(s->blob_fd);
+	_close(r, "server blob", &s->blob_fd);
+	return 0;
+}
+
+/*
+ *  Verify the digest of a stored blob for the scrubber, without the panic
+ *  of eat.  Return 0 when the blob matches the digest, 1 when the blob does
+ *  not exist and 2 when the blob is corrupt, like the script fs-frisk.
+ */
+static int
+fs_sha_frisk(struct request *r)
+{
+	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
+	struct stat st;
+	int status = 0;
+
+	if (_open_blob(r) == ENOENT)
+		return 1;
+	if (io_fstat(s->blob_fd, &st))
+		_panic2(r, "fstat(blob) failed", strerror(errno));
+	r->blob_size = s->packed ? s->packed_size : st.st_size;
+	if (_verify(r))
+		status = 2;
+	else if (!s->packed)
+		verify_stamp(s->blob_fd);
 	_close(r, "server blob", &s->blob_fd);
 	return status;
 }
 
+/*
+ *  Does the blob exist, packed or as a file?  Only a stat, for "have",
+ *  so the blob is neither read nor verified.
+ */
+static int
+fs_sha_exists(char *digest)
+{
+	char dir_path[MAX_FILE_PATH_LEN], blob_path[MAX_FILE_PATH_LEN];
+	int status, probe = 0;
+
+	if (pack_exists("sha", digest) >= 0)
+		return 1;
+	layout_path(boot_data.layout, digest, dir_path, blob_path);
+	while ((status = layout_blob_exists(boot_data.layout, blob_path)) == 0)
+		if (!layout_probe(boot_data.layout, probe++, digest, dir_path,
+								blob_path))
+			return 0;
+	if (status < 0)
+		panic4("sha: exists", blob_path, "stat(blob) failed",
+							strerror(errno));
+	return 1;
+}
+
 /*
  *  Write a portion of a blob to local storage and derive a partial digest.
  *  Return 1 if the accumulated digest matches the expected digest,
- *  0 if the partial digest does not match do not match.
+ *  0 if the partial digest does not match do not match, -1 if the
+ *  blob can never match the size declared by the client.
  */
 static int
-eat_chunk(struct request *r, SHA_CTX *p_ctx, int fd, unsigned char *buf,
+eat_chunk(struct request *r, struct hash *p_ctx, int fd, unsigned char *buf,
 	  int buf_size)
 {
 	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
-	SHA_CTX ctx;
 	unsigned char digest[20];
 	static char n[] = "eat_chunk";
 
 	/*
 	 *  Update the incremental digest.
 	 */
-	if (!SHA1_Update(p_ctx, buf, buf_size))
+	if (!hash_update(p_ctx, buf, buf_size))
 		_panic2(r, n, "SHA1_Update() failed");
 
 	/*
@@ -608,15 +789,28 @@ eat_chunk(struct request *r, SHA_CTX *p_ctx, int fd, unsigned char *buf,
 	 */
 	if (io_write_buf(fd, buf, buf_size))
 		_panic2(r, "eat_chunk: write(tmp) failed", strerror(errno));
+	/*
+	 *  Size declared by client, so finalize only after the last byte.
+	 */
+	if (r->declared_size >= 0) {
+		if (r->blob_size < r->declared_size)
+			return 0;
+		if (r->blob_size > r->declared_size)
+			return -1;
+	}
+
 	/*
 	 *  Determine if we have seen the whole blob
 	 *  by copying the incremental digest, finalizing it,
 	 *  then comparing to the expected blob.
 	 */
-	memcpy(&ctx, p_ctx, sizeof *p_ctx);
-	if (!SHA1_Final(digest, &ctx))
+	if (!hash_copy(&s->copy, p_ctx))
+		_panic2(r, n, "hash_copy() failed");
+	if (!hash_final(&s->copy, digest))
 		_panic2(r, n, "SHA1_Final() failed");
-	return memcmp(s->digest, digest, 20) == 0 ? 1 : 0;
+	if (memcmp(s->digest, digest, 20) == 0)
+		return 1;
+	return r->declared_size >= 0 ? -1 : 0;
 }
 
 static int
@@ -629,10 +823,9 @@ fs_sha_put_request(struct request *r)
 static int
 fs_sha_put_bytes(struct request *r)
 {
-	SHA_CTX ctx;
 	char tmp_path[MAX_FILE_PATH_LEN];
-	unsigned char chunk[CHUNK_SIZE], *cp, *cp_end;
-	int status = 0;
+	unsigned char *chunk, *cp, *cp_end;
+	int status = 0, anon = 0;
 	char buf[MSG_SIZE*2];
 	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
 
@@ -653,13 +846,22 @@ fs_sha_put_bytes(struct request *r)
 					(int)time((time_t *)0),
 					getpid(),
 					r->digest);
+	/*
+	 *  With direct commit, stage the blob in an anonymous file, linked
+	 *  into place only after the digest verifies.
+	 */
+	if (direct_commit == 1 &&
+	    (s->blob_fd = tmp_open_anon(r->algorithm, r->digest)) >= 0) {
+		anon = 1;
+		goto staged;
+	}
 	/*
 	 *  Open the file ... need O_LARGEFILE support!!
 	 *  Need to catch EINTR!!!!
 	 */
 	s->blob_fd = io_open(
 			tmp_path,
-			O_CREAT|O_EXCL|O_WRONLY|O_APPEND,
+			O_CREAT|O_EXCL|O_RDWR|O_APPEND,
 			S_IRUSR
 	);
 	if (s->blob_fd < 0) {
@@ -667,11 +869,12 @@ fs_sha_put_bytes(struct request *r)
 							strerror(errno));
 		_panic(r, buf);
 	}
+staged:
 
 	/*
 	 *  Initialize digest of blob being scanned from the client.
 	 */
-	if (!SHA1_Init(&ctx))
+	if (!hash_init(&s->ctx, HASH_SHA1))
 		_panic(r, "SHA1_Init() failed");
 
 	/*
@@ -696,21 +899,28 @@ fs_sha_put_bytes(struct request *r)
 			_panic(r, "r->scan_size != r->blob_size");
 		}
 
-		if (r->scan_size > (int)(sizeof chunk - 1)) {
+		if (r->scan_size > (int)(chunk_size - 1)) {
 			io_unlink(tmp_path);
 			snprintf(buf, sizeof buf, "max=%lu", 
-					(long unsigned)(sizeof chunk - 1));
+					(long unsigned)(chunk_size - 1));
 			_panic2(r, "scanned chunk too big", buf);
 		}
 
 		/*
 		 *  See if the entire blob fits in the first read.
 		 */
-		if (eat_chunk(r, &ctx, s->blob_fd, r->scan_buf, r->scan_size))
+		switch (eat_chunk(r, &s->ctx, s->blob_fd, r->scan_buf,
+							r->scan_size)) {
+		case -1:
+			_error(r, "blob does not match declared size");
+			goto croak;
+		case 1:
 			goto digested;
+		}
 	}
+	chunk = s->chunk;
 	cp = chunk;
-	cp_end = &chunk[sizeof chunk];
+	cp_end = chunk + chunk_size;
 
 	/*
 	 *  Read more chunks until we see the blob.
@@ -731,9 +941,10 @@ again:
 			_error(r, "blob_read(client) of 0 bytes");
 			goto croak;
 		}
-		switch (eat_chunk(r, &ctx, s->blob_fd, cp, nread)) {
+		switch (eat_chunk(r, &s->ctx, s->blob_fd, cp, nread)) {
 		case -1:
-			_panic(r, "eat_chunk(local) failed");
+			_error(r, "blob does not match declared size");
+			goto croak;
 		case 1:
 			goto digested;
 		}
@@ -745,18 +956,35 @@ again:
 digested:
 
 	/*
-	 *  Rename the temp blob file to the final blob path.
+	 *  Rename the temp blob file to the final blob path, unless small
+	 *  enough to pack.
 	 */
 	make_path(r, r->digest);
 
-	arbor_rename(tmp_path,
-		((struct fs_sha_request *)r->open_data)->blob_path);
+	if (pack_small == 1 &&
+	    layout_blob_exists(boot_data.layout, s->blob_path) == 0 &&
+	    pack_put(r->algorithm, r->digest, s->blob_fd))
+		goto cleanup;
+	if (!anon) {
+		arbor_rename(tmp_path, s->blob_path);
+		goto cleanup;
+	}
+	if (arbor_link(s->blob_fd, s->blob_path) == 0)
+		goto cleanup;
+
+	//  not linkable, so copy to the named file, perhaps across devices
+	if (tmp_name_anon(s->blob_fd, tmp_path, errno)) {
+		_error2(r, "tmp_name_anon() failed", strerror(errno));
+		goto croak;
+	}
+	anon = 0;
+	arbor_move(tmp_path, s->blob_path);
 	goto cleanup;
 croak:
 	status = -1;
 cleanup:
 	_close(r, "tmp blob", &s->blob_fd);
-	if (tmp_path[0] && _unlink(r, tmp_path, (int *)0)) {
+	if (!anon && _unlink(r, tmp_path, (int *)0)) {
 		_panic(r, "_unlink() failed");
 		status = -1;
 	}
@@ -791,11 +1019,19 @@ fs_sha_take_reply(struct request *r, char *reply)
 		int exists = 1;
 		char *slash;
 
-		if (_unlink(r, s->blob_path, &exists))
-			_panic(r, "_unlink() failed");
+		if (s->packed) {
+			if (!pack_take(r->algorithm, r->digest))
+				_warn2(r, "expected packed blob does not exist",
+								r->digest);
+			return 0;
+		}
+		if (_unlink_blob(r, &exists))
+			_panic(r, "_unlink_blob() failed");
 		if (!exists)
 			_warn2(r, "expected blob file does not exist",
 							s->blob_path);
+		else
+			exist_count(-1);
 		/*
 		 *  Request trimming the empty directories.
 		 */
@@ -848,9 +1084,9 @@ fs_sha_give_reply(struct request *r, char *reply)
 static int
 fs_sha_digest(struct request *r, int fd, char *hex_digest)
 {
+	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
 	char unsigned buf[4096], digest[20], *d, *d_end;
 	char *h;
-	SHA_CTX ctx;
 	int nread;
 	int tmp_fd = -1;
 	char tmp_path[MAX_FILE_PATH_LEN];
@@ -886,10 +1122,10 @@ fs_sha_digest(struct request *r, int fd, char *hex_digest)
 	if (tmp_fd < 0)
 		_panic3(r, "digest: open(tmp) failed", tmp_path,
 						strerror(errno));
-	if (!SHA1_Init(&ctx))
+	if (!hash_init(&s->ctx, HASH_SHA1))
 		_panic(r, "SHA1_Init() failed");
 	while ((nread = io_read(fd, buf, sizeof buf)) > 0) {
-		if (!SHA1_Update(&ctx, buf, nread))
+		if (!hash_update(&s->ctx, buf, nread))
 			_panic(r, "SHA1_Update(chunk) failed");
 		if (io_write_buf(tmp_fd, buf, nread) != 0)
 			_panic2(r, "digest: write_buf(tmp) failed",
@@ -899,7 +1135,7 @@ fs_sha_digest(struct request *r, int fd, char *hex_digest)
 		_error(r, "digest: _read() failed");
 		goto croak;
 	}
-	if (!SHA1_Final(digest, &ctx))
+	if (!hash_final(&s->ctx, digest))
 		_panic(r, "SHA1_Final() failed");
 
 	status = io_close(tmp_fd);
@@ -947,6 +1183,14 @@ fs_sha_close(struct request *r, int status)
 
 	struct fs_sha_request *s = (struct fs_sha_request *)r->open_data;
 	_close(r, "blob", &s->blob_fd);
+	io_map_close(&s->map);
+
+	//  keep the hash contexts for the next request, unless nested
+
+	hash_swap(&s->ctx, &spare_ctx);
+	hash_swap(&s->copy, &spare_copy);
+	hash_free(&s->ctx);
+	hash_free(&s->copy);
 
 	return 0;
 }
@@ -978,6 +1222,7 @@ fs_sha_boot()
 	 */
 	if (_mkdir((struct request *)0, boot_data.root_dir_path, 1))
 		panic("sha: boot: _mkdir(root_dir) failed");
+	boot_data.layout = layout_open(boot_data.root_dir_path);
 
 	return 0;
 }
@@ -1043,6 +1288,8 @@ struct digest_module fs_sha_module =
 	.give_reply	=	fs_sha_give_reply,
 
 	.eat		=	fs_sha_eat,
+	.frisk		=	fs_sha_frisk,
+	.exists		=	fs_sha_exists,
 
 	.digest		=	fs_sha_digest,
 	.is_digest	=	fs_sha_is_digest,
@@ -0,0 +1,285 @@
+/*
+ *  Synopsis:
+ *	Measure the hash backend of the digest modules in GB/sec.
+ *  Usage:
+ *	hash-bench [total MB] [chunk KB]
+ *	hash-bench 1024 64
+ *	hash-bench finalize [total MB] [chunk KB]
+ *  Description:
+ *	Hash a buffer of random bytes through hash.c, the way each digest
+ *	module digests a blob: one stream of chunk sized updates, then the
+ *	nested hashes of the final digest.
+ *
+ *		sha	SHA1
+ *		btc20	RIPEMD160(SHA256(SHA256))
+ *		bc160	RIPEMD160(SHA256)
+ *
+ *	The default is 1024 MB in 64 KB chunks.  The run of each algorithm
+ *	is repeated three times and the fastest is reported, as
+ *
+ *		<algorithm>	<GB/sec>	<seconds>
+ *
+ *	With "finalize", the cpu seconds per GB of the digest of a put are
+ *	measured, either finalizing a copy of the running digest after every
+ *	chunk, as a put without a byte count must, or finalizing once, as a
+ *	put.<count> does.  The output is
+ *
+ *	<algorithm> <per chunk cpu sec/GB> <once cpu sec/GB>
+ *  Exit Status:
+ *	0	ok
+ *	1	error
+ *  Note:
+ *	Only the cpu is measured; no file is read.  The cpu seconds are the
+ *	user plus system time of getrusage().
+ */
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bio4d.h"
+
+#define RUNS	3
+
+static void
+die(char *msg1, char *msg2)
+{
+	fprintf(stderr, "hash-bench: ERROR: %s: %s\n", msg1, msg2);
+	exit(1);
+}
+
+//  called by hash.c
+
+void
+error3(char *msg1, char *msg2, char *msg3)
+{
+	fprintf(stderr, "hash-bench: ERROR: %s: %s: %s\n", msg1, msg2, msg3);
+}
+
+void
+info3(char *msg1, char *msg2, char *msg3)
+{
+	printf("%s: %s: %s\n", msg1, msg2, msg3);
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		die("clock_gettime() failed", strerror(errno));
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+cpu()
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		die("getrusage() failed", strerror(errno));
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void
+stream(struct hash *h, int type, unsigned char *buf, size_t chunk,
+	size_t total, unsigned char *digest)
+{
+	size_t off;
+
+	if (!hash_init(h, type))
+		die("hash_init() failed", "stream");
+	for (off = 0;  off < total;  off += chunk)
+		if (!hash_update(h, buf, chunk))
+			die("hash_update() failed", "stream");
+	if (!hash_final(h, digest))
+		die("hash_final() failed", "stream");
+}
+
+static void
+sha(unsigned char *buf, size_t chunk, size_t total)
+{
+	static struct hash h;
+	unsigned char digest[20];
+
+	stream(&h, HASH_SHA1, buf, chunk, total, digest);
+}
+
+static void
+btc20(unsigned char *buf, size_t chunk, size_t total)
+{
+	static struct hash h;
+	unsigned char sha_digest[32], sha_sha_digest[32], digest[20];
+
+	stream(&h, HASH_SHA256, buf, chunk, total, sha_digest);
+	if (!hash_digest(HASH_SHA256, sha_digest, 32, sha_sha_digest) ||
+	    !hash_digest(HASH_RIPEMD160, sha_sha_digest, 32, digest))
+		die("hash_digest() failed", "btc20");
+}
+
+static void
+bc160(unsigned char *buf, size_t chunk, size_t total)
+{
+	static struct hash h;
+	unsigned char sha_digest[32], digest[20];
+
+	stream(&h, HASH_SHA256, buf, chunk, total, sha_digest);
+	if (!hash_digest(HASH_RIPEMD160, sha_digest, 32, digest))
+		die("hash_digest() failed", "bc160");
+}
+
+/*
+ *  Finalize a copy of the running digest, as eat_chunk() of each module
+ *  does to see if the whole blob has arrived.
+ */
+static void
+sha_partial(struct hash *running)
+{
+	static struct hash h;
+	unsigned char digest[20];
+
+	if (!hash_copy(&h, running) || !hash_final(&h, digest))
+		die("hash_final() failed", "sha");
+}
+
+static void
+btc20_partial(struct hash *running)
+{
+	static struct hash h;
+	unsigned char sha_digest[32], sha_sha_digest[32], digest[20];
+
+	if (!hash_copy(&h, running) || !hash_final(&h, sha_digest))
+		die("hash_final() failed", "btc20");
+	if (!hash_digest(HASH_SHA256, sha_digest, 32, sha_sha_digest) ||
+	    !hash_digest(HASH_RIPEMD160, sha_sha_digest, 32, digest))
+		die("hash_digest() failed", "btc20");
+}
+
+static void
+bc160_partial(struct hash *running)
+{
+	static struct hash h;
+	unsigned char sha_digest[32], digest[20];
+
+	if (!hash_copy(&h, running) || !hash_final(&h, sha_digest))
+		die("hash_final() failed", "bc160");
+	if (!hash_digest(HASH_RIPEMD160, sha_digest, 32, digest))
+		die("hash_digest() failed", "bc160");
+}
+
+static struct
+{
+	char	*name;
+	void	(*digest)(unsigned char *buf, size_t chunk, size_t total);
+	int	type;
+	void	(*partial)(struct hash *running);
+} algorithms[] =
+{
+	{"sha",		sha,	HASH_SHA1,	sha_partial},
+	{"btc20",	btc20,	HASH_SHA256,	btc20_partial},
+	{"bc160",	bc160,	HASH_SHA256,	bc160_partial},
+	{(char *)0,	0,	0,		0}
+};
+
+/*
+ *  Cpu seconds to digest the stream of a put, finalizing after every chunk
+ *  or only once.
+ */
+static double
+put(int a, unsigned char *buf, size_t chunk, size_t total, int per_chunk)
+{
+	static struct hash h;
+	unsigned char digest[32];
+	size_t off;
+	double start;
+
+	start = cpu();
+	if (!hash_init(&h, algorithms[a].type))
+		die("hash_init() failed", "put");
+	for (off = 0;  off < total;  off += chunk) {
+		if (!hash_update(&h, buf, chunk))
+			die("hash_update() failed", "put");
+		if (per_chunk)
+			(*algorithms[a].partial)(&h);
+	}
+	if (!hash_final(&h, digest))
+		die("hash_final() failed", "put");
+	return cpu() - start;
+}
+
+static void
+finalize(unsigned char *buf, size_t chunk, size_t total)
+{
+	double per_chunk, once, elapsed;
+	int a, run;
+
+	for (a = 0;  algorithms[a].name;  a++) {
+		per_chunk = once = 0;
+		for (run = 0;  run < RUNS;  run++) {
+			elapsed = put(a, buf, chunk, total, 1);
+			if (per_chunk == 0 || elapsed < per_chunk)
+				per_chunk = elapsed;
+			elapsed = put(a, buf, chunk, total, 0);
+			if (once == 0 || elapsed < once)
+				once = elapsed;
+		}
+		printf("%s\t%.3f\t%.3f\n", algorithms[a].name,
+				per_chunk / total * 1e9, once / total * 1e9);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t total = 1024, chunk = 64, i;
+	unsigned char *buf;
+	double start, elapsed, best;
+	int a, run, final = 0;
+
+	if (argc > 1 && strcmp(argv[1], "finalize") == 0) {
+		final = 1;
+		argc--;
+		argv++;
+	}
+	if (argc > 3)
+		die("wrong number of arguments", "hash-bench [MB] [KB]");
+	if (argc > 1 && (total = strtoul(argv[1], (char **)0, 10)) == 0)
+		die("total MB not > 0", argv[1]);
+	if (argc > 2 && (chunk = strtoul(argv[2], (char **)0, 10)) == 0)
+		die("chunk KB not > 0", argv[2]);
+	total *= 1024 * 1024;
+	chunk *= 1024;
+	total -= total % chunk;
+	if (total == 0)
+		die("total MB < chunk KB", argv[1]);
+
+	if (hash_boot())
+		die("hash_boot() failed", "no digest");
+
+	//  hash the same chunk over and over, so the buffer stays in cache
+
+	if ((buf = malloc(chunk)) == (unsigned char *)0)
+		die("malloc(chunk) failed", strerror(errno));
+	srandom(getpid());
+	for (i = 0;  i < chunk;  i++)
+		buf[i] = random();
+
+	if (final) {
+		finalize(buf, chunk, total);
+		exit(0);
+	}
+	for (a = 0;  algorithms[a].name;  a++) {
+		best = 0;
+		for (run = 0;  run < RUNS;  run++) {
+			start = now();
+			(*algorithms[a].digest)(buf, chunk, total);
+			elapsed = now() - start;
+			if (best == 0 || elapsed < best)
+				best = elapsed;
+		}
+		printf("%s\t%.2f\t%.3f\n", algorithms[a].name,
+					total / best / 1e9, best);
+	}
+	exit(0);
+}
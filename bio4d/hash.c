@@ -0,0 +1,141 @@
+/*
+ *  Synopsis:
+ *	Incremental hash backend for the fs_* digest modules.
+ *  Description:
+ *	All digest modules hash through the calls below instead of the
+ *	legacy SHA1_*(), SHA256_*() and RIPEMD160_*() functions.  The
+ *	backend is OpenSSL EVP, which picks SHA-NI, AVX2 or generic code for
+ *	the local cpu at run time.  Replacing this file replaces the hash
+ *	library for every module.
+ *
+ *	The message digest types are fetched once by hash_boot() in the
+ *	listener, so request processes inherit them instead of paying for a
+ *	provider lookup on every init.
+ *
+ *	All calls but hash_boot(), hash_swap() and hash_free() return 1 on
+ *	success and 0 on error, like the OpenSSL calls they replace.
+ *  Note:
+ *	A struct hash allocates an EVP context on first init and keeps it
+ *	until hash_free().  The digest modules keep their contexts in the
+ *	per request data and hand them to the next request with hash_swap(),
+ *	so a worker allocates each context once.  hash_digest() keeps a
+ *	single static context of its own, since it never outlives a call.
+ *
+ *	There is no multi-buffer mode.  A request process digests one blob
+ *	at a time, so there are no other streams to fill the lanes, and
+ *	OpenSSL offers no public multi-buffer api.
+ */
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+
+#include "bio4d.h"
+
+static char	*names[] =
+{
+	"SHA1",
+	"SHA256",
+	"RIPEMD160"
+};
+
+static const EVP_MD	*types[HASH_TYPE_COUNT];
+
+static const EVP_MD *
+fetch(int type)
+{
+	if (types[type])
+		return types[type];
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	types[type] = EVP_MD_fetch((OSSL_LIB_CTX *)0, names[type], (char *)0);
+#else
+	types[type] = EVP_get_digestbyname(names[type]);
+#endif
+	return types[type];
+}
+
+/*
+ *  Fetch all message digest types before request processes fork.
+ */
+int
+hash_boot()
+{
+	static char n[] = "hash_boot";
+	int i;
+
+	info3(n, "EVP backend", (char *)OpenSSL_version(OPENSSL_VERSION));
+	for (i = 0;  i < HASH_TYPE_COUNT;  i++)
+		if (fetch(i) == (EVP_MD *)0) {
+			error3(n, "can not fetch digest", names[i]);
+			return -1;
+		}
+	return 0;
+}
+
+int
+hash_init(struct hash *h, int type)
+{
+	const EVP_MD *md = fetch(type);
+
+	if (md == (EVP_MD *)0)
+		return 0;
+	if (h->ctx == (EVP_MD_CTX *)0 &&
+	    (h->ctx = EVP_MD_CTX_new()) == (EVP_MD_CTX *)0)
+		return 0;
+	return EVP_DigestInit_ex(h->ctx, md, (ENGINE *)0);
+}
+
+int
+hash_update(struct hash *h, void *buf, size_t size)
+{
+	return EVP_DigestUpdate(h->ctx, buf, size);
+}
+
+int
+hash_final(struct hash *h, unsigned char *digest)
+{
+	return EVP_DigestFinal_ex(h->ctx, digest, (unsigned int *)0);
+}
+
+/*
+ *  Copy the state of a running hash, so the copy can be finalized while
+ *  the original keeps going.
+ */
+int
+hash_copy(struct hash *to, struct hash *from)
+{
+	if (to->ctx == (EVP_MD_CTX *)0 &&
+	    (to->ctx = EVP_MD_CTX_new()) == (EVP_MD_CTX *)0)
+		return 0;
+	return EVP_MD_CTX_copy_ex(to->ctx, from->ctx);
+}
+
+/*
+ *  Exchange the EVP contexts of two hashes.
+ */
+void
+hash_swap(struct hash *a, struct hash *b)
+{
+	EVP_MD_CTX *ctx = a->ctx;
+
+	a->ctx = b->ctx;
+	b->ctx = ctx;
+}
+
+void
+hash_free(struct hash *h)
+{
+	EVP_MD_CTX_free(h->ctx);
+	h->ctx = (EVP_MD_CTX *)0;
+}
+
+/*
+ *  Hash a single buffer, typically the 32 byte digest in a nested hash.
+ */
+int
+hash_digest(int type, void *buf, size_t size, unsigned char *digest)
+{
+	static struct hash h;
+
+	return hash_init(&h, type) &&
+	       hash_update(&h, buf, size) &&
+	       hash_final(&h, digest);
+}
@@ -19,6 +19,7 @@
  *	the network.
  */
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/select.h>
 #include <sys/types.h>
@@ -34,6 +35,8 @@
 #include "macosx.h"
 #endif
 
+int	mmap_blobs = -1;
+
 int
 io_open(char *path, int flags, int mode)
 {
@@ -47,6 +50,19 @@ again:
 	return -1;
 }
 
+int
+io_openat(int dir_fd, char *path, int flags, int mode)
+{
+	int fd;
+again:
+	fd = openat(dir_fd, path, flags, mode);
+	if (fd >= 0)
+		return fd;
+	if (errno == EINTR)
+		goto again;
+	return -1;
+}
+
 int
 io_open_append(char *path)
 {
@@ -101,6 +117,23 @@ again:
 	return (size_t)-1;
 }
 
+/*
+ *  Interuptable writev() of a file descriptor.
+ *  Caller can depend on correct value of errno.
+ */
+ssize_t
+io_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	ssize_t nwritten;
+again:
+	nwritten = writev(fd, iov, iovcnt);
+	if (nwritten >= 0)
+		return nwritten;
+	if (errno == EINTR)
+		goto again;
+	return (size_t)-1;
+}
+
 /*
  *  Write exactly count bytes to stream.
  *  Return 0 on success, -1 on failure, with errno set.
@@ -147,6 +180,20 @@ again:
 	return -1;
 }
 
+int
+io_dup(int fd)
+{
+	int new_fd;
+
+again:
+	new_fd = dup(fd);
+	if (new_fd > -1)
+		return new_fd;
+	if (errno == EINTR)
+		goto again;
+	return -1;
+}
+
 int
 io_stat(const char *path, struct stat *st)
 {
@@ -171,6 +218,18 @@ again:
 	return 0;
 }
 
+int
+io_fstatat(int dir_fd, const char *path, struct stat *st)
+{
+again:
+	if (fstatat(dir_fd, path, st, 0)) {
+		if (errno == EINTR)
+			goto again;
+		return -1;
+	}
+	return 0;
+}
+
 int
 io_path_exists(char *path)
 {
@@ -244,6 +303,20 @@ again:
 	return -1;
 }
 
+/*
+ *  Unlike io_unlink(), a missing file is an error, so the caller can tell.
+ */
+int
+io_unlinkat(int dir_fd, const char *path)
+{
+again:
+	if (unlinkat(dir_fd, path, 0) == 0)
+		return 0;
+	if (errno == EINTR)
+		goto again;
+	return -1;
+}
+
 int
 io_rmdir(const char *path)
 {
@@ -320,7 +393,9 @@ void
 io_msg_new(struct io_message *ip, int fd)
 {
 	ip->fd = fd;
+	ip->payload = ip->buf;
 	ip->len = 0;
+	ip->buf_off = ip->buf_end = 0;
 }
 
 /*
@@ -328,90 +403,109 @@ io_msg_new(struct io_message *ip, int fd)
  *  Messages in the stream are introduced with a leading length byte followed
  *  by upto 255 payload bytes.
  *
+ *  A single read() slurps as many messages as the stream holds, so a busy
+ *  logger drains many messages per system call.  On return ip->payload
+ *  points into the buffer and is valid until the next io_msg_read().
+ *
  *  Returns:
  *	-1	errno indicates
  *	0	end of file (not end of message)
  *	1	message read
- *
- *  Note:
- *	This is the inefficent but correct two read() version.
- *	This algorithm will be replaced with a buffered version
- *	more appropriate to the fast logger processes.
  */
 int
 io_msg_read(struct io_message *ip)
 {
-	int nread, fd;
+	ssize_t nread;
+	size_t avail;
 	unsigned char len, *p;
 
 	if (ip == (struct io_message *)0 || ip->fd < 0) {
 		errno = EINVAL;
 		return -1;
 	}
-
-	fd = ip->fd;
 	ip->len = 0;
-
-	/*
-	 *  Read the single byte payload length.
-	 */
-	nread = io_read(fd, &len, 1);
-	if (nread <= 0)
-		return nread;
-	if (len == 0) {			/* no zero length messages */
+again:
+	p = ip->buf + ip->buf_off;
+	avail = ip->buf_end - ip->buf_off;
+	if (avail > 0) {
+		len = *p;
+		if (len == 0) {			/* no zero length messages */
 #ifdef ENODATA
-		errno = ENODATA;
+			errno = ENODATA;
 #else
-		errno = EBADMSG;
+			errno = EBADMSG;
 #endif
-		return -1;
+			return -1;
+		}
+		if (avail > len) {
+			ip->payload = p + 1;
+			ip->len = len;
+			ip->buf_off += len + 1;
+			return 1;
+		}
+
+		/*
+		 *  Partial message at end of buffer, so shift to the front.
+		 */
+		memmove(ip->buf, p, avail);
 	}
+	ip->buf_off = 0;
+	ip->buf_end = avail;
 
-	/*
-	 *  Multiple blocking reads to slurp up the payload.
-	 */
-	p = ip->payload;
-	while (ip->len < len) {
-		nread = io_read(fd, p, len - ip->len);
-		if (nread < -1)
-			return -1;
+	nread = io_read(ip->fd, ip->buf + avail, sizeof ip->buf - avail);
+	if (nread < 0)
+		return -1;
+	if (nread == 0) {
 		/*
 		 *  End of file before full payload slurped.
 		 */
-		if (nread == 0) {
+		if (avail > 0) {
 			errno = EBADMSG;
 			return -1;
 		}
-		p += nread;
-		ip->len += nread;
+		return 0;
 	}
-	return 1;
+	ip->buf_end += nread;
+	goto again;
+}
+
+/*
+ *  Is a complete message already buffered, so io_msg_read() will not block?
+ */
+int
+io_msg_buffered(struct io_message *ip)
+{
+	size_t avail = ip->buf_end - ip->buf_off;
+
+	return avail > 0 && avail > ip->buf[ip->buf_off];
 }
 
 /*
  *  Write an entire payload as a message.  Payload must be <= MSG_SIZE.
+ *  The length byte and payload go out in a single writev(), which is
+ *  atomic on a pipe, since MSG_SIZE + 1 < PIPE_BUF.
  *
  *  Returns:
  *  	0	message written ok
  *  	-1	error occured, errno set to error
- *  Note:
- *	Replace buffered version with writev()!
  */
 ssize_t
 io_msg_write(int fd, void *payload, unsigned char count)
 {
-	ssize_t nwritten, nwrite;
-	unsigned char buf[MSG_SIZE + 1];	// payload plus len byte
+	ssize_t nwritten;
+	struct iovec iov[2];
 
 	if (fd < 0 || payload == (void *)0 || count == 0) {
 		errno = EINVAL;
 		return -1;
 	}
-	buf[0] = count;
-	nwrite = count + 1;
-	memcpy(buf + 1, payload, count);
-	nwritten = io_write(fd, buf, nwrite);
-	if (nwritten == nwrite)
+	iov[0].iov_base = &count;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = payload;
+	iov[1].iov_len = count;
+
+	nwritten = io_writev(fd, iov, 2);
+	if (nwritten == count + 1)
 		return 0;
 	if (nwritten == -1)
 		return (size_t)-1;
@@ -523,3 +617,86 @@ again:
 		goto again;
 	return -1;
 }
+
+/*
+ *  Map the open blob file on the first call, when enabled by --mmap-blobs
+ *  and the file is at least IO_MAP_MIN_SIZE bytes.
+ */
+static void
+map_open(struct io_map *mp, int fd)
+{
+	struct stat st;
+	void *base;
+
+	mp->state = -1;
+	if (mmap_blobs != 1)
+		return;
+	if (io_fstat(fd, &st))
+		panic3("io_map_read", "fstat(blob) failed", strerror(errno));
+	if (st.st_size < IO_MAP_MIN_SIZE || (ui64)st.st_size > (size_t)-1)
+		return;
+
+	//  file systems unable to map, such as some fuse, fall back to read()
+
+	base = mmap((void *)0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd,
+								(off_t)0);
+	if (base == MAP_FAILED)
+		return;
+	madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+	mp->base = (unsigned char *)base;
+	mp->size = (size_t)st.st_size;
+	mp->offset = 0;
+	mp->state = 1;
+}
+
+/*
+ *  Point *p_buf at the next window of the mapped blob file, returning the
+ *  length of the window, or 0 at the end of the blob.  Returns -1 when the
+ *  file is not mapped, so the caller reads instead.
+ *
+ *  The next window is read ahead while the caller digests and writes
+ *  this one.  Windows behind are released, so a multi-gigabyte blob never
+ *  grows the process, though the pages stay in the page cache.
+ *
+ *  Note:
+ *	A blob file truncated while mapped raises SIGBUS, but blob files
+ *	are never rewritten in place.
+ */
+int
+io_map_read(struct io_map *mp, int fd, unsigned char **p_buf)
+{
+	size_t n, ahead;
+
+	if (mp->state == 0)
+		map_open(mp, fd);
+	if (mp->state < 0)
+		return -1;
+	if (mp->offset >= mp->size) {
+		io_map_close(mp);
+		return 0;
+	}
+	if (mp->offset > 0)
+		madvise(mp->base + mp->offset - IO_MAP_WINDOW, IO_MAP_WINDOW,
+							MADV_DONTNEED);
+	n = mp->size - mp->offset;
+	if (n > IO_MAP_WINDOW)
+		n = IO_MAP_WINDOW;
+	ahead = mp->size - mp->offset - n;
+	if (ahead > 0)
+		madvise(mp->base + mp->offset + n,
+			ahead > IO_MAP_WINDOW ? IO_MAP_WINDOW : ahead,
+			MADV_WILLNEED);
+	*p_buf = mp->base + mp->offset;
+	mp->offset += n;
+	return (int)n;
+}
+
+void
+io_map_close(struct io_map *mp)
+{
+	if (mp->base == (unsigned char *)0)
+		return;
+	if (munmap(mp->base, mp->size))
+		panic3("io_map_close", "munmap(blob) failed", strerror(errno));
+	mp->base = (unsigned char *)0;
+}
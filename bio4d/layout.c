@@ -0,0 +1,652 @@
+/*
+ *  Synopsis:
+ *	Versioned directory layout of the blob files in data/fs_<algo>.
+ *  Description:
+ *	The digest modules derive the directory of a blob from leading hex
+ *	characters of the digest.  The layout of the directories is
+ *	described by the text file data/fs_<algo>/layout, with one line per
+ *	layout version
+ *
+ *		<version>\t<width>[,<width> ...]
+ *
+ *	where each <width> is the count of hex characters in the directory
+ *	name at that level.  For example, "1\t3,3" is the classic layout
+ *
+ *		57c/d59/57cd5957fbc764c5ee9862f76287d09d2170b9ef
+ *
+ *	and is assumed when no layout file exists.  Lines starting with '#'
+ *	are ignored.
+ *
+ *	The last line is the current layout, where new blobs are stored.
+ *	To re-shard a tree, append a new version to the layout file and
+ *	reboot.  The line before the last is then the previous layout and a
+ *	migrator process moves every blob from the previous to the current
+ *	layout in the background.  Until the migration completes, a blob not
+ *	found in the current layout is probed in the previous layout, then
+ *	the current layout again, in case the migrator moved the blob between
+ *	the first two probes.  When done, the migrator rewrites the layout
+ *	file with only the current version and tells all processes to stop
+ *	probing.
+ *  Note:
+ *	Only one previous layout may be in migration.
+ *
+ *	The migrator is idempotent, so a migration interrupted by shutdown
+ *	just resumes upon the next boot.
+ *
+ *	Blobs on a different volume than the current layout, say through a
+ *	mount in the old tree, are skipped and the migration never completes.
+ *
+ *	Blob files are opened and unlinked relative to a descriptor of
+ *	data/fs_<algo> opened at boot, so the kernel never walks data/ per
+ *	request.  A long lived process, like a prefork worker, also caches
+ *	descriptors of recently used first level directories, so an open
+ *	only walks the remaining levels.  The arborist may remove a cached,
+ *	empty directory, so an open that fails through a removed directory
+ *	drops the descriptor and tries again from the root.
+ */
+#include <sys/mman.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "bio4d.h"
+
+#define MAX_LAYOUT_LEVEL	4
+#define MAX_LAYOUT_WIDTH	4
+#define MAX_LAYOUT		8	//  one per digest module
+
+struct layout_version
+{
+	int	version;		//  0 when no layout
+	int	level_count;
+	int	width[MAX_LAYOUT_LEVEL];
+};
+
+struct blob_layout
+{
+	char			root_dir_path[MAX_FILE_PATH_LEN];
+	struct layout_version	current;
+	struct layout_version	previous;
+
+	int			*migrating;	//  shared with migrator
+
+	int			root_fd;	//  root_dir_path, for *at()
+	int			root_len;
+};
+
+/*
+ *  Descriptor of a first level directory, cached per process.
+ */
+struct dir_cache
+{
+	struct blob_layout	*layout;	//  null when empty
+	char			name[MAX_LAYOUT_WIDTH + 1];
+	int			fd;
+	ui64			used;		//  least recently used is evicted
+};
+
+#define DIR_CACHE_SIZE		64
+#define DIR_CACHE_IDLE		(4 * DIR_CACHE_SIZE)	//  lookups
+
+#ifdef O_PATH
+#define DIR_OPEN_FLAGS		(O_PATH | O_DIRECTORY)
+#else
+#define DIR_OPEN_FLAGS		(O_RDONLY | O_DIRECTORY)
+#endif
+
+extern pid_t		logged_pid;
+
+pid_t			migrate_pid = 0;
+
+static struct blob_layout	layouts[MAX_LAYOUT];
+static int			layout_count = 0;
+
+static int			*migrate_flags = (int *)0;
+
+static struct dir_cache		dir_cache[DIR_CACHE_SIZE];
+static ui64			dir_cache_clock = 0;
+static int			dir_cache_on = 0;
+
+static char	classic_layout[] = "1\t3,3";
+
+/*
+ *  Parse a layout line "<version>\t<width>[,<width> ...]".
+ *  Return 0 when valid, -1 otherwise.
+ */
+static int
+parse(char *line, struct layout_version *lv)
+{
+	char *p = line;
+	int n, total = 0;
+
+	lv->version = 0;
+	while (isdigit(*p))
+		lv->version = lv->version * 10 + (*p++ - '0');
+	if (lv->version <= 0 || *p++ != '\t')
+		return -1;
+	lv->level_count = 0;
+	while (*p) {
+		if (lv->level_count == MAX_LAYOUT_LEVEL)
+			return -1;
+		if (!isdigit(*p))
+			return -1;
+		n = *p++ - '0';
+		if (n < 1 || n > MAX_LAYOUT_WIDTH)
+			return -1;
+		lv->width[lv->level_count++] = n;
+		total += n;
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return -1;
+	}
+
+	//  all digests have at least 40 hex characters
+
+	if (total > 16)
+		return -1;
+	return 0;
+}
+
+static void
+format(struct layout_version *lv, char *buf, size_t size)
+{
+	char *p;
+	int i;
+
+	snprintf(buf, size, "%d\t", lv->version);
+	p = buf + strlen(buf);
+	for (i = 0;  i < lv->level_count;  i++) {
+		if (i > 0)
+			*p++ = ',';
+		*p++ = '0' + lv->width[i];
+	}
+	*p = 0;
+}
+
+static void
+build_path(
+	char *root_dir_path,
+	struct layout_version *lv,
+	char *digest,
+	char *dir_path,
+	char *blob_path
+) {
+	char *p, *q;
+	int i, j;
+
+	strcpy(dir_path, root_dir_path);
+	p = dir_path + strlen(dir_path);
+	q = digest;
+	for (i = 0;  i < lv->level_count;  i++) {
+		*p++ = '/';
+		for (j = 0;  j < lv->width[i];  j++)
+			*p++ = *q++;
+	}
+	*p++ = '/';
+	*p = 0;
+
+	blob_path[0] = 0;
+	jmscott_strcat2(blob_path, MAX_FILE_PATH_LEN, dir_path, digest);
+}
+
+/*
+ *  Read the layout file for a digest module.  Called by the boot of the
+ *  module in the listener.
+ */
+struct blob_layout *
+layout_open(char *root_dir_path)
+{
+	struct blob_layout *lp;
+	char path[MAX_FILE_PATH_LEN], text[4096], buf[MSG_SIZE];
+	char *line, *next;
+	struct layout_version lv;
+	int status;
+	static char n[] = "layout_open";
+
+	if (layout_count == MAX_LAYOUT)
+		panic2(n, "too many layouts");
+	lp = &layouts[layout_count++];
+	memset(lp, 0, sizeof *lp);
+	strcpy(lp->root_dir_path, root_dir_path);
+	lp->root_len = strlen(root_dir_path);
+	lp->root_fd = io_open(root_dir_path, DIR_OPEN_FLAGS, 0);
+	if (lp->root_fd < 0)
+		panic4(n, "open(root dir) failed", root_dir_path,
+							strerror(errno));
+
+	snprintf(path, sizeof path, "%s/layout", root_dir_path);
+	status = io_path_exists(path);
+	if (status < 0)
+		panic4(n, "stat(layout) failed", path, strerror(errno));
+	if (status == 0)
+		strcpy(text, classic_layout);
+	else if (slurp_text_file(path, text, sizeof text))
+		panic3(n, "slurp_text_file(layout) failed", path);
+
+	for (line = text;  line && *line;  line = next) {
+		next = index(line, '\n');
+		if (next)
+			*next++ = 0;
+		if (line[0] == '#' || line[0] == 0)
+			continue;
+		if (parse(line, &lv))
+			panic4(n, "bad layout line", path, line);
+		if (lp->current.version > 0 &&
+		    lv.version <= lp->current.version)
+			panic4(n, "layout version not increasing", path,
+									line);
+		if (lp->previous.version > 0)
+			panic3(n, "previous layout still in migration", path);
+		if (lp->current.version > 0)
+			lp->previous = lp->current;
+		lp->current = lv;
+	}
+	if (lp->current.version == 0)
+		panic3(n, "no layout version", path);
+
+	format(&lp->current, buf, sizeof buf);
+	info4(n, root_dir_path, "layout", buf);
+
+	if (lp->previous.version == 0)
+		return lp;
+
+	format(&lp->previous, buf, sizeof buf);
+	info4(n, root_dir_path, "migrating from layout", buf);
+
+	if (migrate_flags == (int *)0) {
+		migrate_flags = (int *)mmap(
+				(void *)0,
+				MAX_LAYOUT * sizeof *migrate_flags,
+				PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANON,
+				-1,
+				(off_t)0
+		);
+		if (migrate_flags == MAP_FAILED)
+			panic3(n, "mmap(migrate flags) failed",
+							strerror(errno));
+	}
+	lp->migrating = &migrate_flags[lp - layouts];
+	*lp->migrating = 1;
+	return lp;
+}
+
+/*
+ *  Derive the directory and file paths of the blob in the current layout.
+ *  The directory path ends with a slash.
+ */
+void
+layout_path(
+	struct blob_layout *lp,
+	char *digest,
+	char *dir_path,
+	char *blob_path
+) {
+	build_path(lp->root_dir_path, &lp->current, digest,
+						dir_path, blob_path);
+}
+
+/*
+ *  Cache the descriptors of first level directories in this long lived
+ *  process.
+ */
+void
+layout_cache_dirs()
+{
+	dir_cache_on = 1;
+}
+
+/*
+ *  Find the directory descriptor and the path relative to it of a path
+ *  under the root of the layout.  Any other path is relative to the
+ *  current directory.
+ */
+static int
+dir_at(struct blob_layout *lp, char *path, char **rel_path)
+{
+	struct dir_cache *dp, *old;
+	char *rel, *slash, name[MAX_LAYOUT_WIDTH + 1];
+	int i, fd;
+	size_t len;
+
+	if (strncmp(path, lp->root_dir_path, lp->root_len) ||
+	    path[lp->root_len] != '/') {
+		*rel_path = path;
+		return AT_FDCWD;
+	}
+	rel = *rel_path = path + lp->root_len + 1;
+
+	slash = index(rel, '/');
+	if (!dir_cache_on || slash == (char *)0 ||
+	    (len = slash - rel) > MAX_LAYOUT_WIDTH)
+		return lp->root_fd;
+
+	dir_cache_clock++;
+	old = &dir_cache[0];
+	for (i = 0;  i < DIR_CACHE_SIZE;  i++) {
+		dp = &dir_cache[i];
+		if (dp->layout == lp && strncmp(dp->name, rel, len) == 0 &&
+		    dp->name[len] == 0) {
+			dp->used = dir_cache_clock;
+			*rel_path = slash + 1;
+			return dp->fd;
+		}
+		if (dp->used < old->used)
+			old = dp;
+	}
+
+	/*
+	 *  Evict only a directory not used recently, so gets spread over
+	 *  more directories than fit do not pay for an open and close of a
+	 *  directory per blob.
+	 */
+	if (old->layout && dir_cache_clock - old->used < DIR_CACHE_IDLE)
+		return lp->root_fd;
+
+	memcpy(name, rel, len);
+	name[len] = 0;
+	fd = io_openat(lp->root_fd, name, DIR_OPEN_FLAGS, 0);
+	if (fd < 0)
+		return lp->root_fd;	//  let the caller see the error
+	if (old->layout && io_close(old->fd))
+		panic3("layout", "close(dir cache) failed", strerror(errno));
+	old->layout = lp;
+	strcpy(old->name, name);
+	old->fd = fd;
+	old->used = dir_cache_clock;
+	*rel_path = slash + 1;
+	return fd;
+}
+
+/*
+ *  After a file was not found through a directory descriptor, was the
+ *  directory removed?  If so, forget the cached descriptor.
+ */
+static int
+dir_removed(struct blob_layout *lp, int dir_fd)
+{
+	struct stat st;
+	int i;
+
+	if (dir_fd == AT_FDCWD || dir_fd == lp->root_fd)
+		return 0;
+	if (io_fstat(dir_fd, &st))
+		panic3("layout", "fstat(dir cache) failed", strerror(errno));
+	if (st.st_nlink > 0) {
+		errno = ENOENT;
+		return 0;
+	}
+	for (i = 0;  i < DIR_CACHE_SIZE;  i++)
+		if (dir_cache[i].layout && dir_cache[i].fd == dir_fd) {
+			io_close(dir_fd);
+			memset(&dir_cache[i], 0, sizeof dir_cache[i]);
+			break;
+		}
+	return 1;
+}
+
+/*
+ *  Open a blob file for reading.  Return the descriptor or -1 with errno
+ *  set, like io_open().
+ */
+int
+layout_open_blob(struct blob_layout *lp, char *blob_path)
+{
+	char *rel_path;
+	int dir_fd, fd;
+
+	do {
+		dir_fd = dir_at(lp, blob_path, &rel_path);
+		fd = io_openat(dir_fd, rel_path, O_RDONLY, 0);
+	} while (fd < 0 && errno == ENOENT && dir_removed(lp, dir_fd));
+	return fd;
+}
+
+/*
+ *  Unlink a blob file.  Return 0 when unlinked or not found, -1 with
+ *  errno set on error, like io_unlink().  When exists is not null,
+ *  *exists tells if the file was found.
+ */
+int
+layout_unlink_blob(struct blob_layout *lp, char *blob_path, int *exists)
+{
+	char *rel_path;
+	int dir_fd, status;
+
+	do {
+		dir_fd = dir_at(lp, blob_path, &rel_path);
+		status = io_unlinkat(dir_fd, rel_path);
+	} while (status && errno == ENOENT && dir_removed(lp, dir_fd));
+	if (exists)
+		*exists = status == 0;
+	if (status && errno == ENOENT)
+		return 0;
+	return status;
+}
+
+/*
+ *  Does the blob file exist?  Return 1 when exists, 0 when not, -1 on
+ *  error, like io_path_exists().
+ */
+int
+layout_blob_exists(struct blob_layout *lp, char *blob_path)
+{
+	struct stat st;
+	char *rel_path;
+	int dir_fd, status;
+
+	do {
+		dir_fd = dir_at(lp, blob_path, &rel_path);
+		status = io_fstatat(dir_fd, rel_path, &st);
+	} while (status && errno == ENOENT && dir_removed(lp, dir_fd));
+	if (status)
+		return errno == ENOENT ? 0 : -1;
+	return 1;
+}
+
+/*
+ *  Rederive the paths of a blob not found on probe number "probe", while
+ *  the previous layout is migrating.  Returns 1 when a new path must be
+ *  tried, 0 when the blob does not exist.
+ */
+int
+layout_probe(
+	struct blob_layout *lp,
+	int probe,
+	char *digest,
+	char *dir_path,
+	char *blob_path
+) {
+	if (lp->migrating == (int *)0 || *lp->migrating == 0)
+		return 0;
+	switch (probe) {
+	case 0:
+		build_path(lp->root_dir_path, &lp->previous, digest,
+							dir_path, blob_path);
+		return 1;
+	case 1:
+		build_path(lp->root_dir_path, &lp->current, digest,
+							dir_path, blob_path);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+is_hex_name(char *name, int width)
+{
+	int i;
+
+	for (i = 0;  i < width;  i++)
+		if (!isxdigit(name[i]) || isupper(name[i]))
+			return 0;
+	return name[i] == 0;
+}
+
+/*
+ *  Move the blobs under dir_path, at the given level of the previous
+ *  layout, into the current layout.
+ */
+static void
+migrate_dir(
+	struct blob_layout *lp,
+	char *dir_path,
+	int level,
+	ui64 *moved,
+	ui64 *skipped
+) {
+	DIR *dirp;
+	struct dirent *dp;
+	struct stat st;
+	char path[MAX_FILE_PATH_LEN];
+	char tgt_dir[MAX_FILE_PATH_LEN], tgt_path[MAX_FILE_PATH_LEN];
+	char *name;
+	int is_leaf = level == lp->previous.level_count;
+	static char n[] = "migrate_dir";
+
+	dirp = io_opendir(dir_path);
+	if (dirp == (DIR *)0) {
+		if (errno == ENOENT)		//  trimmed by the arborist
+			return;
+		panic4(n, "opendir() failed", dir_path, strerror(errno));
+	}
+	//  reset errno before each readdir() to detect an error at the end
+
+	for (errno = 0;  (dp = io_readdir(dirp));  errno = 0) {
+		name = dp->d_name;
+		if (name[0] == '.')
+			continue;
+		if (!is_leaf && !is_hex_name(name, lp->previous.width[level]))
+			continue;
+		if (snprintf(path, sizeof path, "%s/%s", dir_path, name) >=
+		    (int)sizeof path)
+			panic4(n, "path too long", dir_path, name);
+		if (io_lstat(path, &st)) {
+			if (errno == ENOENT)
+				continue;
+			panic4(n, "lstat() failed", path, strerror(errno));
+		}
+
+		//  descend the previous layout, ignoring current layout blobs
+
+		if (!is_leaf) {
+			if (S_ISDIR(st.st_mode))
+				migrate_dir(lp, path, level + 1, moved, skipped);
+			continue;
+		}
+		if (!S_ISREG(st.st_mode))
+			continue;
+
+		build_path(lp->root_dir_path, &lp->current, name,
+							tgt_dir, tgt_path);
+		if (strcmp(path, tgt_path) == 0)
+			continue;
+		if (arbor_publish(path, tgt_path) < 0) {
+			warn4(n, "blob on other device, not moved", path,
+							strerror(errno));
+			(*skipped)++;
+			continue;
+		}
+		(*moved)++;
+	}
+	if (errno)
+		panic4(n, "readdir() failed", dir_path, strerror(errno));
+	if (io_closedir(dirp))
+		panic4(n, "closedir() failed", dir_path, strerror(errno));
+
+	//  the arborist removes the empty directories of the previous layout
+
+	if (is_leaf && level > 0)
+		arbor_trim(dir_path);
+}
+
+static void
+migrate(struct blob_layout *lp)
+{
+	char path[MAX_FILE_PATH_LEN], tmp_path[MAX_FILE_PATH_LEN];
+	char buf[MSG_SIZE], line[16 + 2 * MAX_LAYOUT_LEVEL];
+	ui64 moved = 0, skipped = 0;
+	int fd;
+	static char n[] = "migrate";
+
+	info3(n, "starting", lp->root_dir_path);
+	migrate_dir(lp, lp->root_dir_path, 0, &moved, &skipped);
+
+	snprintf(buf, sizeof buf, "moved %llu blobs, skipped %llu",
+							moved, skipped);
+	info3(n, lp->root_dir_path, buf);
+	if (skipped > 0) {
+		warn3(n, "migration incomplete", lp->root_dir_path);
+		return;
+	}
+
+	/*
+	 *  Replace the layout file with only the current version.
+	 */
+	if (snprintf(path, sizeof path, "%s/layout", lp->root_dir_path) >=
+	    (int)sizeof path ||
+	    snprintf(tmp_path, sizeof tmp_path, "%s/layout.tmp",
+				lp->root_dir_path) >= (int)sizeof tmp_path)
+		panic3(n, "path too long", lp->root_dir_path);
+	format(&lp->current, line, sizeof line);
+	snprintf(buf, sizeof buf,
+		"#  version<tab>hex width of each directory level\n%s\n", line);
+
+	fd = io_open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY,
+					S_IRUSR | S_IWUSR | S_IRGRP);
+	if (fd < 0)
+		panic4(n, "open(layout tmp) failed", tmp_path, strerror(errno));
+	if (io_write_buf(fd, buf, strlen(buf)))
+		panic4(n, "write(layout tmp) failed", tmp_path,strerror(errno));
+	if (io_close(fd))
+		panic4(n, "close(layout tmp) failed", tmp_path,strerror(errno));
+	if (io_rename(tmp_path, path))
+		panic4(n, "rename(layout tmp) failed", path, strerror(errno));
+
+	*lp->migrating = 0;
+	info4(n, lp->root_dir_path, "migrated to layout", line);
+}
+
+/*
+ *  Fork a migrator process when any layout has a previous version.
+ *  Called by the listener after the arborist is running.
+ */
+void
+layout_migrate()
+{
+	pid_t pid;
+	int i;
+	static char n[] = "layout_migrate";
+
+	for (i = 0;  i < layout_count;  i++)
+		if (layouts[i].previous.version > 0)
+			break;
+	if (i == layout_count)
+		return;
+
+	pid = fork();
+	if (pid < 0)
+		panic3(n, "fork() failed", strerror(errno));
+	if (pid > 0) {
+		migrate_pid = pid;
+		return;
+	}
+
+	logged_pid = migrate_pid = getpid();
+	ps_title_set("bio4d-migrate", (char *)0, (char *)0);
+	info2(n, "migrator process started");
+
+	//  yield to requests
+
+	if (nice(10) == -1 && errno)
+		warn3(n, "nice() failed", strerror(errno));
+
+	for (i = 0;  i < layout_count;  i++)
+		if (layouts[i].previous.version > 0)
+			migrate(&layouts[i]);
+	info2(n, "migrator process done");
+	leave(0);
+}
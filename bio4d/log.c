@@ -252,6 +252,12 @@ listen:
 	if ((log_check_count++ % 100) == 0)
 		roll_log_Dow();
 
+	/*
+	 *  No select() while whole messages wait in the read buffer.
+	 */
+	if (io_msg_buffered(&process))
+		goto message;
+
 	FD_ZERO(&log_fd_set);
 	FD_SET(process_fd, &log_fd_set);
 	timeout.tv_sec = LOG_SELECT_TIMEOUT;
@@ -279,6 +285,7 @@ listen:
 	/*
 	 *  Read log message from some process.
 	 */
+message:
 	status = io_msg_read(&process);
 	if (status == -1)
 		panic3(n, "io_msg_read(process) failed", strerror(errno));
@@ -58,6 +58,9 @@ module_boot()
 				modules[i - 1]->name, modules[i]->name);
 	}
 
+	if (hash_boot())
+		panic2(nm, "hash_boot() failed");
+
 	for (i = 0;  i < module_count;  i++) {
 		struct digest_module *mp = modules[i];
 
@@ -0,0 +1,419 @@
+/*
+ *  Synopsis:
+ *	Count the system calls per request of net_read() and net_write().
+ *  Usage:
+ *	net-bench [blob KB] [chunk KB] [requests]
+ *	net-bench 1024 4 1000
+ *	net-bench sweep [blob KB] [requests]
+ *  Description:
+ *	Serve <requests> blob requests over a loopback tcp connection to a
+ *	forked client, through the net.c of bio4d, the way a request process
+ *	moves a blob:
+ *
+ *		put	net_read() of the blob in chunks, then "ok\n"
+ *		get	net_read() of the request, net_write() of chunks
+ *		send	net_read() of the request, net_send_file() of a file
+ *
+ *	The default is a 1024 KB blob in 4 KB chunks, 1000 requests.
+ *	The system calls of net.c are counted by wrappers compiled into
+ *	this program, so no tracer is needed.  The output is
+ *
+ *	<verb> <chunk KB> <recv> <send> <poll> <sendfile> <fcntl> <MB/sec>
+ *
+ *	with each count per request.  A send is one net_send_file() of the
+ *	whole blob, as blob_send_file() does, so its chunk is 0.
+ *
+ *	With "sweep", the three verbs are repeated for chunks of 4, 16, 64,
+ *	256 and 1024 KB, and a send calls net_send_file() once per chunk,
+ *	to measure what a bounded blob_send_file() would cost.
+ *  Exit Status:
+ *	0	ok
+ *	1	error
+ *  Note:
+ *	The client is as fast as loopback, so a slow remote client would
+ *	see more poll() calls per request.
+ */
+#include "bio4d.h"
+
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#define REQUEST_SIZE	64
+#define TIMEOUT		20
+
+static long	nrecv, nsend, npoll, nsendfile, nfcntl;
+
+static void
+die(char *msg1, char *msg2)
+{
+	fprintf(stderr, "net-bench: ERROR: %s: %s\n", msg1, msg2);
+	exit(1);
+}
+
+//  called by net.c
+
+void
+error3(char *msg1, char *msg2, char *msg3)
+{
+	fprintf(stderr, "net-bench: ERROR: %s: %s: %s\n", msg1, msg2, msg3);
+}
+
+void
+panic(char *msg)
+{
+	die("panic", msg);
+}
+
+void
+panic2(char *msg1, char *msg2)
+{
+	die(msg1, msg2);
+}
+
+//  count the system calls of net.c, included below
+
+static ssize_t
+count_recv(int fd, void *buf, size_t len, int flags)
+{
+	nrecv++;
+	return recv(fd, buf, len, flags);
+}
+
+static ssize_t
+count_send(int fd, const void *buf, size_t len, int flags)
+{
+	nsend++;
+	return send(fd, buf, len, flags);
+}
+
+static int
+count_poll(struct pollfd *fds, nfds_t nfds, int msec)
+{
+	npoll++;
+	return poll(fds, nfds, msec);
+}
+
+static int
+count_fcntl(int fd, int cmd, ...)
+{
+	va_list ap;
+	long arg;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, long);
+	va_end(ap);
+	nfcntl++;
+	return fcntl(fd, cmd, arg);
+}
+
+#ifdef __linux__
+static ssize_t
+count_sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	nsendfile++;
+	return sendfile(out_fd, in_fd, offset, count);
+}
+#define sendfile	count_sendfile
+#endif
+
+#define recv		count_recv
+#define send		count_send
+#define poll		count_poll
+#define fcntl		count_fcntl
+
+#include "net.c"
+
+#undef recv
+#undef send
+#undef poll
+#undef fcntl
+#ifdef __linux__
+#undef sendfile
+#endif
+
+static double
+now()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		die("clock_gettime() failed", strerror(errno));
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+full_write(int fd, unsigned char *buf, size_t size)
+{
+	ssize_t nw;
+
+	while (size > 0) {
+		nw = write(fd, buf, size);
+		if (nw < 0) {
+			if (errno == EINTR)
+				continue;
+			die("client write() failed", strerror(errno));
+		}
+		buf += nw;
+		size -= nw;
+	}
+}
+
+static void
+full_read(int fd, unsigned char *buf, size_t bufsize, size_t size)
+{
+	ssize_t nr;
+
+	while (size > 0) {
+		nr = read(fd, buf, size < bufsize ? size : bufsize);
+		if (nr < 0 && errno == EINTR)
+			continue;
+		if (nr <= 0)
+			die("client read() failed", nr ? strerror(errno) : "eof");
+		size -= nr;
+	}
+}
+
+/*
+ *  The client of the forked process: write the blob of a put and wait for
+ *  the reply, or write the request of a get and read the blob.
+ */
+static void
+client(int fd, size_t blob, long requests, int rounds)
+{
+	unsigned char *buf, request[REQUEST_SIZE];
+	size_t bufsize = 64 * 1024;
+	long i;
+	int round;
+
+	if ((buf = malloc(bufsize > blob ? bufsize : blob)) == NULL)
+		die("client malloc() failed", strerror(errno));
+	memset(buf, 'b', blob);
+	memset(request, 'r', sizeof request);
+
+	for (round = 0;  round < rounds;  round++) {
+
+		//  put
+
+		for (i = 0;  i < requests;  i++) {
+			full_write(fd, buf, blob);
+			full_read(fd, buf, 3, 3);
+		}
+
+		//  get, then send
+
+		for (i = 0;  i < 2 * requests;  i++) {
+			full_write(fd, request, sizeof request);
+			full_read(fd, buf, bufsize, blob);
+		}
+	}
+	exit(0);
+}
+
+static void
+must_read(int fd, unsigned char *buf, size_t size)
+{
+	ssize_t nr;
+
+	while (size > 0) {
+		nr = net_read(fd, buf, size, TIMEOUT);
+		if (nr <= 0)
+			die("net_read() failed", nr == 0 ? "eof" : "see above");
+		buf += nr;
+		size -= nr;
+	}
+}
+
+static void
+put(int fd, unsigned char *chunk, size_t chunk_size, size_t blob)
+{
+	size_t left;
+	ssize_t nr;
+
+	for (left = blob;  left > 0;  left -= nr) {
+		nr = net_read(fd, chunk, left < chunk_size ? left : chunk_size,
+								TIMEOUT);
+		if (nr <= 0)
+			die("net_read(put) failed", nr == 0 ? "eof" : "see above");
+	}
+	if (net_write(fd, "ok\n", 3, TIMEOUT))
+		die("net_write(ok) failed", "see above");
+}
+
+static void
+get(int fd, unsigned char *chunk, size_t chunk_size, size_t blob)
+{
+	unsigned char request[REQUEST_SIZE];
+	size_t left, size;
+
+	must_read(fd, request, sizeof request);
+	for (left = blob;  left > 0;  left -= size) {
+		size = left < chunk_size ? left : chunk_size;
+		if (net_write(fd, chunk, size, TIMEOUT))
+			die("net_write(get) failed", "see above");
+	}
+}
+
+/*
+ *  Send the blob file in one net_send_file(), or in pieces of chunk_size
+ *  when chunk_size > 0.
+ */
+static void
+send_file(int fd, int blob_fd, size_t chunk_size, size_t blob)
+{
+	unsigned char request[REQUEST_SIZE];
+	i64 nsent = 0;
+
+	must_read(fd, request, sizeof request);
+	if (lseek(blob_fd, 0, SEEK_SET) < 0)
+		die("lseek(blob) failed", strerror(errno));
+	while (nsent < (i64)blob)
+		if (net_send_file(blob_fd, fd,
+				chunk_size > 0 ? (i64)chunk_size : -1,
+				&nsent, TIMEOUT))
+			die("net_send_file() failed", "see above");
+	if (nsent != (i64)blob)
+		die("net_send_file() short", "blob");
+}
+
+static void
+report(char *verb, size_t chunk_size, long requests, size_t blob,
+	double elapsed)
+{
+	double r = requests;
+
+	printf("%s\t%lu\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\t%.0f\n", verb,
+		(unsigned long)chunk_size / 1024,
+		nrecv / r, nsend / r, npoll / r, nsendfile / r, nfcntl / r,
+		requests * (double)blob / elapsed / (1024 * 1024));
+	nrecv = nsend = npoll = nsendfile = nfcntl = 0;
+}
+
+static void
+bench(int fd, int blob_fd, unsigned char *chunk, size_t chunk_size,
+	size_t send_size, size_t blob, long requests)
+{
+	double start;
+	long i;
+
+	start = now();
+	for (i = 0;  i < requests;  i++)
+		put(fd, chunk, chunk_size, blob);
+	report("put", chunk_size, requests, blob, now() - start);
+
+	start = now();
+	for (i = 0;  i < requests;  i++)
+		get(fd, chunk, chunk_size, blob);
+	report("get", chunk_size, requests, blob, now() - start);
+
+	start = now();
+	for (i = 0;  i < requests;  i++)
+		send_file(fd, blob_fd, send_size, blob);
+	report("send", send_size, requests, blob, now() - start);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t blob = 1024, chunk_size = 4, size;
+	long requests = 1000, i;
+	int sweep = 0, rounds = 1;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof addr;
+	int listen_fd, fd, client_fd, blob_fd, on = 1, status;
+	unsigned char *chunk;
+	char path[] = "/tmp/net-bench-XXXXXX";
+	pid_t pid;
+
+	if (argc > 1 && strcmp(argv[1], "sweep") == 0) {
+		sweep = 1;
+		argc--;
+		argv++;
+		if (argc > 3)
+			die("wrong number of arguments",
+					"net-bench sweep [KB] [count]");
+		if (argc > 2 &&
+		    (requests = strtol(argv[2], (char **)0, 10)) <= 0)
+			die("requests not > 0", argv[2]);
+		chunk_size = 1024;
+		for (size = 4;  size < chunk_size;  size *= 4)
+			rounds++;
+	} else {
+		if (argc > 4)
+			die("wrong number of arguments",
+					"net-bench [KB] [KB] [count]");
+		if (argc > 2 &&
+		    (chunk_size = strtoul(argv[2], (char **)0, 10)) == 0)
+			die("chunk KB not > 0", argv[2]);
+		if (argc > 3 &&
+		    (requests = strtol(argv[3], (char **)0, 10)) <= 0)
+			die("requests not > 0", argv[3]);
+	}
+	if (argc > 1 && (blob = strtoul(argv[1], (char **)0, 10)) == 0)
+		die("blob KB not > 0", argv[1]);
+	blob *= 1024;
+	chunk_size *= 1024;
+
+	if ((chunk = malloc(chunk_size)) == NULL)
+		die("malloc(chunk) failed", strerror(errno));
+	memset(chunk, 'b', chunk_size);
+
+	//  the blob file of send
+
+	if ((blob_fd = mkstemp(path)) < 0)
+		die("mkstemp() failed", strerror(errno));
+	unlink(path);
+	for (i = 0;  (size_t)i < blob;  i += chunk_size)
+		full_write(blob_fd, chunk,
+			blob - i < chunk_size ? blob - i : chunk_size);
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		die("socket() failed", strerror(errno));
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof addr))
+		die("bind() failed", strerror(errno));
+	if (listen(listen_fd, 1))
+		die("listen() failed", strerror(errno));
+	if (getsockname(listen_fd, (struct sockaddr *)&addr, &len))
+		die("getsockname() failed", strerror(errno));
+
+	pid = fork();
+	if (pid < 0)
+		die("fork() failed", strerror(errno));
+	if (pid == 0) {
+		close(listen_fd);
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			die("client socket() failed", strerror(errno));
+		if (connect(fd, (struct sockaddr *)&addr, sizeof addr))
+			die("connect() failed", strerror(errno));
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+		client(fd, blob, requests, rounds);
+	}
+	if ((client_fd = accept(listen_fd, (struct sockaddr *)0, 0)) < 0)
+		die("accept() failed", strerror(errno));
+	setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+
+	if (sweep)
+		for (size = 4 * 1024;  size <= chunk_size;  size *= 4)
+			bench(client_fd, blob_fd, chunk, size, size, blob,
+								requests);
+	else
+		bench(client_fd, blob_fd, chunk, chunk_size, 0, blob, requests);
+
+	if (waitpid(pid, &status, 0) < 0)
+		die("waitpid() failed", strerror(errno));
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		die("client failed", "see above");
+	exit(0);
+}
@@ -9,9 +9,21 @@
  *	Explict, global timeouts are used instead of setsockopt(SO_RCVTIMEO).
  *	Not clear to me (jmscott) if setsockopt(SO_RCVTIMEO) prevents
  *	multiple packets from accumulating in the read() buffer.
+ *
+ *	Only net_accept() still uses the ALRM interval timer.  net_read()
+ *	and net_write() wait in poll(), which is far cheaper per chunk
+ *	than sigaction() plus two setitimer() calls.
+ *
+ *	net_send_file() is zero copy via sendfile() on linux only.
+ *	Other systems read() into a buffer and call net_write().
  */
 #include <sys/time.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
+#include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <unistd.h>
 #include "bio4d.h"
@@ -122,12 +134,79 @@ again:
 	return -1;
 }
 
+/*
+ *  Synopsis:
+ *	Wait for a socket to become readable or writable.
+ *  Returns:
+ *	1	socket ready or in error, so caller retries the i/o
+ *	0	timed out waiting
+ *	-1	poll() error, see errno
+ *  Note:
+ *	A timeout of 0 waits forever, same as an unset interval timer.
+ *
+ *	The deadline is fixed at entry, so a poll() interrupted by a
+ *	signal only waits for the remaining time.
+ */
+static int
+net_poll(int fd, short events, unsigned timeout)
+{
+	struct pollfd p;
+	struct timespec now, deadline;
+	int status, msec = -1;
+
+	if (timeout > 0) {
+		if (clock_gettime(CLOCK_MONOTONIC, &deadline))
+			return -1;
+		deadline.tv_sec += timeout;
+		msec = timeout * 1000;
+	}
+	p.fd = fd;
+	p.events = events;
+again:
+	p.revents = 0;
+	status = poll(&p, 1, msec);
+	if (status > 0)
+		return 1;
+	if (status == 0)
+		return 0;
+	if (errno != EINTR)
+		return -1;
+	if (timeout == 0)
+		goto again;
+
+	/*
+	 *  Interupted by a signal, like CHLD, so wait the remaining time.
+	 */
+	if (clock_gettime(CLOCK_MONOTONIC, &now))
+		return -1;
+	msec = (deadline.tv_sec - now.tv_sec) * 1000 +
+		(deadline.tv_nsec - now.tv_nsec) / 1000000;
+	if (msec <= 0)
+		return 0;
+	goto again;
+}
+
+/*
+ *  Wait for bytes to read, like the next request in a session.
+ *  Returns 1 when readable or closed, 0 on timeout, -1 on error.
+ */
+int
+net_wait_read(int fd, unsigned timeout)
+{
+	return net_poll(fd, POLLIN, timeout);
+}
+
 /*
  *  Do a timed read in child process of some bytes on the network.
  *
  *	>= 0	=> read some bytes
  *	-1	=> read() error
  *	-2	=> timeout
+ *
+ *  Note:
+ *	The socket stays blocking.  A non-blocking recv() is tried first,
+ *	so poll() is only called when no bytes are queued, which avoids
+ *	per read signal and timer system calls for a streaming blob.
  */
 ssize_t
 net_read(int fd, void *buf, size_t buf_size, unsigned timeout)
@@ -136,65 +215,35 @@ net_read(int fd, void *buf, size_t buf_size, unsigned timeout)
 
 	ssize_t nread;
 	int e;
-	struct sigaction a;
-	struct itimerval t;
+	char tbuf[27];
 
-	/*
-	 *  Set the timeout alarm handler.
-	 */
-	memset(&a, 0, sizeof a);
-	alarm_caught = 0;
-	a.sa_handler = catch_SIGALRM;
-	a.sa_flags = 0;
-	sigemptyset(&a.sa_mask);
-	t.it_interval.tv_sec = 0;
-	t.it_interval.tv_usec = 0;
-	t.it_value.tv_sec = timeout;
-	t.it_value.tv_usec = 0;
 again:
-	/*
-	 *  Set the alarm handler.
-	 */
-	if (sigaction(SIGALRM, &a, (struct sigaction *)0))
-		panic3(n, "sigaction(ALRM) failed", strerror(errno));
-	/*
-	 *  Set the interval time.
-	 */
-	if (setitimer(ITIMER_REAL, &t, (struct itimerval *)0))
-		panic3(n, "setitimer(REAL) failed", strerror(errno));
-
-	errno = 0;
-	nread = read(fd, (void *)buf, buf_size);
+	nread = recv(fd, buf, buf_size, MSG_DONTWAIT);
+	if (nread >= 0)
+		return nread;
 	e = errno;
+	if (e == EINTR)
+		goto again;
+	if (e != EAGAIN && e != EWOULDBLOCK) {
+		error3(n, "read() failed", strerror(e));
+		errno = e;
+		return -1;
+	}
 
-	/*
-	 *  Disable timer.
-	 *
-	 *  Note:
-	 *	Does setitimer(t.it_interval.tv_sec == 0) above imply
-	 *	timer never refires?
-	 */
-	t.it_value.tv_sec = 0;
-	if (setitimer(ITIMER_REAL, &t, (struct itimerval *)0))
-		panic3(n, "setitimer(REAL) reset failed", strerror(errno));
-
-	if (nread < 0) {
-		char tbuf[27];
-
-		if (e > 0 && e != EINTR) {
-			error3(n, "read() failed", strerror(e));
-			errno = e;
-			return -1;
-		}
-		if (!alarm_caught)
-			goto again;
-
-		alarm_caught = 0;
-		snprintf(tbuf, sizeof tbuf, "timed out after %d secs", timeout);
-		error3(n, "alarm caught", tbuf);
-		return -2;
+	switch (net_poll(fd, POLLIN, timeout)) {
+	case 1:
+		goto again;
+	case 0:
+		break;
+	default:
+		e = errno;
+		error3(n, "poll(IN) failed", strerror(e));
+		errno = e;
+		return -1;
 	}
-	return nread;
+	snprintf(tbuf, sizeof tbuf, "timed out after %d secs", timeout);
+	error3(n, "poll(IN)", tbuf);
+	return -2;
 }
 
 /*
@@ -204,81 +253,178 @@ again:
  *	0	=> entire buffer written without error
  *	1	=> write() timed out
  *	-1	=> write() error
+ *  Note:
+ *	Like net_read(), the timeout applies to each wait for the socket to
+ *	drain, not to the entire buffer.
  */
 int
 net_write(int fd, void *buf, size_t buf_size, unsigned timeout)
 {
 	static char n[] = "net_write";
 
-	int nwrite;
+	ssize_t nwrite;
 	unsigned char *b, *b_end;
-	struct sigaction a;
-	struct itimerval t;
 	int e;
+	char tbuf[64];
 
 	b = buf;
 	b_end = buf + buf_size;
-
-	/*
-	 *  Set the timeout alarm handler.
-	 */
-	memset(&a, 0, sizeof a);
-
-	alarm_caught = 0;
-	a.sa_handler = catch_SIGALRM;
-	a.sa_flags = 0;
-	sigemptyset(&a.sa_mask);
-	t.it_interval.tv_sec = 0;
-	t.it_interval.tv_usec = 0;
-	t.it_value.tv_sec = timeout;
-	t.it_value.tv_usec = 0;
 again:
-	/*
-	 *  Set the ALRM handler.
-	 */
-	if (sigaction(SIGALRM, &a, (struct sigaction *)0))
-		panic3(n, "sigaction(ALRM) failed", strerror(errno));
-	/*
-	 *  Enable the timer
-	 */
-	if (setitimer(ITIMER_REAL, &t, (struct itimerval *)0))
-		panic3(n, "write_buf: setitimer(REAL) failed", strerror(errno));
-	errno = 0;
-	nwrite = write(fd, (void *)b, b_end - b);
+	nwrite = send(fd, (void *)b, b_end - b, MSG_DONTWAIT);
+	if (nwrite >= 0) {
+		b += nwrite;
+		if (b < b_end)
+			goto again;
+		return 0;
+	}
 	e = errno;
+	if (e == EINTR)
+		goto again;
+	if (e != EAGAIN && e != EWOULDBLOCK) {
+		error3(n, "write() failed", strerror(e));
+		errno = e;
+		return -1;
+	}
 
-	/*
-	 *  Disable the timer.
-	 *
-	 *  Note:
-	 *	Does setitimer(t.it_interval.tv_sec == 0) above imply
-	 *	timer never refires?
-	 */
-	t.it_value.tv_sec = 0;
-	t.it_value.tv_usec = 0;
-	if (setitimer(ITIMER_REAL, &t, (struct itimerval *)0))
-		panic3(n, "setitimer(REAL, 0) failed", strerror(errno));
+	switch (net_poll(fd, POLLOUT, timeout)) {
+	case 1:
+		goto again;
+	case 0:
+		break;
+	default:
+		e = errno;
+		error3(n, "poll(OUT) failed", strerror(e));
+		errno = e;
+		return -1;
+	}
+	snprintf(tbuf, sizeof tbuf, "timed out after %d secs", timeout);
+	error3(n, "poll(OUT)", tbuf);
+	return 1;
+}
+
+/*
+ *  Send length bytes of an open file to the network, from the offset of the
+ *  file, or the rest of the file when length < 0.  Returns
+ *
+ *	0	=> file written up to end of file
+ *	1	=> write timed out
+ *	-1	=> read() or write() error
+ *
+ *  The count of bytes sent is added to *nsent, even upon error.
+ *  Like net_write(), the timeout applies to each wait for the socket to
+ *  drain.
+ */
+int
+net_send_file(int in_fd, int out_fd, i64 length, i64 *nsent,
+	      unsigned timeout)
+{
+	static char n[] = "net_send_file";
+
+	int e;
+	char tbuf[64];
 
-	if (nwrite < 0) {
-		char tbuf[64];
+#ifdef __linux__
+	ssize_t nwrite;
+	size_t count;
+	int flags, status;
 
-		if (e != EINTR) {
-			error3(n, "write() failed", strerror(errno));
+	/*
+	 *  The socket stays blocking for net_read() and net_write(),
+	 *  so briefly go non-blocking, else sendfile() would wait
+	 *  past the timeout.
+	 */
+	flags = fcntl(out_fd, F_GETFL, 0);
+	if (flags == -1) {
+		e = errno;
+		error3(n, "fcntl(GETFL) failed", strerror(e));
+		errno = e;
+		return -1;
+	}
+	if (fcntl(out_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		e = errno;
+		error3(n, "fcntl(SETFL, O_NONBLOCK) failed", strerror(e));
+		errno = e;
+		return -1;
+	}
+	status = 0;
+	e = 0;
+again:
+	count = 1024 * 1024 * 1024;
+	if (length >= 0) {
+		if (length == 0)
+			goto restore;
+		if (length < (i64)count)
+			count = length;
+	}
+	nwrite = sendfile(out_fd, in_fd, (off_t *)0, count);
+	if (nwrite > 0) {
+		*nsent += nwrite;
+		if (length > 0)
+			length -= nwrite;
+		goto again;
+	}
+	if (nwrite == 0)
+		goto restore;
+	e = errno;
+	if (e == EINTR)
+		goto again;
+	if (e != EAGAIN && e != EWOULDBLOCK) {
+		error3(n, "sendfile() failed", strerror(e));
+		status = -1;
+		goto restore;
+	}
+	switch (net_poll(out_fd, POLLOUT, timeout)) {
+	case 1:
+		goto again;
+	case 0:
+		snprintf(tbuf, sizeof tbuf, "timed out after %d secs", timeout);
+		error3(n, "poll(OUT)", tbuf);
+		status = 1;
+		break;
+	default:
+		e = errno;
+		error3(n, "poll(OUT) failed", strerror(e));
+		status = -1;
+		break;
+	}
+restore:
+	if (fcntl(out_fd, F_SETFL, flags) == -1 && status == 0) {
+		e = errno;
+		error3(n, "fcntl(SETFL) failed", strerror(e));
+		status = -1;
+	}
+	errno = e;
+	return status;
+#else
+	unsigned char buf[64 * 1024];
+	ssize_t nread;
+	size_t count;
+	int status;
+
+	(void)tbuf;
+	while (length != 0) {
+		count = sizeof buf;
+		if (length > 0 && length < (i64)count)
+			count = length;
+		if ((nread = read(in_fd, buf, count)) == 0)
+			break;
+		if (nread < 0) {
+			e = errno;
+			if (e == EINTR)
+				continue;
+			error3(n, "read() failed", strerror(e));
 			errno = e;
 			return -1;
 		}
-		if (!alarm_caught)
-			goto again;
-
-		alarm_caught = 0;
-		snprintf(tbuf, sizeof tbuf, "timed out after %d secs", timeout);
-		error3(n, "alarm caught", tbuf);
-		return 1;
+		status = net_write(out_fd, buf, nread, timeout);
+		if (status)
+			return status;
+		*nsent += nread;
+		if (length > 0)
+			length -= nread;
 	}
-	b += nwrite;
-	if (b < b_end)
-		goto again;
 	return 0;
+#endif
 }
 
 /*
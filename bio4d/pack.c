@@ -0,0 +1,749 @@
+/*
+ *  Synopsis:
+ *	Pack small blobs into large, append only segment files.
+ *  Description:
+ *	A verified blob of at most PACK_MAX_BLOB bytes put to a digest module
+ *	is appended to the segment data/pack/seg-<number>, instead of
+ *	costing an inode, a directory entry and a block in data/fs_<algo>.
+ *	Larger blobs still go to the directory layout of the module.
+ *
+ *	Each packed blob is recorded in the append only file data/pack/index
+ *	as a fixed size record of algorithm, digest, length and location.
+ *	A take appends a record with no location.  At boot the listener
+ *	replays the index into an open addressed hash table in anonymous,
+ *	shared memory, so every request process finds a packed blob without
+ *	touching the file system.  The table is sized for four times the
+ *	records in the index, and packing pauses, falling back to the file
+ *	system, once three quarters of the table is used.
+ *
+ *	A packed blob is handed to the digest module as a descriptor of its
+ *	segment positioned at the first byte, with the offset and length of
+ *	the blob, so a get reads or sends the bytes straight from the segment,
+ *	with no copy.
+ *
+ *	Taken blobs leave dead bytes in their segment.  After a roll, the
+ *	request process copies the live blobs of any segment at least half
+ *	dead to the end of the current segment and removes the old segment.
+ *	Segments with no live blobs are removed at boot, when the index is
+ *	also rewritten if mostly stale.
+ *
+ *	Packing is enabled with --pack-small true.
+ *  Note:
+ *	The index and segments are in native byte order, so data/pack does
+ *	not move between machines of different endianness.
+ *
+ *	Only digests of 40 hex characters are packed, which covers sha,
+ *	btc20 and bc160.
+ *
+ *	Packed blobs are invisible to tools walking data/fs_*.
+ */
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "bio4d.h"
+
+#define PACK_ROOT		"data/pack"
+#define PACK_INDEX		PACK_ROOT "/index"
+
+#define SEGMENT_SIZE		(64 * 1024 * 1024)
+#define MAX_SEGMENT		65536
+#define MIN_SLOT_COUNT		(256 * 1024)
+#define SEG_FD_CACHE		16
+
+/*
+ *  The location of a packed blob is the segment number in the high 24
+ *  bits and the offset in the low 40 bits.  Segments start at 1, so a
+ *  location below 1 << 40 is either an empty slot or a taken blob.
+ */
+#define WHERE_SHIFT		40
+#define WHERE_EMPTY		0
+#define WHERE_TAKEN		1
+#define WHERE_SEGMENT(w)	((ui32)((w) >> WHERE_SHIFT))
+#define WHERE_OFFSET(w)		((w) & ((1ULL << WHERE_SHIFT) - 1))
+#define WHERE_LIVE(w)		((w) >= (1ULL << WHERE_SHIFT))
+
+/*
+ *  Both the record in data/pack/index and the slot in the hash table.
+ *  The digest and algorithm of a slot never change once set, so readers
+ *  need no lock.  A taken slot keeps the key till the next boot.
+ */
+struct pack_slot
+{
+	char	algorithm[8];		//  not null terminated when 8 chars
+	ui8	digest[20];
+	ui32	length;
+	ui64	where;
+};
+
+struct pack_segment
+{
+	ui64	size;
+	ui64	dead;
+};
+
+struct pack
+{
+	int			lock;
+	int			compacting;
+	int			full;
+
+	ui32			segment;	//  segment being appended
+	ui64			end;		//  end of segment being appended
+
+	ui64			blob_count;
+	ui64			used_count;	//  live and taken slots
+	ui64			slot_mask;
+
+	struct pack_segment	seg[MAX_SEGMENT];
+	struct pack_slot	slot[];
+};
+
+int			pack_small = -1;
+
+static struct pack	*pack = (struct pack *)0;
+static int		index_fd = -1;
+
+/*
+ *  Segment files opened by this process.
+ */
+static struct
+{
+	ui32	segment;
+	int	fd;
+} seg_fd[SEG_FD_CACHE];
+
+static void
+lock()
+{
+	while (__sync_lock_test_and_set(&pack->lock, 1))
+		sched_yield();
+}
+
+static void
+unlock()
+{
+	__sync_lock_release(&pack->lock);
+}
+
+/*
+ *  Fill the key of a slot from the udig.  Returns 0 when the udig is
+ *  not packable.
+ */
+static int
+key(char *algorithm, char *digest, struct pack_slot *kp)
+{
+	int i;
+	char c;
+
+	if (strlen(algorithm) > sizeof kp->algorithm || strlen(digest) != 40)
+		return 0;
+	for (i = 0;  i < 40;  i++) {
+		c = digest[i];
+		if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+			return 0;
+	}
+	memset(kp, 0, sizeof *kp);
+	strncpy(kp->algorithm, algorithm, sizeof kp->algorithm);
+	decode_hex(digest, kp->digest);
+	return 1;
+}
+
+/*
+ *  Find the slot of the key, live or taken.  When not found and insert
+ *  is true, return the empty slot ending the probe.
+ *
+ *  The digest is already uniformly distributed, so the first 8 bytes
+ *  pick the first probe.
+ */
+static struct pack_slot *
+find(struct pack_slot *kp, int insert)
+{
+	struct pack_slot *sp;
+	ui64 h, i;
+	char *a;
+
+	memcpy(&h, kp->digest, sizeof h);
+	for (a = kp->algorithm;  a < kp->algorithm + sizeof kp->algorithm; a++)
+		h = (h ^ (ui8)*a) * 0x100000001b3ULL;
+
+	for (i = h & pack->slot_mask;  ;  i = (i + 1) & pack->slot_mask) {
+		sp = &pack->slot[i];
+		if (sp->where == WHERE_EMPTY)
+			return insert ? sp : (struct pack_slot *)0;
+		if (memcmp(sp->digest, kp->digest, sizeof kp->digest) == 0 &&
+		    memcmp(sp->algorithm, kp->algorithm,
+		    				sizeof kp->algorithm) == 0)
+			return sp;
+	}
+	/*NOTREACHED*/
+}
+
+static void
+seg_path(ui32 segment, char *path, int size)
+{
+	snprintf(path, size, "%s/seg-%08u", PACK_ROOT, segment);
+}
+
+/*
+ *  Open a segment file, cached per process.  Segment numbers are never
+ *  reused, so a cached descriptor of a removed segment still reads the
+ *  bytes it held.  Returns -1 when the segment does not exist.
+ */
+static int
+seg_open(ui32 segment, int create)
+{
+	char path[MAX_FILE_PATH_LEN];
+	int i = segment % SEG_FD_CACHE, fd;
+
+	if (seg_fd[i].segment == segment)
+		return seg_fd[i].fd;
+
+	seg_path(segment, path, sizeof path);
+	fd = io_open(path, create ? O_RDWR | O_CREAT : O_RDWR,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		if (errno == ENOENT && !create)
+			return -1;
+		panic4("pack", "open(segment) failed", path, strerror(errno));
+	}
+	if (seg_fd[i].segment > 0 && io_close(seg_fd[i].fd))
+		panic3("pack", "close(segment) failed", strerror(errno));
+	seg_fd[i].segment = segment;
+	seg_fd[i].fd = fd;
+	return fd;
+}
+
+static void
+seg_pread(ui64 where, unsigned char *buf, ui32 length)
+{
+	int fd = seg_open(WHERE_SEGMENT(where), 0);
+	ssize_t nread;
+
+	if (fd < 0)
+		panic2("pack", "segment of packed blob missing");
+
+	nread = pread(fd, buf, length, (off_t)WHERE_OFFSET(where));
+	if (nread != (ssize_t)length)
+		panic3("pack", "pread(segment) failed",
+				nread < 0 ? strerror(errno) : "short read");
+}
+
+/*
+ *  Reserve length bytes at the end of the current segment, rolling to
+ *  a new segment when full.  Called while locked.  Returns 0 when out of
+ *  segment numbers.
+ */
+static ui64
+reserve(ui32 length)
+{
+	ui64 where;
+
+	if (pack->end + length > SEGMENT_SIZE) {
+		if (pack->segment + 1 >= MAX_SEGMENT)
+			return 0;
+		pack->segment++;
+		pack->end = 0;
+	}
+	where = ((ui64)pack->segment << WHERE_SHIFT) | pack->end;
+	pack->end += length;
+	pack->seg[pack->segment].size += length;
+	return where;
+}
+
+static void
+append(ui64 where, unsigned char *buf, ui32 length)
+{
+	int fd = seg_open(WHERE_SEGMENT(where), 1);
+
+	if (length > 0 && pwrite(fd, buf, length,
+			(off_t)WHERE_OFFSET(where)) != (ssize_t)length)
+		panic3("pack", "pwrite(segment) failed", strerror(errno));
+}
+
+/*
+ *  Append the slot to data/pack/index.  Called while locked, so records
+ *  land in the order of the changes to the table.
+ */
+static void
+record(struct pack_slot *sp)
+{
+	if (io_write_buf(index_fd, (unsigned char *)sp, sizeof *sp))
+		panic3("pack", "write(index) failed", strerror(errno));
+}
+
+/*
+ *  Pack the verified blob staged in fd, readable from offset 0.
+ *  Returns 1 when the blob is packed, 0 when the caller stores the blob
+ *  in the file system.
+ */
+int
+pack_put(char *algorithm, char *digest, int fd)
+{
+	struct pack_slot k, *sp;
+	struct stat st;
+	unsigned char buf[PACK_MAX_BLOB];
+	ui64 where;
+	int was_empty;
+
+	if (pack == (struct pack *)0 || pack->full)
+		return 0;
+	if (!key(algorithm, digest, &k))
+		return 0;
+	if (io_fstat(fd, &st))
+		panic3("pack_put", "fstat(blob) failed", strerror(errno));
+	if (st.st_size > PACK_MAX_BLOB)
+		return 0;
+	k.length = (ui32)st.st_size;
+	if (k.length > 0 && pread(fd, buf, k.length, (off_t)0) !=
+							(ssize_t)k.length)
+		panic3("pack_put", "pread(blob) failed", strerror(errno));
+
+	lock();
+	sp = find(&k, 1);
+	if (WHERE_LIVE(sp->where)) {
+		unlock();
+		return 1;
+	}
+	if (pack->used_count + 1 > (pack->slot_mask + 1) / 4 * 3 ||
+	    (where = reserve(k.length)) == 0) {
+		pack->full = 1;
+		unlock();
+		warn2("pack_put", "pack is full, so putting small blobs in fs");
+		return 0;
+	}
+	unlock();
+
+	exist_packed(digest);
+	append(where, buf, k.length);
+
+	/*
+	 *  Another process may have packed the same blob while the bytes
+	 *  were written, in which case our copy is dead.
+	 */
+	lock();
+	sp = find(&k, 1);
+	was_empty = sp->where == WHERE_EMPTY;
+	if (!was_empty && WHERE_LIVE(sp->where)) {
+		pack->seg[WHERE_SEGMENT(where)].dead += k.length;
+		unlock();
+		return 1;
+	}
+	if (was_empty) {
+		memcpy(sp->algorithm, k.algorithm, sizeof sp->algorithm);
+		memcpy(sp->digest, k.digest, sizeof sp->digest);
+		pack->used_count++;
+	}
+	sp->length = k.length;
+	__sync_synchronize();
+	sp->where = where;
+	pack->blob_count++;
+	record(sp);
+	unlock();
+
+	exist_count(1);
+	return 1;
+}
+
+/*
+ *  Is the blob packed?  Returns the length or -1.
+ */
+int
+pack_exists(char *algorithm, char *digest)
+{
+	struct pack_slot k, *sp;
+	ui64 where;
+
+	if (pack == (struct pack *)0 || !key(algorithm, digest, &k))
+		return -1;
+	sp = find(&k, 0);
+	if (sp == (struct pack_slot *)0)
+		return -1;
+	where = sp->where;
+	return WHERE_LIVE(where) ? (int)sp->length : -1;
+}
+
+/*
+ *  Open a packed blob as a new descriptor of its segment, positioned at
+ *  the first byte of the blob, setting the offset of the blob in the
+ *  segment and the length.  The caller reads no more than *length bytes
+ *  and closes the descriptor.  Returns -1 when the blob is not packed.
+ */
+int
+pack_open_blob(char *algorithm, char *digest, i64 *offset, i64 *length)
+{
+	struct pack_slot k, *sp;
+	ui64 where;
+	int fd, retry;
+	static char n[] = "pack_open_blob";
+
+	if (pack == (struct pack *)0 || !key(algorithm, digest, &k))
+		return -1;
+	sp = find(&k, 0);
+	if (sp == (struct pack_slot *)0)
+		return -1;
+
+	/*
+	 *  A compaction may move the blob and remove the old segment
+	 *  between reading the location and opening the segment.
+	 */
+	for (retry = 0;  ;  retry++) {
+		where = sp->where;
+		if (!WHERE_LIVE(where))
+			return -1;
+		*length = sp->length;
+		if ((fd = seg_open(WHERE_SEGMENT(where), 0)) >= 0)
+			break;
+		if (retry == 3)
+			panic3(n, "segment of packed blob missing", digest);
+	}
+
+	/*
+	 *  The cached descriptor is only read and written at an offset, so
+	 *  the duplicate owns the shared file offset.
+	 */
+	if ((fd = io_dup(fd)) < 0)
+		panic3(n, "dup(segment) failed", strerror(errno));
+	*offset = (i64)WHERE_OFFSET(where);
+	if (io_lseek(fd, (off_t)*offset, SEEK_SET) < 0)
+		panic3(n, "lseek(segment) failed", strerror(errno));
+	return fd;
+}
+
+/*
+ *  Forget a packed blob, leaving the bytes dead in the segment.
+ *  Returns 1 if the blob was packed.
+ */
+int
+pack_take(char *algorithm, char *digest)
+{
+	struct pack_slot k, *sp;
+
+	if (pack == (struct pack *)0 || !key(algorithm, digest, &k))
+		return 0;
+	lock();
+	sp = find(&k, 0);
+	if (sp == (struct pack_slot *)0 || !WHERE_LIVE(sp->where)) {
+		unlock();
+		return 0;
+	}
+	pack->seg[WHERE_SEGMENT(sp->where)].dead += sp->length;
+	sp->where = WHERE_TAKEN;
+	pack->blob_count--;
+	record(sp);
+	unlock();
+
+	exist_count(-1);
+	return 1;
+}
+
+/*
+ *  Call each() with the algorithm and hex digest of every packed blob,
+ *  returning the count of packed blobs.
+ */
+ui64
+pack_each(void (*each)(char *algorithm, char *digest))
+{
+	struct pack_slot *sp, *sp_end;
+	char algorithm[9], digest[41];
+	static char hex[] = "0123456789abcdef";
+	ui64 count = 0;
+	int i;
+
+	if (pack == (struct pack *)0)
+		return 0;
+	sp_end = pack->slot + pack->slot_mask + 1;
+	for (sp = pack->slot;  sp < sp_end;  sp++) {
+		if (!WHERE_LIVE(sp->where))
+			continue;
+		count++;
+		if (!each)
+			continue;
+		for (i = 0;  i < 20;  i++) {
+			digest[2 * i] = hex[sp->digest[i] >> 4];
+			digest[2 * i + 1] = hex[sp->digest[i] & 0xf];
+		}
+		digest[40] = 0;
+		memcpy(algorithm, sp->algorithm, 8);
+		algorithm[8] = 0;
+		(*each)(algorithm, digest);
+	}
+	return count;
+}
+
+static void
+seg_unlink(ui32 segment)
+{
+	char path[MAX_FILE_PATH_LEN];
+
+	seg_path(segment, path, sizeof path);
+	if (io_unlink(path) && errno != ENOENT)
+		panic4("pack", "unlink(segment) failed", path, strerror(errno));
+	pack->seg[segment].size = pack->seg[segment].dead = 0;
+}
+
+/*
+ *  Move the live blobs of segments at least half dead to the current
+ *  segment, then remove the old segments.  Called by a request process
+ *  after a roll; a compaction already running elsewhere wins.
+ */
+void
+pack_compact()
+{
+	struct pack_slot *sp, *sp_end;
+	struct pack_segment *gp;
+	unsigned char buf[PACK_MAX_BLOB];
+	ui64 where, to, moved = 0, freed = 0;
+	ui32 s, current;
+	char msg[MSG_SIZE];
+
+	if (pack == (struct pack *)0)
+		return;
+	if (!__sync_bool_compare_and_swap(&pack->compacting, 0, 1))
+		return;
+
+	sp_end = pack->slot + pack->slot_mask + 1;
+	current = pack->segment;
+	for (s = 1;  s < current;  s++) {
+		gp = &pack->seg[s];
+		if (gp->size == 0 || gp->dead * 2 < gp->size)
+			continue;
+		freed += gp->size;
+		for (sp = pack->slot;  sp < sp_end;  sp++) {
+			where = sp->where;
+			if (!WHERE_LIVE(where) || WHERE_SEGMENT(where) != s)
+				continue;
+			seg_pread(where, buf, sp->length);
+
+			lock();
+			to = reserve(sp->length);
+			unlock();
+			if (to == 0)
+				goto done;
+			append(to, buf, sp->length);
+
+			//  a take while copying leaves the copy dead
+
+			lock();
+			if (sp->where == where) {
+				sp->where = to;
+				gp->dead += sp->length;
+				record(sp);
+				moved++;
+			} else
+				pack->seg[WHERE_SEGMENT(to)].dead +=
+								sp->length;
+			unlock();
+			freed -= sp->length;
+		}
+		seg_unlink(s);
+	}
+done:
+	__sync_lock_release(&pack->compacting);
+	if (freed == 0)
+		return;
+	snprintf(msg, sizeof msg, "moved %llu blobs, freed %llu KB",
+							moved, freed / 1024);
+	info2("pack_compact", msg);
+}
+
+/*
+ *  Rewrite data/pack/index with only the live blobs.
+ */
+static void
+index_rewrite()
+{
+	struct pack_slot *sp, *sp_end;
+	char tmp_path[] = PACK_INDEX ".tmp";
+	int fd;
+	static char n[] = "pack_index_rewrite";
+
+	fd = io_open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR|S_IWUSR);
+	if (fd < 0)
+		panic4(n, "open(index.tmp) failed", tmp_path, strerror(errno));
+	sp_end = pack->slot + pack->slot_mask + 1;
+	for (sp = pack->slot;  sp < sp_end;  sp++)
+		if (WHERE_LIVE(sp->where) &&
+		    io_write_buf(fd, (unsigned char *)sp, sizeof *sp))
+			panic3(n, "write(index.tmp) failed", strerror(errno));
+	if (fsync(fd))
+		panic3(n, "fsync(index.tmp) failed", strerror(errno));
+	if (io_close(fd))
+		panic3(n, "close(index.tmp) failed", strerror(errno));
+	if (io_rename(tmp_path, PACK_INDEX))
+		panic3(n, "rename(index.tmp) failed", strerror(errno));
+}
+
+/*
+ *  Find the segment files and their sizes.  Returns the greatest segment.
+ */
+static ui32
+seg_scan()
+{
+	DIR *dirp;
+	struct dirent *dp;
+	struct stat st;
+	char path[MAX_FILE_PATH_LEN];
+	unsigned segment;
+	ui32 last = 0;
+	static char n[] = "pack_seg_scan";
+
+	dirp = io_opendir(PACK_ROOT);
+	if (dirp == (DIR *)0)
+		panic4(n, "opendir() failed", PACK_ROOT, strerror(errno));
+	for (errno = 0;  (dp = io_readdir(dirp));  errno = 0) {
+		if (sscanf(dp->d_name, "seg-%u", &segment) != 1 ||
+		    segment == 0 || segment >= MAX_SEGMENT)
+			continue;
+		seg_path(segment, path, sizeof path);
+		if (io_stat(path, &st))
+			panic4(n, "stat(segment) failed", path,
+							strerror(errno));
+		pack->seg[segment].size = st.st_size;
+		if (segment > last)
+			last = segment;
+	}
+	if (errno)
+		panic4(n, "readdir() failed", PACK_ROOT, strerror(errno));
+	if (io_closedir(dirp))
+		panic4(n, "closedir() failed", PACK_ROOT, strerror(errno));
+	return last;
+}
+
+/*
+ *  Replay data/pack/index into the shared table.  Called by the listener
+ *  before forking any process.
+ */
+void
+pack_open()
+{
+	struct stat st;
+	struct pack_slot rec[256], *rp, *sp, *sp_end;
+	ui64 record_count, slot_count, live = 0, i;
+	ssize_t nread;
+	size_t size;
+	ui32 s;
+	char buf[MSG_SIZE];
+	static char n[] = "pack_open";
+
+	if (pack_small != 1) {
+		info2(n, "packing of small blobs disabled");
+		return;
+	}
+
+	if (io_mkdir(PACK_ROOT, S_IRWXU | S_IXGRP) && errno != EEXIST)
+		panic4(n, "mkdir() failed", PACK_ROOT, strerror(errno));
+	index_fd = io_open(PACK_INDEX, O_RDWR | O_CREAT | O_APPEND,
+							S_IRUSR | S_IWUSR);
+	if (index_fd < 0)
+		panic4(n, "open(index) failed", PACK_INDEX, strerror(errno));
+	if (io_fstat(index_fd, &st))
+		panic3(n, "fstat(index) failed", strerror(errno));
+
+	//  a crash may leave a partial record at the end
+
+	record_count = st.st_size / sizeof *rp;
+	if (st.st_size % sizeof *rp) {
+		warn2(n, "truncating partial record at end of index");
+		if (ftruncate(index_fd, record_count * sizeof *rp))
+			panic3(n, "ftruncate(index) failed", strerror(errno));
+	}
+
+	slot_count = MIN_SLOT_COUNT;
+	while (slot_count < 4 * record_count)
+		slot_count <<= 1;
+	size = sizeof *pack + slot_count * sizeof *sp;
+	pack = (struct pack *)mmap(
+			(void *)0,
+			size,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANON,
+			-1,
+			(off_t)0
+	);
+	if (pack == MAP_FAILED)
+		panic3(n, "mmap(pack) failed", strerror(errno));
+	pack->slot_mask = slot_count - 1;
+
+	for (i = 0;  i < record_count;  i += nread / sizeof *rp) {
+		nread = pread(index_fd, rec, sizeof rec, i * sizeof *rp);
+		if (nread <= 0)
+			panic3(n, "pread(index) failed",
+				nread < 0 ? strerror(errno) : "short read");
+		for (rp = rec;  rp < rec + nread / sizeof *rp;  rp++) {
+			sp = find(rp, 1);
+			if (sp->where == WHERE_EMPTY)
+				pack->used_count++;
+			*sp = *rp;
+		}
+	}
+
+	/*
+	 *  Dead bytes are what the live blobs do not cover.
+	 */
+	pack->segment = seg_scan();
+	sp_end = pack->slot + slot_count;
+	for (sp = pack->slot;  sp < sp_end;  sp++)
+		if (WHERE_LIVE(sp->where)) {
+			pack->seg[WHERE_SEGMENT(sp->where)].dead += sp->length;
+			live++;
+		}
+	for (s = 1;  s <= pack->segment;  s++) {
+		struct pack_segment *gp = &pack->seg[s];
+
+		gp->dead = gp->size - gp->dead;
+		if (gp->size > 0 && gp->dead == gp->size &&
+		    s < pack->segment)
+			seg_unlink(s);
+	}
+	pack->blob_count = live;
+	if (pack->segment == 0)
+		pack->segment = 1;
+	pack->end = pack->seg[pack->segment].size;
+
+	if (record_count > 2 * live + 1024) {
+		index_rewrite();
+		if (io_close(index_fd))
+			panic3(n, "close(index) failed", strerror(errno));
+		index_fd = io_open(PACK_INDEX, O_WRONLY | O_APPEND, 0);
+		if (index_fd < 0)
+			panic4(n, "open(index) failed", PACK_INDEX,
+							strerror(errno));
+		snprintf(buf, sizeof buf, "rewrote index: %llu to %llu records",
+							record_count, live);
+		info2(n, buf);
+	}
+
+	snprintf(buf, sizeof buf,
+		"packed %llu blobs in segments 1 to %u, %llu slots",
+			live, pack->segment, slot_count);
+	info2(n, buf);
+}
+
+/*
+ *  Log the packed blobs and the bytes in segments in the heartbeat.
+ */
+void
+pack_heartbeat()
+{
+	char buf[MSG_SIZE];
+	ui64 size = 0, dead = 0;
+	ui32 s;
+
+	if (pack == (struct pack *)0)
+		return;
+	for (s = 1;  s <= pack->segment;  s++) {
+		size += pack->seg[s].size;
+		dead += pack->seg[s].dead;
+	}
+	snprintf(buf, sizeof buf,
+		"pack: blobs=%llu, segment=%u, size=%llu KB, dead=%llu KB",
+			pack->blob_count,
+			pack->segment,
+			size / 1024,
+			dead / 1024
+	);
+	info(buf);
+}
@@ -0,0 +1,230 @@
+/*
+ *  Synopsis:
+ *	Measure the put throughput of a running bio4d from many clients.
+ *  Usage:
+ *	put-flood <host> <port> <clients> <puts> [size]
+ *	put-flood localhost 1797 8 400 1024
+ *  Description:
+ *	Fork <clients> processes, each putting <puts> distinct sha blobs of
+ *	<size> bytes, default 1024, each on a new connection.  The blobs are
+ *	new to the server on every run, so each put commits a blob file.
+ *	The digests are computed before the clock starts, so the rate
+ *	measures the server.  The output is
+ *
+ *		puts <count> <seconds> <puts/sec>
+ *
+ *	Compare the commit paths by running against a bio4d booted with
+ *	"--direct-commit true", then "--direct-commit false".
+ *  Exit Status:
+ *	0	all puts answered "ok"
+ *	1	error
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bio4d.h"
+
+#define UDIG_LEN	44		//  sha: + 40 hex digits
+
+static struct addrinfo	*server;
+static unsigned char	*blob;
+static size_t		blob_size = 1024;
+static char		*udigs;
+static unsigned long	seed;
+
+static void
+die(char *msg1, char *msg2)
+{
+	fprintf(stderr, "put-flood: ERROR: %s: %s\n", msg1, msg2);
+	exit(1);
+}
+
+//  called by hash.c
+
+void
+error3(char *msg1, char *msg2, char *msg3)
+{
+	fprintf(stderr, "put-flood: ERROR: %s: %s: %s\n", msg1, msg2, msg3);
+}
+
+void
+info3(char *msg1, char *msg2, char *msg3)
+{
+	(void)msg1;
+	(void)msg2;
+	(void)msg3;
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		die("clock_gettime() failed", strerror(errno));
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ *  The blob numbered i is the random bytes of blob[] with the seed of the
+ *  run and i in the first bytes.
+ */
+static void
+make_blob(long i)
+{
+	unsigned long n = i;
+
+	memcpy(blob, &seed, sizeof seed);
+	memcpy(blob + sizeof seed, &n, sizeof n);
+}
+
+static int
+dial()
+{
+	int fd, on = 1;
+
+	fd = socket(server->ai_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		die("socket() failed", strerror(errno));
+	if (connect(fd, server->ai_addr, server->ai_addrlen))
+		die("connect() failed", strerror(errno));
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on))
+		die("setsockopt(TCP_NODELAY) failed", strerror(errno));
+	return fd;
+}
+
+static void
+write_all(int fd, void *buf, size_t size)
+{
+	ssize_t nw;
+
+	while (size > 0) {
+		nw = write(fd, buf, size);
+		if (nw < 0) {
+			if (errno == EINTR)
+				continue;
+			die("write() failed", strerror(errno));
+		}
+		buf = (char *)buf + nw;
+		size -= nw;
+	}
+}
+
+static void
+reply(int fd, char *udig)
+{
+	char buf[3];
+	size_t nread = 0;
+	ssize_t nr;
+
+	while (nread < sizeof buf) {
+		nr = read(fd, buf + nread, sizeof buf - nread);
+		if (nr < 0 && errno == EINTR)
+			continue;
+		if (nr <= 0)
+			die("read(reply) failed", nr ? strerror(errno) : "eof");
+		nread += nr;
+	}
+	if (memcmp(buf, "ok\n", 3))
+		die("put not ok", udig);
+}
+
+static void
+client(int id, long puts)
+{
+	char request[UDIG_LEN + 6];
+	char *udig;
+	long i, n;
+	int fd;
+
+	for (i = 0;  i < puts;  i++) {
+		n = id * puts + i;
+		udig = udigs + n * (UDIG_LEN + 1);
+		make_blob(n);
+		snprintf(request, sizeof request, "put %s\n", udig);
+
+		fd = dial();
+		write_all(fd, request, strlen(request));
+		reply(fd, udig);
+		write_all(fd, blob, blob_size);
+		reply(fd, udig);
+		close(fd);
+	}
+	exit(0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct addrinfo hints;
+	int clients, c, status, err;
+	long puts, total, i, j;
+	unsigned char digest[20];
+	char *udig;
+	double start, elapsed;
+	pid_t pid;
+
+	if (argc < 5 || argc > 6)
+		die("usage",
+		    "put-flood <host> <port> <clients> <puts> [size]");
+	if ((clients = atoi(argv[3])) <= 0)
+		die("clients not > 0", argv[3]);
+	if ((puts = atol(argv[4])) <= 0)
+		die("puts not > 0", argv[4]);
+	if (argc == 6 && (blob_size = strtoul(argv[5], (char **)0, 10)) <
+							2 * sizeof seed)
+		die("size too small", argv[5]);
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((err = getaddrinfo(argv[1], argv[2], &hints, &server)))
+		die("getaddrinfo() failed", (char *)gai_strerror(err));
+
+	if (hash_boot())
+		die("hash_boot() failed", "no digest");
+	if ((blob = malloc(blob_size)) == NULL)
+		die("malloc(blob) failed", strerror(errno));
+	seed = (unsigned long)time((time_t *)0) << 20 ^ getpid();
+	srandom(seed);
+	for (i = 0;  i < (long)blob_size;  i++)
+		blob[i] = random();
+
+	//  digest every blob up front
+
+	total = clients * puts;
+	if ((udigs = malloc(total * (UDIG_LEN + 1))) == NULL)
+		die("malloc(udigs) failed", strerror(errno));
+	for (i = 0;  i < total;  i++) {
+		make_blob(i);
+		if (!hash_digest(HASH_SHA1, blob, blob_size, digest))
+			die("hash_digest() failed", "sha");
+		udig = udigs + i * (UDIG_LEN + 1);
+		strcpy(udig, "sha:");
+		for (j = 0;  j < 20;  j++)
+			snprintf(udig + 4 + 2 * j, 3, "%02x", digest[j]);
+	}
+
+	start = now();
+	for (c = 0;  c < clients;  c++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork() failed", strerror(errno));
+		if (pid == 0)
+			client(c, puts);
+	}
+	for (c = 0;  c < clients;  c++) {
+		if (wait(&status) < 0)
+			die("wait() failed", strerror(errno));
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			die("client failed", "see above");
+	}
+	elapsed = now() - start;
+	printf("puts %ld %.3f %.0f\n", total, elapsed, total / elapsed);
+	exit(0);
+}
@@ -0,0 +1,222 @@
+/*
+ *  Synopsis:
+ *	Measure the eat and get throughput of large blobs from a running bio4d.
+ *  Usage:
+ *	read-bench <host> <port> <requests> [MB]
+ *	read-bench localhost 1797 8 256
+ *  Description:
+ *	Put one new sha blob of [MB] megabytes, default 64, then time
+ *	<requests> eats and <requests> gets of the blob, each on a new
+ *	connection.  A get reads and discards the whole blob.  The output is
+ *
+ *		eat <MB> <requests> <seconds> <GB/sec>
+ *		get <MB> <requests> <seconds> <GB/sec>
+ *
+ *	Compare the read paths of the blob file by running against a bio4d
+ *	booted with "--mmap-blobs true", then "--mmap-blobs false".  Boot
+ *	with "--trust-fs false", so a get digests the blob as well.
+ *  Exit Status:
+ *	0	all requests answered "ok"
+ *	1	error
+ *  Note:
+ *	The blob is in the page cache after the put, so the rate measures
+ *	the server, not the disk.  The blob is left in the server.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bio4d.h"
+
+#define UDIG_LEN	44		//  sha: + 40 hex digits
+#define READ_SIZE	(1024 * 1024)
+
+static struct addrinfo	*server;
+static char		udig[UDIG_LEN + 1];
+
+static void
+die(char *msg1, char *msg2)
+{
+	fprintf(stderr, "read-bench: ERROR: %s: %s\n", msg1, msg2);
+	exit(1);
+}
+
+//  called by hash.c
+
+void
+error3(char *msg1, char *msg2, char *msg3)
+{
+	fprintf(stderr, "read-bench: ERROR: %s: %s: %s\n", msg1, msg2, msg3);
+}
+
+void
+info3(char *msg1, char *msg2, char *msg3)
+{
+	(void)msg1;
+	(void)msg2;
+	(void)msg3;
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		die("clock_gettime() failed", strerror(errno));
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+dial()
+{
+	int fd, on = 1;
+
+	fd = socket(server->ai_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		die("socket() failed", strerror(errno));
+	if (connect(fd, server->ai_addr, server->ai_addrlen))
+		die("connect() failed", strerror(errno));
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on))
+		die("setsockopt(TCP_NODELAY) failed", strerror(errno));
+	return fd;
+}
+
+static void
+write_all(int fd, void *buf, size_t size)
+{
+	ssize_t nw;
+
+	while (size > 0) {
+		nw = write(fd, buf, size);
+		if (nw < 0) {
+			if (errno == EINTR)
+				continue;
+			die("write() failed", strerror(errno));
+		}
+		buf = (char *)buf + nw;
+		size -= nw;
+	}
+}
+
+static void
+reply(int fd, char *verb)
+{
+	char buf[3];
+	size_t nread = 0;
+	ssize_t nr;
+
+	while (nread < sizeof buf) {
+		nr = read(fd, buf + nread, sizeof buf - nread);
+		if (nr < 0 && errno == EINTR)
+			continue;
+		if (nr <= 0)
+			die("read(reply) failed", nr ? strerror(errno) : "eof");
+		nread += nr;
+	}
+	if (memcmp(buf, "ok\n", 3))
+		die(verb, "not ok");
+}
+
+static int
+request(char *verb)
+{
+	char buf[UDIG_LEN + 7];
+	int fd;
+
+	fd = dial();
+	snprintf(buf, sizeof buf, "%s %s\n", verb, udig);
+	write_all(fd, buf, strlen(buf));
+	reply(fd, verb);
+	return fd;
+}
+
+/*
+ *  Read and discard the blob up to the close by the server.
+ */
+static void
+drain(int fd, size_t size, unsigned char *buf)
+{
+	size_t nread = 0;
+	ssize_t nr;
+
+	while ((nr = read(fd, buf, READ_SIZE)) != 0) {
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			die("read(blob) failed", strerror(errno));
+		}
+		nread += nr;
+	}
+	if (nread != size)
+		die("get", "short blob");
+}
+
+static void
+report(char *verb, long mb, long requests, double elapsed)
+{
+	printf("%s %ld %ld %.3f %.2f\n", verb, mb, requests, elapsed,
+				(double)mb * requests / 1024 / elapsed);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct addrinfo hints;
+	int fd, err;
+	long requests, mb = 64, i;
+	size_t size;
+	unsigned char digest[20], *blob;
+	unsigned long seed;
+	double start;
+
+	if (argc < 4 || argc > 5)
+		die("usage", "read-bench <host> <port> <requests> [MB]");
+	if ((requests = atol(argv[3])) <= 0)
+		die("requests not > 0", argv[3]);
+	if (argc == 5 && (mb = atol(argv[4])) <= 0)
+		die("MB not > 0", argv[4]);
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((err = getaddrinfo(argv[1], argv[2], &hints, &server)))
+		die("getaddrinfo() failed", (char *)gai_strerror(err));
+
+	if (hash_boot())
+		die("hash_boot() failed", "no digest");
+	size = mb * 1024 * 1024;
+	if ((blob = malloc(size)) == NULL)
+		die("malloc(blob) failed", strerror(errno));
+	seed = (unsigned long)time((time_t *)0) << 20 ^ getpid();
+	srandom(seed);
+	for (i = 0;  i < (long)size;  i++)
+		blob[i] = random();
+	if (!hash_digest(HASH_SHA1, blob, size, digest))
+		die("hash_digest() failed", "sha");
+	strcpy(udig, "sha:");
+	for (i = 0;  i < 20;  i++)
+		snprintf(udig + 4 + 2 * i, 3, "%02x", digest[i]);
+
+	fd = request("put");
+	write_all(fd, blob, size);
+	reply(fd, "put");
+	close(fd);
+
+	start = now();
+	for (i = 0;  i < requests;  i++)
+		close(request("eat"));
+	report("eat", mb, requests, now() - start);
+
+	start = now();
+	for (i = 0;  i < requests;  i++) {
+		fd = request("get");
+		drain(fd, size, blob);
+		close(fd);
+	}
+	report("get", mb, requests, now() - start);
+	exit(0);
+}
@@ -28,6 +28,13 @@ extern unsigned char	request_exit_status;
 
 static char	hexchar[] = "0123456789abcdef";
 
+/*
+ *  Bytes of the next requests in a session, read ahead while scanning
+ *  the current request.  See req_unread().
+ */
+static unsigned char	unread_buf[MSG_SIZE];
+static size_t		unread_size = 0;
+
 /*
  *  Do a timed read() into a buffer for a child request process.
  *  Returns
@@ -45,6 +52,14 @@ req_read(struct request *r, void *buf, size_t buf_size)
 	char ebuf[MSG_SIZE];
 	int e;
 
+	if (unread_size > 0) {
+		if (buf_size > unread_size)
+			buf_size = unread_size;
+		memcpy(buf, unread_buf, buf_size);
+		unread_size -= buf_size;
+		memmove(unread_buf, unread_buf + buf_size, unread_size);
+		return buf_size;
+	}
 	nread = net_read(r->client_fd, buf, buf_size, r->read_timeout);
 	if (nread >= 0)
 		return nread;
@@ -85,14 +100,61 @@ req_read(struct request *r, void *buf, size_t buf_size)
 }
 
 /*
- *  Read a blob from the remote client, updating blob_size record.
+ *  Wait for the first bytes of the next request in a session, reading
+ *  like req_read().  Returns 0 when the client closes or the session is
+ *  idle for read_timeout seconds, which ends the session quietly.
+ */
+ssize_t
+req_read_next(struct request *r, void *buf, size_t buf_size)
+{
+	static char n[] = "req_read_next";
+
+	if (unread_size == 0)
+		switch (net_wait_read(r->client_fd, r->read_timeout)) {
+		case 1:
+			break;
+		case 0:
+			return 0;
+		default:
+			error3(n, "poll(IN) failed", strerror(errno));
+			_SET_EXIT_ERROR;
+			return -1;
+		}
+	return req_read(r, buf, buf_size);
+}
+
+/*
+ *  Push back bytes read ahead of the current request in a session, to be
+ *  read first by the next req_read().
+ */
+void
+req_unread(struct request *r, void *buf, size_t size)
+{
+	if (unread_size + size > sizeof unread_buf)
+		panic3(r->verb, "req_unread", "too many bytes read ahead");
+	memmove(unread_buf + size, unread_buf, unread_size);
+	memcpy(unread_buf, buf, size);
+	unread_size += size;
+}
+
+/*
+ *  Read a blob from the remote client, or from the staged file of a
+ *  "stage" commit, updating blob_size record.
+ *  In a session, never read past a declared size, since the following
+ *  bytes belong to the next request.
  */
 ssize_t
 blob_read(struct request *r, void *buf, size_t buf_size)
 {
 	 ssize_t nread;
 
-	nread = req_read(r, buf, buf_size);
+	if (r->session && r->declared_size >= 0 &&
+	    (i64)buf_size > r->declared_size - r->blob_size)
+		buf_size = r->declared_size - r->blob_size;
+	if (r->stage_fd >= 0)
+		nread = io_read(r->stage_fd, buf, buf_size);
+	else
+		nread = req_read(r, buf, buf_size);
 	if (nread > 0)
 		r->blob_size += nread;
 	return nread;
@@ -167,6 +229,57 @@ blob_write(struct request *r, void *buf, size_t buf_size)
 	return 0;
 }
 
+/*
+ *  Send length bytes of an open blob file to the remote client, or the rest
+ *  of the file when length < 0, updating the blob size.  Bytes never touch
+ *  user space on linux.  Returns
+ *
+ *	0	=> blob sent without error
+ *	1	=> write timed out
+ *	-1	=> read() or write() error
+ */
+int
+blob_send_file(struct request *r, int blob_fd, i64 length)
+{
+	static char n[] = "blob_send_file";
+	int status;
+	int e;
+	char ebuf[MSG_SIZE];
+
+	status = net_send_file(
+			blob_fd,
+			r->client_fd,
+			length,
+			&r->blob_size,
+			r->write_timeout
+	);
+	if (status == 0)
+		return 0;
+	e = errno;
+
+	if (status == -1) {
+		snprintf(ebuf, sizeof ebuf, "net_send_file(%s) failed",
+							r->transport_tiny);
+		if (r->step)
+			error5(n, r->verb, r->step, ebuf, strerror(e));
+		else
+			error4(n, r->verb, ebuf, strerror(e));
+		_SET_EXIT_ERROR;
+		errno = e;
+		return -1;
+	}
+
+	snprintf(ebuf, sizeof ebuf, "send file(%s) timed out",
+							r->transport_tiny);
+	if (r->step)
+		error4(n, r->verb, r->step, ebuf);
+	else
+		error3(n, r->verb, ebuf);
+	_SET_EXIT_TIMEOUT;
+	errno = e;
+	return 1;
+}
+
 /*
  *  Append ok,chat
  */
@@ -212,6 +325,60 @@ write_ok(struct request *r)
 	return 0;
 }
 
+/*
+ *  Synopsis:
+ *	Write "ok.<size>\n" to the client, for replies followed by <size>
+ *	bytes.
+ */
+int
+write_ok_size(struct request *r, i64 size)
+{
+	char ok[4 + 20 + 1];
+	static char n[] = "write_ok_size";
+
+	snprintf(ok, sizeof ok, "ok.%lld\n", size);
+	if (req_write(r, ok, strlen(ok))) {
+		error4(n, "req_write() failed", r->algorithm, r->digest);
+		return -1;
+	}
+	add_chat_history(r, "ok");
+	return 0;
+}
+
+/*
+ *  Synopsis:
+ *	Write "ok.<size>.<blob size>\n" to the client, for a range of <size>
+ *	bytes of a blob of <blob size> bytes.
+ */
+int
+write_ok_range(struct request *r, i64 size, i64 blob_size)
+{
+	char ok[4 + 20 + 1 + 20 + 1];
+	static char n[] = "write_ok_range";
+
+	snprintf(ok, sizeof ok, "ok.%lld.%lld\n", size, blob_size);
+	if (req_write(r, ok, strlen(ok))) {
+		error4(n, "req_write() failed", r->algorithm, r->digest);
+		return -1;
+	}
+	add_chat_history(r, "ok");
+	return 0;
+}
+
+/*
+ *  Synopsis:
+ *	Write the ok of a get or take to the client.  In a session, the ok
+ *	carries the size of the blob, "ok.<size>\n", since the connection
+ *	stays open after the blob.
+ */
+int
+write_ok_blob(struct request *r)
+{
+	if (!r->session)
+		return write_ok(r);
+	return write_ok_size(r, r->reply_size);
+}
+
 /*
  *  Synopsis:
  *	Write no\n to the client, logging algorithm/module upon error.
@@ -256,15 +423,18 @@ read_reply(struct request *r)
 	char reply[4];
 	ssize_t nr, nread;
 
-	static char big_read[] = "more than 4 chars read in reply";
 	static char bad_nl[] = "unexpected characters after new-line in reply";
 	static char bad_crnl[] =
 		"corrupted <carriage-return new-line> termination";
 	char ebuf[MSG_SIZE];
 
+	/*
+	 *  Read no more than the reply, since, in a session, the next
+	 *  request may follow.
+	 */
 	nread = 0;
 again:
-	nr = req_read(r, reply + nread, sizeof reply - nread);
+	nr = req_read(r, reply + nread, (nread < 3 ? 3 : 4) - nread);
 	if (nr < 0)
 		return reply_error(r, "req_read() failed");
 
@@ -272,16 +442,14 @@ again:
 		return reply_error(r, "req_read() returned 0");
 
 	nread += nr;
-	if (nread < 2)
+	if (nread < 3)
 		goto again;
-	if (nread >  4)
-		return reply_error(r, big_read);
 	if (nread == 3) {
 		if (reply[2] == '\r')
 			goto again;
 		if (reply[2] != '\n')
 			return reply_error(r, bad_nl);
-	} else if (reply[2] != '\r' || reply[3] == '\n')
+	} else if (reply[3] != '\n')
 		return reply_error(r, bad_crnl);
 
 	reply[2] = 0;
@@ -0,0 +1,773 @@
+/*
+ *  Synopsis:
+ *	Scrubber process that verifies the digest of every stored blob.
+ *  Description:
+ *	With --scrub-rate <MB/sec> greater than 0, the listener forks a
+ *	scrubber process at boot that walks data/fs_* in sorted order, then
+ *	the packed blobs, verifying the digest of each blob, like the script
+ *	fs-frisk, but with no process per blob.  The scrubber feeds the
+ *	udigs through a pipe to --scrub-workers hasher processes, so a pass
+ *	uses more than one cpu and keeps more than one read in flight.
+ *
+ *	The scrubber paces itself to --scrub-rate MB/sec and, when given,
+ *	--scrub-iops blobs/sec.  The request processes measure the elapsed
+ *	time of each request into a short and a long term average, and the
+ *	scrubber backs off while the short term latency of a busy server is
+ *	more than twice the long term latency.
+ *
+ *	The path in data/ of the last blob verified in order is saved in
+ *	run/scrub-cursor every few seconds, so a pass interrupted by a
+ *	shutdown resumes upon the next boot.  At the end of a pass the counts
+ *	are logged and written to run/scrub-summary, ending with the exit
+ *	status that fs-frisk gives for the same result:
+ *
+ *		0	no errors
+ *		1	some blobs disappeared, none corrupt
+ *		2	some blobs corrupt, none disappeared
+ *		3	both corrupt and disappeared blobs
+ *		4	unexpected error
+ *
+ *	The next pass starts a day after the previous pass ended.
+ *  Note:
+ *	Corrupt blobs are logged as !udig and disappeared blobs as ?udig,
+ *	but not removed.  A get with --verify-ttl zaps a corrupt blob.
+ *
+ *	Hashers are processes, not threads, like the rest of bio4d.
+ *
+ *	A blob verified by the scrubber is stamped for --verify-ttl.
+ */
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bio4d.h"
+
+#define CURSOR_PATH	"run/scrub-cursor"
+#define SUMMARY_PATH	"run/scrub-summary"
+#define SCRUB_PAUSE	86400		//  seconds between passes
+#define SAVE_PAUSE	10		//  seconds between saves of cursor
+#define PROGRESS_PAUSE	60		//  seconds between progress logs
+#define RING_SIZE	1024		//  blobs between cursor and last sent
+#define BACKOFF_USEC	100000
+#define MAX_BACKOFF	50		//  backoffs before forcing one blob
+
+/*
+ *  Exit status of fs-frisk for an unexpected error.  The frisk() status of
+ *  each blob, 1 when disappeared and 2 when corrupt, is or'ed in.
+ */
+#define FRISK_ERROR	4
+
+struct latency
+{
+	ui64	short_usec;		//  moving average of last 8 requests
+	ui64	long_usec;		//  moving average of last 1024
+	time_t	recent;			//  end of most recent request
+};
+
+struct job
+{
+	ui32	seq;
+	char	algorithm[MAX_ALGORITHM_SIZE + 1];
+	char	digest[MAX_DIGEST_SIZE + 1];
+};
+
+struct result
+{
+	ui32	seq;
+	int	status;
+	ui64	size;
+};
+
+/*
+ *  Blobs sent to the hashers, in order, so the cursor only advances past
+ *  a blob when all blobs before are verified.
+ */
+struct flight
+{
+	int	done;
+	char	path[MAX_FILE_PATH_LEN];
+};
+
+struct pass
+{
+	int		status;
+	ui64		ok_count;
+	ui64		missing_count;
+	ui64		bad_count;
+	ui64		byte_count;
+	ui64		backoff_count;
+
+	ui32		next_seq;	//  next blob to send
+	ui32		tail_seq;	//  oldest blob not verified
+	ui32		in_flight;
+
+	char		cursor[MAX_FILE_PATH_LEN];
+	ui64		pack_skip;
+	ui64		pack_seen;
+
+	struct timespec	pace;
+	time_t		start;
+	time_t		saved;
+	time_t		progress;
+};
+
+extern pid_t		logged_pid;
+
+int			scrub_rate = -1;
+int			scrub_iops = -1;
+int			scrub_workers = 0;
+pid_t			scrub_pid = 0;
+
+static struct latency	*latency = (struct latency *)0;
+
+static struct pass	pass;
+static struct flight	ring[RING_SIZE];
+static int		job_fd = -1;
+static int		result_fd = -1;
+static pid_t		hashers[SCRUB_MAX_WORKERS];
+
+/*
+ *  Fold the elapsed time of a request into the latency averages.
+ *  Called by the request process, so updates may race and drop a sample,
+ *  which is fine for a hint.
+ */
+void
+scrub_request(struct request *r)
+{
+	i64 usec, s, l;
+
+	if (latency == (struct latency *)0)
+		return;
+	usec = (r->end_time.tv_sec - r->start_time.tv_sec) * 1000000 +
+		(r->end_time.tv_nsec - r->start_time.tv_nsec) / 1000;
+	if (usec < 0)
+		return;
+	s = latency->short_usec;
+	l = latency->long_usec;
+	if (l == 0)			//  first request
+		s = l = usec;
+	latency->short_usec = s + (usec - s) / 8;
+	latency->long_usec = l + (usec - l) / 1024;
+	latency->recent = r->end_time.tv_sec;
+}
+
+/*
+ *  Is the server busy and slower than usual?  An idle server never is.
+ */
+static int
+slow()
+{
+	if (time((time_t *)0) - latency->recent > 1)
+		return 0;
+	return latency->short_usec > 1000 &&
+	       latency->short_usec > 2 * latency->long_usec;
+}
+
+static void
+save_cursor()
+{
+	char tmp_path[] = CURSOR_PATH ".tmp";
+	char buf[MAX_FILE_PATH_LEN + 1];
+	int fd;
+	static char n[] = "scrub_save_cursor";
+
+	pass.saved = time((time_t *)0);
+	if (!pass.cursor[0])
+		return;
+	snprintf(buf, sizeof buf, "%s\n", pass.cursor);
+	fd = io_open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR|S_IWUSR);
+	if (fd < 0)
+		panic4(n, "open() failed", tmp_path, strerror(errno));
+	if (io_write_buf(fd, buf, strlen(buf)))
+		panic4(n, "write() failed", tmp_path, strerror(errno));
+	if (io_close(fd))
+		panic4(n, "close() failed", tmp_path, strerror(errno));
+	if (io_rename(tmp_path, CURSOR_PATH))
+		panic4(n, "rename() failed", CURSOR_PATH, strerror(errno));
+}
+
+/*
+ *  Load the cursor of an interrupted pass.  Return 1 when a pass was
+ *  interrupted, 0 otherwise.
+ */
+static int
+load_cursor()
+{
+	char buf[MAX_FILE_PATH_LEN + 1], *nl;
+	int fd, nread;
+	static char n[] = "scrub_load_cursor";
+
+	pass.cursor[0] = 0;
+	fd = io_open(CURSOR_PATH, O_RDONLY, 0);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			panic4(n, "open() failed", CURSOR_PATH,strerror(errno));
+		return 0;
+	}
+	nread = io_read(fd, buf, sizeof buf - 1);
+	if (nread < 0)
+		panic4(n, "read() failed", CURSOR_PATH, strerror(errno));
+	io_close(fd);
+	buf[nread] = 0;
+	nl = strchr(buf, '\n');
+	if (nl == (char *)0 || nl == buf) {
+		warn3(n, "ignoring unknown cursor file", CURSOR_PATH);
+		return 0;
+	}
+	*nl = 0;
+	strcpy(pass.cursor, buf);
+	return 1;
+}
+
+static void
+progress()
+{
+	char buf[MSG_SIZE];
+	time_t now = time((time_t *)0);
+
+	snprintf(buf, sizeof buf,
+		"scrub: ok=%llu, miss=%llu, bad=%llu, %.1f MB/sec, backoff=%llu",
+			pass.ok_count,
+			pass.missing_count,
+			pass.bad_count,
+			(double)pass.byte_count / 1048576.0 /
+				(now > pass.start ? now - pass.start : 1),
+			pass.backoff_count
+	);
+	info(buf);
+	pass.progress = now;
+}
+
+/*
+ *  Read the result of one blob from the hashers and advance the cursor
+ *  past every blob verified in order.  Return -1 when every hasher exited.
+ */
+static int
+collect()
+{
+	struct result res;
+	ssize_t nread;
+	time_t now;
+	static char n[] = "scrub_collect";
+
+	nread = io_read(result_fd, &res, sizeof res);
+	if (nread == 0)
+		return -1;
+	if (nread != sizeof res)
+		panic3(n, "read(result) failed", strerror(errno));
+	pass.in_flight--;
+
+	switch (res.status) {
+	case 0:
+		pass.ok_count++;
+		pass.byte_count += res.size;
+		break;
+	case 1:
+		pass.missing_count++;
+		break;
+	default:
+		pass.bad_count++;
+		break;
+	}
+	pass.status |= res.status;
+
+	ring[res.seq % RING_SIZE].done = 1;
+	while (pass.tail_seq != pass.next_seq &&
+	       ring[pass.tail_seq % RING_SIZE].done) {
+		strcpy(pass.cursor, ring[pass.tail_seq % RING_SIZE].path);
+		pass.tail_seq++;
+	}
+
+	now = time((time_t *)0);
+	if (now - pass.saved >= SAVE_PAUSE)
+		save_cursor();
+	if (now - pass.progress >= PROGRESS_PAUSE)
+		progress();
+	return 0;
+}
+
+/*
+ *  Wait until the budget of bytes and blobs per second allows reading
+ *  a blob of a certain size, then while requests are slow.
+ */
+static void
+pace(ui64 size)
+{
+	struct timespec now, wait;
+	ui64 nsec = 0;
+	int i;
+	static char n[] = "scrub_pace";
+
+	if (scrub_rate > 0)
+		nsec += size * 1000000000 / ((ui64)scrub_rate * 1048576);
+	if (scrub_iops > 0)
+		nsec += 1000000000 / scrub_iops;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now))
+		panic3(n, "clock_gettime(MONOTONIC) failed", strerror(errno));
+
+	//  no credit for time spent idle or behind the budget
+
+	if (pass.pace.tv_sec < now.tv_sec || (pass.pace.tv_sec == now.tv_sec &&
+	    pass.pace.tv_nsec < now.tv_nsec))
+		pass.pace = now;
+	else {
+		wait.tv_sec = pass.pace.tv_sec - now.tv_sec;
+		wait.tv_nsec = pass.pace.tv_nsec - now.tv_nsec;
+		if (wait.tv_nsec < 0) {
+			wait.tv_sec--;
+			wait.tv_nsec += 1000000000;
+		}
+		while (nanosleep(&wait, &wait) && errno == EINTR)
+			;
+	}
+	pass.pace.tv_sec += nsec / 1000000000;
+	pass.pace.tv_nsec += nsec % 1000000000;
+	if (pass.pace.tv_nsec >= 1000000000) {
+		pass.pace.tv_sec++;
+		pass.pace.tv_nsec -= 1000000000;
+	}
+
+	for (i = 0;  i < MAX_BACKOFF && slow();  i++) {
+		usleep(BACKOFF_USEC);
+		pass.backoff_count++;
+	}
+}
+
+/*
+ *  Send a blob to the hashers.  Return -1 when the pass must stop.
+ */
+static int
+dispatch(char *algorithm, char *digest, ui64 size, char *path)
+{
+	struct job job;
+	static char n[] = "scrub_dispatch";
+
+	pace(size);
+
+	while (pass.in_flight >= 2 * (ui32)scrub_workers ||
+	       pass.next_seq - pass.tail_seq == RING_SIZE)
+		if (pass.in_flight == 0 || collect()) {
+			error2(n, "hasher process exited before pass done");
+			return -1;
+		}
+
+	memset(&job, 0, sizeof job);
+	job.seq = pass.next_seq;
+	strncpy(job.algorithm, algorithm, MAX_ALGORITHM_SIZE);
+	strncpy(job.digest, digest, MAX_DIGEST_SIZE);
+
+	ring[job.seq % RING_SIZE].done = 0;
+	strcpy(ring[job.seq % RING_SIZE].path, path);
+
+	if (io_write_buf(job_fd, &job, sizeof job)) {
+		error3(n, "write(job) failed", strerror(errno));
+		return -1;
+	}
+	pass.next_seq++;
+	pass.in_flight++;
+	return 0;
+}
+
+static int
+visible(const struct dirent *dp)
+{
+	return dp->d_name[0] != '.';
+}
+
+/*
+ *  Walk data/<path> in sorted order, sending every blob after the
+ *  remaining components of the cursor in resume.  Return -1 when the
+ *  pass must stop.
+ */
+static int
+walk(char *path, struct digest_module *mp, char *resume)
+{
+	struct dirent **names;
+	struct stat st;
+	char dir_path[MAX_FILE_PATH_LEN], sub_path[MAX_FILE_PATH_LEN];
+	char *name, *sub_resume;
+	int i, count, cmp, len, status = 0;
+	static char n[] = "scrub_walk";
+
+	snprintf(dir_path, sizeof dir_path, "data/%s", path);
+	count = scandir(dir_path, &names, visible, alphasort);
+	if (count < 0) {
+		if (errno == ENOENT)		//  trimmed by the arborist
+			return 0;
+		panic4(n, "scandir() failed", dir_path, strerror(errno));
+	}
+	for (i = 0;  i < count;  i++) {
+		name = names[i]->d_name;
+		if (status)
+			goto next;
+
+		/*
+		 *  Skip entries before the cursor, descend into the entry
+		 *  on the cursor and walk every entry after.
+		 */
+		sub_resume = (char *)0;
+		cmp = 1;
+		if (resume) {
+			len = strcspn(resume, "/");
+			cmp = strncmp(name, resume, len);
+			if (cmp == 0 && name[len])
+				cmp = 1;
+			if (cmp < 0)
+				goto next;
+			if (cmp == 0 && resume[len] == '/')
+				sub_resume = resume + len + 1;
+			if (cmp > 0)
+				resume = (char *)0;
+		}
+
+		if (mp == (struct digest_module *)0) {
+			if (strncmp(name, "fs_", 3))
+				goto next;
+			mp = module_get(name + 3);
+			if (mp)
+				status = walk(name, mp, sub_resume);
+			mp = (struct digest_module *)0;
+			goto next;
+		}
+
+		if (snprintf(sub_path, sizeof sub_path, "%s/%s", path, name) >=
+		    (int)sizeof sub_path ||
+		    snprintf(dir_path, sizeof dir_path, "data/%s", sub_path) >=
+		    (int)sizeof dir_path)
+			panic4(n, "path too long", path, name);
+		if (io_lstat(dir_path, &st)) {
+			if (errno == ENOENT)
+				goto next;
+			panic4(n, "lstat() failed", dir_path, strerror(errno));
+		}
+		if (S_ISDIR(st.st_mode))
+			status = walk(sub_path, mp, sub_resume);
+		else if (S_ISREG(st.st_mode) && cmp > 0 &&
+			 (*mp->is_digest)(name))
+			status = dispatch(mp->name, name, st.st_size, sub_path);
+next:
+		free(names[i]);
+	}
+	free(names);
+	return status;
+}
+
+static void
+send_packed(char *algorithm, char *digest)
+{
+	char path[MAX_FILE_PATH_LEN];
+
+	if (pass.status & FRISK_ERROR)
+		return;
+	if (++pass.pack_seen <= pass.pack_skip)
+		return;
+	snprintf(path, sizeof path, "pack/%llu", pass.pack_seen);
+	if (dispatch(algorithm, digest, PACK_MAX_BLOB, path))
+		pass.status |= FRISK_ERROR;
+}
+
+/*
+ *  Verify blobs read from the job pipe until end of file.
+ */
+static void
+hasher()
+{
+	struct job job;
+	struct result res;
+	struct request r;
+	struct digest_module *mp;
+	ssize_t nread;
+	char udig[MAX_UDIG_SIZE + 2];
+	static char n[] = "scrub_hasher";
+
+	ps_title_set("bio4d-scrub-hasher", (char *)0, (char *)0);
+	layout_cache_dirs();
+	while ((nread = io_read(job_fd, &job, sizeof job)) == sizeof job) {
+		mp = module_get(job.algorithm);
+		if (mp == (struct digest_module *)0)
+			panic3(n, "unknown algorithm", job.algorithm);
+
+		memset(&r, 0, sizeof r);
+		r.client_fd = -1;
+		r.verb = "eat";
+		r.step = "scrub";
+		r.algorithm = job.algorithm;
+		r.digest = job.digest;
+		r.declared_size = -1;
+		if ((*mp->open)(&r))
+			panic3(n, "open() failed", job.digest);
+
+		res.seq = job.seq;
+		res.status = (*mp->frisk)(&r);
+		res.size = r.blob_size;
+		(*mp->close)(&r, res.status);
+		free(r.open_data);
+
+		if (res.status) {
+			snprintf(udig, sizeof udig, "%c%s:%s",
+					res.status == 1 ? '?' : '!',
+					job.algorithm, job.digest);
+			warn3(n, res.status == 1 ?
+				"blob disappeared" : "blob corrupt", udig);
+		}
+		if (io_write_buf(result_fd, &res, sizeof res))
+			panic3(n, "write(result) failed", strerror(errno));
+	}
+	if (nread != 0)
+		panic3(n, "read(job) failed", strerror(errno));
+	leave(0);
+}
+
+static void
+open_hashers()
+{
+	int job_pipe[2], result_pipe[2], i;
+	pid_t pid;
+	static char n[] = "scrub_open_hashers";
+
+	if (io_pipe(job_pipe) || io_pipe(result_pipe))
+		panic3(n, "pipe() failed", strerror(errno));
+	for (i = 0;  i < scrub_workers;  i++) {
+		pid = fork();
+		if (pid < 0)
+			panic3(n, "fork() failed", strerror(errno));
+		if (pid == 0) {
+			logged_pid = getpid();
+			io_close(job_pipe[1]);
+			io_close(result_pipe[0]);
+			job_fd = job_pipe[0];
+			result_fd = result_pipe[1];
+			hasher();
+		}
+		hashers[i] = pid;
+	}
+	io_close(job_pipe[0]);
+	io_close(result_pipe[1]);
+	job_fd = job_pipe[1];
+	result_fd = result_pipe[0];
+}
+
+/*
+ *  Tell the hashers no more blobs are coming, then wait for the results
+ *  still in flight and the exit of each hasher.
+ */
+static void
+close_hashers()
+{
+	int i, status;
+
+	io_close(job_fd);
+	job_fd = -1;
+	while (collect() == 0)
+		;
+	io_close(result_fd);
+	result_fd = -1;
+	if (pass.in_flight > 0)
+		pass.status |= FRISK_ERROR;
+	for (i = 0;  i < scrub_workers;  i++)
+		if (waitpid(hashers[i], &status, 0) == hashers[i] &&
+		    (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+			pass.status |= FRISK_ERROR;
+}
+
+static void
+summary()
+{
+	char buf[MSG_SIZE * 4], status[32], tmp_path[] = SUMMARY_PATH ".tmp";
+	int fd;
+	struct tm *t;
+	static char n[] = "scrub_summary";
+
+	t = gmtime(&pass.start);
+	snprintf(buf, sizeof buf,
+		"start time: %04d-%02d-%02dT%02d:%02d:%02d+00:00\n"
+		"ok count: %llu\n"
+		"missing count: %llu\n"
+		"bad count: %llu\n"
+		"scanned: %llu blobs total\n"
+		"ok byte total: %llu bytes\n"
+		"backoff count: %llu\n"
+		"elapsed: %ld sec\n"
+		"exit status: %d\n",
+			t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+			t->tm_hour, t->tm_min, t->tm_sec,
+			pass.ok_count,
+			pass.missing_count,
+			pass.bad_count,
+			pass.ok_count + pass.missing_count + pass.bad_count,
+			pass.byte_count,
+			pass.backoff_count,
+			(long)(time((time_t *)0) - pass.start),
+			pass.status
+	);
+	progress();
+	snprintf(status, sizeof status, "exit status: %d", pass.status);
+	info3(n, "pass done", status);
+
+	fd = io_open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY,
+						S_IRUSR | S_IWUSR | S_IRGRP);
+	if (fd < 0)
+		panic4(n, "open() failed", tmp_path, strerror(errno));
+	if (io_write_buf(fd, buf, strlen(buf)))
+		panic4(n, "write() failed", tmp_path, strerror(errno));
+	if (io_close(fd))
+		panic4(n, "close() failed", tmp_path, strerror(errno));
+	if (io_rename(tmp_path, SUMMARY_PATH))
+		panic4(n, "rename() failed", SUMMARY_PATH, strerror(errno));
+}
+
+/*
+ *  Verify every blob in data/fs_* and the pack, resuming after the
+ *  cursor of an interrupted pass.
+ */
+static void
+scrub_pass()
+{
+	char *pack_cursor = (char *)0;
+	static char n[] = "scrub_pass";
+
+	memset(&pass, 0, sizeof pass);
+	pass.start = pass.saved = pass.progress = time((time_t *)0);
+	if (load_cursor()) {
+		info3(n, "resuming after cursor", pass.cursor);
+		if (strncmp(pass.cursor, "pack/", 5) == 0) {
+			pack_cursor = pass.cursor + 5;
+			pass.pack_skip = strtoull(pack_cursor, (char **)0, 10);
+		}
+	} else
+		info2(n, "starting new pass");
+
+	open_hashers();
+	if (pack_cursor == (char *)0 &&
+	    walk("", (struct digest_module *)0,
+			pass.cursor[0] ? pass.cursor : (char *)0))
+		pass.status |= FRISK_ERROR;
+	pack_each(send_packed);
+	close_hashers();
+
+	summary();
+	if (pass.status & FRISK_ERROR)
+		save_cursor();
+	else if (io_unlink(CURSOR_PATH) && errno != ENOENT)
+		panic4(n, "unlink() failed", CURSOR_PATH, strerror(errno));
+}
+
+/*
+ *  Seconds until the next pass, a day after the previous pass ended,
+ *  unless the previous pass was interrupted.
+ */
+static unsigned
+pause_before_pass()
+{
+	struct stat st;
+	time_t next;
+
+	if (io_path_exists(CURSOR_PATH) == 1)
+		return 0;
+	if (io_stat(SUMMARY_PATH, &st)) {
+		if (errno == ENOENT)
+			return 0;
+		panic4("scrub", "stat() failed", SUMMARY_PATH, strerror(errno));
+	}
+	next = st.st_mtime + SCRUB_PAUSE;
+	if (next <= time((time_t *)0))
+		return 0;
+	return next - time((time_t *)0);
+}
+
+static void
+scrubber()
+{
+	char buf[MSG_SIZE];
+	unsigned secs;
+	static char n[] = "scrubber";
+
+	//  write to a dead hasher gets EPIPE
+
+	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+		panic3(n, "signal(PIPE) failed", strerror(errno));
+	if (nice(10) == -1 && errno)
+		warn3(n, "nice() failed", strerror(errno));
+
+	while (1) {
+		secs = pause_before_pass();
+		if (secs > 0) {
+			snprintf(buf, sizeof buf, "next pass in %u sec", secs);
+			info2(n, buf);
+			while ((secs = sleep(secs)) > 0)
+				;
+		}
+		scrub_pass();
+	}
+}
+
+/*
+ *  Map the request latency and fork the scrubber process.  Called by the
+ *  listener before forking any request process.
+ */
+void
+scrub_open()
+{
+	char buf[MSG_SIZE];
+	pid_t pid;
+	static char n[] = "scrub_open";
+
+	if (scrub_rate <= 0) {
+		info2(n, "scrubber disabled");
+		return;
+	}
+	if (scrub_iops < 0)
+		scrub_iops = 0;
+	if (scrub_workers == 0)
+		scrub_workers = 2;
+	snprintf(buf, sizeof buf,
+		"scrubber budget %d MB/sec, %d blob/sec, %d hashers",
+					scrub_rate, scrub_iops, scrub_workers);
+	info2(n, buf);
+
+	latency = (struct latency *)mmap(
+			(void *)0,
+			sizeof *latency,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANON,
+			-1,
+			(off_t)0
+	);
+	if (latency == MAP_FAILED)
+		panic3(n, "mmap(latency) failed", strerror(errno));
+
+	pid = fork();
+	if (pid < 0)
+		panic3(n, "fork() failed", strerror(errno));
+	if (pid > 0) {
+		scrub_pid = pid;
+		return;
+	}
+	logged_pid = scrub_pid = getpid();
+	ps_title_set("bio4d-scrub", (char *)0, (char *)0);
+	info2(n, "scrubber process started");
+	scrubber();
+}
+
+/*
+ *  The scrubber exited, which only happens on a panic or shutdown.
+ */
+void
+scrub_reap(int status)
+{
+	char buf[MSG_SIZE];
+
+	if (WIFEXITED(status))
+		snprintf(buf, sizeof buf, "scrubber process exit status: %d",
+						WEXITSTATUS(status));
+	else if (WIFSIGNALED(status))
+		snprintf(buf, sizeof buf, "scrubber process exit signal: %d",
+						WTERMSIG(status));
+	else
+		snprintf(buf, sizeof buf, "scrubber process exit: 0x%x",
+						status);
+	warn(buf);
+}
@@ -0,0 +1,325 @@
+/*
+ *  Synopsis:
+ *	Streaming sketches of the udigs in requests: total, distinct and hot.
+ *  Description:
+ *	Every get, put, give, take and eat request adds the udig to sketches
+ *	in anonymous, shared memory mapped by the listener at boot, so both
+ *	forked request processes and prefork workers update the same counts.
+ *
+ *	The distinct count is a HyperLogLog estimate, 4096 one byte registers
+ *	with a standard error near 1.6%.  Registers are kept since boot, for
+ *	each heartbeat and for each sample in run/bio4d.rrd.
+ *
+ *	The hot udigs of each heartbeat are found by a count-min sketch,
+ *	4 rows of 4096 counters, feeding a small table of the udigs with
+ *	the greatest estimated counts.  The estimate never under counts.
+ *
+ *	When (total - distinct) is large, caching pays.
+ *  Note:
+ *	All updates are lock free but the hot table, which is only locked
+ *	when a udig estimate beats the coldest hot udig.
+ */
+#include <sys/mman.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "bio4d.h"
+
+#define HLL_BITS	12
+#define HLL_SIZE	(1 << HLL_BITS)
+
+#define CMS_DEPTH	4
+#define CMS_WIDTH	4096
+
+#define HOT_SIZE	8		//  hot udigs tracked per heartbeat
+#define HOT_LOG		3		//  hot udigs written to log
+
+struct sample
+{
+	ui64	total;
+	ui8	reg[HLL_SIZE];
+};
+
+struct hot
+{
+	char	udig[MAX_UDIG_SIZE + 1];
+	ui32	count;
+};
+
+struct sketch
+{
+	struct sample	boot;		//  since boot
+	struct sample	log;		//  since previous heartbeat
+	struct sample	rrd;		//  since previous rrd sample
+
+	ui32		cms[CMS_DEPTH][CMS_WIDTH];
+
+	volatile pid_t	hot_lock;	//  pid of holder or 0
+	ui32		hot_min;	//  coldest count when table full
+	struct hot	hot[HOT_SIZE];
+};
+
+static struct sketch	*sketch = (struct sketch *)0;
+
+/*
+ *  Try to lock the hot table without waiting.  The lock holds the pid of
+ *  the holder, so a request process killed while holding the lock can be
+ *  detected.  Returns 1 when locked, 0 when busy.
+ */
+static int
+hot_trylock()
+{
+	return __sync_bool_compare_and_swap(&sketch->hot_lock, 0, getpid());
+}
+
+static void
+hot_unlock()
+{
+	__sync_synchronize();
+	sketch->hot_lock = 0;
+}
+
+/*
+ *  64 bit FNV-1a, then the murmur3 finalizer to spread the high bits
+ *  that pick the HyperLogLog register.
+ */
+static ui64
+udig_hash(char *algo, char *digest)
+{
+	ui64 h = 0xcbf29ce484222325ULL;
+	char *p;
+
+	for (p = algo;  *p;  p++)
+		h = (h ^ (ui8)*p) * 0x100000001b3ULL;
+	h = (h ^ ':') * 0x100000001b3ULL;
+	for (p = digest;  *p;  p++)
+		h = (h ^ (ui8)*p) * 0x100000001b3ULL;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static void
+hll_add(struct sample *sp, ui64 h)
+{
+	ui8 *r, rank, prev;
+	ui64 w;
+
+	__sync_fetch_and_add(&sp->total, 1);
+
+	r = &sp->reg[h >> (64 - HLL_BITS)];
+	w = h << HLL_BITS;
+	rank = w ? __builtin_clzll(w) + 1 : 64 - HLL_BITS + 1;
+
+	while ((prev = *r) < rank)
+		if (__sync_bool_compare_and_swap(r, prev, rank))
+			break;
+}
+
+static ui64
+hll_count(struct sample *sp)
+{
+	double sum = 0, e, m = HLL_SIZE;
+	int i, zero = 0;
+
+	for (i = 0;  i < HLL_SIZE;  i++) {
+		sum += ldexp(1.0, -sp->reg[i]);
+		if (sp->reg[i] == 0)
+			zero++;
+	}
+	e = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+
+	//  small range correction: linear counting
+	if (e <= 2.5 * m && zero > 0)
+		e = m * log(m / zero);
+	return (ui64)(e + 0.5);
+}
+
+static void
+sample_reset(struct sample *sp)
+{
+	sp->total = 0;
+	memset(sp->reg, 0, sizeof sp->reg);
+}
+
+static void
+hot_add(char *algo, char *digest, ui32 count)
+{
+	struct hot *hp, *cold;
+	char udig[MAX_UDIG_SIZE + 1];
+	int i;
+
+	/*
+	 *  Skip the update when the table is busy.  The count-min estimate
+	 *  keeps growing, so a hot udig is offered again on a later request.
+	 */
+	if (!hot_trylock())
+		return;
+	snprintf(udig, sizeof udig, "%s:%s", algo, digest);
+
+	cold = &sketch->hot[0];
+	for (i = 0;  i < HOT_SIZE;  i++) {
+		hp = &sketch->hot[i];
+		if (hp->count == 0 || strcmp(hp->udig, udig) == 0)
+			break;
+		if (hp->count < cold->count)
+			cold = hp;
+	}
+	if (i == HOT_SIZE) {
+		if (count <= cold->count)
+			goto unlock;
+		hp = cold;
+	}
+	if (strcmp(hp->udig, udig))
+		strcpy(hp->udig, udig);
+	hp->count = count;
+
+	//  the table is full, so record the coldest count
+	if (sketch->hot[HOT_SIZE - 1].count > 0) {
+		cold = &sketch->hot[0];
+		for (i = 1;  i < HOT_SIZE;  i++)
+			if (sketch->hot[i].count < cold->count)
+				cold = &sketch->hot[i];
+		sketch->hot_min = cold->count;
+	}
+unlock:
+	hot_unlock();
+}
+
+/*
+ *  Map the sketches shared by all request processes.  Called by the
+ *  listener before forking any process.
+ */
+void
+sketch_open()
+{
+	static char n[] = "sketch_open";
+
+	sketch = (struct sketch *)mmap(
+			(void *)0,
+			sizeof *sketch,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANON,
+			-1,
+			(off_t)0
+	);
+	if (sketch == MAP_FAILED)
+		panic3(n, "mmap(sketch) failed", strerror(errno));
+}
+
+/*
+ *  Add the udig of a blob request to the sketches.
+ */
+void
+sketch_udig(char *algo, char *digest)
+{
+	ui64 h;
+	ui32 h1, h2, c, count = ~0U;
+	int i;
+
+	if (sketch == (struct sketch *)0)
+		return;
+
+	h = udig_hash(algo, digest);
+	hll_add(&sketch->boot, h);
+	hll_add(&sketch->log, h);
+	hll_add(&sketch->rrd, h);
+
+	h1 = (ui32)h;
+	h2 = (ui32)(h >> 32) | 1;
+	for (i = 0;  i < CMS_DEPTH;  i++) {
+		c = __sync_add_and_fetch(
+			&sketch->cms[i][(h1 + i * h2) % CMS_WIDTH], 1);
+		if (c < count)
+			count = c;
+	}
+	if (count > sketch->hot_min)
+		hot_add(algo, digest, count);
+}
+
+/*
+ *  Log udig counts since boot and since the previous heartbeat, along with
+ *  the hottest udigs, then start a new heartbeat sample.
+ *  Called by the listener.
+ */
+void
+sketch_heartbeat()
+{
+	char buf[MSG_SIZE];
+	struct hot hot[HOT_SIZE], *hp;
+	int i, j;
+	pid_t holder;
+
+	if (sketch == (struct sketch *)0 || sketch->log.total == 0)
+		return;
+
+	snprintf(buf, sizeof buf,
+		"udig: total=%llu, distinct=%llu, recent total=%llu, distinct=%llu",
+			sketch->boot.total,
+			hll_count(&sketch->boot),
+			sketch->log.total,
+			hll_count(&sketch->log)
+	);
+	info(buf);
+
+	/*
+	 *  A busy hot table is reported next heartbeat.  A table locked by a
+	 *  process that no longer exists may be half written, so reset it
+	 *  without logging.
+	 */
+	memset(hot, 0, sizeof hot);
+	if (hot_trylock()) {
+		memcpy(hot, sketch->hot, sizeof hot);
+		memset(sketch->hot, 0, sizeof sketch->hot);
+		sketch->hot_min = 0;
+		hot_unlock();
+	} else if ((holder = sketch->hot_lock) != 0 &&
+	    kill(holder, 0) < 0 && errno == ESRCH &&
+	    __sync_bool_compare_and_swap(&sketch->hot_lock, holder,
+								getpid())) {
+		warn("udig: reset hot table locked by exited process");
+		memset(sketch->hot, 0, sizeof sketch->hot);
+		sketch->hot_min = 0;
+		hot_unlock();
+	} else
+		info("udig: hot table busy, skipped");
+
+	memset(sketch->cms, 0, sizeof sketch->cms);
+	sample_reset(&sketch->log);
+
+	//  log the hottest udigs requested more than once
+	for (i = 0;  i < HOT_LOG;  i++) {
+		hp = (struct hot *)0;
+		for (j = 0;  j < HOT_SIZE;  j++)
+			if (hot[j].count > 1 &&
+			    (hp == (struct hot *)0 || hot[j].count > hp->count))
+				hp = &hot[j];
+		if (hp == (struct hot *)0)
+			break;
+		snprintf(buf, sizeof buf, "udig hot: %s=%u", hp->udig,
+								hp->count);
+		info(buf);
+		hp->count = 0;
+	}
+}
+
+/*
+ *  Fetch the udig total and distinct counts since the previous rrd sample,
+ *  then start a new rrd sample.
+ */
+void
+sketch_rrd(ui64 *total, ui64 *distinct)
+{
+	if (sketch == (struct sketch *)0) {
+		*total = *distinct = 0;
+		return;
+	}
+	*total = sketch->rrd.total;
+	*distinct = hll_count(&sketch->rrd);
+	sample_reset(&sketch->rrd);
+}
@@ -45,6 +45,9 @@
  *
  *	Also, probably need cross volume tests on startup.
  */
+#define _GNU_SOURCE		//  O_TMPFILE in glibc
+
+#include <fcntl.h>
 #include <ctype.h>
 #include <stdlib.h>
 
@@ -52,6 +55,8 @@
 
 #define _NULLC	(char *)0
 
+#define STAGE_TTL	3600	//  seconds a staged blob may sit unwritten
+
 static char *BLOBIO_TMPDIR = (char *)0;
 
 struct tmp_map_entry
@@ -240,6 +245,62 @@ make_map()
 	}
 }
 
+/*
+ *  Remove the files tmp/stage-<token>-<algorithm>-<digest> of "stage"
+ *  not written for ttl seconds, left by a client that never committed.
+ */
+static void
+reap_stage(char *dir_path, time_t ttl)
+{
+	DIR *dirp;
+	struct dirent *dp;
+	struct stat st;
+	char path[MAX_FILE_PATH_LEN + 1];
+	time_t now;
+	static char n[] = "reap_stage";
+
+	time(&now);
+	dirp = io_opendir(dir_path);
+	if (dirp == NULL)
+		panic4(n, "opendir() failed", dir_path, strerror(errno));
+	errno = 0;
+	while ((dp = io_readdir(dirp))) {
+		if (strncmp(dp->d_name, "stage-", 6))
+			continue;
+		if (snprintf(path, sizeof path, "%s/%s", dir_path,
+					dp->d_name) >= (int)sizeof path)
+			panic4(n, "path too long", dir_path, dp->d_name);
+		if (io_lstat(path, &st)) {
+			if (errno == ENOENT)
+				continue;
+			panic4(n, "lstat() failed", path, strerror(errno));
+		}
+		if (!S_ISREG(st.st_mode) || now - st.st_mtime < ttl)
+			continue;
+		if (io_unlink(path) && errno != ENOENT)
+			panic4(n, "unlink() failed", path, strerror(errno));
+		info3(n, "removed stale stage", path);
+		errno = 0;
+	}
+	if (errno && errno != ENOENT)
+		panic4(n, "readdir() failed", dir_path, strerror(errno));
+	if (io_closedir(dirp))
+		panic4(n, "closedir() failed", dir_path, strerror(errno));
+}
+
+static void
+reap_stages(time_t ttl)
+{
+	struct tmp_map_entry *tm;
+
+	reap_stage(default_path, ttl);
+	if ((tm = tmp_map))
+		while (tm->digest_algorithm[0]) {
+			reap_stage(tm->path, ttl);
+			tm++;
+		}
+}
+
 /*
  *  Parse env variables BLOBIO_TMPDIR_MAP and BLOBIO_TMPDIR
  */
@@ -264,6 +325,19 @@ tmp_open()
 	_info2("default temp path", default_path);
 	if (!io_path_exists(default_path))
 		_panic2("tmp path does not exist", default_path);
+
+	//  no request is alive at boot, so every staged blob is stale
+
+	reap_stages(0);
+}
+
+/*
+ *  Called by the listener every heartbeat.
+ */
+void
+tmp_heartbeat()
+{
+	reap_stages(STAGE_TTL);
 }
 
 static int
@@ -287,3 +361,82 @@ tmp_get(char *digest_algorithm, char *digest_prefix)
 		}
 	return default_path;
 }
+
+/*
+ *  Open an anonymous file in the temp directory for the digest, to stage a
+ *  put or give without a name.  arbor_link() links the file into the blob
+ *  tree only after the digest verifies, so an aborted request leaves
+ *  nothing to clean up.
+ *
+ *  The file is also readable, so pack_put() can read back a small blob.
+ *
+ *  Returns -1 when the os or the file system lacks O_TMPFILE, in which
+ *  case the caller stages the blob in a named temp file.
+ */
+static int	anon_unsupported = 0;
+
+int
+tmp_open_anon(char *algorithm, char *digest_prefix)
+{
+#ifdef O_TMPFILE
+	char *path;
+	int fd;
+
+	if (anon_unsupported)
+		return -1;
+	path = tmp_get(algorithm, digest_prefix);
+	fd = io_open(path, O_TMPFILE | O_RDWR | O_APPEND,
+						S_IRUSR | S_IRGRP);
+	if (fd >= 0)
+		return fd;
+	if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+		panic4("tmp_open_anon", "open(O_TMPFILE) failed", path,
+							strerror(errno));
+	anon_unsupported = 1;
+	info2("tmp_open_anon", "no O_TMPFILE, so staging in named file");
+#else
+	(void)algorithm;
+	(void)digest_prefix;
+#endif
+	return -1;
+}
+
+/*
+ *  Copy an anonymous file that arbor_link() could not link into the named
+ *  temp file tmp_path, for arbor_move().  The errno of the failed link
+ *  says why: EXDEV is a temp directory on another file system than the
+ *  blob, which only this digest may map to, while EPERM or ENOSYS forbid
+ *  linking any anonymous file, so later blobs are staged in named files.
+ *
+ *  Returns 0 when copied, -1 on error, with errno set and no file left.
+ */
+int
+tmp_name_anon(int fd, char *tmp_path, int errno_link)
+{
+	int tmp_fd, err;
+	ssize_t nr;
+	static unsigned char buf[64 * 1024];
+	static char n[] = "tmp_name_anon";
+
+	if (errno_link != EXDEV && anon_unsupported == 0) {
+		anon_unsupported = 1;
+		warn3(n, "linkat(O_TMPFILE) failed, so staging in named file",
+							strerror(errno_link));
+	}
+	if (io_lseek(fd, (off_t)0, SEEK_SET) < 0)
+		return -1;
+	tmp_fd = io_open(tmp_path, O_CREAT|O_EXCL|O_WRONLY, S_IRUSR);
+	if (tmp_fd < 0)
+		return -1;
+	while ((nr = io_read(fd, buf, sizeof buf)) > 0)
+		if (io_write_buf(tmp_fd, buf, nr))
+			goto croak;
+	if (nr == 0 && io_close(tmp_fd) == 0)
+		return 0;
+croak:
+	err = errno;
+	io_close(tmp_fd);
+	io_unlink(tmp_path);
+	errno = err;
+	return -1;
+}
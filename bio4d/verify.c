@@ -0,0 +1,310 @@
+/*
+ *  Synopsis:
+ *	Cache of verification stamps of blob files, for verify before "ok".
+ *  Description:
+ *	With --verify-ttl <seconds> greater than 0, a get or take verifies the
+ *	digest of the stored blob before sending "ok", so a corrupt blob is
+ *	answered "no" instead of streamed.  The verification is stamped in a
+ *	table keyed by the device, inode, modify time and size of the blob
+ *	file.  A get of a blob file stamped within the ttl skips the hash
+ *	and streams zero copy, like --trust-fs, as does an eat.
+ *
+ *	The table is 4 way set associative, evicting the oldest stamp, in
+ *	anonymous, shared memory mapped by the listener at boot.  The
+ *	listener saves the table to run/verify-stamp at most once a minute
+ *	from the heartbeat and at shutdown, and loads it at boot, so a
+ *	restart does not rehash the hot blobs.
+ *  Note:
+ *	A stamp trusts that a change to the contents of a blob file changes
+ *	the modify time or size, which holds for any write through the file
+ *	system, but not for silent corruption on disk.  The ttl bounds how
+ *	long such corruption goes unnoticed by a get.
+ *
+ *	Packed blobs are small, so are always verified and never stamped.
+ *
+ *	Without --verify-ttl, an untrusted server still stamps the blobs,
+ *	but only a "range" honors a stamp, for RANGE_TTL seconds, so the
+ *	ranges of a get over many streams verify the blob once, not once per
+ *	range.
+ */
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bio4d.h"
+
+#define STAMP_PATH		"run/verify-stamp"
+#define STAMP_MAGIC		"bverify1"
+#define SET_COUNT		16384
+#define WAYS			4
+#define SAVE_PAUSE		60
+#define RANGE_TTL		600	//  ttl of a range without --verify-ttl
+
+struct stamp
+{
+	ui64	dev;
+	ui64	ino;
+	ui64	mtime;			//  nanoseconds
+	ui64	size;
+	ui64	verified;		//  zero when empty
+};
+
+struct stamp_table
+{
+	int		lock;
+	int		dirty;
+	ui64		hit_count;
+	ui64		miss_count;
+	struct stamp	set[SET_COUNT][WAYS];
+};
+
+int				verify_ttl = -1;
+
+static struct stamp_table	*table = (struct stamp_table *)0;
+static time_t			saved = 0;
+
+static void
+lock()
+{
+	while (__sync_lock_test_and_set(&table->lock, 1))
+		sched_yield();
+}
+
+static void
+unlock()
+{
+	__sync_lock_release(&table->lock);
+}
+
+static int
+key(int fd, struct stamp *kp)
+{
+	struct stat st;
+
+	if (io_fstat(fd, &st))
+		panic3("verify", "fstat(blob) failed", strerror(errno));
+	if (!S_ISREG(st.st_mode))
+		return 0;
+	kp->dev = st.st_dev;
+	kp->ino = st.st_ino;
+	kp->mtime = (ui64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	kp->size = st.st_size;
+	return 1;
+}
+
+static struct stamp *
+set_of(struct stamp *kp)
+{
+	ui64 h = (kp->ino ^ (kp->dev << 32)) * 0x9e3779b97f4a7c15ULL;
+
+	return table->set[(h >> 32) % SET_COUNT];
+}
+
+static int
+same(struct stamp *sp, struct stamp *kp)
+{
+	return sp->ino == kp->ino && sp->dev == kp->dev &&
+	       sp->mtime == kp->mtime && sp->size == kp->size;
+}
+
+/*
+ *  Was the open blob file verified within the ttl?  A range is fresh for
+ *  RANGE_TTL seconds without --verify-ttl.
+ */
+int
+verify_fresh(int fd, int range)
+{
+	struct stamp k, *sp;
+	ui64 now;
+	int i, fresh = 0, ttl = verify_ttl;
+
+	if (ttl <= 0) {
+		if (!range)
+			return 0;
+		ttl = RANGE_TTL;
+	}
+	if (table == (struct stamp_table *)0 || !key(fd, &k))
+		return 0;
+	now = time((time_t *)0);
+
+	lock();
+	sp = set_of(&k);
+	for (i = 0;  i < WAYS;  i++)
+		if (sp[i].verified && same(&sp[i], &k)) {
+			fresh = sp[i].verified + ttl > now;
+			break;
+		}
+	unlock();
+
+	if (fresh)
+		__sync_fetch_and_add(&table->hit_count, 1);
+	else
+		__sync_fetch_and_add(&table->miss_count, 1);
+	return fresh;
+}
+
+/*
+ *  Stamp the open blob file as verified now, replacing the stamp of the
+ *  same file or the oldest stamp in the set.
+ */
+void
+verify_stamp(int fd)
+{
+	struct stamp k, *sp, *old;
+	int i;
+
+	if (table == (struct stamp_table *)0 || !key(fd, &k))
+		return;
+	k.verified = time((time_t *)0);
+
+	lock();
+	sp = set_of(&k);
+	old = &sp[0];
+	for (i = 0;  i < WAYS;  i++) {
+		if (sp[i].verified == 0 || same(&sp[i], &k)) {
+			old = &sp[i];
+			break;
+		}
+		if (sp[i].verified < old->verified)
+			old = &sp[i];
+	}
+	*old = k;
+	table->dirty = 1;
+	unlock();
+}
+
+/*
+ *  Save a copy of the stamps, taken while locked so no stamp is torn.
+ */
+static void
+save()
+{
+	char tmp_path[] = STAMP_PATH ".tmp";
+	int fd;
+	static struct stamp copy[SET_COUNT][WAYS];
+	static char n[] = "verify_save";
+
+	lock();
+	memcpy(copy, table->set, sizeof copy);
+	table->dirty = 0;
+	unlock();
+
+	fd = io_open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR|S_IWUSR);
+	if (fd < 0) {
+		error4(n, "open() failed", tmp_path, strerror(errno));
+		return;
+	}
+	if (io_write_buf(fd, STAMP_MAGIC, 8) ||
+	    io_write_buf(fd, copy, sizeof copy)) {
+		error3(n, "write() failed", strerror(errno));
+		io_close(fd);
+		io_unlink(tmp_path);
+		return;
+	}
+	if (io_close(fd))
+		panic3(n, "close() failed", strerror(errno));
+	if (io_rename(tmp_path, STAMP_PATH))
+		error3(n, "rename() failed", strerror(errno));
+	saved = time((time_t *)0);
+}
+
+static void
+load()
+{
+	char magic[8], *b, *b_end = (char *)table->set + sizeof table->set;
+	struct stat st;
+	int fd, nread;
+	static char n[] = "verify_load";
+
+	fd = io_open(STAMP_PATH, O_RDONLY, 0);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			error4(n, "open() failed", STAMP_PATH, strerror(errno));
+		return;
+	}
+	if (io_fstat(fd, &st))
+		panic3(n, "fstat() failed", strerror(errno));
+	if (st.st_size != sizeof magic + sizeof table->set ||
+	    io_read(fd, magic, sizeof magic) != sizeof magic ||
+	    memcmp(magic, STAMP_MAGIC, sizeof magic)) {
+		warn3(n, "ignoring unknown stamp file", STAMP_PATH);
+		io_close(fd);
+		return;
+	}
+	for (b = (char *)table->set;  b < b_end;  b += nread) {
+		nread = io_read(fd, b, b_end - b);
+		if (nread <= 0) {
+			warn3(n, "short read of stamp file", STAMP_PATH);
+			memset(table->set, 0, sizeof table->set);
+			break;
+		}
+	}
+	io_close(fd);
+}
+
+/*
+ *  Map the stamp table and load the stamps saved by the previous run.
+ *  Called by the listener before forking any process.
+ */
+void
+verify_open()
+{
+	char buf[MSG_SIZE];
+	static char n[] = "verify_open";
+
+	if (trust_fs == 1) {
+		info2(n, "verify before ok disabled by trust fs");
+		return;
+	}
+	table = (struct stamp_table *)mmap(
+			(void *)0,
+			sizeof *table,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANON,
+			-1,
+			(off_t)0
+	);
+	if (table == MAP_FAILED)
+		panic3(n, "mmap(stamp table) failed", strerror(errno));
+	load();
+	saved = time((time_t *)0);
+
+	if (verify_ttl <= 0)
+		snprintf(buf, sizeof buf,
+			"verify before ok disabled, ranges fresh for %d sec",
+							RANGE_TTL);
+	else
+		snprintf(buf, sizeof buf,
+			"verify before ok, stamps fresh for %d sec", verify_ttl);
+	info2(n, buf);
+}
+
+/*
+ *  Log the stamp hits and save the stamps when changed.  Called by the
+ *  listener.
+ */
+void
+verify_heartbeat()
+{
+	char buf[MSG_SIZE];
+
+	if (table == (struct stamp_table *)0)
+		return;
+	snprintf(buf, sizeof buf, "verify: stamp hit=%llu, miss=%llu",
+					table->hit_count, table->miss_count);
+	info(buf);
+	if (table->dirty && time((time_t *)0) - saved >= SAVE_PAUSE)
+		save();
+}
+
+/*
+ *  Save the stamps at shutdown.
+ */
+void
+verify_close()
+{
+	if (table && table->dirty)
+		save();
+}
@@ -468,9 +468,17 @@ scan_verb(char **src)
 		verb = "wrap";
 		break;
 	case 'r':
-		if (*p++ != 'o' || *p++ != 'l' || *p++ != 'l')
-			vexit("expected 'o' or 'l'", "roll");
-		verb = "roll";
+		c = *p++;
+		if (c == 'o') {
+			if (*p++ != 'l' || *p++ != 'l')
+				vexit("expected 'l'", "roll");
+			verb = "roll";
+		} else if (c == 'a') {
+			if (*p++ != 'n' || *p++ != 'g' || *p++ != 'e')
+				vexit("expected 'n' or 'g' or 'e'", "range");
+			verb = "range";
+		} else
+			vexit("expected char 'o' or 'a'", "{roll, range}");
 		break;
 	default: {
 		static char errfc[] = "unexpected first char";
@@ -598,7 +606,7 @@ scan_chat_history(char *verb, char **src)
 			//  "wrap"
 			v1 == 'w'				||
 
-			//  "roll"
+			//  "roll" or "range"
 			v1 == 'r'
 		)
 			goto done;
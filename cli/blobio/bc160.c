@@ -11,8 +11,6 @@
 #include <unistd.h>
 #include <stdlib.h>
 
-#include "openssl/sha.h"
-#include "openssl/ripemd.h"
 #include "jmscott/libjmscott.h"
 #include "blobio.h"
 
@@ -20,11 +18,12 @@ static unsigned char	bin_digest[20];
 
 typedef struct
 {
-	RIPEMD160_CTX	ripemd160;
-	SHA256_CTX	sha256;
+	struct hash	ripemd160;
+	struct hash	sha256;
 } BC160_CTX;
 
 static BC160_CTX	bc160_ctx;
+static long long	chewed = 0;
 
 static char	empty[]		= "b472a266d0bd89c13706a4132ccfb16f7c3b9fcb";
 
@@ -35,9 +34,9 @@ bc160_init()
 	unsigned char *d20;
 	unsigned int i;
 
-	if (!SHA256_Init(&bc160_ctx.sha256))
+	if (!hash_init(&bc160_ctx.sha256, HASH_SHA256))
 		return "SHA256_Init() failed";
-	if (!RIPEMD160_Init(&bc160_ctx.ripemd160))
+	if (!hash_init(&bc160_ctx.ripemd160, HASH_RIPEMD160))
 		return "RIPEMD160_Init() failed";
 	if (!ascii_digest[0])
 		return (char *)0;
@@ -85,30 +84,41 @@ static char *
 bc160_chew(unsigned char *chunk, int size)
 {
 	TRACE("entered");
-	if (!SHA256_Update(&bc160_ctx.sha256, chunk, size))
+	if (!hash_update(&bc160_ctx.sha256, chunk, size))
 		return "SHA256_Update(chunk) failed";
 
+	/*
+	 *  Size known in advance, so only finalize after the last byte,
+	 *  or at end of stream.
+	 */
+	if (chew_size >= 0 && size > 0) {
+		chewed += size;
+		if (chewed < chew_size)
+			return "1";
+	}
+
 	/*
 	 *  Finalize a temporary copy of sha256.
 	 */
-	SHA256_CTX tmp_sha_ctx;
+	static struct hash tmp_sha_ctx;
 	unsigned char tmp_sha_digest[32];
 
-	tmp_sha_ctx = bc160_ctx.sha256;
-	if (!SHA256_Final(tmp_sha_digest, &tmp_sha_ctx))
+	if (!hash_copy(&tmp_sha_ctx, &bc160_ctx.sha256))
+		return "hash_copy() failed";
+	if (!hash_final(&tmp_sha_ctx, tmp_sha_digest))
 		return "SHA256_Final(tmp) failed";
 
 	/*
 	 *  Take RIPEMD160 of temp sha256 digest.
 	 */
 	unsigned char tmp_ripemd_digest[20];
-	RIPEMD160_CTX tmp_ripemd_ctx;
+	static struct hash tmp_ripemd_ctx;
 
-	if (!RIPEMD160_Init(&tmp_ripemd_ctx))
+	if (!hash_init(&tmp_ripemd_ctx, HASH_RIPEMD160))
 		return "RIPEMD160_Init(tmp) failed";
-	if (!RIPEMD160_Update(&tmp_ripemd_ctx, tmp_sha_digest, 32))
+	if (!hash_update(&tmp_ripemd_ctx, tmp_sha_digest, 32))
 		return "RIPEMD160_Update(tmp SHA256) failed";
-	if (!RIPEMD160_Final(tmp_ripemd_digest, &tmp_ripemd_ctx))
+	if (!hash_final(&tmp_ripemd_ctx, tmp_ripemd_digest))
 		return "RIPEMD160_Final(tmp SHA256) failed";
 #ifdef COMPILE_TRACE
 	if (tracing) {
@@ -226,16 +236,16 @@ bc160_eat_input(int fd)
 	TRACE("entered");
 
 	while ((nread = jmscott_read(fd, buf, sizeof buf)) > 0)
-		if (!SHA256_Update(&bc160_ctx.sha256, buf, nread))
+		if (!hash_update(&bc160_ctx.sha256, buf, nread))
 			return "SHA256_Update(chunk) failed";
 	if (nread < 0)
 		return strerror(errno);
-	if (!SHA256_Final(sha_digest, &bc160_ctx.sha256))
+	if (!hash_final(&bc160_ctx.sha256, sha_digest))
 		return "SHA256_Final() failed";
 
-	if (!RIPEMD160_Update(&bc160_ctx.ripemd160, sha_digest, 32))
+	if (!hash_update(&bc160_ctx.ripemd160, sha_digest, 32))
 		return "RIPEMD160_Update(SHA256) failed";
-	if (!RIPEMD160_Final(bin_digest, &bc160_ctx.ripemd160))
+	if (!hash_final(&bc160_ctx.ripemd160, bin_digest))
 		return "RIPEMD160_Final(SHA256) failed";
 
 	p = ascii_digest;
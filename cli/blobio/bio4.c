@@ -13,6 +13,7 @@
  */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <ctype.h>
 #include <limits.h>
 #include <errno.h>
@@ -36,6 +37,28 @@ extern int	io_timeout;
 
 static int server_fd = -1;
 
+//  host and port of the server, to open the connection of each stream
+
+static char server_host[HOST_NAME_MAX + 1];
+static int server_port = 0;
+
+//  bytes of a blob per range or segment request of a stream
+
+#define STREAM_SEGMENT_SIZE	(64 * 1024 * 1024)
+
+//  token in "session.<token>" of every stream of a put, keying the staged
+//  file on the server, or -1 for the plain sessions of a get
+
+static long long stream_token = -1;
+
+//  blob i/o buffer of chunk_size bytes, allocated once in bio4_open()
+
+static unsigned char *chunk = 0;
+
+//  byte count sent in "put.<count> udig" request, or -1 for no count
+
+static long long request_size = -1;
+
 extern struct service bio4_service;		//  initialized below
 
 /*
@@ -225,7 +248,11 @@ bio4_open_output()
 
 	TRACE("entered");
 
-	if (output_path != null_device)
+	if (resume)
+		flag = O_RDWR | O_CREAT;	//  reread bytes got so far
+	else if (streams > 1)
+		flag = O_RDWR | O_CREAT | O_EXCL;	//  reread to digest
+	else if (output_path != null_device)
 		flag |= O_EXCL;		//  fail if file exists (and not null)
 
 	fd = jmscott_open(output_path, flag, S_IRUSR | S_IRGRP);
@@ -240,7 +267,7 @@ static char *
 bio4_open()
 {
 	int status;
-	char host[HOST_NAME_MAX + 1], *p;
+	char *host = server_host, *p;
 	char pbuf[6];
 	int port = 0;
 	char *ep = bio4_service.end_point;
@@ -256,6 +283,10 @@ bio4_open()
 	if (algo[0])
 		return "service query arg \"algo\" can not exist for bio4";
 
+	chunk = malloc(chunk_size);
+	if (chunk == NULL)
+		return strerror(errno);
+
 	p = strchr(ep, ':');
 	memcpy(host, ep, p - ep);
 	host[p - ep] = 0;
@@ -263,7 +294,7 @@ bio4_open()
 	TRACE2("port fragment", p);
 	strcpy(pbuf, p);
 
-	port = atoi(pbuf);
+	port = server_port = atoi(pbuf);
 
 	/*
 	 *  Connect to service.
@@ -294,6 +325,7 @@ bio4_close()
  *  Assemble the command sent to the server.
  *
  *	get/put/give/take/eat/wrap/roll algorithm:digest
+ *	put.<count>/give.<count> algorithm:digest
  *	wrap algorithm
  */
 static int
@@ -307,6 +339,8 @@ make_request(char *command)
 	*c++ = verb[2];
 	if (verb[3])
 		*c++ = verb[3];
+	if (request_size >= 0)
+		c += sprintf(c, ".%lld", request_size);
 	if (algorithm[0]) {
 		*c++ = ' ';
 
@@ -511,7 +545,7 @@ bio4_set_brr(char *hist)
 static char *
 _bio4_get(int *ok_no, int in_take)
 {
-	unsigned char buf[MAX_ATOMIC_MSG];
+	unsigned char *buf = chunk;
 	char *err;
 	int more;
 	int nread;
@@ -525,6 +559,11 @@ _bio4_get(int *ok_no, int in_take)
 	if (*ok_no == 1 || (in_take && bio4_service.digest->empty()))
 		return (char *)0;
 
+	//  server closes after a get, so only finalize digest at end of stream
+
+	if (!in_take)
+		chew_size = LLONG_MAX;
+
 	/*
 	 *  Read the blob back from the server, incrementally
 	 *  verifying the signature.
@@ -532,7 +571,7 @@ _bio4_get(int *ok_no, int in_take)
 	more = 1;
 	while (more) {
 
-		err = _read(server_fd, buf, sizeof buf, &nread);
+		err = _read(server_fd, buf, chunk_size, &nread);
 		if (err)
 			return err;
 
@@ -590,6 +629,118 @@ bio4_eat(int *ok_no)
 	return bio4_set_brr(*ok_no == 0 ? "ok" : "no");
 }
 
+/*
+ *  Read the next udig, one per line, from the udig set on input.
+ *  Sets *eof at the end of the set.
+ */
+static char *
+read_set_udig(char *ud, int *eof)
+{
+	static int off = 0, nbuf = 0;
+	unsigned char *nl;
+	char *err;
+	int len, nr;
+
+	while (!(nl = memchr(chunk + off, '\n', nbuf - off))) {
+		if (nbuf - off > 8 + 1 + 128)
+			return "udig in set too long";
+		memmove(chunk, chunk + off, nbuf - off);
+		nbuf -= off;
+		off = 0;
+		if ((err = _read(input_fd, chunk + nbuf, chunk_size-nbuf, &nr)))
+			return err;
+		if (nr == 0) {
+			if (nbuf > 0)
+				return "no new-line at end of udig set";
+			*eof = 1;
+			return (char *)0;
+		}
+		nbuf += nr;
+	}
+	len = nl - (chunk + off);
+	if (len > 8 + 1 + 128)
+		return "udig in set too long";
+	memcpy(ud, chunk + off, len);
+	ud[len] = 0;
+	off += len + 1;
+	return jmscott_frisk_udig(ud);
+}
+
+/*
+ *  Synopsis:
+ *	Eat each udig in a set, pipelined in a single session.
+ *  Description:
+ *	Send the "session" verb ahead of the first "eat", then keep up to
+ *	EAT_SET_WINDOW "eat" requests in flight, writing "<udig>\t<ok|no>\n"
+ *	to output for each reply, in the order of the set.  The server
+ *	writes a brr for each eat.  An empty set starts no session.
+ *
+ *	Set *ok_no 0 if every blob exists, 1 if any blob does not.
+ */
+#define EAT_SET_WINDOW	64
+
+static char *
+bio4_eat_set(int *ok_no)
+{
+	static char set_udig[EAT_SET_WINDOW][8 + 1 + 128 + 1];
+	char req[8 + EAT_SET_WINDOW * (4 + 8 + 1 + 128 + 1)], *r, *w;
+	char out[8 + 1 + 128 + 1 + 3 + 1];
+	char *err, *ud;
+	int head = 0, count = 0, eof = 0, reply, in_session = 0;
+
+	TRACE("request to eat udig set");
+
+	*ok_no = 0;
+	while (!eof || count > 0) {
+
+		//  fill the window with requests for the next udigs,
+		//  leaving room for "session\n" before the first
+
+		r = w = req + 8;
+		while (!eof && count < EAT_SET_WINDOW) {
+			ud = set_udig[(head + count) % EAT_SET_WINDOW];
+			if ((err = read_set_udig(ud, &eof)))
+				return err;
+			if (eof)
+				break;
+			r += sprintf(r, "eat %s\n", ud);
+			count++;
+		}
+		if (r > w && !in_session) {
+			w = req;
+			memcpy(w, "session\n", 8);
+		}
+		if (r > w &&
+		    (err = _write(server_fd, (unsigned char *)w, r - w)))
+			return err;
+		if (count == 0)
+			break;
+		if (!in_session) {
+			if ((err = read_ok_no(&reply)))
+				return err;
+			if (reply)
+				return "server refused session";
+			in_session = 1;
+		}
+
+		//  reply to the oldest request
+
+		if ((err = read_ok_no(&reply)))
+			return err;
+		if (reply)
+			*ok_no = 1;
+		out[0] = 0;
+		buf3cat(out, sizeof out, set_udig[head], "\t",
+						reply ? "no\n" : "ok\n");
+		if ((err = _write(output_fd, (unsigned char *)out,strlen(out))))
+			return err;
+		head = (head + 1) % EAT_SET_WINDOW;
+		count--;
+	}
+	TRACE("eat udig set done");
+	return bio4_set_brr(*ok_no == 0 ? "ok" : "no");
+}
+
 static char *
 _put_untrusted()
 {
@@ -597,12 +748,12 @@ _put_untrusted()
 
 	char *err;
 	int nread, more;
-	unsigned char buf[MAX_ATOMIC_MSG];
+	unsigned char *buf = chunk;
 
 	//  write the blob to the server
 	more = 1;
 	while (more) {
-		err = _read(input_fd, buf, sizeof buf, &nread);
+		err = _read(input_fd, buf, chunk_size, &nread);
 		if (err)
 			return err;
 
@@ -640,11 +791,11 @@ _put_trusted()
 
 	char *err;
 	int nread;
-	unsigned char buf[MAX_ATOMIC_MSG];
+	unsigned char *buf = chunk;
 
 	nread = -1;
 	while (nread != 0) {
-		err = _read(input_fd, buf, sizeof buf, &nread);
+		err = _read(input_fd, buf, chunk_size, &nread);
 		if (err)
 			return err;
 		err = _write(server_fd, buf, nread);
@@ -654,14 +805,249 @@ _put_trusted()
 	return (char *)0;
 }
 
+/*
+ *  Read the reply to "have" or "range", either "ok.<count>\n" or "no\n", a
+ *  byte at a time, since the bitmap or bytes follow the new-line.  Set
+ *  *reply 0 for ok, 1 for no.  The ok of a "range" is followed by the size
+ *  of the blob, "ok.<count>.<size>\n", set in *size when not null.
+ */
+static char *
+read_ok_count(int *reply, long long *count, long long *size)
+{
+	unsigned char buf[3 + 19 + 1 + 19 + 1];
+	long long *n;
+	char *err;
+	int nr, len = 0, i;
+
+	while (len == 0 || buf[len - 1] != '\n') {
+		if (len == sizeof buf)
+			return "reply too long";
+		if ((err = _read(server_fd, buf + len, 1, &nr)))
+			return err;
+		if (nr == 0)
+			return "unexpected end of stream reading reply";
+		len++;
+	}
+	if (len == 3 && buf[0] == 'n' && buf[1] == 'o') {
+		*reply = 1;
+		return (char *)0;
+	}
+	if (len < 5 || buf[0] != 'o' || buf[1] != 'k' || buf[2] != '.')
+		return "server reply not \"ok.<count>\" or \"no\"";
+	n = count;
+	*n = 0;
+	for (i = 3;  i < len - 1;  i++) {
+		if (buf[i] == '.' && n == count && size && i > 3) {
+			n = size;
+			*n = 0;
+			continue;
+		}
+		if (!isdigit(buf[i]))
+			return "non digit in count of reply";
+		*n = *n * 10 + (buf[i] - '0');
+	}
+	if (size && (n != size || buf[len - 2] == '.'))
+		return "no blob size in reply";
+	*reply = 0;
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Which blobs in a udig set does the server have?
+ *  Description:
+ *	Send the udig set in a single "have.<size>" request, read back the
+ *	bitmap of the blobs that exist, then reread the set, writing
+ *	"<udig>\t<ok|no>\n" to output for each udig.  The set must be a
+ *	regular file, to be read twice.
+ *
+ *	Set *ok_no 0 if every blob exists, 1 if any blob does not.
+ */
+static char *
+bio4_have(int *ok_no)
+{
+	char req[5 + 20 + 1 + 1];
+	char ud[8 + 1 + 128 + 1];
+	char out[8 + 1 + 128 + 1 + 3 + 1];
+	unsigned char *bitmap = 0;
+	long long count, i, nbytes;
+	struct stat st;
+	char *err;
+	int reply, nr, eof = 0;
+
+	TRACE("request to have()");
+
+	if (fstat(input_fd, &st))
+		return strerror(errno);
+	if (!S_ISREG(st.st_mode))
+		return "udig set is not a regular file";
+
+	snprintf(req, sizeof req, "have.%lld\n", (long long)st.st_size);
+	if ((err = _write(server_fd, (unsigned char *)req, strlen(req))))
+		return err;
+	if ((err = read_ok_no(&reply)))
+		return err;
+	if (reply) {
+		*ok_no = 1;
+		return bio4_set_brr("no");
+	}
+	if ((err = _put_trusted()))
+		return err;
+	if ((err = read_ok_count(&reply, &count, (long long *)0)))
+		return err;
+	if (reply) {
+		*ok_no = 1;
+		return bio4_set_brr("ok,no");
+	}
+
+	//  read the bitmap of blobs that exist
+
+	nbytes = (count + 7) / 8;
+	if (nbytes > 0 && (bitmap = malloc(nbytes)) == NULL)
+		return strerror(errno);
+	for (i = 0;  i < nbytes;  i += nr) {
+		err = _read(server_fd, bitmap + i, nbytes - i, &nr);
+		if (!err && nr == 0)
+			err = "unexpected end of stream reading bitmap";
+		if (err)
+			goto croak;
+	}
+
+	//  reread the udig set, writing the answer for each udig
+
+	if (lseek(input_fd, (off_t)0, SEEK_SET) < 0) {
+		err = strerror(errno);
+		goto croak;
+	}
+	*ok_no = 0;
+	for (i = 0;  ;  i++) {
+		if ((err = read_set_udig(ud, &eof)))
+			goto croak;
+		if (eof)
+			break;
+		if (i == count) {
+			err = "more udigs in set than server counted";
+			goto croak;
+		}
+		reply = (bitmap[i / 8] >> (i % 8)) & 1 ? 0 : 1;
+		if (reply)
+			*ok_no = 1;
+		out[0] = 0;
+		buf3cat(out, sizeof out, ud, "\t", reply ? "no\n" : "ok\n");
+		if ((err = _write(output_fd, (unsigned char *)out,strlen(out))))
+			goto croak;
+	}
+	if (i != count) {
+		err = "fewer udigs in set than server counted";
+		goto croak;
+	}
+	free(bitmap);
+	TRACE("have() done");
+	return bio4_set_brr("ok,ok");
+croak:
+	free(bitmap);
+	return err;
+}
+
+/*
+ *  Synopsis:
+ *	Get a range of a blob, "range.<offset>[.<length>] udig".
+ *  Description:
+ *	With --resume, get the rest of the blob after the bytes already in
+ *	--output-path.  The bytes in the file are digested first, so the
+ *	resumed blob is verified whole, like a get.  A range from --offset
+ *	or --length is not verified, since only the server sees the whole
+ *	blob.
+ *
+ *	Set *ok_no 0 for ok, 1 for no.
+ */
+static char *
+bio4_range(int *ok_no)
+{
+	char req[6 + 20 + 20 + 1 + 8 + 1 + 128 + 1 + 1];
+	long long offset, size, whole, got;
+	char *err, *status;
+	int reply, nread, len;
+
+	TRACE("request to range()");
+
+	offset = range_offset >= 0 ? range_offset : 0;
+	if (resume) {
+
+		//  server closes after the range, so finalize at end of stream
+
+		chew_size = LLONG_MAX;
+		offset = 0;
+		while (!(err = _read(output_fd, chunk, chunk_size, &nread)) &&
+		       nread > 0) {
+			status = bio4_service.digest->get_update(chunk, nread);
+			if (*status != '1')
+				return status;
+			offset += nread;
+		}
+		if (err)
+			return err;
+		TRACE_LL("resume at offset", offset);
+	}
+
+	len = snprintf(req, sizeof req, "range.%lld", offset);
+	if (range_length >= 0)
+		len += snprintf(req + len, sizeof req - len, ".%lld",
+							range_length);
+	len += snprintf(req + len, sizeof req - len, " %s:%s\n", algorithm,
+							ascii_digest);
+	if ((err = _write(server_fd, (unsigned char *)req, len)))
+		return err;
+	if ((err = read_ok_count(&reply, &size, &whole)))
+		return err;
+	if (reply) {
+		*ok_no = 1;
+		return bio4_set_brr("no");
+	}
+	if (range_length < 0 && offset + size != whole)
+		return "range short of end of blob";
+
+	for (got = 0;  got < size;  got += nread) {
+		len = size - got < chunk_size ? size - got : chunk_size;
+		if ((err = _read(server_fd, chunk, len, &nread)))
+			return err;
+		if (nread == 0)
+			return "unexpected end of stream reading range";
+		if (resume) {
+			status = bio4_service.digest->get_update(chunk, nread);
+			if (*status != '1')
+				return status;
+		}
+		if ((err = _write(output_fd, chunk, nread)))
+			return err;
+	}
+	if (resume &&
+	    *bio4_service.digest->get_update(chunk, 0) != '0') {
+		rm_output_path_error = 1;
+		return "blob does not match digest";
+	}
+	*ok_no = 0;
+	TRACE("range() done");
+	return bio4_set_brr("ok");
+}
+
 static char *
 bio4_put(int *ok_no)
 {
 	char *err;
-	char req[5 + 8 + 1 + 128 + 1 + 1];
+	char req[5 + 1 + 20 + 8 + 1 + 128 + 1 + 1];
+	struct stat st;
 
 	TRACE("request to put()");
 
+	//  size of a regular input file is known before the transfer
+
+	if (fstat(input_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		chew_size = st.st_size;
+		if (declare_size)
+			request_size = st.st_size;
+	}
+
 	//  write the put request to the remote server
 
 	err = _write(
@@ -693,6 +1079,356 @@ bio4_put(int *ok_no)
 	return bio4_set_brr(*ok_no == 0 ? "ok" : "no");
 }
 
+/*
+ *  Start a session on the connection of a stream, so the stream sends
+ *  many range or stage requests.
+ */
+static char *
+stream_session()
+{
+	char req[8 + 20 + 1 + 1], *err;
+	int reply, len;
+
+	if (stream_token >= 0)
+		len = snprintf(req, sizeof req, "session.%lld\n", stream_token);
+	else
+		len = snprintf(req, sizeof req, "session\n");
+	if ((err = _write(server_fd, (unsigned char *)req, len)))
+		return err;
+	if ((err = read_ok_no(&reply)))
+		return err;
+	if (reply)
+		return "server refused session";
+	return (char *)0;
+}
+
+/*
+ *  Choose the random token shared by the streams of a put, so the segments
+ *  staged on the server never mix with those of another client putting
+ *  the same blob at once.
+ */
+static char *
+stream_token_new()
+{
+	unsigned long long r;
+	ssize_t nread;
+	int fd;
+
+	if ((fd = jmscott_open("/dev/urandom", O_RDONLY, 0)) < 0)
+		return strerror(errno);
+	nread = jmscott_read(fd, &r, sizeof r);
+	if (nread < 0) {
+		int e = errno;
+
+		jmscott_close(fd);
+		return strerror(e);
+	}
+	if (jmscott_close(fd))
+		return strerror(errno);
+	if (nread != sizeof r)
+		return "short read of /dev/urandom";
+
+	//  the server scans at most 18 digits
+
+	stream_token = r % 1000000000000000000ULL;
+	return (char *)0;
+}
+
+/*
+ *  Wait for the forked streams, killing them first after an error in the
+ *  parent.
+ */
+static char *
+stream_wait(pid_t *pid, int count, int kill_first)
+{
+	char *err = (char *)0;
+	int i, status;
+
+	for (i = 0;  i < count;  i++) {
+		if (kill_first)
+			kill(pid[i], SIGTERM);
+		while (waitpid(pid[i], &status, 0) < 0)
+			if (errno != EINTR)
+				return strerror(errno);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			err = "stream failed";
+	}
+	return err;
+}
+
+/*
+ *  Fork the streams after the first.  Each child opens a new connection
+ *  in a session and calls segments() with the number of the stream.  The
+ *  first stream is the parent, on the connection already open.
+ */
+static char *
+stream_fork(pid_t *pid, char *(*segments)(long long))
+{
+	char *err;
+	int i, status;
+
+	for (i = 1;  i < streams;  i++) {
+		pid[i - 1] = fork();
+		if (pid[i - 1] < 0) {
+			err = strerror(errno);
+			stream_wait(pid, i - 1, 1);
+			return err;
+		}
+		if (pid[i - 1] > 0)
+			continue;
+
+		//  in the child, the connection of the parent is not ours
+
+		jmscott_close(server_fd);
+		server_fd = -1;
+		if ((status = bio4_connect(server_host, server_port,
+								&server_fd)))
+			err = strerror(status);
+		else if (!(err = stream_session()))
+			err = (*segments)(i);
+		if (err)
+			jmscott_die2(3, "stream", err);
+		_exit(0);
+	}
+	return (char *)0;
+}
+
+//  size of the blob got over streams, from the reply to the first range
+
+static long long stream_blob_size;
+
+/*
+ *  Get the segment of the blob at offset into the output file, setting
+ *  stream_blob_size from the reply.
+ */
+static char *
+get_segment(long long offset, int *reply)
+{
+	char req[6 + 20 + 20 + 1 + 8 + 1 + 128 + 1 + 1];
+	long long size, got;
+	char *err;
+	int nread, len;
+
+	len = snprintf(req, sizeof req, "range.%lld.%d %s:%s\n", offset,
+				STREAM_SEGMENT_SIZE, algorithm, ascii_digest);
+	if ((err = _write(server_fd, (unsigned char *)req, len)))
+		return err;
+	if ((err = read_ok_count(reply, &size, &stream_blob_size)) || *reply)
+		return err;
+	if (size != STREAM_SEGMENT_SIZE && offset + size != stream_blob_size)
+		return "range not a whole segment";
+	for (got = 0;  got < size;  got += nread) {
+		len = size - got < chunk_size ? size - got : chunk_size;
+		if ((err = _read(server_fd, chunk, len, &nread)))
+			return err;
+		if (nread == 0)
+			return "unexpected end of stream reading range";
+		if (pwrite(output_fd, chunk, nread, offset + got) != nread)
+			return strerror(errno);
+	}
+	return (char *)0;
+}
+
+/*
+ *  Get every streams'th segment, starting at segment first, until the end
+ *  of the blob.  "no" means the blob was taken after the first range.
+ */
+static char *
+get_segments(long long first)
+{
+	long long k;
+	char *err;
+	int reply;
+
+	for (k = first;  k * STREAM_SEGMENT_SIZE < stream_blob_size;
+								k += streams) {
+		err = get_segment(k * STREAM_SEGMENT_SIZE, &reply);
+		if (err)
+			return err;
+		if (reply)
+			return "blob disappeared during get";
+	}
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Get a large blob over --streams connections at once.
+ *  Description:
+ *	Each stream gets every streams'th segment of the blob with "range"
+ *	requests in a session, writing the segment at its offset in
+ *	--output-path.  The first segment is got before the other streams
+ *	start, so a small blob needs one connection, the reply tells the size
+ *	of the blob and an untrusted server verifies the blob once, for the
+ *	first range.  After the streams finish, the output file is digested
+ *	once, like a get.
+ *
+ *	Set *ok_no 0 for ok, 1 for no.
+ */
+static char *
+bio4_get_streams(int *ok_no)
+{
+	pid_t pid[MAX_STREAMS];
+	long long count;
+	char *err, *status;
+	int reply, nread;
+
+	TRACE("request to get_streams()");
+
+	if ((err = stream_session()))
+		return err;
+	if ((err = get_segment(0, &reply)))
+		return err;
+	if (reply) {
+		*ok_no = 1;
+		return bio4_set_brr("no");
+	}
+
+	//  no more streams than segments after the first
+
+	count = (stream_blob_size - 1) / STREAM_SEGMENT_SIZE;
+	if (count > 0) {
+		if (count < streams - 1)
+			streams = count + 1;
+		if ((err = stream_fork(pid, get_segments)))
+			return err;
+		err = get_segments(streams);
+		status = stream_wait(pid, streams - 1, err != (char *)0);
+		if (err || (err = status))
+			return err;
+	}
+
+	//  digest the reassembled blob
+
+	if (lseek(output_fd, (off_t)0, SEEK_SET) < 0)
+		return strerror(errno);
+	chew_size = LLONG_MAX;
+	blob_size = 0;
+	while (!(err = _read(output_fd, chunk, chunk_size, &nread)) &&
+	       nread > 0) {
+		status = bio4_service.digest->get_update(chunk, nread);
+		if (*status != '1')
+			return status;
+		blob_size += nread;
+	}
+	if (err)
+		return err;
+	if (*bio4_service.digest->get_update(chunk, 0) != '0')
+		return "blob does not match digest";
+	*ok_no = 0;
+	TRACE("get_streams() done");
+	return bio4_set_brr("ok");
+}
+
+/*
+ *  Put every streams'th segment of the input, starting at segment first,
+ *  with "stage.<offset>.<length> udig" requests.
+ */
+static char *
+put_segments(long long first)
+{
+	char req[6 + 20 + 20 + 1 + 8 + 1 + 128 + 1 + 1];
+	long long k, offset, length, sent;
+	char *err;
+	int reply, len;
+	ssize_t nread;
+
+	for (k = first;  k * STREAM_SEGMENT_SIZE < blob_size;  k += streams) {
+		offset = k * STREAM_SEGMENT_SIZE;
+		length = blob_size - offset;
+		if (length > STREAM_SEGMENT_SIZE)
+			length = STREAM_SEGMENT_SIZE;
+		len = snprintf(req, sizeof req, "stage.%lld.%lld %s:%s\n",
+				offset, length, algorithm, ascii_digest);
+		if ((err = _write(server_fd, (unsigned char *)req, len)))
+			return err;
+		if ((err = read_ok_no(&reply)))
+			return err;
+		if (reply)
+			return "server refused segment";
+		for (sent = 0;  sent < length;  sent += nread) {
+			len = length - sent < chunk_size ?
+						length - sent : chunk_size;
+			nread = pread(input_fd, chunk, len, offset + sent);
+			if (nread < 0 && errno == EINTR) {
+				nread = 0;
+				continue;
+			}
+			if (nread < 0)
+				return strerror(errno);
+			if (nread == 0)
+				return "input shorter than at start";
+			if ((err = _write(server_fd, chunk, nread)))
+				return err;
+		}
+		if ((err = read_ok_no(&reply)))
+			return err;
+		if (reply)
+			return "server rejected segment";
+	}
+	return (char *)0;
+}
+
+/*
+ *  Synopsis:
+ *	Put a large blob over --streams connections at once.
+ *  Description:
+ *	Each stream puts every streams'th segment of the input with "stage"
+ *	requests in a session started with the same random token, which
+ *	keys the staged file on the server.  After the streams finish,
+ *	"stage.<size>" commits the staged blob, which the server digests
+ *	once, whole, before storing.  The input must be a regular file.  A
+ *	blob of one segment or less is put as usual.
+ *
+ *	Set *ok_no 0 for ok, 1 for no.
+ */
+static char *
+bio4_put_streams(int *ok_no)
+{
+	pid_t pid[MAX_STREAMS];
+	char req[6 + 20 + 1 + 8 + 1 + 128 + 1 + 1];
+	struct stat st;
+	char *err, *status;
+	int len;
+
+	TRACE("request to put_streams()");
+
+	if (fstat(input_fd, &st))
+		return strerror(errno);
+	if (!S_ISREG(st.st_mode))
+		return "input is not a regular file";
+	if (st.st_size <= STREAM_SEGMENT_SIZE)
+		return bio4_put(ok_no);
+	blob_size = st.st_size;
+
+	if ((err = stream_token_new()))
+		return err;
+	if ((err = stream_session()))
+		return err;
+	if ((err = stream_fork(pid, put_segments)))
+		return err;
+	err = put_segments(0);
+	status = stream_wait(pid, streams - 1, err != (char *)0);
+	if (err || (err = status))
+		return err;
+
+	//  commit the staged blob
+
+	len = snprintf(req, sizeof req, "stage.%lld %s:%s\n", blob_size,
+						algorithm, ascii_digest);
+	if ((err = _write(server_fd, (unsigned char *)req, len)))
+		return err;
+	if ((err = read_ok_no(ok_no)))
+		return err;
+	if (*ok_no == 1)
+		return (char *)0;		//  server said no
+	if ((err = read_ok_no(ok_no)))
+		return err;
+
+	TRACE("put_streams() done");
+	return bio4_set_brr(*ok_no == 0 ? "ok" : "no");
+}
+
 static char *
 bio4_take(int *ok_no)
 {
@@ -840,6 +1576,11 @@ struct service bio4_service =
 	.close			=	bio4_close,
 	.get			=	bio4_get,
 	.eat			=	bio4_eat,
+	.eat_set		=	bio4_eat_set,
+	.have			=	bio4_have,
+	.range			=	bio4_range,
+	.get_streams		=	bio4_get_streams,
+	.put_streams		=	bio4_put_streams,
 	.put			=	bio4_put,
 	.take			=	bio4_take,
 	.give			=	bio4_give,
@@ -1,6 +1,7 @@
 /*
  *  Synopsis:
- *	Client to get/put/give/take/eat/wrap/roll blobs from blobio services.
+ *	Client to get/put/give/take/eat/wrap/roll/have blobs from blobio
+ *	services.
  *  Exit Status:
  *  	0	request succeed (Ok).
  *  	1	request denied (no).
@@ -15,6 +16,11 @@
  *	--algorithm name
  *	--input-path <path/to/file>
  *	--output-path <path/to/file>
+ *	--udig-set <path/to/file>
+ *	--offset <bytes>
+ *	--length <bytes>
+ *	--resume
+ *	--streams <count>
  *	--help
  *  Note:
  *	- Why does a "blobio get(fs) | blobio put(network) take so long and
@@ -71,7 +77,7 @@
 
 char	*jmscott_progname = "blobio";
 
-static int	rm_output_path_error = 1;
+int	rm_output_path_error = 1;
 
 /*
  *  The global request.
@@ -84,6 +90,20 @@ char	udig[8 + 1 + 128 + 1] = {0};
 char	ascii_digest[129] = {0};
 char	*output_path = 0;
 char	*input_path = 0;
+char	*udig_set_path = 0;		//  udigs to eat or have
+
+//  range of a blob to get, from --offset and --length, -1 when not given
+
+long long	range_offset = -1;
+long long	range_length = -1;
+
+//  get the rest of the blob after the bytes already in --output-path
+
+int		resume = 0;
+
+//  concurrent connections of a get or put of a large blob, from --streams
+
+int		streams = 1;
 
 /*
  *  Bit mask for which blob requests records are written:
@@ -106,9 +126,20 @@ char	*null_device = "/dev/null";
 char	chat_history[2+1+2+1+2+1] = {0};
 char	transport[8+1+128 + 1] = {0};
 int	io_timeout = -1;		//  read/write() i/o timeout in seconds
+int	chunk_size = MAX_ATOMIC_MSG;	//  bytes per read/write of blob
 
 long long	blob_size = 0;
 
+/*
+ *  Bytes the digest will chew, when known before the transfer, so the
+ *  digest is finalized once instead of after every chunk.  -1 if unknown.
+ */
+long long	chew_size = -1;
+
+//  send the byte count in "put.<count> udig", from query arg "size=true"
+
+int		declare_size = 0;
+
 struct timespec	start_time;
 int trust_fd = -1;
 
@@ -125,7 +156,7 @@ struct digest			*digest_module;
 struct service			*service = 0;
 
 static char		usage[] =
-	"usage: blobio [help | get|put|give|take|eat|wrap|roll|empty] "
+	"usage: blobio [help | get|put|give|take|eat|wrap|roll|have|empty] "
 	"[options]\n"
 ;
 
@@ -192,13 +223,18 @@ static void
 help()
 {
 	static char blurb[] = "Usage:\n\
-	blobio [get|put|give|take|eat|wrap|roll|empty | help] [options]\n\
+	blobio [get|put|give|take|eat|wrap|roll|have|empty | help] [options]\n\
 Options:\n\
 	--service       request blob from service <name:end_point>\n\
 	--input-path    put/give/eat source file <default stdin>\n\
 	--output-path   get/take target file <default stdout>\n\
 	--udig          algorithm:digest for get/put/give/take/eat/empty/roll\n\
 	--algorithm     algorithm name for local eat request\n\
+	--udig-set      udigs, one per line, for have or eat in a session\n\
+	--offset        get bytes of the blob from offset <default 0>\n\
+	--length        get at most length bytes <default rest of blob>\n\
+	--resume        get rest of blob after bytes in --output-path\n\
+	--streams       get/put large blob over count connections <default 1>\n\
 	--trace		deep trace to standard error\n\
 	--io-timeout	network only read/write() timeouts.\n\
 	--help\n\
@@ -207,7 +243,9 @@ Service Query Args:\n\
 	brr	hex one byte bit map mask for which brr records to write\n\
 		  \"brr=ff\" puts a brr for all verbs\n\
 		  \"brr=6e\" puts a brr for verbs that write to storage\n\
+	chunk	bytes per read/write of blob, power of two in [4096, 1048576]\n\
 	fnp	file name prefix of the path to log file spool/<prefix>.brr\n\
+	size	send byte count of input file in put/give request [true|false]\n\
 Exit Status:\n\
 	0	request succeed\n\
   	1	request denied.  blob may not exist or is not empty\n\
@@ -223,6 +261,16 @@ Examples:\n\
 \n\
 	UDIG=$(blobio eat --algorithm sha --input-path resume.pdf)\n\
 	blobio put --udig $UD --input-path resume.pdf --service $S\n\
+\n\
+	blobio eat --service $S --udig-set udig.set --output-path eat.out\n\
+\n\
+	blobio have --service $S --udig-set udig.set | grep 'no$'\n\
+\n\
+	blobio get --service $S --udig $UD --length 512 | file -\n\
+\n\
+	blobio get --service $S --udig $UD --output-path big.iso --resume\n\
+\n\
+	blobio put --service $S --udig $UD --input-path big.iso --streams 8\n\
 Digest Algorithms:\n\
 ";
 	write(1, blurb, strlen(blurb));
@@ -401,6 +449,7 @@ parse_argv(int argc, char **argv)
 	    strcmp("take",  argv[1]) != 0 &&
 	    strcmp("wrap",  argv[1]) != 0 &&
 	    strcmp("roll",  argv[1]) != 0 &&
+	    strcmp("have",  argv[1]) != 0 &&
 	    strcmp("empty", argv[1]) != 0)
 	    	die2("unknown verb", argv[1]);
 	strcpy(verb, argv[1]);
@@ -423,6 +472,11 @@ parse_argv(int argc, char **argv)
 		 *	--algorithm [btc20|sha|bc160]
 		 *	--input-path <path/to/file>
 		 *	--output-path <path/to/file>
+		 *	--udig-set <path/to/file>
+		 *	--offset <bytes>
+		 *	--length <bytes>
+		 *	--resume
+		 *	--streams <count>
 		 *	--trace
 		 *	--io-timeout <sec>
 		 *	--help
@@ -531,6 +585,56 @@ parse_argv(int argc, char **argv)
 			else
 				output_path = argv[i];
 
+		//  --udig-set path/to/file
+
+		} else if (strcmp("udig-set", a) == 0) {
+			if (udig_set_path)
+				emany("udig-set");
+
+			if (++i == argc)
+				eopt("udig-set", "requires file path");
+			if (!*argv[i])
+				eopt("udig-set", "empty file path");
+			udig_set_path = argv[i];
+
+		//  --offset <bytes> or --length <bytes>
+
+		} else if (strcmp("offset", a) == 0 ||
+		           strcmp("length", a) == 0) {
+			long long *p;
+			unsigned long long ull;
+
+			p = *a == 'o' ? &range_offset : &range_length;
+			if (*p >= 0)
+				emany(a);
+			if (++i == argc)
+				eopt(a, "missing <bytes>");
+			if ((err = jmscott_a2ui63(argv[i], &ull)))
+				eopt2(a, "can not parse bytes", err);
+			*p = ull;
+
+		//  --resume
+
+		} else if (strcmp("resume", a) == 0) {
+			if (resume)
+				emany("resume");
+			resume = 1;
+
+		//  --streams <count>
+
+		} else if (strcmp("streams", a) == 0) {
+			unsigned long long ull;
+
+			if (streams > 1)
+				emany("streams");
+			if (++i == argc)
+				eopt("streams", "missing <count>");
+			if ((err = jmscott_a2ui63(argv[i], &ull)))
+				eopt2("streams", "can not parse count", err);
+			if (ull < 1 || ull > MAX_STREAMS)
+				eopt("streams", "count not in [1, 64]");
+			streams = ull;
+
 		//  --service protocol:endpoint[?qargs]
 
 		} else if (strcmp("service", a) == 0) {
@@ -626,7 +730,9 @@ parse_argv(int argc, char **argv)
 
 				BLOBIO_SERVICE_get_algo(query);
 				BLOBIO_SERVICE_get_brr_mask(query);
+				BLOBIO_SERVICE_get_chunk_size(query);
 				BLOBIO_SERVICE_get_fnp(query);
+				BLOBIO_SERVICE_get_size(query);
 			}
 
 			//  validate the syntax of the specific end point
@@ -663,6 +769,16 @@ parse_argv(int argc, char **argv)
 	}
 	if (service && brr_mask > 0 && !service->brr_frisk)
 		die2("brr mask not supported for service", service->name);
+	if (service && udig_set_path && *verb == 'e' && !service->eat_set)
+		die2("udig set not supported for service", service->name);
+	if (service && *verb == 'h' && !service->have)
+		die2("have not supported for service", service->name);
+	if (service && (range_offset >= 0 || range_length >= 0 || resume) &&
+	    !service->range)
+		die2("range not supported for service", service->name);
+	if (service && streams > 1 && (!service->get_streams ||
+	    !service->put_streams))
+		die2("streams not supported for service", service->name);
 	if (io_timeout == -1)
 		io_timeout = 0;
 }
@@ -697,6 +813,32 @@ xref_argv()
 	 *  	no --output-path
 	 *	--service requires --udig and 
 	 *		implies no --algorithm
+	 *	--udig-set requires --service and
+	 *		implies no --{udig,algorithm,input-path}
+	 *
+	 *  verb: have
+	 *	--service and --udig-set required
+	 *	no --{udig,algorithm,input-path}
+	 *
+	 *  verb: all but eat, have
+	 *	no --udig-set
+	 *
+	 *  verb: all but get
+	 *	no --{offset,length,resume}
+	 *
+	 *  verb: get --resume
+	 *	--output-path required, not /dev/null
+	 *	no --{offset,length}
+	 *
+	 *  verb: all but get, put
+	 *	no --streams
+	 *
+	 *  verb: get --streams
+	 *	--output-path required, not /dev/null
+	 *	no --{offset,length,resume}
+	 *
+	 *  verb: put --streams
+	 *	--input-path required
 	 *
 	 *  verb: wrap
 	 *	no --{input,output}-path, --udig
@@ -705,6 +847,55 @@ xref_argv()
 	 *  Note:
 	 *	Convert if/else if/ tests to switch.
 	 */
+	if (*verb == 'h' && !udig_set_path)
+		no_opt("udig-set");
+	if (strcmp("get", verb) != 0) {
+		if (range_offset >= 0)
+			enot("offset");
+		if (range_length >= 0)
+			enot("length");
+		if (resume)
+			enot("resume");
+	}
+	if (resume) {
+		if (!output_path || output_path == null_device)
+			no_opt("output-path");
+		if (range_offset >= 0)
+			eopt("offset", "option --resume conflicts");
+		if (range_length >= 0)
+			eopt("length", "option --resume conflicts");
+
+		//  keep the bytes got so far upon error, to resume again
+
+		rm_output_path_error = 0;
+	}
+	if (streams > 1) {
+		if (strcmp("get", verb) == 0) {
+			if (!output_path || output_path == null_device)
+				no_opt("output-path");
+			if (range_offset >= 0)
+				eopt("offset", "option --streams conflicts");
+			if (range_length >= 0)
+				eopt("length", "option --streams conflicts");
+			if (resume)
+				eopt("resume", "option --streams conflicts");
+		} else if (strcmp("put", verb) == 0) {
+			if (!input_path)
+				no_opt("input-path");
+		} else
+			enot("streams");
+	}
+	if (udig_set_path) {
+		if (strcmp("eat", verb) != 0 && *verb != 'h')
+			enot("udig-set");
+		if (!service)
+			no_opt("service");
+		if (algorithm[0])
+			enot(ascii_digest[0] ? "udig" : "algorithm");
+		if (input_path)
+			enot("input-path");
+		return;
+	}
 	if (*verb == 'g' || *verb == 'p' || *verb == 't' || *verb == 'r') {
 		if (!service)
 			no_opt("service");
@@ -788,6 +979,7 @@ main(int argc, char **argv)
 	TRACE2("query arg: brr mask", brr_mask2ascii(brr_mask));
 	TRACE2("query arg: algo", algo);
 	TRACE2("query arg: fnp", fnp);
+	TRACE_LL("query arg: chunk size", (long long)chunk_size);
 
 	//  the input path must always exist in the file system.
 
@@ -802,9 +994,9 @@ main(int argc, char **argv)
 	}
 
 	//  the output path must never exist in the file system, unless
-	//  /dev/null
+	//  /dev/null or resumed
 
-	if (output_path && output_path != null_device) {
+	if (output_path && output_path != null_device && !resume) {
 		struct stat st;
 
 		if (jmscott_stat(output_path, &st) == 0) {
@@ -851,6 +1043,21 @@ main(int argc, char **argv)
 		input_fd = fd;
 	}
 
+	//  open the udig set as the input to "have" or "eat --udig-set"
+
+	if (udig_set_path) {
+		int fd;
+
+		fd = jmscott_open(udig_set_path, O_RDONLY, 0);
+		if (fd == -1)
+			die3(
+				"open(udig set) failed",
+				strerror(errno),
+				udig_set_path
+			);
+		input_fd = fd;
+	}
+
 	//  open the output path if verb is wrap/roll or local "eat" 
 
 	char v = verb[0];
@@ -879,7 +1086,13 @@ main(int argc, char **argv)
 		//  "get" or "give" a blob
 
 		if (verb[1] == 'e') {				//  "get"
-			if ((err = service->get(&ok_no)))
+			if (range_offset >= 0 || range_length >= 0 || resume) {
+				if ((err = service->range(&ok_no)))
+					die2("get(range) failed", err);
+			} else if (streams > 1) {
+				if ((err = service->get_streams(&ok_no)))
+					die2("get(streams) failed", err);
+			} else if ((err = service->get(&ok_no)))
 				die2("get failed", err);
 			exit_status = ok_no;
 		} else {					//  "give"
@@ -904,7 +1117,11 @@ main(int argc, char **argv)
 		 *  eat the blob
 		 */
 		if (verb[1] == 'a') {
-			if (service) {
+			if (udig_set_path) {
+				if ((err = service->eat_set(&ok_no)))
+					die2("eat(udig set) failed", err);
+				exit_status = ok_no;
+			} else if (service) {
 				if ((err = service->eat(&ok_no)))
 					die2("eat(service) failed", err);
 				exit_status = ok_no;
@@ -943,7 +1160,10 @@ main(int argc, char **argv)
 			exit_status = 0;
 		}
 	} else if (*verb == 'p') {
-		if ((err = service->put(&ok_no)))
+		if (streams > 1) {
+			if ((err = service->put_streams(&ok_no)))
+				die2("put(streams) failed", err);
+		} else if ((err = service->put(&ok_no)))
 			die2("put() failed", err);
 		exit_status = ok_no;
 	} else if (*verb == 't') {
@@ -971,10 +1191,18 @@ main(int argc, char **argv)
 		if ((err = service->roll(&ok_no)))
 			die2("roll() failed", err);
 		exit_status = ok_no;
+	} else if (*verb == 'h') {
+		if ((err = service->have(&ok_no)))
+			die2("have() failed", err);
+		exit_status = ok_no;
 	}
 
-	//  write a blob request record, using brr mask
-	if (brr_mask_is_set(verb, brr_mask) && service) {
+	//  write a blob request record, using brr mask.
+	//  no single udig for a set, so the server records each eat,
+	//  and no whole blob for a range, recorded by the server.
+
+	if (brr_mask_is_set(verb, brr_mask) && service && !udig_set_path &&
+	    range_offset < 0 && range_length < 0 && !resume) {
 		char *err = brr_service(service);
 		if (err)
 			die3("brr_service() failed", service->name, err);
@@ -21,6 +21,15 @@
 
 #define MAX_ATOMIC_MSG	JMSCOTT_ATOMIC_WRITE_SIZE
 
+//  bounds of query arg "chunk", the bytes per read/write of a blob
+
+#define CHUNK_SIZE_MIN	(4 * 1024)
+#define CHUNK_SIZE_MAX	(1024 * 1024)
+
+//  most connections of a get or put with --streams
+
+#define MAX_STREAMS	64
+
 #ifdef COMPILE_TRACE
 
 extern int	tracing;
@@ -169,6 +178,26 @@ struct digest
 	char	*(*fs_dir_path)(char *dir_path, int size);
 };
 
+/*
+ *  Incremental hash backend for the digest modules, defined in hash.c
+ */
+#define HASH_SHA1		0
+#define HASH_SHA256		1
+#define HASH_RIPEMD160		2
+#define HASH_TYPE_COUNT		3
+
+struct hash
+{
+	struct evp_md_ctx_st	*ctx;		//  EVP_MD_CTX
+};
+
+extern int	hash_init(struct hash *h, int type);
+extern int	hash_update(struct hash *h, void *buf, size_t size);
+extern int	hash_final(struct hash *h, unsigned char *digest);
+extern int	hash_copy(struct hash *to, struct hash *from);
+extern int	hash_digest(int type, void *buf, size_t size,
+				unsigned char *digest);
+
 struct brr
 {
 	struct timespec		start_time;
@@ -200,6 +229,11 @@ struct service
 
 	char		*(*get)(int *ok_no);
 	char		*(*eat)(int *ok_no);
+	char		*(*eat_set)(int *ok_no);	//  --udig-set
+	char		*(*have)(int *ok_no);
+	char		*(*range)(int *ok_no);	//  --offset, --length
+	char		*(*get_streams)(int *ok_no);	//  --streams
+	char		*(*put_streams)(int *ok_no);	//  --streams
 	char		*(*put)(int *ok_no);
 	char		*(*take)(int *ok_no);
 	char		*(*give)(int *ok_no);
@@ -249,7 +283,9 @@ extern char	*BLOBIO_SERVICE_frisk_qargs(char *query);
 
 void		BLOBIO_SERVICE_get_algo(char *query);
 void		BLOBIO_SERVICE_get_brr_mask(char *query);
+void		BLOBIO_SERVICE_get_chunk_size(char *query);
 void		BLOBIO_SERVICE_get_fnp(char *query);
+void		BLOBIO_SERVICE_get_size(char *query);
 
 extern struct digest	*find_digest(char *algorithm);
 
@@ -264,11 +300,20 @@ extern int 		output_fd;
 extern char 		*output_path;
 extern int 		input_fd;
 extern char 		*input_path;
+extern char		*udig_set_path;
+extern long long	range_offset;
+extern long long	range_length;
+extern int		resume;
+extern int		streams;
+extern int		rm_output_path_error;
 extern char 		*null_device;
 extern long long	blob_size;
+extern long long	chew_size;
+extern int		declare_size;
 extern char		ascii_digest[129];
 extern char		transport[8+1+128 + 1];
 extern int		trust_fs;
+extern int		chunk_size;
 
 extern unsigned char	brr_mask;
 extern char *		brr_service(struct service *);
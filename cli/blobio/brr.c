@@ -63,6 +63,8 @@ brr_mask2ascii(unsigned char mask)
  *	6	"wrap"
  *	7	"roll"
  *	8	"cat"
+ *
+ *  A "range" of a blob is recorded with the bit of "get".
  */
 
 int
@@ -81,6 +83,8 @@ brr_mask_is_set(char *verb, unsigned char mask)
 	case 'p':
 		return (mask & 0x04) ? 1 : 0;		//  verb "put"
 	case 'r':
+		if (verb[1] == 'a')
+			return (mask & 0x01) ? 1 : 0;	//  verb "range"
 		return (mask & 0x40) ? 1 : 0;		//  verb "roll"
 	case 't':
 		return (mask & 0x02) ? 1 : 0;		//  verb "take"
@@ -11,20 +11,19 @@
 #include <unistd.h>
 #include <stdlib.h>
 
-#include "openssl/sha.h"
-#include "openssl/ripemd.h"
 #include "blobio.h"
 
 static unsigned char	bin_digest[20];
 
 typedef struct
 {
-	SHA256_CTX	sha256;
-	SHA256_CTX	sha256_sha256;
-	RIPEMD160_CTX	ripemd160;
+	struct hash	sha256;
+	struct hash	sha256_sha256;
+	struct hash	ripemd160;
 } BTC20_CTX;
 
 static BTC20_CTX	btc20_ctx;
+static long long	chewed = 0;
 
 static char	empty[]		= "fd7b15dc5dc2039556693555c2b81b36c8deec15";
 
@@ -35,11 +34,11 @@ btc20_init()
 	unsigned char *d20;
 	unsigned int i;
 
-if (!SHA256_Init(&btc20_ctx.sha256))
+if (!hash_init(&btc20_ctx.sha256, HASH_SHA256))
 	return "SHA256_Init(blob) failed";
-if (!SHA256_Init(&btc20_ctx.sha256_sha256))
+if (!hash_init(&btc20_ctx.sha256_sha256, HASH_SHA256))
 	return "SHA256_Init(sha256) failed";
-if (!RIPEMD160_Init(&btc20_ctx.ripemd160))
+if (!hash_init(&btc20_ctx.ripemd160, HASH_RIPEMD160))
 	return "RIPEMD160_Init() failed";
 
 if (!ascii_digest[0])
@@ -91,42 +90,53 @@ chew(unsigned char *chunk, int size)
 {
 	TRACE("request to chew()");
 
-	if (!SHA256_Update(&btc20_ctx.sha256, chunk, size))
+	if (!hash_update(&btc20_ctx.sha256, chunk, size))
 		return "SHA256_Update(chunk) failed";
 
+	/*
+	 *  Size known in advance, so only finalize after the last byte,
+	 *  or at end of stream.
+	 */
+	if (chew_size >= 0 && size > 0) {
+		chewed += size;
+		if (chewed < chew_size)
+			return "1";
+	}
+
 	/*
 	 *  Finalize a temporary copy of sha256.
 	 */
-	SHA256_CTX tmp_sha_ctx;
+	static struct hash tmp_sha_ctx;
 	unsigned char tmp_sha_digest[32];
 
-	tmp_sha_ctx = btc20_ctx.sha256;
-	if (!SHA256_Final(tmp_sha_digest, &tmp_sha_ctx))
+	if (!hash_copy(&tmp_sha_ctx, &btc20_ctx.sha256))
+		return "hash_copy() failed";
+	if (!hash_final(&tmp_sha_ctx, tmp_sha_digest))
 		return "SHA256_Final(tmp) failed";
 
 	/*
 	 *  Now take a temporary SHA256(SHA256) of currently seen SHA256.
 	 */
-	SHA256_CTX tmp_sha_sha_ctx;
+	static struct hash tmp_sha_sha_ctx;
 	unsigned char tmp_sha_sha_digest[32];
-	if (!SHA256_Init(&tmp_sha_sha_ctx))
+	if (!hash_init(&tmp_sha_sha_ctx, HASH_SHA256))
 		return "SHA256_Init(sha256) failed";
-	if (!SHA256_Update(&tmp_sha_sha_ctx, tmp_sha_digest, 32))
+	if (!hash_update(&tmp_sha_sha_ctx, tmp_sha_digest, 32))
 		return "SHA256_Update(sha256) failed";
-	if (!SHA256_Final(tmp_sha_sha_digest, &tmp_sha_sha_ctx))
+	if (!hash_final(&tmp_sha_sha_ctx, tmp_sha_sha_digest))
 		return "SHA256_Final(sha256) failed";
 
 	/*
 	 *  Take RIPEMD160 of temp sha256 of sha256 digest.
 	 */
 	unsigned char tmp_ripemd_digest[20];
-	RIPEMD160_CTX tmp_ripemd_ctx;
+	static struct hash tmp_ripemd_ctx;
 
-	if (!RIPEMD160_Init(&tmp_ripemd_ctx))
+	if (!hash_init(&tmp_ripemd_ctx, HASH_RIPEMD160))
 		return "RIPEMD160_Init(tmp sha256 sha256) failed";
-	if (!RIPEMD160_Update(&tmp_ripemd_ctx, tmp_sha_sha_digest, 32))
+	if (!hash_update(&tmp_ripemd_ctx, tmp_sha_sha_digest, 32))
 		return "RIPEMD160_Update(tmp sha256 sha256) failed";
-	if (!RIPEMD160_Final(tmp_ripemd_digest, &tmp_ripemd_ctx))
+	if (!hash_final(&tmp_ripemd_ctx, tmp_ripemd_digest))
 		return "RIPEMD160_Final(tmp sha256 sha256) failed";
 #ifdef COMPILE_TRACE
 	if (tracing) {
@@ -242,28 +252,28 @@ btc20_eat_input(int fd)
 	TRACE("entered");
 
 	while ((nread = jmscott_read(fd, buf, sizeof buf)) > 0)
-		if (!SHA256_Update(&btc20_ctx.sha256, buf, nread))
+		if (!hash_update(&btc20_ctx.sha256, buf, nread))
 			return "SHA256_Update(chunk) failed";
 	if (nread < 0)
 		return strerror(errno);
 
 	unsigned char sha_digest[32];
-	if (!SHA256_Final(sha_digest, &btc20_ctx.sha256))
+	if (!hash_final(&btc20_ctx.sha256, sha_digest))
 		return "SHA256_Final(blob) failed";
 
 	//  take the sha256 of the 32 byte sha256 of the entire blob
-	if (!SHA256_Update(&btc20_ctx.sha256_sha256, sha_digest, 32))
+	if (!hash_update(&btc20_ctx.sha256_sha256, sha_digest, 32))
 		return "SHA256_Update(sha256) failed";
 
 	unsigned char sha_sha_digest[32];
-	if (!SHA256_Final(sha_sha_digest, &btc20_ctx.sha256_sha256))
+	if (!hash_final(&btc20_ctx.sha256_sha256, sha_sha_digest))
 		return "SHA256_Final(sha256) failed";
 
 	//  calculate the 20 byte ripemd of the composed sha256(sha256(blob))
-	if (!RIPEMD160_Update(&btc20_ctx.ripemd160, sha_sha_digest, 32))
+	if (!hash_update(&btc20_ctx.ripemd160, sha_sha_digest, 32))
 		return "RIPEMD160_Update(SHA256) failed";
 	unsigned char ripe_digest[32];
-	if (!RIPEMD160_Final(ripe_digest, &btc20_ctx.ripemd160))
+	if (!hash_final(&btc20_ctx.ripemd160, ripe_digest))
 		return "RIPEMD160_Final(SHA256) failed";
 
 	//  convert the ripemd 20 byte to 40 byte ascii
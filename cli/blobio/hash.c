@@ -0,0 +1,93 @@
+/*
+ *  Synopsis:
+ *	Incremental hash backend for the client digest modules.
+ *  Description:
+ *	The sha, btc20 and bc160 modules hash through the calls below
+ *	instead of the legacy SHA1_*(), SHA256_*() and RIPEMD160_*()
+ *	functions.  The backend is OpenSSL EVP, which picks SHA-NI, AVX2 or
+ *	generic code for the local cpu at run time.
+ *
+ *	All calls return 1 on success and 0 on error, like the OpenSSL calls
+ *	they replace.
+ *  Note:
+ *	Message digest types are fetched on first use and cached for the
+ *	life of the process.  A struct hash allocates an EVP context on
+ *	first init and keeps it, so declare a struct hash static.
+ */
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+
+#include "blobio.h"
+
+static char	*names[] =
+{
+	"SHA1",
+	"SHA256",
+	"RIPEMD160"
+};
+
+static const EVP_MD	*types[HASH_TYPE_COUNT];
+
+static const EVP_MD *
+fetch(int type)
+{
+	if (types[type])
+		return types[type];
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	types[type] = EVP_MD_fetch((OSSL_LIB_CTX *)0, names[type], (char *)0);
+#else
+	types[type] = EVP_get_digestbyname(names[type]);
+#endif
+	return types[type];
+}
+
+int
+hash_init(struct hash *h, int type)
+{
+	const EVP_MD *md = fetch(type);
+
+	if (md == (EVP_MD *)0)
+		return 0;
+	if (h->ctx == (EVP_MD_CTX *)0 &&
+	    (h->ctx = EVP_MD_CTX_new()) == (EVP_MD_CTX *)0)
+		return 0;
+	return EVP_DigestInit_ex(h->ctx, md, (ENGINE *)0);
+}
+
+int
+hash_update(struct hash *h, void *buf, size_t size)
+{
+	return EVP_DigestUpdate(h->ctx, buf, size);
+}
+
+int
+hash_final(struct hash *h, unsigned char *digest)
+{
+	return EVP_DigestFinal_ex(h->ctx, digest, (unsigned int *)0);
+}
+
+/*
+ *  Copy the state of a running hash, so the copy can be finalized while
+ *  the original keeps going.
+ */
+int
+hash_copy(struct hash *to, struct hash *from)
+{
+	if (to->ctx == (EVP_MD_CTX *)0 &&
+	    (to->ctx = EVP_MD_CTX_new()) == (EVP_MD_CTX *)0)
+		return 0;
+	return EVP_MD_CTX_copy_ex(to->ctx, from->ctx);
+}
+
+/*
+ *  Hash a single buffer, typically the 32 byte digest in a nested hash.
+ */
+int
+hash_digest(int type, void *buf, size_t size, unsigned char *digest)
+{
+	static struct hash h;
+
+	return hash_init(&h, type) &&
+	       hash_update(&h, buf, size) &&
+	       hash_final(&h, digest);
+}
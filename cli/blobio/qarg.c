@@ -1,6 +1,8 @@
 /*
  *  Synopsis:
- *	Frisk and extract query from uri: {algo,brr}={\d{1,3}|<path>}
+ *	Frisk and extract query from uri:
+ *
+ *		{algo,brr,chunk,size}={\d{1,3}|<path>}
  *  Note:
  *	Add qarg "tmo=<sec>" for timeout!
  *
@@ -21,6 +23,11 @@ static int	algo_length = -1;
 
 static int	brr_mask_offset = -1;
 
+static int	chunk_offset = -1;
+static int	chunk_length = -1;
+
+static int	size_offset = -1;
+
 static int	fnp_offset = -1;
 static int	fnp_length = -1;
 
@@ -99,9 +106,11 @@ qae(char *qarg, char *err)
  *
  *		algo=[a-z][a-z0-9]{0,7}	#  algorithm for verb "wrap"
  *		brr=[0-9a-f][0-9a-f]	#  bit mask for brr verbs to write
+ *		chunk=[1-9][0-9]{3,6}	#  bytes per read/write of blob
  *		fnp=[a-z][0-9a-f]{0,15}	#  file name prefix of brr log in spool
+ *		size=(true|false)	#  send byte count in put/give request
  *
- *	tis an error if args other than the three above exist in query string.
+ *	tis an error if args other than the five above exist in query string.
  *  returns:
  *	an error string or (char *)0 if no unexpected args exist.
  */
@@ -182,6 +191,39 @@ BLOBIO_SERVICE_frisk_qargs(char *query)
 
 			c = *q++;
 			break;
+
+		//  match: chunk=[1-9][0-9]{3,6}, a power of two in
+		//         [CHUNK_SIZE_MIN, CHUNK_SIZE_MAX]
+
+		case 'c': {
+			unsigned long size = 0;
+
+			TRACE("saw char 'c', so expect \"chunk\"");
+			err = frisk_qarg("chunk", q - 1, &equal, 7);
+			if (err)
+				return qae("chunk", err);
+			if (chunk_offset > -1)
+				return qae("chunk", eonce);
+
+			q = equal;
+			chunk_offset = q - query;
+
+			if (*q == '0')
+				return qae("chunk", "leading zero");
+			while ((c = *q++) && c != '&') {
+				if (!isdigit(c))
+					return qae("chunk", "char not digit");
+				size = size * 10 + (c - '0');
+			}
+			chunk_length = q - &query[chunk_offset];
+			if (c)
+				chunk_length--;
+			if (size < CHUNK_SIZE_MIN || size > CHUNK_SIZE_MAX)
+				return qae("chunk", "size not in [4096, 1048576]");
+			if (size & (size - 1))
+				return qae("chunk", "size not power of two");
+			break;
+		}
 		case 'f':
 			TRACE("saw char 'f', so expect \"fnp\"");
 			err = frisk_qarg("fnp", q - 1, &equal, 32);
@@ -208,6 +250,29 @@ BLOBIO_SERVICE_frisk_qargs(char *query)
 			if (fnp_length > 32)
 				return qae("fnp", "path length > 32 chars");
 			break;
+
+		//  match: size=(true|false)
+
+		case 's':
+			TRACE("saw char 's', so expect \"size\"");
+			err = frisk_qarg("size", q - 1, &equal, 5);
+			if (err)
+				return qae("size", err);
+			if (size_offset > -1)
+				return qae("size", eonce);
+
+			q = equal;
+			size_offset = q - query;
+			if (strncmp(q, "true", 4) == 0)
+				q += 4;
+			else if (strncmp(q, "false", 5) == 0)
+				q += 5;
+			else
+				return qae("size", "value not \"true\" or \"false\"");
+			c = *q++;
+			if (c && c != '&')
+				return qae("size", "value not \"true\" or \"false\"");
+			break;
 		default: {
 			char got[2];
 
@@ -242,6 +307,40 @@ BLOBIO_SERVICE_get_algo(char *query)
 	TRACE2("algo", algo);
 }
 
+/*
+ *  Synopsis:
+ *  	Extract the "chunk" size from a frisked query string.
+ *  Note:
+ *	Already frisked value of "chunk" as power of two in range.
+ */
+void
+BLOBIO_SERVICE_get_chunk_size(char *query)
+{
+	if (chunk_offset == -1)
+		return;
+
+	char *q = &query[chunk_offset];
+	int i;
+
+	chunk_size = 0;
+	for (i = 0;  i < chunk_length;  i++)
+		chunk_size = chunk_size * 10 + (q[i] - '0');
+	TRACE_LL("chunk size", (long long)chunk_size);
+}
+
+/*
+ *  Synopsis:
+ *  	Extract the "size" boolean from a frisked query string.
+ */
+void
+BLOBIO_SERVICE_get_size(char *query)
+{
+	if (size_offset == -1)
+		return;
+	declare_size = query[size_offset] == 't' ? 1 : 0;
+	TRACE2("size", (declare_size ? "true" : "false"));
+}
+
 /*
  *  Synopsis:
  *  	Extract the "fnp" value from a frisked query string.
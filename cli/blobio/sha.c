@@ -13,12 +13,12 @@
 #include <unistd.h>
 #include <stdlib.h>
 
-#include "openssl/sha.h"
 
 #include "blobio.h"
 
 static unsigned char	bin_digest[20];
-static SHA_CTX	sha_ctx;
+static struct hash	sha_ctx;
+static long long	chewed = 0;
 
 static char	empty[]		= "da39a3ee5e6b4b0d3255bfef95601890afd80709";
 
@@ -29,7 +29,7 @@ sha_init()
 	unsigned char *d20;
 	unsigned int i;
 
-	if (!SHA1_Init(&sha_ctx))
+	if (!hash_init(&sha_ctx, HASH_SHA1))
 		return "SHA1_Init() failed";
 	if (!ascii_digest[0])
 		return (char *)0;
@@ -81,16 +81,27 @@ chew(unsigned char *chunk, int size)
 	 *  Incremental digest.
 	 */
 	unsigned char tmp_digest[20];
-	SHA_CTX tmp_ctx;
+	static struct hash tmp_ctx;
 
-	if (!SHA1_Update(&sha_ctx, chunk, size))
+	if (!hash_update(&sha_ctx, chunk, size))
 		return "SHA1_Update(chunk) failed";
+
+	/*
+	 *  Size known in advance, so only finalize after the last byte,
+	 *  or at end of stream.
+	 */
+	if (chew_size >= 0 && size > 0) {
+		chewed += size;
+		if (chewed < chew_size)
+			return "1";
+	}
 	/*
 	 *  Copy current digest state to a temporary state,
 	 *  finalize and then compare to expected state.
 	 */
-	tmp_ctx = sha_ctx;
-	if (!SHA1_Final(tmp_digest, &tmp_ctx))
+	if (!hash_copy(&tmp_ctx, &sha_ctx))
+		return "hash_copy() failed";
+	if (!hash_final(&tmp_ctx, tmp_digest))
 		return "SHA1_Final(tmp) failed";
 
 #ifdef COMPILE_TRACE
@@ -207,11 +218,11 @@ sha_eat_input(int fd)
 	TRACE("request to sha_eat_input()");
 
 	while ((nread = jmscott_read(fd, buf, sizeof buf)) > 0)
-		if (!SHA1_Update(&sha_ctx, buf, nread))
+		if (!hash_update(&sha_ctx, buf, nread))
 			return "SHA1_Update(chunk) failed";
 	if (nread < 0)
 		return strerror(errno);
-	if (!SHA1_Final(bin_digest, &sha_ctx))
+	if (!hash_final(&sha_ctx, bin_digest))
 		return "SHA1_Final() failed";
 
 	p = ascii_digest;
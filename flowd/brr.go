@@ -113,7 +113,7 @@ func (*brr) parse(s string) (*brr, error) {
 	 */
 	v := b[2]
 	if v != "get" && v != "put" && v != "give" && v != "take" &&
-		v != "eat" && v != "wrap" && v != "roll" {
+		v != "eat" && v != "wrap" && v != "roll" && v != "range" {
 		return nil, errors.New("unknown verb: " + v)
 	}
 
@@ -142,13 +142,14 @@ CREATE DOMAIN brr_verb AS text
 		'wrap',
 		'roll',
 		'eat',
-		'cat'
+		'cat',
+		'range'
 	)
 	AND
 	value IS NOT NULL
 );
 COMMENT ON DOMAIN brr_verb IS
-  'The 8 deadly verbs of a blob request record'
+  'The 8 deadly verbs of a blob request record, plus range, a partial get'
 ;
 ALTER DOMAIN brr_verb OWNER TO :db_owner;
 
@@ -202,7 +203,7 @@ DROP DOMAIN IF EXISTS brr CASCADE;
 CREATE DOMAIN brr AS blob_request_record
   CHECK (
   	(
-		(value).verb = 'get'
+		(value).verb IN ('get', 'range')
 		AND
 		(value).chat_history IN ('ok', 'no')
 	)
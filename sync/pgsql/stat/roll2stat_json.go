@@ -343,7 +343,7 @@ func scan_brr_log(brr_log string, done chan interface{}) {
 			default:
 				_cdie("eat", chat_history)
 			}
-		case "get":
+		case "get", "range":
 			switch chat_history {
 			case "ok":
 				r2s.Stat.GetOkCount++